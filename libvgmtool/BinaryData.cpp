@@ -8,26 +8,31 @@
 
 BinaryData::BinaryData(const std::string& filename)
 {
-    Utils::load_file(_data, filename);
+    Utils::load_file(*_data, filename);
+}
+
+BinaryData::BinaryData(std::vector<uint8_t>&& data)
+    : _data(std::make_shared<std::vector<uint8_t>>(std::move(data)))
+{
 }
 
 void BinaryData::seek(const unsigned int offset)
 {
-    if (offset < 0 || static_cast<size_t>(offset) > _data.size())
+    if (offset < 0 || static_cast<size_t>(offset) > _data->size())
     {
-        throw std::runtime_error(std::format("Cannot seek to offset 0x{:x} as it is beyond the data size ({} bytes)", offset, _data.size()));
+        throw std::runtime_error(std::format("Cannot seek to offset 0x{:x} as it is beyond the data size ({} bytes)", offset, _data->size()));
     }
     _offset = offset;
 }
 
 uint8_t BinaryData::peek() const
 {
-    return _data[_offset]; // No increment
+    return (*_data)[_offset]; // No increment
 }
 
 uint8_t BinaryData::read_uint8()
 {
-    return _data[_offset++];
+    return (*_data)[_offset++];
 }
 
 uint16_t BinaryData::read_uint16()
@@ -54,6 +59,12 @@ uint32_t BinaryData::read_uint32()
     return result;
 }
 
+uint64_t BinaryData::read_uint64()
+{
+    const uint64_t result = read_uint32();
+    return result | static_cast<uint64_t>(read_uint32()) << 32;
+}
+
 std::string BinaryData::read_ascii_string(const uint32_t length)
 {
     std::string result;
@@ -88,27 +99,48 @@ std::vector<uint8_t> BinaryData::read_range(const uint32_t length)
     return result;
 }
 
+SharedBytes BinaryData::read_shared_range(const uint32_t length)
+{
+    if (static_cast<size_t>(_offset) + length > _data->size())
+    {
+        throw std::runtime_error(std::format("Cannot read {} bytes at offset 0x{:x} as it is beyond the data size ({} bytes)", length, _offset, _data->size()));
+    }
+    SharedBytes result(_data, _offset, length);
+    _offset += length;
+    return result;
+}
+
 void BinaryData::copy_range(std::vector<unsigned char>& destination, uint32_t startIndex, uint32_t byteCount) const
 {
-    std::copy_n(_data.begin() + startIndex, byteCount, std::back_inserter(destination));
+    std::copy_n(_data->begin() + startIndex, byteCount, std::back_inserter(destination));
 }
 
 void BinaryData::reset()
 {
-    _data.clear();
+    if (_data.use_count() > 1)
+    {
+        // Someone else is looking at it, so we leave it to them
+        _data = std::make_shared<std::vector<uint8_t>>();
+    }
+    _data->clear();
     _offset = 0;
 }
 
 void BinaryData::check_write_space(const size_t size)
 {
+    if (_data.use_count() > 1)
+    {
+        // Someone else is looking at it, so we make our own copy to write to
+        _data = std::make_shared<std::vector<uint8_t>>(*_data);
+    }
     const auto requiredSize = _offset + size;
-    if (requiredSize < _data.size())
+    if (requiredSize < _data->size())
     {
         // Nothing to do
         return;
     }
     // Else make space
-    _data.resize(requiredSize);
+    _data->resize(requiredSize);
 }
 
 void BinaryData::write_unterminated_ascii_string(const std::string& s)
@@ -117,38 +149,44 @@ void BinaryData::write_unterminated_ascii_string(const std::string& s)
 
     for (const uint8_t c : s)
     {
-        _data[_offset++] = c;
+        (*_data)[_offset++] = c;
     }
 }
 
 void BinaryData::write_uint32(const uint32_t i)
 {
     check_write_space(4);
-    _data[_offset++] = (i >> 0) & 0xff;
-    _data[_offset++] = (i >> 8) & 0xff;
-    _data[_offset++] = (i >> 16) & 0xff;
-    _data[_offset++] = (i >> 24) & 0xff;
+    (*_data)[_offset++] = (i >> 0) & 0xff;
+    (*_data)[_offset++] = (i >> 8) & 0xff;
+    (*_data)[_offset++] = (i >> 16) & 0xff;
+    (*_data)[_offset++] = (i >> 24) & 0xff;
+}
+
+void BinaryData::write_uint64(const uint64_t i)
+{
+    write_uint32(static_cast<uint32_t>(i));
+    write_uint32(static_cast<uint32_t>(i >> 32));
 }
 
 void BinaryData::write_uint24(uint32_t i)
 {
     check_write_space(3);
-    _data[_offset++] = (i >> 0) & 0xff;
-    _data[_offset++] = (i >> 8) & 0xff;
-    _data[_offset++] = (i >> 16) & 0xff;
+    (*_data)[_offset++] = (i >> 0) & 0xff;
+    (*_data)[_offset++] = (i >> 8) & 0xff;
+    (*_data)[_offset++] = (i >> 16) & 0xff;
 }
 
 void BinaryData::write_uint16(const uint16_t i)
 {
     check_write_space(2);
-    _data[_offset++] = (i >> 0) & 0xff;
-    _data[_offset++] = (i >> 8) & 0xff;
+    (*_data)[_offset++] = (i >> 0) & 0xff;
+    (*_data)[_offset++] = (i >> 8) & 0xff;
 }
 
 void BinaryData::write_uint8(uint8_t i)
 {
     check_write_space(1);
-    _data[_offset++] = i;
+    (*_data)[_offset++] = i;
 }
 
 void BinaryData::write_terminated_utf16_string(const std::wstring& s)
@@ -161,17 +199,17 @@ void BinaryData::write_terminated_utf16_string(const std::wstring& s)
     write_uint16(0);
 }
 
-void BinaryData::write_range(const std::vector<unsigned char>& data)
+void BinaryData::write_range(const std::span<const uint8_t> data)
 {
     check_write_space(data.size());
-    std::ranges::copy(data, _data.begin() + _offset);
+    std::ranges::copy(data, _data->begin() + _offset);
     _offset += static_cast<uint32_t>(data.size());
 }
 
 void BinaryData::save(const std::string& filename) const
 {
     std::ofstream f(filename, std::ios::binary | std::ios::trunc | std::ios::out);
-    f.write(reinterpret_cast<const char*>(_data.data()), static_cast<std::streamsize>(_data.size()));
+    f.write(reinterpret_cast<const char*>(_data->data()), static_cast<std::streamsize>(_data->size()));
     f.close();
 }
 
@@ -1,18 +1,52 @@
 #pragma once
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 
 #include "VgmHeader.h"
 
+// A read-only range of bytes which shares ownership of its storage,
+// so it can refer to part of a loaded file without copying it
+class SharedBytes
+{
+public:
+    SharedBytes() = default;
+
+    explicit SharedBytes(std::vector<uint8_t>&& data)
+        : _owner(std::make_shared<const std::vector<uint8_t>>(std::move(data))),
+          _span(*_owner) { }
+
+    SharedBytes(std::shared_ptr<const std::vector<uint8_t>> owner, const size_t offset, const size_t size)
+        : _owner(std::move(owner)),
+          _span(_owner->data() + offset, size) { }
+
+    [[nodiscard]] std::span<const uint8_t> span() const
+    {
+        return _span;
+    }
+
+    [[nodiscard]] size_t size() const
+    {
+        return _span.size();
+    }
+
+private:
+    std::shared_ptr<const std::vector<uint8_t>> _owner;
+    std::span<const uint8_t> _span;
+};
+
 // Holds binary data and lets us read stuff from it easily
 // - just holds the whole file in memory
 // - decompresses from GZip transparently
 // - assumes little-endian byte ordering
+// - the buffer is shared with any SharedBytes taken from it, and copied if it is written to after that
 class BinaryData
 {
 public:
     BinaryData() = default;
     BinaryData(const std::string& filename);
+    explicit BinaryData(std::vector<uint8_t>&& data);
 
     void seek(unsigned int offset);
 
@@ -21,16 +55,19 @@ public:
     uint16_t read_uint16();
     uint32_t read_uint24();
     uint32_t read_uint32();
+    uint64_t read_uint64();
 
     std::string read_ascii_string(uint32_t length);
     std::wstring read_null_terminated_utf16_string();
 
     std::vector<uint8_t> read_range(uint32_t length);
+    // Reads a range without copying it
+    SharedBytes read_shared_range(uint32_t length);
 
     [[nodiscard]]
     unsigned int size() const
     {
-        return static_cast<unsigned int>(_data.size());
+        return static_cast<unsigned int>(_data->size());
     }
 
     [[nodiscard]]
@@ -53,6 +90,7 @@ public:
     // Write numbers of given sizes
     void write_uint8(uint8_t i);
     void write_uint32(uint32_t i);
+    void write_uint64(uint64_t i);
     void write_uint24(uint32_t i);
     void write_uint16(uint16_t i);
 
@@ -60,7 +98,7 @@ public:
     void write_terminated_utf16_string(const std::wstring& s);
 
     // Write an arbitrary blob of data
-    void write_range(const std::vector<unsigned char>& data);
+    void write_range(std::span<const uint8_t> data);
 
     // Save to disk
     void save(const std::string& filename) const;
@@ -68,7 +106,7 @@ public:
     // Get the whole buffer as a const ref
     [[nodiscard]] const std::vector<uint8_t>& buffer() const
     {
-        return _data;
+        return *_data;
     }
 
     // Reset to empty
@@ -77,6 +115,6 @@ public:
 private:
     void check_write_space(size_t size);
 
-    std::vector<uint8_t> _data;
+    std::shared_ptr<std::vector<uint8_t>> _data = std::make_shared<std::vector<uint8_t>>();
     unsigned int _offset{};
 };
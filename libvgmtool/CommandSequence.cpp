@@ -0,0 +1,499 @@
+#include "CommandSequence.h"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace
+{
+    // Commands per chunk. Bigger makes iterating faster, and edits slower.
+    constexpr size_t CHUNK_SIZE = 256;
+
+    uint32_t random_priority()
+    {
+        thread_local std::minstd_rand random;
+        return static_cast<uint32_t>(random());
+    }
+
+}
+
+CommandSequence::CommandSequence() = default;
+
+CommandSequence::CommandSequence(std::vector<VgmCommands::ICommand*>&& commands)
+    : _root(make_tree(std::move(commands)))
+{
+}
+
+CommandSequence::~CommandSequence()
+{
+    delete_commands(_root);
+}
+
+CommandSequence::CommandSequence(CommandSequence&& other) noexcept
+    : _root(std::move(other._root))
+{
+}
+
+CommandSequence& CommandSequence::operator=(CommandSequence&& other) noexcept
+{
+    if (this != &other)
+    {
+        clear();
+        _root = std::move(other._root);
+    }
+    return *this;
+}
+
+CommandSequence::const_iterator::const_iterator(const Node* root)
+{
+    push_left(root);
+    next_chunk();
+}
+
+void CommandSequence::const_iterator::push_left(const Node* node)
+{
+    for (; node != nullptr; node = node->left.get())
+    {
+        _stack.push_back(node);
+    }
+}
+
+void CommandSequence::const_iterator::next_chunk()
+{
+    _index = 0;
+    if (_stack.empty())
+    {
+        // This makes us equal to end()
+        _chunk = nullptr;
+        _chunkSize = 0;
+        return;
+    }
+    const auto* node = _stack.back();
+    _stack.pop_back();
+    push_left(node->right.get());
+    _chunk = node->commands.data();
+    _chunkSize = node->commands.size();
+}
+
+CommandSequence::const_iterator CommandSequence::begin() const
+{
+    return const_iterator(_root.get());
+}
+
+CommandSequence::const_iterator CommandSequence::end() const
+{
+    return {};
+}
+
+size_t CommandSequence::size() const
+{
+    return summary(_root).count;
+}
+
+bool CommandSequence::empty() const
+{
+    return _root == nullptr;
+}
+
+VgmCommands::ICommand* CommandSequence::operator[](size_t index) const
+{
+    if (index >= size())
+    {
+        throw std::out_of_range("Command index out of range");
+    }
+    const auto* node = _root.get();
+    for (;;)
+    {
+        const auto leftCount = summary(node->left).count;
+        if (index < leftCount)
+        {
+            node = node->left.get();
+            continue;
+        }
+        index -= leftCount;
+        if (index < node->commands.size())
+        {
+            return node->commands[index];
+        }
+        index -= node->commands.size();
+        node = node->right.get();
+    }
+}
+
+uint32_t CommandSequence::sample_count() const
+{
+    return static_cast<uint32_t>(summary(_root).sampleCount);
+}
+
+uint32_t CommandSequence::loop_sample_count() const
+{
+    const auto& rootSummary = summary(_root);
+    return rootSummary.hasLoop ? static_cast<uint32_t>(rootSummary.sampleCount - rootSummary.samplesBeforeLoop) : 0;
+}
+
+uint32_t CommandSequence::data_size() const
+{
+    return static_cast<uint32_t>(summary(_root).byteCount);
+}
+
+std::optional<uint32_t> CommandSequence::loop_data_offset() const
+{
+    if (const auto& rootSummary = summary(_root); rootSummary.hasLoop)
+    {
+        return static_cast<uint32_t>(rootSummary.bytesBeforeLoop);
+    }
+    return std::nullopt;
+}
+
+std::optional<size_t> CommandSequence::loop_index() const
+{
+    size_t result = 0;
+    for (const auto* node = _root.get(); node != nullptr && node->summary.hasLoop;)
+    {
+        const auto& leftSummary = summary(node->left);
+        if (leftSummary.hasLoop)
+        {
+            node = node->left.get();
+            continue;
+        }
+        result += leftSummary.count;
+        if (node->chunkSummary.hasLoop)
+        {
+            const auto it = std::ranges::find_if(node->measures, [](const Measure& measure)
+            {
+                return measure.isLoop;
+            });
+            return result + static_cast<size_t>(it - node->measures.begin());
+        }
+        result += node->commands.size();
+        node = node->right.get();
+    }
+    return std::nullopt;
+}
+
+uint32_t CommandSequence::sample_offset(size_t index) const
+{
+    if (index > size())
+    {
+        throw std::out_of_range("Command index out of range");
+    }
+    uint64_t result = 0;
+    for (const auto* node = _root.get(); node != nullptr;)
+    {
+        const auto& leftSummary = summary(node->left);
+        if (index <= leftSummary.count)
+        {
+            node = node->left.get();
+            continue;
+        }
+        result += leftSummary.sampleCount;
+        index -= leftSummary.count;
+        if (index <= node->commands.size())
+        {
+            for (auto i = 0u; i < index; ++i)
+            {
+                result += node->measures[i].sampleCount;
+            }
+            break;
+        }
+        result += node->chunkSummary.sampleCount;
+        index -= node->commands.size();
+        node = node->right.get();
+    }
+    return static_cast<uint32_t>(result);
+}
+
+size_t CommandSequence::find_sample(const uint32_t sampleOffset) const
+{
+    size_t result = 0;
+    // How many samples we still need before the command we return
+    int64_t remaining = sampleOffset;
+    for (const auto* node = _root.get(); node != nullptr && remaining > 0;)
+    {
+        const auto& leftSummary = summary(node->left);
+        if (std::cmp_less_equal(remaining, leftSummary.sampleCount))
+        {
+            node = node->left.get();
+            continue;
+        }
+        remaining -= static_cast<int64_t>(leftSummary.sampleCount);
+        result += leftSummary.count;
+        if (std::cmp_less_equal(remaining, node->chunkSummary.sampleCount))
+        {
+            for (const auto& measure : node->measures)
+            {
+                remaining -= measure.sampleCount;
+                ++result;
+                if (remaining <= 0)
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        remaining -= static_cast<int64_t>(node->chunkSummary.sampleCount);
+        result += node->commands.size();
+        node = node->right.get();
+    }
+    return result;
+}
+
+void CommandSequence::insert(const size_t index, std::vector<VgmCommands::ICommand*>&& commands)
+{
+    splice(index, CommandSequence(std::move(commands)));
+}
+
+void CommandSequence::splice(const size_t index, CommandSequence&& other)
+{
+    if (index > size())
+    {
+        throw std::out_of_range("Command index out of range");
+    }
+    auto [left, right] = split(std::move(_root), index);
+    _root = join(join(std::move(left), std::move(other._root)), std::move(right));
+}
+
+CommandSequence CommandSequence::extract(const size_t first, const size_t last)
+{
+    if (first > last || last > size())
+    {
+        throw std::out_of_range("Command range out of range");
+    }
+    auto [left, rest] = split(std::move(_root), first);
+    auto [middle, right] = split(std::move(rest), last - first);
+    _root = join(std::move(left), std::move(right));
+    CommandSequence result;
+    result._root = std::move(middle);
+    return result;
+}
+
+void CommandSequence::erase(const size_t first, const size_t last)
+{
+    // The extracted commands are deleted when it goes out of scope
+    const auto erased = extract(first, last);
+}
+
+void CommandSequence::clear()
+{
+    delete_commands(_root);
+    _root.reset();
+}
+
+std::vector<VgmCommands::ICommand*> CommandSequence::release()
+{
+    std::vector<VgmCommands::ICommand*> result;
+    result.reserve(size());
+    release_commands(_root, result);
+    return result;
+}
+
+void CommandSequence::Summary::append(const Summary& other)
+{
+    if (!hasLoop && other.hasLoop)
+    {
+        hasLoop = true;
+        samplesBeforeLoop = sampleCount + other.samplesBeforeLoop;
+        bytesBeforeLoop = byteCount + other.bytesBeforeLoop;
+    }
+    count += other.count;
+    sampleCount += other.sampleCount;
+    byteCount += other.byteCount;
+}
+
+void CommandSequence::Node::update()
+{
+    summary = CommandSequence::summary(left);
+    summary.append(chunkSummary);
+    summary.append(CommandSequence::summary(right));
+}
+
+CommandSequence::Measure CommandSequence::measure(const VgmCommands::ICommand* pCommand)
+{
+    Measure result{0, 0, dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr};
+    if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
+    {
+        result.sampleCount = pWait->duration();
+    }
+    // We find the size by writing the command out
+    thread_local BinaryData scratch;
+    scratch.reset();
+    pCommand->to_data(scratch);
+    result.byteCount = scratch.size();
+    return result;
+}
+
+CommandSequence::Summary CommandSequence::summarise(const std::vector<Measure>& measures)
+{
+    Summary result;
+    for (const auto& measure : measures)
+    {
+        if (measure.isLoop && !result.hasLoop)
+        {
+            result.hasLoop = true;
+            result.samplesBeforeLoop = result.sampleCount;
+            result.bytesBeforeLoop = result.byteCount;
+        }
+        result.sampleCount += measure.sampleCount;
+        result.byteCount += measure.byteCount;
+    }
+    result.count = measures.size();
+    return result;
+}
+
+const CommandSequence::Summary& CommandSequence::summary(const NodePtr& node)
+{
+    static const Summary empty;
+    return node == nullptr ? empty : node->summary;
+}
+
+CommandSequence::NodePtr CommandSequence::make_node(
+    std::vector<VgmCommands::ICommand*>&& commands,
+    std::vector<Measure>&& measures,
+    const uint32_t priority)
+{
+    auto node = std::make_unique<Node>();
+    node->commands = std::move(commands);
+    node->measures = std::move(measures);
+    node->chunkSummary = summarise(node->measures);
+    node->priority = priority;
+    node->update();
+    return node;
+}
+
+CommandSequence::NodePtr CommandSequence::make_tree(std::vector<VgmCommands::ICommand*>&& commands)
+{
+    NodePtr result;
+    for (size_t start = 0; start < commands.size(); start += CHUNK_SIZE)
+    {
+        const auto first = commands.begin() + static_cast<ptrdiff_t>(start);
+        const auto last = commands.begin() + static_cast<ptrdiff_t>(std::min(start + CHUNK_SIZE, commands.size()));
+        std::vector<Measure> measures;
+        measures.reserve(static_cast<size_t>(last - first));
+        std::transform(first, last, std::back_inserter(measures), measure);
+        result = merge(std::move(result), make_node({first, last}, std::move(measures), random_priority()));
+    }
+    commands.clear();
+    return result;
+}
+
+std::pair<CommandSequence::NodePtr, CommandSequence::NodePtr> CommandSequence::split(NodePtr node, const size_t count)
+{
+    if (node == nullptr)
+    {
+        return {};
+    }
+    const auto leftCount = summary(node->left).count;
+    const auto chunkCount = node->commands.size();
+    if (count <= leftCount)
+    {
+        auto [left, right] = split(std::move(node->left), count);
+        node->left = std::move(right);
+        node->update();
+        return {std::move(left), std::move(node)};
+    }
+    if (count >= leftCount + chunkCount)
+    {
+        auto [left, right] = split(std::move(node->right), count - leftCount - chunkCount);
+        node->right = std::move(left);
+        node->update();
+        return {std::move(node), std::move(right)};
+    }
+
+    // The split is inside our chunk, so we move the end of it to a new node. It takes our priority, so the tree
+    // stays in order.
+    const auto splitIndex = static_cast<ptrdiff_t>(count - leftCount);
+    auto tail = make_node(
+        {node->commands.begin() + splitIndex, node->commands.end()},
+        {node->measures.begin() + splitIndex, node->measures.end()},
+        node->priority);
+    node->commands.resize(static_cast<size_t>(splitIndex));
+    node->measures.resize(static_cast<size_t>(splitIndex));
+    node->chunkSummary = summarise(node->measures);
+    tail->right = std::move(node->right);
+    tail->update();
+    node->update();
+    return {std::move(node), std::move(tail)};
+}
+
+CommandSequence::NodePtr CommandSequence::merge(NodePtr left, NodePtr right)
+{
+    if (left == nullptr)
+    {
+        return right;
+    }
+    if (right == nullptr)
+    {
+        return left;
+    }
+    if (left->priority > right->priority)
+    {
+        left->right = merge(std::move(left->right), std::move(right));
+        left->update();
+        return left;
+    }
+    right->left = merge(std::move(left), std::move(right->left));
+    right->update();
+    return right;
+}
+
+CommandSequence::NodePtr CommandSequence::join(NodePtr left, NodePtr right)
+{
+    if (left == nullptr || right == nullptr)
+    {
+        return merge(std::move(left), std::move(right));
+    }
+
+    // Find the chunks either side of the join
+    std::vector<Node*> leftSpine;
+    for (auto* node = left.get(); node != nullptr; node = node->right.get())
+    {
+        leftSpine.push_back(node);
+    }
+    const auto* first = right.get();
+    while (first->left != nullptr)
+    {
+        first = first->left.get();
+    }
+
+    if (auto* last = leftSpine.back(); last->commands.size() + first->commands.size() <= CHUNK_SIZE)
+    {
+        // Move the first chunk on the right to the end of the last chunk on the left
+        auto [front, rest] = split(std::move(right), first->commands.size());
+        last->commands.insert(last->commands.end(), front->commands.begin(), front->commands.end());
+        last->measures.insert(last->measures.end(), front->measures.begin(), front->measures.end());
+        last->chunkSummary.append(front->chunkSummary);
+        for (auto it = leftSpine.rbegin(); it != leftSpine.rend(); ++it)
+        {
+            (*it)->update();
+        }
+        right = std::move(rest);
+    }
+    return merge(std::move(left), std::move(right));
+}
+
+void CommandSequence::delete_commands(const NodePtr& node)
+{
+    if (node == nullptr)
+    {
+        return;
+    }
+    delete_commands(node->left);
+    for (const auto* pCommand : node->commands)
+    {
+        delete pCommand;
+    }
+    node->commands.clear();
+    delete_commands(node->right);
+}
+
+void CommandSequence::release_commands(NodePtr& node, std::vector<VgmCommands::ICommand*>& commands)
+{
+    if (node == nullptr)
+    {
+        return;
+    }
+    release_commands(node->left, commands);
+    commands.insert(commands.end(), node->commands.begin(), node->commands.end());
+    release_commands(node->right, commands);
+    node.reset();
+}
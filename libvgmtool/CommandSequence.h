@@ -0,0 +1,175 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "VgmCommands.h"
+
+// An editable sequence of commands, for when we want to insert, remove or move many ranges. The commands are held in
+// chunks in a balanced tree, so edits at any position are O(log n) and iterating is nearly as fast as a vector. The
+// total samples, loop length and loop offset are kept up to date as we go.
+//
+// We own the commands, and delete any that are erased.
+class CommandSequence
+{
+    struct Node;
+
+public:
+    CommandSequence();
+    // Takes ownership of the commands
+    explicit CommandSequence(std::vector<VgmCommands::ICommand*>&& commands);
+    ~CommandSequence();
+
+    // We own the commands, so we can't be copied
+    CommandSequence(const CommandSequence& other) = delete;
+    CommandSequence(CommandSequence&& other) noexcept;
+    CommandSequence& operator=(const CommandSequence& other) = delete;
+    CommandSequence& operator=(CommandSequence&& other) noexcept;
+
+    // Invalidated by any change to the sequence
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = const VgmCommands::ICommand*;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = value_type;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return _chunk[_index];
+        }
+
+        const_iterator& operator++()
+        {
+            if (++_index == _chunkSize)
+            {
+                next_chunk();
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto result = *this;
+            ++*this;
+            return result;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return _chunk == other._chunk && _index == other._index;
+        }
+
+    private:
+        friend class CommandSequence;
+        explicit const_iterator(const Node* root);
+        void push_left(const Node* node);
+        void next_chunk();
+
+        // The nodes we have yet to visit, in reverse order
+        std::vector<const Node*> _stack;
+        VgmCommands::ICommand* const* _chunk = nullptr;
+        size_t _chunkSize = 0;
+        size_t _index = 0;
+    };
+
+    [[nodiscard]] const_iterator begin() const;
+    [[nodiscard]] const_iterator end() const;
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] bool empty() const;
+    [[nodiscard]] VgmCommands::ICommand* operator[](size_t index) const;
+
+    // Total samples of waits
+    [[nodiscard]] uint32_t sample_count() const;
+    // Samples after the loop point, or 0 if there is none
+    [[nodiscard]] uint32_t loop_sample_count() const;
+    // Bytes of command data, and the offset of the loop point from the start of it, as they would be written
+    [[nodiscard]] uint32_t data_size() const;
+    [[nodiscard]] std::optional<uint32_t> loop_data_offset() const;
+    // Index of the first loop point, if there is one
+    [[nodiscard]] std::optional<size_t> loop_index() const;
+
+    // Samples of waits before the command at index
+    [[nodiscard]] uint32_t sample_offset(size_t index) const;
+    // Index of the first command with at least the given number of samples of waits before it, or size() if the
+    // sequence is shorter than that
+    [[nodiscard]] size_t find_sample(uint32_t sampleOffset) const;
+
+    // Takes ownership of the commands and inserts them before index
+    void insert(size_t index, std::vector<VgmCommands::ICommand*>&& commands);
+    // Moves all of other's commands into us before index
+    void splice(size_t index, CommandSequence&& other);
+    // Removes the commands in [first, last) and returns them
+    [[nodiscard]] CommandSequence extract(size_t first, size_t last);
+    // Deletes the commands in [first, last)
+    void erase(size_t first, size_t last);
+    // Deletes all commands
+    void clear();
+
+    // Gives up ownership of all the commands, in order, leaving us empty
+    [[nodiscard]] std::vector<VgmCommands::ICommand*> release();
+
+private:
+    // What we know about a range of commands
+    struct Summary
+    {
+        size_t count = 0;
+        uint64_t sampleCount = 0;
+        uint64_t byteCount = 0;
+        // For the first loop point in the range, if any
+        bool hasLoop = false;
+        uint64_t samplesBeforeLoop = 0;
+        uint64_t bytesBeforeLoop = 0;
+
+        void append(const Summary& other);
+    };
+
+    // What we need to know about each command, so we don't have to work it out again when chunks are split
+    struct Measure
+    {
+        uint32_t sampleCount;
+        uint32_t byteCount;
+        bool isLoop;
+    };
+
+    struct Node
+    {
+        std::vector<VgmCommands::ICommand*> commands;
+        std::vector<Measure> measures;
+        // Of commands, then of this whole subtree
+        Summary chunkSummary;
+        Summary summary;
+        // Higher is nearer the root; random so the tree stays balanced
+        uint32_t priority = 0;
+        std::unique_ptr<Node> left;
+        std::unique_ptr<Node> right;
+
+        void update();
+    };
+
+    using NodePtr = std::unique_ptr<Node>;
+
+    static Measure measure(const VgmCommands::ICommand* pCommand);
+    static Summary summarise(const std::vector<Measure>& measures);
+    static const Summary& summary(const NodePtr& node);
+    static NodePtr make_node(std::vector<VgmCommands::ICommand*>&& commands, std::vector<Measure>&& measures, uint32_t priority);
+    static NodePtr make_tree(std::vector<VgmCommands::ICommand*>&& commands);
+    // Splits the tree into the first count commands and the rest
+    static std::pair<NodePtr, NodePtr> split(NodePtr node, size_t count);
+    static NodePtr merge(NodePtr left, NodePtr right);
+    // As merge(), but combines the chunks either side of the join if they are small enough, so repeated edits don't
+    // leave lots of tiny chunks
+    static NodePtr join(NodePtr left, NodePtr right);
+    static void delete_commands(const NodePtr& node);
+    static void release_commands(NodePtr& node, std::vector<VgmCommands::ICommand*>& commands);
+
+    NodePtr _root;
+};
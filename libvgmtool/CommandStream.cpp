@@ -4,6 +4,14 @@
 #include <ranges>
 #include <stdexcept>
 
+#include "Profile.h"
+
+namespace
+{
+    constexpr uint32_t WAIT_60TH = 44100 / 60;
+    constexpr uint32_t WAIT_50TH = 44100 / 50;
+}
+
 CommandStream::CommandStream()
 {
     // Register all the commands we have handlers for
@@ -45,6 +53,11 @@ CommandStream::CommandStream()
     register_command<VgmCommands::YM2612Sample>(0x80, 0x8f);
     // 0x90-0x95: DAC stream control
     register_command<VgmCommands::DacStreamControlSetup>();
+    register_command<VgmCommands::DacStreamSetData>();
+    register_command<VgmCommands::DacStreamSetFrequency>();
+    register_command<VgmCommands::DacStreamStart>();
+    register_command<VgmCommands::DacStreamStop>();
+    register_command<VgmCommands::DacStreamStartFast>();
     // 0xa0-0xaf: AY8910, and "second" YM chips
     register_command<VgmCommands::AY8910>();
     register_command<VgmCommands::YM2413_Second>();
@@ -96,8 +109,67 @@ CommandStream::CommandStream()
     */
 }
 
+CommandStream::~CommandStream()
+{
+    clear();
+}
+
+void CommandStream::clear()
+{
+    for (const auto* pCommand : _data)
+    {
+        delete pCommand;
+    }
+    _data.clear();
+}
+
+void CommandStream::add_wait(std::vector<VgmCommands::ICommand*>& commands, uint32_t sampleCount)
+{
+    while (sampleCount > 0xffff)
+    {
+        auto* pWait = new VgmCommands::Wait16bit();
+        pWait->set_duration(0xffff);
+        commands.push_back(pWait);
+        sampleCount -= 0xffff;
+    }
+    switch (sampleCount)
+    {
+    case 0:
+        return;
+    case WAIT_60TH * 2:
+        commands.push_back(new VgmCommands::Wait60th());
+        [[fallthrough]];
+    case WAIT_60TH:
+        commands.push_back(new VgmCommands::Wait60th());
+        return;
+    case WAIT_50TH * 2:
+        commands.push_back(new VgmCommands::Wait50th());
+        [[fallthrough]];
+    case WAIT_50TH:
+        commands.push_back(new VgmCommands::Wait50th());
+        return;
+    default:
+        if (sampleCount <= 16)
+        {
+            auto* pWait = new VgmCommands::Wait4bit();
+            pWait->set_duration(static_cast<int>(sampleCount));
+            commands.push_back(pWait);
+        }
+        else
+        {
+            auto* pWait = new VgmCommands::Wait16bit();
+            pWait->set_duration(static_cast<uint16_t>(sampleCount));
+            commands.push_back(pWait);
+        }
+        return;
+    }
+}
+
 void CommandStream::from_data(BinaryData& data, uint32_t loop_offset, uint32_t end_offset)
 {
+    Profile::Scope scope("parse");
+    clear();
+
     // TODO check for end of data?
     while (data.offset() < end_offset)
     {
@@ -107,13 +179,7 @@ void CommandStream::from_data(BinaryData& data, uint32_t loop_offset, uint32_t e
             _data.push_back(new VgmCommands::LoopPoint());
         }
 
-        const auto marker = data.peek();
-        auto it = _commandGenerators.find(marker);
-        if (it == _commandGenerators.end())
-        {
-            throw std::runtime_error(std::format("No generator for marker {:x}", marker));
-        }
-        auto pCommand = it->second(data);
+        auto pCommand = read_command(data);
         _data.push_back(pCommand);
 
         if (dynamic_cast<VgmCommands::End*>(pCommand) != nullptr)
@@ -133,6 +199,43 @@ void CommandStream::from_data(BinaryData& data, uint32_t loop_offset, uint32_t e
     throw std::runtime_error("No EOF marker found in VGM data");
 }
 
+void CommandStream::copy_from(const CommandStream& other)
+{
+    clear();
+    _data.reserve(other._data.size());
+
+    // Commands can't be copied directly, so we write them all out and read them back. The loop point is virtual so
+    // it has no data.
+    BinaryData data;
+    for (const auto* pCommand : other._data)
+    {
+        pCommand->to_data(data);
+    }
+    data.seek(0);
+    for (const auto* pCommand : other._data)
+    {
+        if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+        {
+            _data.push_back(new VgmCommands::LoopPoint());
+        }
+        else
+        {
+            _data.push_back(read_command(data));
+        }
+    }
+}
+
+VgmCommands::ICommand* CommandStream::read_command(BinaryData& data) const
+{
+    const auto marker = data.peek();
+    const auto it = _commandGenerators.find(marker);
+    if (it == _commandGenerators.end())
+    {
+        throw std::runtime_error(std::format("No generator for marker {:x}", marker));
+    }
+    return it->second(data);
+}
+
 template <typename T>
 void CommandStream::register_command()
 {
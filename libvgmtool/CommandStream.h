@@ -9,9 +9,18 @@ class CommandStream
 {
 public:
     CommandStream();
+    ~CommandStream();
     // explicit CommandStream(BinaryData& data);
 
+    // We own the commands, so we can't be copied
+    CommandStream(const CommandStream& other) = delete;
+    CommandStream(CommandStream&& other) noexcept = delete;
+    CommandStream& operator=(const CommandStream& other) = delete;
+    CommandStream& operator=(CommandStream&& other) noexcept = delete;
+
     void from_data(BinaryData& data, uint32_t loop_offset, uint32_t end_offset);
+    // Replaces our commands with copies of other's
+    void copy_from(const CommandStream& other);
 
     std::vector<VgmCommands::ICommand*>& commands()
     {
@@ -23,6 +32,15 @@ public:
         return _data;
     }
 
+    // Deletes all commands
+    void clear();
+
+    // Appends the most compact wait command(s) for the given number of samples
+    static void add_wait(std::vector<VgmCommands::ICommand*>& commands, uint32_t sampleCount);
+
+    // Reads one command from data, which the caller then owns
+    VgmCommands::ICommand* read_command(BinaryData& data) const;
+
 private:
     template <typename T>
     void register_command();
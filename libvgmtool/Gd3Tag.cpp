@@ -7,10 +7,32 @@
 #include "BinaryData.h"
 #include "KeyValuePrinter.h"
 #include "libpu8.h"
+#include "utils.h"
 
 namespace
 {
     const std::string GD3_IDENT("Gd3 ");
+
+    const std::unordered_map<std::string, Gd3Tag::Key> KEY_NAMES{
+        {"title", Gd3Tag::Key::TitleEn},
+        {"title-jp", Gd3Tag::Key::TitleJp},
+        {"game", Gd3Tag::Key::GameEn},
+        {"game-jp", Gd3Tag::Key::GameJp},
+        {"system", Gd3Tag::Key::SystemEn},
+        {"system-jp", Gd3Tag::Key::SystemJp},
+        {"author", Gd3Tag::Key::AuthorEn},
+        {"author-jp", Gd3Tag::Key::AuthorJp},
+        {"date", Gd3Tag::Key::ReleaseDate},
+        {"creator", Gd3Tag::Key::Creator},
+        {"notes", Gd3Tag::Key::Notes},
+    };
+}
+
+Gd3Tag::Gd3Tag()
+{
+    // The only version there is
+    _version.set_major(1);
+    _version.set_minor(0);
 }
 
 
@@ -61,10 +83,11 @@ void Gd3Tag::to_binary(BinaryData& data) const
 {
     data.write_unterminated_ascii_string(GD3_IDENT);
     _version.to_binary(data);
+    // All the strings are written, even if they were never set
     uint32_t textLength = 0;
-    for (const auto& s : _text | std::views::values)
+    for (const auto& [name, key] : KEY_NAMES)
     {
-        textLength += static_cast<uint32_t>(s.size()) * 2 + 2;
+        textLength += static_cast<uint32_t>(get_text(key).size()) * 2 + 2;
     }
     data.write_uint32(textLength);
     data.write_terminated_utf16_string(get_text(Key::TitleEn));
@@ -100,6 +123,16 @@ void Gd3Tag::set_text(const Key key, const std::wstring& value)
     _text[key] = value;
 }
 
+Gd3Tag::Key Gd3Tag::key_from_name(const std::string& name)
+{
+    const auto it = KEY_NAMES.find(Utils::to_lower(name));
+    if (it == KEY_NAMES.end())
+    {
+        throw std::runtime_error(std::format("Unknown GD3 field \"{}\"", name));
+    }
+    return it->second;
+}
+
 std::string Gd3Tag::write_to_text() const
 {
     KeyValuePrinter printer;
@@ -9,7 +9,7 @@ class BinaryData;
 class Gd3Tag
 {
 public:
-    Gd3Tag() = default;;
+    Gd3Tag();
     ~Gd3Tag() = default;
 
     void from_binary(BinaryData& data);
@@ -34,6 +34,9 @@ public:
     [[nodiscard]] std::wstring get_text(Key key) const;
     void set_text(Key key, const std::wstring& value);
 
+    // Short name for the key, e.g. "title" or "title-jp", as used in tag manifests
+    [[nodiscard]] static Key key_from_name(const std::string& name);
+
     std::string write_to_text() const;
 
 private:
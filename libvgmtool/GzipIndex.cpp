@@ -0,0 +1,292 @@
+#include "GzipIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <zlib.h>
+
+#include "BinaryData.h"
+#include "utils.h"
+
+namespace
+{
+    constexpr auto INDEX_IDENT = "GZIX";
+    constexpr uint32_t INDEX_VERSION = 1;
+    constexpr uint32_t CHUNK_SIZE = 64 * 1024;
+
+    // Owns a z_stream for inflating
+    class Inflater
+    {
+    public:
+        // See inflateInit2() for windowBits
+        explicit Inflater(const int windowBits)
+        {
+            if (inflateInit2(&stream, windowBits) != Z_OK)
+            {
+                throw std::runtime_error("Failed to initialise zlib");
+            }
+        }
+
+        ~Inflater()
+        {
+            inflateEnd(&stream);
+        }
+
+        Inflater(const Inflater&) = delete;
+        Inflater& operator=(const Inflater&) = delete;
+
+        // Inflates, throwing on errors. Returns true at the end of the data.
+        bool inflate(const int flush, const std::string& filename)
+        {
+            switch (const auto result = ::inflate(&stream, flush))
+            {
+            case Z_STREAM_END:
+                return true;
+            case Z_OK:
+            case Z_BUF_ERROR:
+                return false;
+            default:
+                throw std::runtime_error(std::format(
+                    "Error decompressing \"{}\": {}: {}",
+                    filename,
+                    result,
+                    stream.msg == nullptr ? "" : stream.msg));
+            }
+        }
+
+        // Refills the input from f if it is empty
+        void fill(std::ifstream& f, std::vector<uint8_t>& buffer, const std::string& filename)
+        {
+            if (stream.avail_in != 0)
+            {
+                return;
+            }
+            f.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+            stream.avail_in = static_cast<uInt>(f.gcount());
+            stream.next_in = buffer.data();
+            if (stream.avail_in == 0)
+            {
+                throw std::runtime_error(std::format("Unexpected end of compressed data in \"{}\"", filename));
+            }
+        }
+
+        z_stream stream{};
+    };
+
+    int64_t modified_time(const std::string& filename)
+    {
+        return std::filesystem::last_write_time(filename).time_since_epoch().count();
+    }
+}
+
+GzipIndex GzipIndex::build(const std::string& filename, const uint32_t spacing)
+{
+    std::ifstream f(filename, std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", filename));
+    }
+
+    GzipIndex index;
+    index._compressedSize = std::filesystem::file_size(filename);
+    index._modified = modified_time(filename);
+
+    // 32 + 15 means a gzip or zlib header, and the maximum window size
+    Inflater inflater(32 + 15);
+    auto& stream = inflater.stream;
+    std::vector<uint8_t> input(CHUNK_SIZE);
+    // We decompress into the window, wrapping around, so it always has the most recent data
+    std::vector<uint8_t> window(WINDOW_SIZE);
+    uint32_t totalIn = 0;
+    uint32_t totalOut = 0;
+    auto finished = false;
+    while (!finished)
+    {
+        inflater.fill(f, input, filename);
+        if (stream.avail_out == 0)
+        {
+            stream.avail_out = WINDOW_SIZE;
+            stream.next_out = window.data();
+        }
+
+        // Z_BLOCK makes it stop at the end of each deflate block
+        totalIn += stream.avail_in;
+        totalOut += stream.avail_out;
+        finished = inflater.inflate(Z_BLOCK, filename);
+        totalIn -= stream.avail_in;
+        totalOut -= stream.avail_out;
+
+        // Bit 7 means we are at the end of a block, bit 6 means it was the last one.
+        // We can restart from here, if it is far enough from the last point.
+        if (!finished && (stream.data_type & 128) != 0 && (stream.data_type & 64) == 0 &&
+            (index._points.empty() || totalOut - index._points.back().out > spacing))
+        {
+            AccessPoint point{totalOut, totalIn, static_cast<uint8_t>(stream.data_type & 7), std::vector<uint8_t>(WINDOW_SIZE)};
+            // The oldest data is after the current position in the window
+            const auto left = stream.avail_out;
+            std::memcpy(point.window.data(), window.data() + WINDOW_SIZE - left, left);
+            std::memcpy(point.window.data() + left, window.data(), WINDOW_SIZE - left);
+            index._points.push_back(std::move(point));
+        }
+    }
+    index._size = totalOut;
+    return index;
+}
+
+bool GzipIndex::load(const std::string& filename)
+{
+    const auto& indexFilename = sidecar_filename(filename);
+    if (!Utils::file_exists(indexFilename))
+    {
+        return false;
+    }
+    BinaryData data(indexFilename);
+    if (data.read_ascii_string(4) != INDEX_IDENT || data.read_uint32() != INDEX_VERSION)
+    {
+        return false;
+    }
+    _compressedSize = data.read_uint64();
+    _modified = static_cast<int64_t>(data.read_uint64());
+    if (_compressedSize != std::filesystem::file_size(filename) || _modified != modified_time(filename))
+    {
+        return false;
+    }
+    _size = data.read_uint32();
+    _points.resize(data.read_uint32());
+    for (auto& point : _points)
+    {
+        point.out = data.read_uint32();
+        point.in = data.read_uint32();
+        point.bits = data.read_uint8();
+        point.window = data.read_range(WINDOW_SIZE);
+    }
+    return true;
+}
+
+void GzipIndex::save(const std::string& filename) const
+{
+    BinaryData data;
+    data.write_unterminated_ascii_string(INDEX_IDENT);
+    data.write_uint32(INDEX_VERSION);
+    data.write_uint64(_compressedSize);
+    data.write_uint64(static_cast<uint64_t>(_modified));
+    data.write_uint32(_size);
+    data.write_uint32(static_cast<uint32_t>(_points.size()));
+    for (const auto& point : _points)
+    {
+        data.write_uint32(point.out);
+        data.write_uint32(point.in);
+        data.write_uint8(point.bits);
+        data.write_range(point.window);
+    }
+    data.save(sidecar_filename(filename));
+}
+
+std::vector<uint8_t> GzipIndex::read(const std::string& filename, const uint32_t offset, uint32_t length) const
+{
+    std::vector<uint8_t> result;
+    if (offset >= _size || length == 0)
+    {
+        return result;
+    }
+    length = std::min(length, _size - offset);
+
+    // We start from the last point before the offset. The first point is at the start, so there always is one.
+    const auto it = std::ranges::upper_bound(_points, offset, {}, &AccessPoint::out);
+    if (it == _points.begin())
+    {
+        throw std::runtime_error(std::format("Invalid index for \"{}\"", filename));
+    }
+    const auto& point = *std::prev(it);
+
+    std::ifstream f(filename, std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", filename));
+    }
+    // The point may be part way through a byte
+    f.seekg(point.in - (point.bits > 0 ? 1 : 0));
+
+    // We decompress raw deflate data from here, with the window as the dictionary
+    Inflater inflater(-15);
+    auto& stream = inflater.stream;
+    if (point.bits > 0)
+    {
+        const auto partialByte = f.get();
+        inflatePrime(&stream, point.bits, partialByte >> (8 - point.bits));
+    }
+    inflateSetDictionary(&stream, point.window.data(), WINDOW_SIZE);
+
+    std::vector<uint8_t> input(CHUNK_SIZE);
+    // Data before the offset is decompressed into here and discarded
+    std::vector<uint8_t> discard(WINDOW_SIZE);
+    auto skipCount = offset - point.out;
+    result.resize(length);
+    uint32_t readCount = 0;
+    auto finished = false;
+    while (readCount < length && !finished)
+    {
+        if (skipCount > 0)
+        {
+            stream.next_out = discard.data();
+            stream.avail_out = std::min(skipCount, WINDOW_SIZE);
+        }
+        else
+        {
+            stream.next_out = result.data() + readCount;
+            stream.avail_out = length - readCount;
+        }
+        inflater.fill(f, input, filename);
+        const auto availableBefore = stream.avail_out;
+        finished = inflater.inflate(Z_NO_FLUSH, filename);
+        const auto count = availableBefore - stream.avail_out;
+        if (skipCount > 0)
+        {
+            skipCount -= count;
+        }
+        else
+        {
+            readCount += count;
+        }
+    }
+    result.resize(readCount);
+    return result;
+}
+
+std::vector<uint8_t> read_file_range(const std::string& filename, const uint32_t offset, const uint32_t length)
+{
+    if (GzipIndex index; index.load(filename))
+    {
+        return index.read(filename, offset, length);
+    }
+
+    // Else we let zlib skip to the offset. For compressed files, that means decompressing everything before it.
+    const auto f = gzopen(filename.c_str(), "rb");
+    if (f == nullptr)
+    {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", filename));
+    }
+    std::vector<uint8_t> result;
+    if (gzseek(f, static_cast<z_off_t>(offset), SEEK_SET) == static_cast<z_off_t>(offset))
+    {
+        // The length may be far beyond the end of the file
+        while (result.size() < length && gzeof(f) == 0)
+        {
+            const auto sizeBefore = result.size();
+            const auto chunkSize = std::min<size_t>(CHUNK_SIZE, length - sizeBefore);
+            result.resize(sizeBefore + chunkSize);
+            const auto amountRead = gzread(f, result.data() + sizeBefore, static_cast<unsigned int>(chunkSize));
+            if (amountRead <= 0)
+            {
+                result.resize(sizeBefore);
+                break;
+            }
+            result.resize(sizeBefore + amountRead);
+        }
+    }
+    gzclose(f);
+    return result;
+}
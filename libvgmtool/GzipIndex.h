@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Random access into gzip-compressed files. We decompress the file once, and remember the decompressor state at
+// points through it (as zran.c in the zlib examples). A read can then start from the nearest point before it,
+// instead of from the start of the file. The index can be saved next to the file for later use.
+class GzipIndex
+{
+public:
+    // Distance between access points in the uncompressed data
+    static constexpr uint32_t DEFAULT_SPACING = 1024 * 1024;
+
+    GzipIndex() = default;
+
+    // Makes an index by decompressing the whole file
+    static GzipIndex build(const std::string& filename, uint32_t spacing = DEFAULT_SPACING);
+
+    // Loads the saved index for filename. Returns false if there isn't one, or it is out of date.
+    bool load(const std::string& filename);
+    // Saves the index for filename next to it
+    void save(const std::string& filename) const;
+
+    static std::string sidecar_filename(const std::string& filename)
+    {
+        return filename + ".gzi";
+    }
+
+    // Reads up to length bytes from offset in the uncompressed data. This decompresses at most the access point
+    // spacing more than is wanted.
+    [[nodiscard]] std::vector<uint8_t> read(const std::string& filename, uint32_t offset, uint32_t length) const;
+
+    // Size of the uncompressed data
+    [[nodiscard]] uint32_t size() const
+    {
+        return _size;
+    }
+
+private:
+    // Deflate uses a 32KB window, so that is what we need to restart from any point
+    static constexpr uint32_t WINDOW_SIZE = 32 * 1024;
+
+    struct AccessPoint
+    {
+        // Offset in the uncompressed data
+        uint32_t out;
+        // Offset in the compressed data of the first byte with any bits of the next block
+        uint32_t in;
+        // Number of bits of the byte before in which are part of the next block
+        uint8_t bits;
+        // The last 32KB of uncompressed data before this point
+        std::vector<uint8_t> window;
+    };
+
+    // For spotting when the file has changed since the index was made
+    uint64_t _compressedSize{};
+    int64_t _modified{};
+
+    uint32_t _size{};
+    std::vector<AccessPoint> _points;
+};
+
+// Reads up to length bytes from offset in filename, decompressing it if needed. Compressed files use their saved
+// GzipIndex if there is one.
+std::vector<uint8_t> read_file_range(const std::string& filename, uint32_t offset, uint32_t length);
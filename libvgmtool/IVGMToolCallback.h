@@ -1,13 +1,87 @@
 ﻿#pragma once
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+
+#include "Profile.h"
+
+// Thrown by long operations when the callback asks them to stop
+class OperationCancelled : public std::runtime_error
+{
+public:
+    OperationCancelled(): std::runtime_error("Cancelled") {}
+};
 
 class IVGMToolCallback
 {
 public:
+    // What one stage of an operation did, e.g. "compress"
+    struct StageMetrics
+    {
+        std::string_view stage;
+        std::chrono::nanoseconds wallTime{};
+        uint64_t bytesIn = 0;
+        uint64_t bytesOut = 0;
+        uint64_t commandCount = 0;
+    };
+
     virtual ~IVGMToolCallback() = default;
 
     virtual void show_message(const std::string& message) const = 0;
     virtual void show_error(const std::string& message) const = 0;
     virtual void show_status(const std::string& message) const = 0;
     virtual void show_conversion_progress(const std::string& message) const = 0;
+
+    // Progress through a stage, in bytes or commands. This is called from busy loops, so it should be quick.
+    virtual void show_progress(std::string_view /*stage*/, uint64_t /*done*/, uint64_t /*total*/) const {}
+
+    // Called at the end of each stage
+    virtual void show_metrics(const StageMetrics& /*metrics*/) const {}
+
+    // Long operations check this now and then, and throw OperationCancelled if it is true.
+    // It may be called from several threads at once.
+    [[nodiscard]] virtual bool is_cancelled() const
+    {
+        return false;
+    }
+
+    // Reports progress and throws OperationCancelled if we have been cancelled
+    void check_progress(const std::string_view stage, const uint64_t done, const uint64_t total) const
+    {
+        if (is_cancelled())
+        {
+            throw OperationCancelled();
+        }
+        show_progress(stage, done, total);
+    }
+};
+
+// Measures a stage for IVGMToolCallback::show_metrics(). Stages that fail are not reported. It is also a profiler stage.
+class StageTimer
+{
+public:
+    StageTimer(const IVGMToolCallback& callback, const std::string_view stage)
+        : _scope(stage),
+          _callback(callback),
+          _start(std::chrono::steady_clock::now())
+    {
+        _metrics.stage = stage;
+    }
+
+    void finish(const uint64_t bytesIn, const uint64_t bytesOut, const uint64_t commandCount = 0)
+    {
+        _metrics.wallTime = std::chrono::steady_clock::now() - _start;
+        _metrics.bytesIn = bytesIn;
+        _metrics.bytesOut = bytesOut;
+        _metrics.commandCount = commandCount;
+        _callback.show_metrics(_metrics);
+    }
+
+private:
+    Profile::Scope _scope;
+    const IVGMToolCallback& _callback;
+    std::chrono::steady_clock::time_point _start;
+    IVGMToolCallback::StageMetrics _metrics;
 };
@@ -0,0 +1,348 @@
+#include "PcmCompression.h"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+#include <stdexcept>
+
+#include "BinaryData.h"
+
+namespace
+{
+    // Bytes before the compressed data: method, uncompressed size, bits decompressed, bits compressed, sub-type,
+    // offset/start value
+    constexpr auto COMPRESSED_HEADER_SIZE = 10;
+    // Bytes before the values in a table block
+    constexpr auto TABLE_HEADER_SIZE = 6;
+    // Bytes for a data block command, excluding the payload
+    constexpr auto DATA_BLOCK_OVERHEAD = 7;
+    // Data block type for PWM, which is 12-bit data stored as 16 bits
+    constexpr uint8_t PWM_DATA_TYPE = 0x03;
+
+    // Reads values of a given number of bits, high bits first
+    class BitReader
+    {
+    public:
+        explicit BitReader(const std::span<const uint8_t> data)
+            : _data(data) { }
+
+        uint32_t read(const int bitCount)
+        {
+            uint32_t result = 0;
+            for (auto i = 0; i < bitCount; ++i)
+            {
+                if (_bitOffset / 8 >= _data.size())
+                {
+                    throw std::runtime_error("Compressed data block is truncated");
+                }
+                const auto bit = (_data[_bitOffset / 8] >> (7 - _bitOffset % 8)) & 1;
+                result = (result << 1) | bit;
+                ++_bitOffset;
+            }
+            return result;
+        }
+
+    private:
+        std::span<const uint8_t> _data;
+        size_t _bitOffset = 0;
+    };
+
+    class BitWriter
+    {
+    public:
+        void write(const uint32_t value, const int bitCount)
+        {
+            for (auto i = bitCount - 1; i >= 0; --i)
+            {
+                if (_bitOffset % 8 == 0)
+                {
+                    _data.push_back(0);
+                }
+                _data.back() |= static_cast<uint8_t>(((value >> i) & 1) << (7 - _bitOffset % 8));
+                ++_bitOffset;
+            }
+        }
+
+        std::vector<uint8_t>& data()
+        {
+            return _data;
+        }
+
+    private:
+        std::vector<uint8_t> _data;
+        size_t _bitOffset = 0;
+    };
+
+    // Bits needed to hold values 0..maxValue
+    int bits_for(const uint32_t maxValue)
+    {
+        return std::max(1, static_cast<int>(std::bit_width(maxValue)));
+    }
+
+    std::vector<uint8_t> make_payload(
+        const PcmCompression::Method method,
+        const PcmCompression::SubType subType,
+        const uint32_t uncompressedSize,
+        const int bitsCompressed,
+        const uint16_t offset,
+        std::vector<uint8_t>&& packed)
+    {
+        BinaryData data;
+        data.write_uint8(static_cast<uint8_t>(method));
+        data.write_uint32(uncompressedSize);
+        data.write_uint8(8);
+        data.write_uint8(static_cast<uint8_t>(bitsCompressed));
+        data.write_uint8(static_cast<uint8_t>(subType));
+        data.write_uint16(offset);
+        data.write_range(packed);
+        return data.buffer();
+    }
+
+    size_t table_block_size(const PcmCompression::Table& table)
+    {
+        return DATA_BLOCK_OVERHEAD + TABLE_HEADER_SIZE + table.values.size();
+    }
+}
+
+PcmCompression::Table PcmCompression::Table::from_payload(const std::span<const uint8_t> payload)
+{
+    if (payload.size() < TABLE_HEADER_SIZE)
+    {
+        throw std::runtime_error("Decompression table is truncated");
+    }
+    Table table;
+    table.method = static_cast<Method>(payload[0]);
+    table.subType = static_cast<SubType>(payload[1]);
+    table.bitsDecompressed = payload[2];
+    table.bitsCompressed = payload[3];
+    const auto count = static_cast<size_t>(payload[4] | (payload[5] << 8));
+    const auto valueSize = static_cast<size_t>((table.bitsDecompressed + 7) / 8);
+    if (payload.size() < TABLE_HEADER_SIZE + count * valueSize)
+    {
+        throw std::runtime_error("Decompression table is truncated");
+    }
+    for (auto i = 0u; i < count; ++i)
+    {
+        const auto* p = payload.data() + TABLE_HEADER_SIZE + i * valueSize;
+        table.values.push_back(static_cast<uint16_t>(valueSize == 1 ? p[0] : p[0] | (p[1] << 8)));
+    }
+    return table;
+}
+
+std::vector<uint8_t> PcmCompression::Table::to_payload() const
+{
+    BinaryData data;
+    data.write_uint8(static_cast<uint8_t>(method));
+    data.write_uint8(static_cast<uint8_t>(subType));
+    data.write_uint8(bitsDecompressed);
+    data.write_uint8(bitsCompressed);
+    data.write_uint16(static_cast<uint16_t>(values.size()));
+    for (const auto value : values)
+    {
+        if (bitsDecompressed > 8)
+        {
+            data.write_uint16(value);
+        }
+        else
+        {
+            data.write_uint8(static_cast<uint8_t>(value));
+        }
+    }
+    return data.buffer();
+}
+
+std::vector<uint8_t> PcmCompression::decompress(const std::span<const uint8_t> payload, const Table* pTable)
+{
+    if (payload.size() < COMPRESSED_HEADER_SIZE)
+    {
+        throw std::runtime_error("Compressed data block is truncated");
+    }
+    const auto method = static_cast<Method>(payload[0]);
+    const auto uncompressedSize = static_cast<uint32_t>(payload[1] | (payload[2] << 8) | (payload[3] << 16) | (payload[4] << 24));
+    const auto bitsDecompressed = payload[5];
+    const auto bitsCompressed = payload[6];
+    const auto subType = static_cast<SubType>(payload[7]);
+    const auto offset = static_cast<uint16_t>(payload[8] | (payload[9] << 8));
+
+    if (bitsDecompressed != 8 && bitsDecompressed != 16)
+    {
+        throw std::runtime_error(std::format("Unsupported decompressed bit count {}", bitsDecompressed));
+    }
+    if (bitsCompressed == 0 || bitsCompressed > bitsDecompressed)
+    {
+        throw std::runtime_error(std::format("Invalid compressed bit count {}", bitsCompressed));
+    }
+    const auto usesTable = method == Method::Dpcm || subType == SubType::Table;
+    if (usesTable)
+    {
+        if (pTable == nullptr)
+        {
+            throw std::runtime_error("Compressed data block needs a decompression table, but there isn't one");
+        }
+        if (pTable->method != method || pTable->bitsDecompressed != bitsDecompressed || pTable->bitsCompressed != bitsCompressed)
+        {
+            throw std::runtime_error("Decompression table does not match the compressed data block");
+        }
+    }
+
+    BitReader reader(payload.subspan(COMPRESSED_HEADER_SIZE));
+    std::vector<uint8_t> result;
+    result.reserve(uncompressedSize);
+    const auto mask = static_cast<uint32_t>((1 << bitsDecompressed) - 1);
+    uint32_t dpcmValue = offset;
+    while (result.size() < uncompressedSize)
+    {
+        const auto input = reader.read(bitsCompressed);
+        if (usesTable && input >= pTable->values.size())
+        {
+            throw std::runtime_error(std::format("Compressed value {} is beyond the end of the decompression table", input));
+        }
+        uint32_t value;
+        if (method == Method::Dpcm)
+        {
+            dpcmValue = (dpcmValue + pTable->values[input]) & mask;
+            value = dpcmValue;
+        }
+        else
+        {
+            switch (subType)
+            {
+            case SubType::Copy:
+                value = input + offset;
+                break;
+            case SubType::ShiftLeft:
+                value = (input << (bitsDecompressed - bitsCompressed)) + offset;
+                break;
+            case SubType::Table:
+                value = pTable->values[input];
+                break;
+            default:
+                throw std::runtime_error(std::format("Unknown bit packing sub-type {}", static_cast<int>(subType)));
+            }
+        }
+        result.push_back(static_cast<uint8_t>(value));
+        if (bitsDecompressed == 16)
+        {
+            result.push_back(static_cast<uint8_t>(value >> 8));
+        }
+    }
+    // A 16-bit value could take us one byte past the size
+    result.resize(uncompressedSize);
+    return result;
+}
+
+PcmCompression::Compressed PcmCompression::compress(const std::span<const uint8_t> data)
+{
+    Compressed best{{}, false, {}};
+    if (data.empty())
+    {
+        return best;
+    }
+    // Anything has to beat the original
+    auto bestSize = data.size();
+    const auto size = static_cast<uint32_t>(data.size());
+    auto consider = [&](std::vector<uint8_t>&& payload, const Table* pTable)
+    {
+        if (const auto totalSize = payload.size() + (pTable == nullptr ? 0 : table_block_size(*pTable));
+            totalSize < bestSize)
+        {
+            bestSize = totalSize;
+            best = {std::move(payload), pTable != nullptr, pTable == nullptr ? Table{} : *pTable};
+        }
+    };
+
+    const auto [minIt, maxIt] = std::ranges::minmax_element(data);
+    const auto minValue = *minIt;
+    const auto range = static_cast<uint32_t>(*maxIt - minValue);
+
+    // Bit packing with an offset
+    if (const auto bits = bits_for(range); bits < 8)
+    {
+        BitWriter writer;
+        for (const auto value : data)
+        {
+            writer.write(value - minValue, bits);
+        }
+        consider(make_payload(Method::BitPacking, SubType::Copy, size, bits, minValue, std::move(writer.data())), nullptr);
+    }
+
+    // Bit packing with a shift, if the low bits are unused. The shift is implied by the compressed bit count.
+    uint32_t usedBits = 0;
+    for (const auto value : data)
+    {
+        usedBits |= static_cast<uint32_t>(value - minValue);
+    }
+    if (const auto shift = usedBits == 0 ? 0 : std::countr_zero(usedBits); shift > 0)
+    {
+        const auto bits = 8 - shift;
+        BitWriter writer;
+        for (const auto value : data)
+        {
+            writer.write(static_cast<uint32_t>(value - minValue) >> shift, bits);
+        }
+        consider(make_payload(Method::BitPacking, SubType::ShiftLeft, size, bits, minValue, std::move(writer.data())), nullptr);
+    }
+
+    // Table lookup, if there are few distinct values
+    std::vector<bool> isUsed(256, false);
+    for (const auto value : data)
+    {
+        isUsed[value] = true;
+    }
+    if (const auto distinctCount = static_cast<uint32_t>(std::count(isUsed.begin(), isUsed.end(), true)); bits_for(distinctCount - 1) < 8)
+    {
+        Table table{Method::BitPacking, SubType::Table, 8, static_cast<uint8_t>(bits_for(distinctCount - 1)), {}};
+        std::vector<uint8_t> indexes(256, 0);
+        for (auto value = 0; value < 256; ++value)
+        {
+            if (isUsed[value])
+            {
+                indexes[value] = static_cast<uint8_t>(table.values.size());
+                table.values.push_back(static_cast<uint16_t>(value));
+            }
+        }
+        BitWriter writer;
+        for (const auto value : data)
+        {
+            writer.write(indexes[value], table.bitsCompressed);
+        }
+        consider(make_payload(Method::BitPacking, SubType::Table, size, table.bitsCompressed, 0, std::move(writer.data())), &table);
+    }
+
+    // DPCM, if there are few distinct deltas. The start value is the one before the first.
+    std::vector<bool> isDeltaUsed(256, false);
+    for (auto i = 1u; i < data.size(); ++i)
+    {
+        isDeltaUsed[static_cast<uint8_t>(data[i] - data[i - 1])] = true;
+    }
+    // We use a zero delta for the first value
+    isDeltaUsed[0] = true;
+    if (const auto distinctCount = static_cast<uint32_t>(std::count(isDeltaUsed.begin(), isDeltaUsed.end(), true)); bits_for(distinctCount - 1) < 8)
+    {
+        Table table{Method::Dpcm, SubType::Copy, 8, static_cast<uint8_t>(bits_for(distinctCount - 1)), {}};
+        std::vector<uint8_t> indexes(256, 0);
+        for (auto delta = 0; delta < 256; ++delta)
+        {
+            if (isDeltaUsed[delta])
+            {
+                indexes[delta] = static_cast<uint8_t>(table.values.size());
+                table.values.push_back(static_cast<uint16_t>(delta));
+            }
+        }
+        BitWriter writer;
+        writer.write(indexes[0], table.bitsCompressed);
+        for (auto i = 1u; i < data.size(); ++i)
+        {
+            writer.write(indexes[static_cast<uint8_t>(data[i] - data[i - 1])], table.bitsCompressed);
+        }
+        consider(make_payload(Method::Dpcm, SubType::Copy, size, table.bitsCompressed, data[0], std::move(writer.data())), &table);
+    }
+
+    return best;
+}
+
+bool PcmCompression::is_compressible_type(const uint8_t type)
+{
+    // 0x3f would be 0x7f once compressed, which is the decompression table type
+    return type < 0x3f && type != PWM_DATA_TYPE;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Compression of PCM data blocks, as used by data block types 0x40-0x7e, with tables in type 0x7f blocks
+namespace PcmCompression
+{
+    enum class Method : uint8_t
+    {
+        BitPacking = 0,
+        Dpcm = 1
+    };
+
+    // Sub-types for bit packing. DPCM only uses Copy.
+    enum class SubType : uint8_t
+    {
+        // Values are stored as (value - offset)
+        Copy = 0,
+        // Values are stored as (value - offset) >> (decompressed bits - compressed bits)
+        ShiftLeft = 1,
+        // Values are stored as indexes into the table
+        Table = 2
+    };
+
+    // A decompression table, as held in a type 0x7f data block. For DPCM the values are deltas.
+    struct Table
+    {
+        Method method = Method::BitPacking;
+        SubType subType = SubType::Table;
+        uint8_t bitsDecompressed = 8;
+        uint8_t bitsCompressed = 0;
+        std::vector<uint16_t> values;
+
+        bool operator==(const Table& other) const = default;
+
+        static Table from_payload(std::span<const uint8_t> payload);
+        [[nodiscard]] std::vector<uint8_t> to_payload() const;
+    };
+
+    // Decompresses the payload of a compressed data block (type 0x40-0x7e). pTable is the last table seen, if any.
+    std::vector<uint8_t> decompress(std::span<const uint8_t> payload, const Table* pTable);
+
+    struct Compressed
+    {
+        std::vector<uint8_t> payload;
+        // True if the payload needs table to be written before it
+        bool needsTable;
+        Table table;
+    };
+
+    // Compresses 8-bit data losslessly with whichever method makes it smallest, counting the table if one is needed.
+    // Returns an empty payload if nothing is smaller than the original.
+    Compressed compress(std::span<const uint8_t> data);
+
+    // Data block types which can be compressed, i.e. streams of 8-bit values
+    bool is_compressible_type(uint8_t type);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <string_view>
+
+// Optional measurement of the stages of work, to find out where the time goes. With no profiler set, a scope costs one
+// check of a pointer.
+//
+// The profiler is set per thread, so several commands can run at once with only some of them profiled. Work handed to
+// other threads has to take the profiler with it, using Profile::UseProfiler.
+
+class IProfiler
+{
+public:
+    virtual ~IProfiler() = default;
+
+    // Called on the thread doing the work, with stages nesting on each thread. Stage names are string literals. file is
+    // the file the stage works on, if it knows; later stages on the same thread are taken to be on the same file.
+    virtual void begin(std::string_view stage, std::string_view file) = 0;
+    virtual void end() = 0;
+};
+
+class Profile
+{
+public:
+    // Set this on the thread doing the work before it starts, and clear it once it has all finished
+    static void set_profiler(IProfiler* profiler)
+    {
+        _profiler = profiler;
+    }
+
+    // The profiler for this thread, if any
+    static IProfiler* profiler()
+    {
+        return _profiler;
+    }
+
+    // Sets this thread's profiler, for as long as it exists
+    class UseProfiler
+    {
+    public:
+        explicit UseProfiler(IProfiler* profiler)
+            : _previous(_profiler)
+        {
+            _profiler = profiler;
+        }
+
+        ~UseProfiler()
+        {
+            _profiler = _previous;
+        }
+
+        UseProfiler(const UseProfiler&) = delete;
+        UseProfiler& operator=(const UseProfiler&) = delete;
+
+    private:
+        IProfiler* _previous;
+    };
+
+    // Measures a stage, for as long as it exists
+    class Scope
+    {
+    public:
+        explicit Scope(const std::string_view stage, const std::string_view file = {})
+            : _profiler(profiler())
+        {
+            if (_profiler != nullptr)
+            {
+                _profiler->begin(stage, file);
+            }
+        }
+
+        ~Scope()
+        {
+            if (_profiler != nullptr)
+            {
+                _profiler->end();
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        IProfiler* _profiler;
+    };
+
+private:
+    inline static thread_local IProfiler* _profiler = nullptr;
+};
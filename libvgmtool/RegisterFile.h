@@ -0,0 +1,328 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Describes one register of a chip, for use in a register layout
+struct RegisterInfo
+{
+    // Bits which do something. Zero means the register doesn't exist, and writes to it can be dropped.
+    uint8_t validBits = 0;
+    // Bits which start something when they go from 0 to 1, e.g. key on.
+    // An off-on sequence has to be kept even if the value doesn't change.
+    uint8_t keyBits = 0;
+    // Every write does something (e.g. strobes, sample data, envelope restarts), so they are never dropped or reordered
+    bool hasSideEffects = false;
+    // For registers with side effects, bits of the value which select what the rest of it is for (e.g. the channel for
+    // key on/off), so the last value for each can be restored
+    uint8_t selectBits = 0;
+    // For registers with side effects, writing the same value again restarts something (e.g. an envelope)
+    bool isRestartedByRewrite = false;
+    // The value only takes effect when this other register is written, or -1 if it takes effect immediately
+    int latchedUntil = -1;
+    // For latched registers, where the value is held until then. Registers with the same latch share it, so the value
+    // taken is from the last write to any of them. It's a register index, so it can be the index of one of them.
+    int latch = -1;
+};
+
+// Holds the state of a chip's registers, as described by Layout, and tracks what has been written out.
+// Layout is a type with:
+// - static constexpr int registerCount
+// - static constexpr std::array<RegisterInfo, registerCount> registers
+// - static constexpr std::array<int, registerCount> writeOrder, holding every register index in the order
+//   changes need to be written in (e.g. latched registers before the one they're latched until)
+template <typename Layout>
+class RegisterFile
+{
+public:
+    static constexpr int registerCount = Layout::registerCount;
+
+    [[nodiscard]] static bool is_valid(const int index)
+    {
+        return index >= 0 && index < registerCount && Layout::registers[index].validBits != 0;
+    }
+
+    [[nodiscard]] static bool has_side_effects(const int index)
+    {
+        return Layout::registers[index].hasSideEffects;
+    }
+
+    [[nodiscard]] static uint8_t valid_bits(const int index)
+    {
+        return Layout::registers[index].validBits;
+    }
+
+    [[nodiscard]] static uint8_t key_bits(const int index)
+    {
+        return Layout::registers[index].keyBits;
+    }
+
+    [[nodiscard]] uint8_t operator[](const int index) const
+    {
+        return _registers[index];
+    }
+
+    [[nodiscard]] const std::array<uint8_t, registerCount>& values() const
+    {
+        return _registers;
+    }
+
+    // Applies a write. Writes to registers with side effects are assumed to be passed through in place by the caller.
+    void write(const int index, const uint8_t value)
+    {
+        if (!is_valid(index))
+        {
+            return;
+        }
+        const auto& info = Layout::registers[index];
+        if (info.latchedUntil >= 0)
+        {
+            // It takes effect, and becomes part of the state, when the register it is latched until is written
+            _latches[info.latch] = value;
+            return;
+        }
+        if (const auto latchedIndex = latchedBy[index]; latchedIndex >= 0)
+        {
+            _registers[latchedIndex] = _latches[Layout::registers[latchedIndex].latch];
+            _isChanged.set(latchedIndex);
+        }
+        if (info.keyBits != 0)
+        {
+            track_key_presses(index, value);
+        }
+        if (info.hasSideEffects)
+        {
+            remember_side_effect_write(index, value);
+            _registers[index] = value;
+            _writtenRegisters[index] = value;
+            _isKnown.set(index);
+            return;
+        }
+        _registers[index] = value;
+        _isChanged.set(index);
+    }
+
+    // Whether writing value to a register with side effects does nothing, because it's the same as the last write for
+    // its selection and writing it again doesn't restart anything, e.g. a key on for a channel which is already on
+    [[nodiscard]] bool is_repeat(const int index, const uint8_t value) const
+    {
+        if (Layout::registers[index].isRestartedByRewrite)
+        {
+            return false;
+        }
+        const auto it = find_side_effect_write(_sideEffectWrites, index, value);
+        return it != _sideEffectWrites.rend() && it->value == value;
+    }
+
+    // Calls visit(index, keys) for each register with keys pressed since the last call which the change in state since
+    // then doesn't show, i.e. pressed again after a release, or pressed and released again
+    template <typename Visit>
+    void take_hidden_key_presses(Visit&& visit)
+    {
+        if (_isAnyKeyPressed)
+        {
+            for (int index = 0; index < registerCount; ++index)
+            {
+                if (const auto hiddenKeys = static_cast<uint8_t>(
+                        _keysPressedSinceTaken[index] & (_keysBeforeTaken[index] | ~_registers[index]));
+                    _isKeyTouched[index] && hiddenKeys != 0)
+                {
+                    visit(index, hiddenKeys);
+                }
+            }
+        }
+        _isAnyKeyPressed = false;
+        _isKeyTouched.reset();
+    }
+
+    // Calls emit(index, value) for the writes needed to go from the last written state to the current one,
+    // and then treats the current state as written
+    template <typename Emit>
+    void write_changes(Emit&& emit)
+    {
+        if (_isChanged.none())
+        {
+            return;
+        }
+        std::bitset<registerCount> mustWrite;
+        for (const auto index : Layout::writeOrder)
+        {
+            const auto& info = Layout::registers[index];
+            if (info.latchedUntil >= 0 && is_needed(info.latchedUntil))
+            {
+                // The latch may be shared, and hold a value for another register, so we always write ours first
+                mustWrite.set(index);
+            }
+            if (!_isChanged[index] && !mustWrite[index])
+            {
+                continue;
+            }
+            const auto value = _registers[index];
+            // If a key was pressed again after a release, or pressed and released again, going straight to the new value
+            // won't show it. We need to write the release and the press or the key won't restart.
+            const auto written = _writtenRegisters[index];
+            if (const auto hiddenKeys = hidden_keys(index); hiddenKeys != 0)
+            {
+                if ((written & hiddenKeys) != 0)
+                {
+                    emit(index, static_cast<uint8_t>(value & ~hiddenKeys));
+                }
+                if ((value & hiddenKeys) != hiddenKeys)
+                {
+                    emit(index, static_cast<uint8_t>(value | hiddenKeys));
+                }
+            }
+            else if (!mustWrite[index] && !is_needed(index))
+            {
+                _isChanged.reset(index);
+                _keysPressed[index] = 0;
+                continue;
+            }
+            emit(index, value);
+            if (info.latchedUntil >= 0)
+            {
+                mustWrite.set(info.latchedUntil);
+            }
+            _writtenRegisters[index] = value;
+            _isKnown.set(index);
+            _isChanged.reset(index);
+            _keysPressed[index] = 0;
+        }
+    }
+
+    // Calls emit(index, value) for every register without side effects, in write order.
+    // If includeKeys is false, key bits are written as 0.
+    template <typename Emit>
+    void write_state(Emit&& emit, const bool includeKeys) const
+    {
+        for (const auto index : Layout::writeOrder)
+        {
+            if (const auto& info = Layout::registers[index];
+                info.validBits != 0 && !info.hasSideEffects)
+            {
+                emit(index, static_cast<uint8_t>(includeKeys ? _registers[index] : _registers[index] & ~info.keyBits));
+            }
+        }
+    }
+
+    // Calls emit(index, value) for the last value written to each register with side effects, for each selection, in
+    // the order they were written, so the state they set up can be restored. If isLoopPoint is set, registers which
+    // restart something when the same value is written again are left out, as they will usually have it already.
+    template <typename Emit>
+    void write_side_effect_state(Emit&& emit, const bool isLoopPoint) const
+    {
+        for (const auto& [index, value] : _sideEffectWrites)
+        {
+            if (!isLoopPoint || !Layout::registers[index].isRestartedByRewrite)
+            {
+                emit(index, value);
+            }
+        }
+    }
+
+    // Forgets the last written state, so the next write to each register is always kept.
+    // This is needed at the loop point, as we will arrive there from the end of the file too.
+    void forget_written_state()
+    {
+        _isKnown.reset();
+    }
+
+private:
+    // The register each one is latched by, or -1
+    static constexpr std::array<int, registerCount> latchedBy = []
+    {
+        std::array<int, registerCount> result{};
+        result.fill(-1);
+        for (auto i = 0; i < registerCount; ++i)
+        {
+            if (Layout::registers[i].latchedUntil >= 0)
+            {
+                result[Layout::registers[i].latchedUntil] = i;
+            }
+        }
+        return result;
+    }();
+
+    [[nodiscard]] uint8_t hidden_keys(const int index) const
+    {
+        return static_cast<uint8_t>(_keysPressed[index] & (_writtenRegisters[index] | ~_registers[index]));
+    }
+
+    // Whether a changed register has to be written by write_changes()
+    [[nodiscard]] bool is_needed(const int index) const
+    {
+        return _isChanged[index]
+            && (!_isKnown[index]
+                || ((_writtenRegisters[index] ^ _registers[index]) & Layout::registers[index].validBits) != 0
+                || hidden_keys(index) != 0);
+    }
+
+    // The last of writes to index with the same selection as value, or writes.rend()
+    template <typename Writes>
+    static auto find_side_effect_write(Writes& writes, const int index, const uint8_t value)
+    {
+        const auto selectBits = Layout::registers[index].selectBits;
+        // Usually it's the same as the last one, e.g. DAC data, so we search from the end
+        return std::find_if(writes.rbegin(), writes.rend(), [&](const SideEffectWrite& write)
+        {
+            return write.index == index && ((write.value ^ value) & selectBits) == 0;
+        });
+    }
+
+    void remember_side_effect_write(const int index, const uint8_t value)
+    {
+        const auto it = find_side_effect_write(_sideEffectWrites, index, value);
+        if (it != _sideEffectWrites.rend())
+        {
+            if (it == _sideEffectWrites.rbegin())
+            {
+                it->value = value;
+                return;
+            }
+            _sideEffectWrites.erase(std::next(it).base());
+        }
+        _sideEffectWrites.push_back({index, value});
+    }
+
+    void track_key_presses(const int index, const uint8_t value)
+    {
+        if (!_isKeyTouched[index])
+        {
+            _keysBeforeTaken[index] = _registers[index];
+            _keysPressedSinceTaken[index] = 0;
+            _isKeyTouched.set(index);
+        }
+        if (const auto pressedKeys = static_cast<uint8_t>(~_registers[index] & value & Layout::registers[index].keyBits);
+            pressedKeys != 0)
+        {
+            _keysPressed[index] |= pressedKeys;
+            _keysPressedSinceTaken[index] |= pressedKeys;
+            _isAnyKeyPressed = true;
+        }
+    }
+
+    std::array<uint8_t, registerCount> _registers{};
+    std::array<uint8_t, registerCount> _writtenRegisters{};
+    // Indexed by RegisterInfo::latch
+    std::array<uint8_t, registerCount> _latches{};
+    // Keys which went from off to on since the last write_changes()
+    std::array<uint8_t, registerCount> _keysPressed{};
+    std::bitset<registerCount> _isKnown;
+    std::bitset<registerCount> _isChanged;
+    struct SideEffectWrite
+    {
+        int index;
+        uint8_t value;
+    };
+
+    // The last value written to each register with side effects, for each selection, in the order they were written
+    std::vector<SideEffectWrite> _sideEffectWrites;
+    // For take_hidden_key_presses()
+    std::array<uint8_t, registerCount> _keysBeforeTaken{};
+    std::array<uint8_t, registerCount> _keysPressedSinceTaken{};
+    std::bitset<registerCount> _isKeyTouched;
+    bool _isAnyKeyPressed = false;
+};
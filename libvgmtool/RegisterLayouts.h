@@ -0,0 +1,337 @@
+#pragma once
+#include <array>
+#include <initializer_list>
+#include <utility>
+
+#include "RegisterFile.h"
+
+// Register layouts for use with RegisterFile.
+// Adding a chip means adding a layout here, and a RegisterModel for its commands in RegisterModel.cpp.
+namespace RegisterLayouts
+{
+    // Makes a write order that is ascending, except that latched registers come immediately before the register they
+    // are latched until, and writtenLast come at the end
+    template <size_t N>
+    constexpr std::array<int, N> make_write_order(
+        const std::array<RegisterInfo, N>& registers,
+        const std::initializer_list<int> writtenLast = {})
+    {
+        std::array<int, N> latchedBy{};
+        std::array<bool, N> isLast{};
+        for (auto& index : latchedBy)
+        {
+            index = -1;
+        }
+        for (auto i = 0; i < static_cast<int>(N); ++i)
+        {
+            if (registers[i].latchedUntil >= 0)
+            {
+                latchedBy[registers[i].latchedUntil] = i;
+            }
+        }
+        for (const auto index : writtenLast)
+        {
+            isLast[index] = true;
+        }
+        std::array<int, N> result{};
+        size_t count = 0;
+        for (auto i = 0; i < static_cast<int>(N); ++i)
+        {
+            if (registers[i].latchedUntil >= 0 || isLast[i])
+            {
+                continue;
+            }
+            if (latchedBy[i] >= 0)
+            {
+                result[count++] = latchedBy[i];
+            }
+            result[count++] = i;
+        }
+        for (const auto index : writtenLast)
+        {
+            result[count++] = index;
+        }
+        return result;
+    }
+
+    // The SSG part of the AY8910 and YM2203
+    constexpr void add_ssg_registers(RegisterInfo* registers)
+    {
+        constexpr std::array<uint8_t, 16> validBits
+        {
+            0xff, 0x0f, 0xff, 0x0f, 0xff, 0x0f, // Tone periods
+            0x1f, // Noise period
+            0xff, // Mixer, I/O direction
+            0x1f, 0x1f, 0x1f, // Levels
+            0xff, 0xff, // Envelope period
+            0x0f, // Envelope shape
+            0xff, 0xff // I/O ports
+        };
+        for (auto i = 0; i < 16; ++i)
+        {
+            registers[i].validBits = validBits[i];
+        }
+        // Writing the envelope shape restarts the envelope
+        registers[0x0d].hasSideEffects = true;
+        registers[0x0d].isRestartedByRewrite = true;
+    }
+
+    // The FM operator and channel registers shared by the OPN family (YM2203, YM2612), for one port
+    constexpr void add_opn_fm_registers(RegisterInfo* registers, const int channelCount)
+    {
+        // Detune/multiple, total level, rate scaling/attack rate, decay rate/AM, sustain rate,
+        // sustain level/release rate, SSG-EG
+        constexpr std::array<uint8_t, 7> operatorValidBits{0x7f, 0x7f, 0xdf, 0x9f, 0x1f, 0xff, 0x0f};
+        for (auto i = 0; i < 7; ++i)
+        {
+            for (auto channel = 0; channel < channelCount; ++channel)
+            {
+                for (auto slot = 0; slot < 4; ++slot)
+                {
+                    registers[0x30 + i * 0x10 + slot * 4 + channel].validBits = operatorValidBits[i];
+                }
+            }
+        }
+        for (auto channel = 0; channel < channelCount; ++channel)
+        {
+            // F-number LSB, then block/F-number MSB, which is latched until the LSB is written. There is only one latch,
+            // shared by all the channels (and both ports of the YM2612), so its index is absolute.
+            registers[0xa0 + channel].validBits = 0xff;
+            registers[0xa4 + channel] = {.validBits = 0x3f, .latchedUntil = 0xa0 + channel, .latch = 0xa4};
+            // Feedback/algorithm
+            registers[0xb0 + channel].validBits = 0x3f;
+        }
+    }
+
+    constexpr void add_opn_channel_3_registers(RegisterInfo* registers)
+    {
+        // Channel 3 special mode frequencies, latched in the same way, with a latch of their own
+        for (auto slot = 0; slot < 3; ++slot)
+        {
+            registers[0xa8 + slot].validBits = 0xff;
+            registers[0xac + slot] = {.validBits = 0x3f, .latchedUntil = 0xa8 + slot, .latch = 0xac};
+        }
+    }
+
+    constexpr std::array<RegisterInfo, 0x39> make_ym2413_registers()
+    {
+        std::array<RegisterInfo, 0x39> r{};
+        // Custom instrument
+        for (auto i = 0x00; i <= 0x07; ++i)
+        {
+            r[i].validBits = i == 0x03 ? 0xdf : 0xff;
+        }
+        // Rhythm control. The test register at 0x0f is left invalid.
+        r[0x0e] = {.validBits = 0x3f, .keyBits = 0x1f};
+        for (auto channel = 0; channel < 9; ++channel)
+        {
+            // F-number low bits
+            r[0x10 + channel].validBits = 0xff;
+            // F-number high bit, block, key, sustain
+            r[0x20 + channel] = {.validBits = 0x3f, .keyBits = 0x10};
+            // Instrument, volume
+            r[0x30 + channel].validBits = 0xff;
+        }
+        return r;
+    }
+
+    constexpr std::array<RegisterInfo, 0x200> make_ym2612_registers()
+    {
+        // Port 1 registers are at 0x100 and up
+        std::array<RegisterInfo, 0x200> r{};
+        r[0x21] = {.validBits = 0xff, .hasSideEffects = true}; // Test
+        r[0x22].validBits = 0x0f; // LFO
+        r[0x24].validBits = 0xff; // Timer A
+        r[0x25].validBits = 0x03;
+        r[0x26].validBits = 0xff; // Timer B
+        r[0x27] = {.validBits = 0xff, .hasSideEffects = true}; // Timer control, channel 3 mode
+        r[0x28] = {.validBits = 0xf7, .hasSideEffects = true, .selectBits = 0x07}; // Key on/off, by channel
+        r[0x2a] = {.validBits = 0xff, .hasSideEffects = true}; // DAC data
+        r[0x2b].validBits = 0x80; // DAC enable
+        r[0x2c] = {.validBits = 0xff, .hasSideEffects = true}; // Test
+        for (const auto port : {0x000, 0x100})
+        {
+            add_opn_fm_registers(r.data() + port, 3);
+            // Stereo, LFO sensitivity
+            for (auto channel = 0; channel < 3; ++channel)
+            {
+                r[port + 0xb4 + channel].validBits = 0xf7;
+            }
+        }
+        add_opn_channel_3_registers(r.data());
+        // Latch targets in port 1 need adjusting, but the latch is shared with port 0
+        for (auto i = 0x100; i < 0x200; ++i)
+        {
+            if (r[i].latchedUntil >= 0)
+            {
+                r[i].latchedUntil += 0x100;
+            }
+        }
+        return r;
+    }
+
+    constexpr std::array<RegisterInfo, 0x100> make_ym2151_registers()
+    {
+        std::array<RegisterInfo, 0x100> r{};
+        r[0x01] = {.validBits = 0xff, .hasSideEffects = true}; // Test, LFO reset
+        r[0x08] = {.validBits = 0x7f, .hasSideEffects = true, .selectBits = 0x07}; // Key on/off, by channel
+        r[0x0f].validBits = 0x9f; // Noise
+        r[0x10].validBits = 0xff; // Timer A
+        r[0x11].validBits = 0x03;
+        r[0x12].validBits = 0xff; // Timer B
+        r[0x14] = {.validBits = 0xbf, .hasSideEffects = true}; // Timer control, CSM
+        r[0x18].validBits = 0xff; // LFO frequency
+        r[0x19] = {.validBits = 0xff, .hasSideEffects = true, .selectBits = 0x80}; // AM and PM depth share this register
+        r[0x1b].validBits = 0xc3; // CT, LFO waveform
+        for (auto channel = 0; channel < 8; ++channel)
+        {
+            r[0x20 + channel].validBits = 0xff; // Stereo, feedback, algorithm
+            r[0x28 + channel].validBits = 0x7f; // Key code
+            r[0x30 + channel].validBits = 0xfc; // Key fraction
+            r[0x38 + channel].validBits = 0x73; // PM/AM sensitivity
+        }
+        // Detune/multiple, total level, key scale/attack rate, AM/decay rate, detune 2/sustain rate,
+        // sustain level/release rate
+        constexpr std::array<uint8_t, 6> operatorValidBits{0x7f, 0x7f, 0xdf, 0x9f, 0xdf, 0xff};
+        for (auto i = 0; i < 6; ++i)
+        {
+            for (auto slot = 0; slot < 0x20; ++slot)
+            {
+                r[0x40 + i * 0x20 + slot].validBits = operatorValidBits[i];
+            }
+        }
+        return r;
+    }
+
+    constexpr std::array<RegisterInfo, 0x10> make_ay8910_registers()
+    {
+        std::array<RegisterInfo, 0x10> r{};
+        add_ssg_registers(r.data());
+        return r;
+    }
+
+    constexpr std::array<RegisterInfo, 0x100> make_ym2203_registers()
+    {
+        std::array<RegisterInfo, 0x100> r{};
+        add_ssg_registers(r.data());
+        r[0x21] = {.validBits = 0xff, .hasSideEffects = true}; // Test
+        r[0x24].validBits = 0xff; // Timer A
+        r[0x25].validBits = 0x03;
+        r[0x26].validBits = 0xff; // Timer B
+        r[0x27] = {.validBits = 0xff, .hasSideEffects = true}; // Timer control, channel 3 mode
+        r[0x28] = {.validBits = 0xf3, .hasSideEffects = true, .selectBits = 0x03}; // Key on/off, by channel
+        for (auto i = 0x2d; i <= 0x2f; ++i)
+        {
+            r[i] = {.validBits = 0xff, .hasSideEffects = true}; // Prescaler
+        }
+        add_opn_fm_registers(r.data(), 3);
+        add_opn_channel_3_registers(r.data());
+        return r;
+    }
+
+    // Also used for the YM3526, which lacks the waveform select
+    constexpr std::array<RegisterInfo, 0x100> make_ym3812_registers()
+    {
+        std::array<RegisterInfo, 0x100> r{};
+        r[0x01].validBits = 0xff; // Test, waveform select enable
+        r[0x02].validBits = 0xff; // Timer 1
+        r[0x03].validBits = 0xff; // Timer 2
+        r[0x04] = {.validBits = 0xff, .hasSideEffects = true}; // Timer control, IRQ reset
+        r[0x08].validBits = 0xc0; // CSM, keyboard split
+        // AM/VIB/EG/KSR/multiple, key scale/total level, attack/decay, sustain/release, waveform
+        constexpr std::array<std::pair<int, uint8_t>, 5> operatorRegisters
+        {
+            {{0x20, 0xff}, {0x40, 0xff}, {0x60, 0xff}, {0x80, 0xff}, {0xe0, 0x03}}
+        };
+        for (const auto& [base, validBits] : operatorRegisters)
+        {
+            for (auto slot = 0; slot < 0x16; ++slot)
+            {
+                if ((slot & 7) < 6)
+                {
+                    r[base + slot].validBits = validBits;
+                }
+            }
+        }
+        for (auto channel = 0; channel < 9; ++channel)
+        {
+            r[0xa0 + channel].validBits = 0xff; // F-number low bits
+            r[0xb0 + channel] = {.validBits = 0x3f, .keyBits = 0x20}; // Key, block, F-number high bits
+            r[0xc0 + channel].validBits = 0x0f; // Feedback, connection
+        }
+        r[0xbd] = {.validBits = 0xff, .keyBits = 0x1f}; // AM/VIB depth, rhythm
+        return r;
+    }
+
+    constexpr std::array<RegisterInfo, 0x100> make_sega_pcm_registers()
+    {
+        // The chip's registers are just RAM, so everything is valid
+        std::array<RegisterInfo, 0x100> r{};
+        for (auto& info : r)
+        {
+            info.validBits = 0xff;
+        }
+        for (auto channel = 0; channel < 16; ++channel)
+        {
+            // The current address is updated by the chip as it plays, so writing it again restarts the sample.
+            // The flags include the key off bit.
+            for (auto i = 4; i <= 5; ++i)
+            {
+                r[0x80 + channel * 8 + i] = {.validBits = 0xff, .hasSideEffects = true, .isRestartedByRewrite = true};
+            }
+            r[0x80 + channel * 8 + 6].hasSideEffects = true;
+        }
+        return r;
+    }
+}
+
+struct YM2413Layout
+{
+    static constexpr int registerCount = 0x39;
+    static constexpr auto registers = RegisterLayouts::make_ym2413_registers();
+    // We write the rhythm register last, so the percussion channels are set up before any key on
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers, {0x0e});
+};
+
+struct YM2612Layout
+{
+    static constexpr int registerCount = 0x200;
+    static constexpr auto registers = RegisterLayouts::make_ym2612_registers();
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers);
+};
+
+struct YM2151Layout
+{
+    static constexpr int registerCount = 0x100;
+    static constexpr auto registers = RegisterLayouts::make_ym2151_registers();
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers);
+};
+
+struct AY8910Layout
+{
+    static constexpr int registerCount = 0x10;
+    static constexpr auto registers = RegisterLayouts::make_ay8910_registers();
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers);
+};
+
+struct YM2203Layout
+{
+    static constexpr int registerCount = 0x100;
+    static constexpr auto registers = RegisterLayouts::make_ym2203_registers();
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers);
+};
+
+struct YM3812Layout
+{
+    static constexpr int registerCount = 0x100;
+    static constexpr auto registers = RegisterLayouts::make_ym3812_registers();
+    // Rhythm keys go last, as for the YM2413
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers, {0xbd});
+};
+
+struct SegaPcmLayout
+{
+    static constexpr int registerCount = 0x100;
+    static constexpr auto registers = RegisterLayouts::make_sega_pcm_registers();
+    static constexpr auto writeOrder = RegisterLayouts::make_write_order(registers);
+};
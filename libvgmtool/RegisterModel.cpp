@@ -0,0 +1,192 @@
+#include "RegisterModel.h"
+
+#include "RegisterFile.h"
+#include "RegisterLayouts.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmHeader.h"
+
+namespace
+{
+    int index_of(const VgmCommands::RegisterDataCommand* pCommand)
+    {
+        return pCommand->registerIndex();
+    }
+
+    int index_of(const VgmCommands::AddressDataCommand* pCommand)
+    {
+        return pCommand->address();
+    }
+
+    void set_index(VgmCommands::RegisterDataCommand* pCommand, const int index)
+    {
+        pCommand->set_register(static_cast<uint8_t>(index));
+    }
+
+    void set_index(VgmCommands::AddressDataCommand* pCommand, const int index)
+    {
+        pCommand->set_address(static_cast<uint16_t>(index));
+    }
+
+    // A chip with the given register layout, driven by Port0 commands, and optionally Port1 commands for
+    // registers 0x100 and up
+    template <typename Layout, typename Port0, typename Port1 = Port0>
+    class RegisterModel final : public IRegisterModel
+    {
+    public:
+        AddResult add(const VgmCommands::ICommand* pCommand) override
+        {
+            int index;
+            uint8_t value;
+            if (const auto* p = dynamic_cast<const Port0*>(pCommand); p != nullptr)
+            {
+                index = index_of(p);
+                value = p->value();
+            }
+            else if (const auto* p1 = dynamic_cast<const Port1*>(pCommand); p1 != nullptr)
+            {
+                index = index_of(p1) + 0x100;
+                value = p1->value();
+            }
+            else
+            {
+                return AddResult::NotHandled;
+            }
+
+            if (index >= RegisterFile<Layout>::registerCount)
+            {
+                // e.g. the second chip bit for the AY8910
+                return AddResult::NotHandled;
+            }
+            if (RegisterFile<Layout>::is_valid(index) && RegisterFile<Layout>::has_side_effects(index))
+            {
+                if (!_registers.is_repeat(index, value))
+                {
+                    const int values[] = {index, value};
+                    _sideEffectWritesHash = Utils::hash(values, sizeof(values), _sideEffectWritesHash);
+                }
+                _registers.write(index, value);
+                return AddResult::KeepInPlace;
+            }
+            _registers.write(index, value);
+            return AddResult::Deferred;
+        }
+
+        void write_changes(std::vector<VgmCommands::ICommand*>& commands) override
+        {
+            _registers.write_changes([&](const int index, const uint8_t value)
+            {
+                if (index >= 0x100)
+                {
+                    add_write<Port1>(commands, index - 0x100, value);
+                }
+                else
+                {
+                    add_write<Port0>(commands, index, value);
+                }
+            });
+        }
+
+        void write_state(std::vector<VgmCommands::ICommand*>& commands, const bool isLoopPoint) const override
+        {
+            auto emit = [&](const int index, const uint8_t value)
+            {
+                if (index >= 0x100)
+                {
+                    add_write<Port1>(commands, index - 0x100, value);
+                }
+                else
+                {
+                    add_write<Port0>(commands, index, value);
+                }
+            };
+            _registers.write_state(emit, true);
+            // Keys go on after everything else is set up
+            _registers.write_side_effect_state(emit, isLoopPoint);
+        }
+
+        void forget_written_state() override
+        {
+            _registers.forget_written_state();
+        }
+
+        [[nodiscard]] uint64_t state_hash() const override
+        {
+            auto values = _registers.values();
+            for (int i = 0; i < RegisterFile<Layout>::registerCount; ++i)
+            {
+                values[i] &= RegisterFile<Layout>::valid_bits(i);
+            }
+            return Utils::hash(values.data(), values.size());
+        }
+
+        uint64_t take_key_presses_hash() override
+        {
+            auto hash = Utils::hash(nullptr, 0);
+            _registers.take_hidden_key_presses([&](const int index, const uint8_t keys)
+            {
+                const int values[] = {index, keys};
+                hash = Utils::hash(values, sizeof(values), hash);
+            });
+            return hash;
+        }
+
+        uint64_t take_side_effect_writes_hash() override
+        {
+            const auto hash = _sideEffectWritesHash;
+            _sideEffectWritesHash = Utils::hash(nullptr, 0);
+            return hash;
+        }
+
+    private:
+        template <typename T>
+        static void add_write(std::vector<VgmCommands::ICommand*>& commands, const int index, const uint8_t value)
+        {
+            auto* pCommand = new T();
+            set_index(pCommand, index);
+            pCommand->set_value(value);
+            commands.push_back(pCommand);
+        }
+
+        RegisterFile<Layout> _registers;
+        uint64_t _sideEffectWritesHash = Utils::hash(nullptr, 0);
+    };
+}
+
+std::vector<std::unique_ptr<IRegisterModel>> IRegisterModel::create_all(const VgmHeader& header)
+{
+    std::vector<std::unique_ptr<IRegisterModel>> result;
+    if (header.clock(VgmHeader::Chip::YM2413) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM2413Layout, VgmCommands::YM2413>>());
+    }
+    if (header.clock(VgmHeader::Chip::YM2612) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM2612Layout, VgmCommands::YM2612Port0, VgmCommands::YM2612Port1>>());
+    }
+    if (header.clock(VgmHeader::Chip::YM2151) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM2151Layout, VgmCommands::YM2151>>());
+    }
+    if (header.clock(VgmHeader::Chip::SegaPCM) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<SegaPcmLayout, VgmCommands::SegaPCM>>());
+    }
+    if (header.clock(VgmHeader::Chip::YM2203) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM2203Layout, VgmCommands::YM2203>>());
+    }
+    if (header.clock(VgmHeader::Chip::YM3812) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM3812Layout, VgmCommands::YM3812>>());
+    }
+    if (header.clock(VgmHeader::Chip::YM3526) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<YM3812Layout, VgmCommands::YM3526>>());
+    }
+    if (header.clock(VgmHeader::Chip::AY8910) != 0)
+    {
+        result.push_back(std::make_unique<RegisterModel<AY8910Layout, VgmCommands::AY8910>>());
+    }
+    return result;
+}
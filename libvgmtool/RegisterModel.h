@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace VgmCommands
+{
+    class ICommand;
+}
+
+class VgmHeader;
+
+// Tracks the registers of a register-based chip from its commands, so only the changes need to be written out
+class IRegisterModel
+{
+public:
+    enum class AddResult
+    {
+        // The command is not for this chip
+        NotHandled,
+        // The write has been applied, and write_changes() will emit it if it is needed
+        Deferred,
+        // The write has side effects, so the command has to be kept where it is
+        KeepInPlace
+    };
+
+    virtual ~IRegisterModel() = default;
+
+    virtual AddResult add(const VgmCommands::ICommand* pCommand) = 0;
+    // Appends the commands needed to go from the last written state to the current one,
+    // and then treats the current state as written
+    virtual void write_changes(std::vector<VgmCommands::ICommand*>& commands) = 0;
+    // Appends the commands to set every register to its current value, whether or not it has changed. Registers with
+    // side effects get the last values written to them, such as which keys are held, except for those where that
+    // restarts something if isLoopPoint is set. The last written state is not updated.
+    virtual void write_state(std::vector<VgmCommands::ICommand*>& commands, bool isLoopPoint) const = 0;
+    // Forgets the last written state, so the next write to each register is always kept
+    virtual void forget_written_state() = 0;
+    // Hash of the current register state, for comparing states. Bits which do nothing are ignored.
+    [[nodiscard]] virtual uint64_t state_hash() const = 0;
+    // Hash of the key presses since the last call which the state doesn't show, e.g. a key released and pressed again
+    // between two points in time
+    virtual uint64_t take_key_presses_hash() = 0;
+    // Hash of the writes to registers with side effects since the last call, in order. Writes which do nothing, such as
+    // a key on for a channel which is already on, are left out.
+    virtual uint64_t take_side_effect_writes_hash() = 0;
+
+    // Makes models for all the chips in the header that we have register layouts for
+    static std::vector<std::unique_ptr<IRegisterModel>> create_all(const VgmHeader& header);
+};
@@ -0,0 +1,204 @@
+#include "SN76489Renderer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "VgmCommands.h"
+#include "VgmHeader.h"
+
+namespace
+{
+    // Maximum amplitude of one channel, so four channels can't clip
+    constexpr auto CHANNEL_AMPLITUDE = 8191;
+    // Fixed point fraction bits for timing
+    constexpr auto TIME_SHIFT = 16;
+    // Noise register bit 2 selects white noise
+    constexpr auto WHITE_NOISE_BIT = 0b100;
+
+    // Some v1.10+ files leave these as 0, which the chip can't be; we use the defaults for older files instead
+    uint16_t feedback_or_default(const VgmHeader& header)
+    {
+        const auto feedback = header.sn76489_feedback();
+        return feedback == 0 ? 0x0009 : feedback;
+    }
+
+    uint8_t shift_register_width_or_default(const VgmHeader& header)
+    {
+        const auto width = header.sn76489_shift_register_width();
+        return width == 0 || width > 32 ? 16 : width;
+    }
+}
+
+SN76489Renderer::SN76489Renderer(const VgmHeader& header)
+    : _state(header),
+      _feedback(feedback_or_default(header)),
+      _shiftRegisterWidth(shift_register_width_or_default(header)),
+      _isZeroPeriodMaximum((header.sn76489_flags() & 0b0001) != 0),
+      _isOutputNegated((header.sn76489_flags() & 0b0010) != 0),
+      _isStereoEnabled((header.sn76489_flags() & 0b0100) == 0)
+{
+    _lfsr = 1u << (_shiftRegisterWidth - 1);
+    // The chip counts down at clock/16, unless the /8 divider is turned off
+    const auto clockDivider = (header.sn76489_flags() & 0b1000) == 0 ? 16 : 2;
+    // Bit 31 is the T6W28 flag, bit 30 is dual chips
+    const auto clock = header.clock(VgmHeader::Chip::SN76489) & 0x3fffffff;
+    _ticksPerSample = (static_cast<int64_t>(clock) << TIME_SHIFT) / clockDivider / sampleRate;
+    // 2dB per step, and 15 is silent
+    for (auto i = 0; i < 15; ++i)
+    {
+        _amplitudes[i] = static_cast<int32_t>(CHANNEL_AMPLITUDE * std::pow(10.0, -2.0 * i / 20));
+    }
+    for (auto& channel : _channels)
+    {
+        channel.counter = 1ll << TIME_SHIFT;
+    }
+}
+
+void SN76489Renderer::add(const VgmCommands::SN76489* pCommand)
+{
+    _state.add(pCommand);
+    if (_state.latched_register_index() == 6)
+    {
+        // Any write to the noise register resets the shift register
+        _lfsr = 1u << (_shiftRegisterWidth - 1);
+    }
+}
+
+void SN76489Renderer::add(const VgmCommands::GGStereo* pStereo)
+{
+    _state.add(pStereo);
+}
+
+int SN76489Renderer::tone_period(const int channel) const
+{
+    const auto period = _state.register_value(channel * 2);
+    if (period == 0 && _isZeroPeriodMaximum)
+    {
+        return 0x400;
+    }
+    return period;
+}
+
+int SN76489Renderer::noise_period() const
+{
+    const auto shift = _state.register_value(6) & 0b11;
+    if (shift == 3)
+    {
+        // Use channel 2's rate
+        return std::max(tone_period(2), 1);
+    }
+    return 0x10 << shift;
+}
+
+void SN76489Renderer::render_tone(Channel& channel, const int period, const uint32_t sampleCount)
+{
+    const auto reload = static_cast<int64_t>(period) << TIME_SHIFT;
+    for (auto i = 0u; i < sampleCount; ++i)
+    {
+        auto remaining = _ticksPerSample;
+        int64_t sum = 0;
+        while (channel.counter <= remaining)
+        {
+            sum += channel.output * channel.counter;
+            remaining -= channel.counter;
+            channel.output = -channel.output;
+            channel.counter = reload;
+        }
+        channel.counter -= remaining;
+        _channelBuffer[i] = sum + channel.output * remaining;
+    }
+}
+
+void SN76489Renderer::render_noise(const uint32_t sampleCount)
+{
+    // The noise output is the low bit of the shift register, which is shifted each time the noise counter flips to +1.
+    auto& noise = _channels[3];
+    const auto period = static_cast<int64_t>(noise_period()) << TIME_SHIFT;
+    const auto isWhiteNoise = (_state.register_value(6) & WHITE_NOISE_BIT) != 0;
+    for (auto i = 0u; i < sampleCount; ++i)
+    {
+        auto remaining = _ticksPerSample;
+        int64_t sum = 0;
+        auto level = (_lfsr & 1) != 0 ? 1 : -1;
+        while (noise.counter <= remaining)
+        {
+            sum += level * noise.counter;
+            remaining -= noise.counter;
+            noise.output = -noise.output;
+            if (noise.output > 0)
+            {
+                const auto bit = isWhiteNoise
+                    ? static_cast<uint32_t>(std::popcount(_lfsr & _feedback) & 1)
+                    : _lfsr & 1;
+                _lfsr = (_lfsr >> 1) | (bit << (_shiftRegisterWidth - 1));
+                level = (_lfsr & 1) != 0 ? 1 : -1;
+            }
+            noise.counter = period;
+        }
+        noise.counter -= remaining;
+        _channelBuffer[i] = sum + level * remaining;
+    }
+}
+
+void SN76489Renderer::mix(const int channel, const uint32_t sampleCount)
+{
+    const auto volume = _state.register_value(channel * 2 + 1);
+    auto amplitude = static_cast<int64_t>(_amplitudes[volume]);
+    if (amplitude == 0)
+    {
+        return;
+    }
+    if (_isOutputNegated)
+    {
+        amplitude = -amplitude;
+    }
+    const auto stereoMask = _isStereoEnabled ? _state.stereo_mask() : 0xff;
+    const auto isLeft = (stereoMask & (0x10 << channel)) != 0;
+    const auto isRight = (stereoMask & (0x01 << channel)) != 0;
+    for (auto i = 0u; i < sampleCount; ++i)
+    {
+        const auto value = static_cast<int32_t>(_channelBuffer[i] * amplitude / _ticksPerSample);
+        _left[i] += isLeft ? value : 0;
+        _right[i] += isRight ? value : 0;
+    }
+}
+
+void SN76489Renderer::render(const uint32_t sampleCount, std::vector<int16_t>& output)
+{
+    if (_ticksPerSample == 0)
+    {
+        // No PSG
+        output.resize(output.size() + sampleCount * 2);
+        return;
+    }
+    _channelBuffer.resize(sampleCount);
+    _left.assign(sampleCount, 0);
+    _right.assign(sampleCount, 0);
+
+    // The registers can't change during a render, so we do each channel in turn
+    for (auto channel = 0; channel < 3; ++channel)
+    {
+        if (const auto period = tone_period(channel); period <= 1)
+        {
+            // Periods 0 and 1 give a constant output, which is used for sample playback
+            _channels[channel].output = 1;
+            std::fill_n(_channelBuffer.begin(), sampleCount, _ticksPerSample);
+        }
+        else
+        {
+            render_tone(_channels[channel], period, sampleCount);
+        }
+        mix(channel, sampleCount);
+    }
+
+    render_noise(sampleCount);
+    mix(3, sampleCount);
+
+    output.reserve(output.size() + sampleCount * 2);
+    for (auto i = 0u; i < sampleCount; ++i)
+    {
+        output.push_back(static_cast<int16_t>(std::clamp(_left[i], -32768, 32767)));
+        output.push_back(static_cast<int16_t>(std::clamp(_right[i], -32768, 32767)));
+    }
+}
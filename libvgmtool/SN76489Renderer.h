@@ -0,0 +1,62 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "SN76489State.h"
+
+namespace VgmCommands
+{
+    class SN76489;
+    class GGStereo;
+}
+
+class VgmHeader;
+
+// Renders SN76489 (and Game Gear stereo) output to 44.1kHz 16-bit stereo PCM
+class SN76489Renderer
+{
+public:
+    static constexpr uint32_t sampleRate = 44100;
+
+    explicit SN76489Renderer(const VgmHeader& header);
+
+    void add(const VgmCommands::SN76489* pCommand);
+    void add(const VgmCommands::GGStereo* pStereo);
+
+    // Appends sampleCount samples to output, as interleaved left, right pairs
+    void render(uint32_t sampleCount, std::vector<int16_t>& output);
+
+private:
+    struct Channel
+    {
+        // Time until the next output flip, in 1/65536ths of a chip tick
+        int64_t counter = 0;
+        int output = 1;
+    };
+
+    // Renders a tone channel into _channelBuffer, as the sum of its +/-1 output over each sample in the same units
+    // as the counter
+    void render_tone(Channel& channel, int period, uint32_t sampleCount);
+    void render_noise(uint32_t sampleCount);
+
+    [[nodiscard]] int tone_period(int channel) const;
+    [[nodiscard]] int noise_period() const;
+    void mix(int channel, uint32_t sampleCount);
+
+    SN76489State _state;
+    std::array<Channel, 4> _channels{};
+    uint32_t _lfsr;
+    uint16_t _feedback;
+    uint8_t _shiftRegisterWidth;
+    bool _isZeroPeriodMaximum;
+    bool _isOutputNegated;
+    bool _isStereoEnabled;
+    // Chip ticks per output sample, in 1/65536ths
+    int64_t _ticksPerSample;
+    std::array<int32_t, 16> _amplitudes{};
+
+    std::vector<int64_t> _channelBuffer;
+    std::vector<int32_t> _left;
+    std::vector<int32_t> _right;
+};
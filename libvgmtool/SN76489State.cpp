@@ -81,6 +81,8 @@ void SN76489State::add_with_text(const VgmCommands::ICommand* pCommand, std::ost
 void SN76489State::add(const VgmCommands::GGStereo* pStereo)
 {
     _stereoMask = pStereo->value();
+    _isStereoUsed = true;
+    _changedMask |= 1 << 8;
 }
 
 void SN76489State::add(const VgmCommands::SN76489* pCommand)
@@ -113,8 +115,154 @@ void SN76489State::add(const VgmCommands::SN76489* pCommand)
             _registers[_latchedRegisterIndex] = value & 0b1111;
         }
     }
+    _changedMask |= 1 << _latchedRegisterIndex;
 }
 
+void SN76489State::write_changes(std::vector<VgmCommands::ICommand*>& commands)
+{
+    // Tones first, then noise, then volumes
+    for (const auto registerIndex : {0, 2, 4, 6, 1, 3, 5, 7})
+    {
+        const auto bit = 1 << registerIndex;
+        if ((_changedMask & bit) == 0)
+        {
+            continue;
+        }
+        const auto value = _registers[registerIndex];
+        const auto isKnown = (_knownMask & bit) != 0;
+        if (registerIndex == 6)
+        {
+            // Writing to the noise register resets the LFSR, so we always keep it even if the value is unchanged
+            add_write(commands, static_cast<uint8_t>(0b11100000 | (value & 0b111)));
+        }
+        else if (isKnown && _writtenRegisters[registerIndex] == value)
+        {
+            continue;
+        }
+        else if (registerIndex % 2 == 0)
+        {
+            // Tone: we can skip either byte if its bits are unchanged,
+            // but the data byte goes to whatever was last latched.
+            const auto changedBits = isKnown ? value ^ _writtenRegisters[registerIndex] : 0b1111111111;
+            if ((changedBits & 0b0000001111) != 0 || _writtenLatchedRegisterIndex != registerIndex)
+            {
+                add_write(commands, static_cast<uint8_t>(0b10000000 | (registerIndex << 4) | (value & 0b1111)));
+            }
+            if ((changedBits & 0b1111110000) != 0)
+            {
+                add_write(commands, static_cast<uint8_t>((value >> 4) & 0b111111));
+            }
+        }
+        else
+        {
+            // Volume
+            add_write(commands, static_cast<uint8_t>(0b10000000 | (registerIndex << 4) | (value & 0b1111)));
+        }
+        _writtenRegisters[registerIndex] = value;
+        _knownMask |= bit;
+    }
+
+    if ((_changedMask & (1 << 8)) != 0 && ((_knownMask & (1 << 8)) == 0 || _writtenStereoMask != _stereoMask))
+    {
+        auto* pStereo = new VgmCommands::GGStereo();
+        pStereo->set_value(_stereoMask);
+        commands.push_back(pStereo);
+        _writtenStereoMask = _stereoMask;
+        _knownMask |= 1 << 8;
+    }
+
+    _changedMask = 0;
+}
+
+void SN76489State::write_state(std::vector<VgmCommands::ICommand*>& commands) const
+{
+    // In the same order as write_changes()
+    for (const auto registerIndex : {0, 2, 4, 6, 1, 3, 5, 7})
+    {
+        const auto value = _registers[registerIndex];
+        if (registerIndex == 6)
+        {
+            append_write(commands, static_cast<uint8_t>(0b11100000 | (value & 0b111)));
+        }
+        else if (registerIndex % 2 == 0)
+        {
+            append_write(commands, static_cast<uint8_t>(0b10000000 | (registerIndex << 4) | (value & 0b1111)));
+            append_write(commands, static_cast<uint8_t>((value >> 4) & 0b111111));
+        }
+        else
+        {
+            append_write(commands, static_cast<uint8_t>(0b10000000 | (registerIndex << 4) | (value & 0b1111)));
+        }
+    }
+
+    if (_isStereoUsed)
+    {
+        auto* pStereo = new VgmCommands::GGStereo();
+        pStereo->set_value(_stereoMask);
+        commands.push_back(pStereo);
+    }
+}
+
+void SN76489State::forget_written_state()
+{
+    _knownMask = 0;
+    _writtenLatchedRegisterIndex = -1;
+}
+
+uint64_t SN76489State::state_hash() const
+{
+    const auto hash = Utils::hash(_registers.data(), _registers.size() * sizeof(int));
+    return Utils::hash(&_stereoMask, sizeof(_stereoMask), hash);
+}
+
+uint64_t SN76489State::audible_state_hash() const
+{
+    auto registers = _registers;
+    const auto isNoiseAudible = registers[7] != 0xf;
+    // Noise can be clocked by channel 2, in which case its tone matters even if it is silent
+    const auto isNoiseUsingChannel2 = isNoiseAudible && (registers[6] & 0b11) == 0b11;
+    if (!isNoiseAudible)
+    {
+        registers[6] = 0;
+    }
+    for (auto channel = 0; channel < 3; ++channel)
+    {
+        if (registers[channel * 2 + 1] == 0xf && !(channel == 2 && isNoiseUsingChannel2))
+        {
+            registers[channel * 2] = 0;
+        }
+    }
+    const auto hash = Utils::hash(registers.data(), registers.size() * sizeof(int));
+    return Utils::hash(&_stereoMask, sizeof(_stereoMask), hash);
+}
+
+bool SN76489State::is_audible() const
+{
+    for (auto i = 1; i < 8; i += 2)
+    {
+        if (_registers[i] != 0xf)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SN76489State::add_write(std::vector<VgmCommands::ICommand*>& commands, const uint8_t value)
+{
+    append_write(commands, value);
+    if ((value & 0b10000000) != 0)
+    {
+        _writtenLatchedRegisterIndex = (value & 0b01110000) >> 4;
+    }
+}
+
+void SN76489State::append_write(std::vector<VgmCommands::ICommand*>& commands, const uint8_t value)
+{
+    auto* pCommand = new VgmCommands::SN76489();
+    pCommand->set_value(value);
+    commands.push_back(pCommand);
+}
 
 std::string SN76489State::print_stereo_mask(const uint8_t mask)
 {
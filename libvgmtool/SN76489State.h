@@ -21,7 +21,43 @@ public:
     void add(const VgmCommands::SN76489* pCommand);
     void add_with_text(const VgmCommands::ICommand* pCommand, std::ostream& s);
 
+    // Appends the commands needed to go from the last written state to the current one,
+    // and then treats the current state as written
+    void write_changes(std::vector<VgmCommands::ICommand*>& commands);
+    // Appends the commands to set every register to its current value, whether or not it has changed. The stereo
+    // mask is only included if the file uses it. The last written state is not updated.
+    void write_state(std::vector<VgmCommands::ICommand*>& commands) const;
+    // Forgets the last written state, so the next write to each register is always kept.
+    // This is needed at the loop point, as we will arrive there from the end of the file too.
+    void forget_written_state();
+
+    // Hash of the current register state, for comparing states
+    [[nodiscard]] uint64_t state_hash() const;
+    // Hash of the state that affects the output: tone and noise settings are ignored for silent channels
+    [[nodiscard]] uint64_t audible_state_hash() const;
+    // True if any channel's attenuation is below the maximum
+    [[nodiscard]] bool is_audible() const;
+
+    // Registers are four tone, volume pairs; the noise control is in the tone slot for channel 3
+    [[nodiscard]] int register_value(const int index) const
+    {
+        return _registers[index];
+    }
+
+    [[nodiscard]] int latched_register_index() const
+    {
+        return _latchedRegisterIndex;
+    }
+
+    [[nodiscard]] uint8_t stereo_mask() const
+    {
+        return _stereoMask;
+    }
+
 private:
+    void add_write(std::vector<VgmCommands::ICommand*>& commands, uint8_t value);
+    static void append_write(std::vector<VgmCommands::ICommand*>& commands, uint8_t value);
+
     static std::string print_stereo_mask(uint8_t mask);
     [[nodiscard]] double tone_length_to_hz(int length) const;
     std::string make_noise_description(const char* prefix, int shift) const;
@@ -29,8 +65,16 @@ private:
     // Registers are four tone, volume pairs
     std::vector<int> _registers{0, 0xf, 0, 0xf, 0, 0xf, 0, 0xf};
     uint8_t _stereoMask = 0xff;
+    bool _isStereoUsed = false;
     int _latchedRegisterIndex = 0;
 
+    // Last written state, for write_changes(). Bit n of the masks is register n, bit 8 is the stereo mask.
+    std::vector<int> _writtenRegisters{0, 0xf, 0, 0xf, 0, 0xf, 0, 0xf};
+    uint8_t _writtenStereoMask = 0xff;
+    int _writtenLatchedRegisterIndex = -1;
+    uint16_t _knownMask = 0;
+    uint16_t _changedMask = 0;
+
     uint32_t _clockRate;
     std::vector<std::string> _noiseSpeedDescriptions;
     std::vector<std::string> _volumeDescriptions;
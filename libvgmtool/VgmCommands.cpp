@@ -186,7 +186,7 @@ VgmCommands::Wait50th::Wait50th(): NoDataCommand(0x63, VgmHeader::Chip::Nothing)
 
 void VgmCommands::Wait4bit::set_duration(const int sampleCount)
 {
-    if (sampleCount <= 0 || sampleCount >= 16)
+    if (sampleCount <= 0 || sampleCount > 16)
     {
         throw std::runtime_error(std::format("Length out of range 1..16: {}", sampleCount));
     }
@@ -227,7 +227,7 @@ void VgmCommands::DataBlock::from_data(BinaryData& data)
     }
     _type = data.read_uint8();
     const auto size = data.read_uint32();
-    _data.write_range(data.read_range(size));
+    _data = data.read_shared_range(size);
 }
 
 void VgmCommands::DataBlock::to_data(BinaryData& data) const
@@ -235,8 +235,8 @@ void VgmCommands::DataBlock::to_data(BinaryData& data) const
     data.write_uint8(get_marker());
     data.write_uint8(0x66);
     data.write_uint8(_type);
-    data.write_uint32(_data.size());
-    data.write_range(_data.buffer());
+    data.write_uint32(static_cast<uint32_t>(_data.size()));
+    data.write_range(_data.span());
 }
 
 void VgmCommands::PcmRamWrite::from_data(BinaryData& data)
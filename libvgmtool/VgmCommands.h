@@ -287,9 +287,15 @@ namespace VgmCommands
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
 
+        // Types 0x40-0x7e are compressed versions of types 0x00-0x3e
+        static constexpr uint8_t COMPRESSED_TYPE_OFFSET = 0x40;
+        // Type 0x7f holds a decompression table
+        static constexpr uint8_t DECOMPRESSION_TABLE_TYPE = 0x7f;
+
+        // The length of the payload as stored
         [[nodiscard]] unsigned int length() const
         {
-            return _data.size();
+            return static_cast<unsigned int>(_data.size());
         }
 
         [[nodiscard]] uint8_t type() const
@@ -297,9 +303,27 @@ namespace VgmCommands
             return _type;
         }
 
+        [[nodiscard]] bool is_compressed() const
+        {
+            return _type >= COMPRESSED_TYPE_OFFSET && _type < DECOMPRESSION_TABLE_TYPE;
+        }
+
+        // The payload as stored, i.e. compressed if is_compressed()
+        [[nodiscard]] std::span<const uint8_t> data() const
+        {
+            return _data.span();
+        }
+
+        void set_data(const uint8_t type, std::vector<uint8_t>&& data)
+        {
+            _type = type;
+            _data = SharedBytes(std::move(data));
+        }
+
     private:
         uint8_t _type{};
-        BinaryData _data;
+        // Refers to the loaded file until it is changed
+        SharedBytes _data;
     };
 
     class PcmRamWrite : public MarkedCommand
@@ -319,6 +343,11 @@ namespace VgmCommands
     class YM2612Sample : public Wait, public ICommand
     {
     public:
+        void set_duration(const uint8_t duration)
+        {
+            _duration = duration;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
 
@@ -338,6 +367,14 @@ namespace VgmCommands
     public:
         DacStreamControlSetup(): MarkedCommand(0x90, VgmHeader::Chip::GenericDAC) {}
 
+        void set(const uint8_t streamId, const uint8_t chipType, const uint8_t port, const uint8_t command)
+        {
+            _streamId = streamId;
+            _chipType = chipType;
+            _port = port;
+            _command = command;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
     };
@@ -351,6 +388,14 @@ namespace VgmCommands
     public:
         DacStreamSetData(): MarkedCommand(0x91, VgmHeader::Chip::GenericDAC) {}
 
+        void set(const uint8_t streamId, const uint8_t dataBankId, const uint8_t stepSize, const uint8_t stepBase)
+        {
+            _streamId = streamId;
+            _dataBankId = dataBankId;
+            _stepSize = stepSize;
+            _stepBase = stepBase;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
     };
@@ -362,6 +407,12 @@ namespace VgmCommands
     public:
         DacStreamSetFrequency(): MarkedCommand(0x92, VgmHeader::Chip::GenericDAC) {}
 
+        void set(const uint8_t streamId, const uint32_t frequency)
+        {
+            _streamId = streamId;
+            _frequency = frequency;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
     };
@@ -375,6 +426,20 @@ namespace VgmCommands
     public:
         DacStreamStart(): MarkedCommand(0x93, VgmHeader::Chip::GenericDAC) {}
 
+        // Length modes
+        static constexpr uint8_t LENGTH_IGNORE = 0;
+        static constexpr uint8_t LENGTH_COMMANDS = 1;
+        static constexpr uint8_t LENGTH_MILLISECONDS = 2;
+        static constexpr uint8_t LENGTH_TO_END = 3;
+
+        void set(const uint8_t streamId, const uint32_t dataStartOffset, const uint8_t lengthMode, const uint32_t dataLength)
+        {
+            _streamId = streamId;
+            _dataStartOffset = dataStartOffset;
+            _lengthMode = lengthMode;
+            _dataLength = dataLength;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
     };
@@ -459,11 +524,23 @@ namespace VgmCommands
         YMF271(): PortRegisterDataCommand(0xd1, VgmHeader::Chip::YMF271) {}
     };
 
+    // Seeks in the YM2612 PCM data bank, for YM2612Sample
     class PCMSeek : public MarkedCommand
     {
         uint32_t _address;
     public:
-        PCMSeek(): MarkedCommand(0xe0, VgmHeader::Chip::SegaPCM), _address(0) {}
+        PCMSeek(): MarkedCommand(0xe0, VgmHeader::Chip::YM2612), _address(0) {}
+
+        [[nodiscard]] uint32_t address() const
+        {
+            return _address;
+        }
+
+        void set_address(const uint32_t address)
+        {
+            _address = address;
+        }
+
         void from_data(BinaryData& data) override;
         void to_data(BinaryData& data) const override;
     };
@@ -527,7 +604,7 @@ namespace VgmCommands
     class YM2610Port0_Second : public RegisterDataCommand
     {
     public:
-        YM2610Port0_Second(): RegisterDataCommand(0xa8, VgmHeader::Chip::YM2608) {}
+        YM2610Port0_Second(): RegisterDataCommand(0xa8, VgmHeader::Chip::YM2610) {}
     };
 
     class YM2610Port1_Second : public RegisterDataCommand
@@ -539,7 +616,7 @@ namespace VgmCommands
     class YM3812_Second : public RegisterDataCommand
     {
     public:
-        YM3812_Second(): RegisterDataCommand(0xaa, VgmHeader::Chip::YM2610) {}
+        YM3812_Second(): RegisterDataCommand(0xaa, VgmHeader::Chip::YM3812) {}
     };
 
     class YM3526_Second : public RegisterDataCommand
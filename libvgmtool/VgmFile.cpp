@@ -1,41 +1,174 @@
 #include "VgmFile.h"
 
+#include <filesystem>
 #include <format>
+#include <limits>
 #include <stdexcept>
+#include <utility>
 
 #include "BinaryData.h"
+#include "GzipIndex.h"
 #include "IVGMToolCallback.h"
 #include "libpu8.h"
+#include "Profile.h"
 #include "SN76489State.h"
 #include "utils.h"
 #include "YM2413State.h"
 
+namespace
+{
+    template <typename Commands>
+    void write(BinaryData& data, VgmHeader& header, const Commands& commands, const Gd3Tag& gd3Tag)
+    {
+        // First the header. We write it again at the end once we know the offsets,
+        // but we need to know its size.
+        header.to_binary(data);
+        header.set_data_offset(data.offset());
+
+        // Then the data. The loop point is a virtual command, so we note its offset as we go.
+        header.set_loop_offset(0);
+        for (const auto* pCommand : commands)
+        {
+            if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                header.set_loop_offset(data.offset());
+            }
+            pCommand->to_data(data);
+        }
+
+        // Then the GD3 tag
+        if (!gd3Tag.empty())
+        {
+            header.set_gd3_offset(data.offset());
+            gd3Tag.to_binary(data);
+        }
+        else
+        {
+            header.set_gd3_offset(0);
+        }
+
+        header.set_eof_offset(data.size());
+
+        // Write the header again
+        header.to_binary(data);
+    }
+}
+
+VgmFile::VgmFile()
+    : _header(std::make_shared<VgmHeader>()),
+      _commands(std::make_shared<Commands>()),
+      _gd3Tag(std::make_shared<Gd3Tag>())
+{
+}
+
 VgmFile::VgmFile(const std::string& filename)
+    : VgmFile()
 {
     load_file(filename);
 }
 
+VgmFile::VgmFile(
+    std::shared_ptr<VgmHeader> header,
+    std::shared_ptr<Commands> commands,
+    std::shared_ptr<Gd3Tag> gd3Tag)
+    : _header(std::move(header)),
+      _commands(std::move(commands)),
+      _gd3Tag(std::move(gd3Tag))
+{
+}
+
+VgmFile VgmFile::snapshot() const
+{
+    return {_header, _commands, _gd3Tag};
+}
+
+void VgmFile::unshare_commands()
+{
+    auto commands = std::make_shared<Commands>();
+    std::lock_guard lock(_commands->parseMutex);
+    if (_commands->parsed)
+    {
+        commands->stream.copy_from(_commands->stream);
+    }
+    else
+    {
+        // There's nothing parsed to copy, so we take our own reference to the data (or filename) instead
+        commands->unparsedData = _commands->unparsedData;
+        commands->unparsedDataOffset = _commands->unparsedDataOffset;
+        commands->unparsedLoopOffset = _commands->unparsedLoopOffset;
+        commands->unparsedEndOffset = _commands->unparsedEndOffset;
+        commands->unparsedFilename = _commands->unparsedFilename;
+        commands->parsed = false;
+    }
+    _commands = std::move(commands);
+}
+
 void VgmFile::load_file(const std::string& filename)
 {
-    // Read file
-    BinaryData data(filename);
+    load_data(BinaryData(filename));
+}
+
+void VgmFile::load_data(std::vector<uint8_t>&& data)
+{
+    load_data(BinaryData(std::move(data)));
+}
 
-    // Parse header
-    _header.from_binary(data);
+void VgmFile::load_data(BinaryData&& data)
+{
+    // We replace everything, so any snapshots keep what they had
+    auto header = std::make_shared<VgmHeader>();
+    header->from_binary(data);
 
-    const auto gd3Offset = _header.gd3_offset();
-    if (gd3Offset > 0)
+    auto gd3Tag = std::make_shared<Gd3Tag>();
+    if (const auto gd3Offset = header->gd3_offset(); gd3Offset > 0)
     {
         data.seek(gd3Offset);
-        _gd3Tag.from_binary(data);
+        gd3Tag->from_binary(data);
+    }
+
+    // We keep the data to parse later, as many uses only need the header and GD3 tag
+    auto commands = std::make_shared<Commands>();
+    commands->set_unparsed_data(std::move(data), *header);
+    commands->parsed = false;
+
+    _header = std::move(header);
+    _commands = std::move(commands);
+    _gd3Tag = std::move(gd3Tag);
+}
+
+void VgmFile::load_header_and_gd3(const std::string& filename)
+{
+    // Big enough for any header we can parse
+    constexpr uint32_t maxHeaderSize = 0x1000;
+    BinaryData headerData(read_file_range(filename, 0, maxHeaderSize));
+    auto header = std::make_shared<VgmHeader>();
+    header->from_binary(headerData);
+
+    auto gd3Tag = std::make_shared<Gd3Tag>();
+    if (const auto gd3Offset = header->gd3_offset(); gd3Offset > 0)
+    {
+        // The tag runs to the end of the file
+        BinaryData gd3Data(read_file_range(filename, gd3Offset, std::numeric_limits<uint32_t>::max()));
+        gd3Tag->from_binary(gd3Data);
     }
 
-    // We copy the data as a blob, we don't parse it (yet)
-    const auto dataOffset = _header.data_offset();
-    data.seek(dataOffset);
+    // The whole file is read if the commands are needed
+    auto commands = std::make_shared<Commands>();
+    commands->unparsedFilename = filename;
+    commands->parsed = false;
+
+    _header = std::move(header);
+    _commands = std::move(commands);
+    _gd3Tag = std::move(gd3Tag);
+}
+
+void VgmFile::Commands::set_unparsed_data(BinaryData&& data, const VgmHeader& header)
+{
+    const auto dataOffset = header.data_offset();
+    const auto gd3Offset = header.gd3_offset();
     // The data either runs up to EOF or the GD3
-    auto endOffset = _header.eof_offset();
-    if (_header.gd3_offset() < _header.eof_offset() && _header.gd3_offset() > dataOffset)
+    auto endOffset = header.eof_offset();
+    if (gd3Offset < header.eof_offset() && gd3Offset > dataOffset)
     {
         endOffset = gd3Offset;
     }
@@ -43,77 +176,156 @@ void VgmFile::load_file(const std::string& filename)
     {
         throw std::runtime_error("Invalid data offsets imply no data");
     }
-    //const auto byteCount = endOffset - dataOffset;
 
-    data.seek(dataOffset);
+    unparsedData = std::move(data);
+    unparsedDataOffset = dataOffset;
+    unparsedLoopOffset = header.loop_offset();
+    unparsedEndOffset = endOffset;
+}
 
-    _data.from_data(data, _header.loop_offset(), endOffset);
+void VgmFile::Commands::parse()
+{
+    std::lock_guard lock(parseMutex);
+    if (parsed)
+    {
+        // Another thread got here first
+        return;
+    }
+
+    if (!unparsedFilename.empty())
+    {
+        // We only have the header so far, so we read the whole file. The offsets come from its own header, in case
+        // ours was modified.
+        BinaryData data(unparsedFilename);
+        VgmHeader header;
+        header.from_binary(data);
+        set_unparsed_data(std::move(data), header);
+        unparsedFilename.clear();
+    }
+
+    unparsedData.seek(unparsedDataOffset);
+    stream.from_data(unparsedData, unparsedLoopOffset, unparsedEndOffset);
 
     // Check for orphaned data
-    if (data.offset() < endOffset)
+    if (unparsedData.offset() < unparsedEndOffset)
     {
-        throw std::runtime_error(std::format("Unconsumed data in VGM file at offset {:x}", data.offset()));
+        throw std::runtime_error(std::format("Unconsumed data in VGM file at offset {:x}", unparsedData.offset()));
     }
+
+    // Anything still using the buffer (e.g. data blocks) keeps it alive
+    unparsedData = BinaryData();
+    parsed = true;
 }
 
 void VgmFile::save_file(const std::string& filename)
 {
+    Profile::Scope scope("write", filename);
+    // We don't do compression here
     BinaryData data;
+    to_binary(data);
+    data.save(filename);
+}
 
-    // First the header TODO write this last, but we need to know its size
-    _header.to_binary(data);
-
-    // Then the data
-    // TODO if the header size changes then the pointers need to be rewritten
-    // TODO data.write_range(_data);
-
-    // Then the GD3 tag. We can move this before the data now...
-    if (!_gd3Tag.empty())
+void VgmFile::save_over(const std::string& filename)
+{
+    const auto isCompressed = Utils::is_compressed(filename);
+    const auto tempFilename = Utils::make_temp_filename(filename);
+    try
     {
-        _header.set_gd3_offset(data.offset());
-        _gd3Tag.to_binary(data);
+        Profile::Scope scope("write", filename);
+        BinaryData data;
+        to_binary(data);
+        if (isCompressed)
+        {
+            Utils::save_gzip(tempFilename, data.buffer());
+        }
+        else
+        {
+            data.save(tempFilename);
+        }
     }
-    else
+    catch (...)
     {
-        _header.set_gd3_offset(0);
+        std::filesystem::remove(tempFilename);
+        throw;
     }
+    Utils::replace_file(filename, tempFilename);
+}
 
-    _header.set_eof_offset(data.size());
+void VgmFile::save_file(const std::string& filename, VgmHeader& header, const std::vector<const VgmCommands::ICommand*>& commands) const
+{
+    Profile::Scope scope("write", filename);
+    BinaryData data;
+    write(data, header, commands, *_gd3Tag);
+    data.save(filename);
+}
 
-    data.seek(0u);
-    // Write the header again
-    _header.to_binary(data);
+void VgmFile::to_binary(BinaryData& data)
+{
+    // Only the header is changed, so we don't need our own copy of the commands
+    write(data, header(), std::as_const(*this).commands(), *_gd3Tag);
+}
 
-    // Finally, save to disk. We don't do compression here.
-    data.save(filename + ".foo.vgm");
+void VgmFile::set_commands(std::vector<VgmCommands::ICommand*>&& commands)
+{
+    // Any snapshots keep the old ones, and if not, they're deleted with it
+    auto newCommands = std::make_shared<Commands>();
+    newCommands->stream.commands().swap(commands);
+    _commands = std::move(newCommands);
 }
 
-void VgmFile::check_header(bool fix)
+void VgmFile::edit_commands(const std::function<void(CommandSequence&)>& edit)
 {
-    // Check lengths
-    auto totalSampleCount = 0u;
+    auto& commands = this->commands();
+    CommandSequence sequence(std::move(commands));
+    try
+    {
+        edit(sequence);
+    }
+    catch (...)
+    {
+        // We still own whatever is left
+        commands = sequence.release();
+        throw;
+    }
+    header().set_sample_count(sequence.sample_count());
+    header().set_loop_sample_count(sequence.loop_sample_count());
+    commands = sequence.release();
+}
+
+void VgmFile::count_samples(uint32_t& sampleCount, uint32_t& loopSampleCount) const
+{
+    sampleCount = 0;
     auto loopStartSampleCount = 0u;
 
-    for (const auto* pCommand : _data.commands())
+    for (const auto* pCommand : commands())
     {
         if (auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
         {
-            totalSampleCount += pWait->duration();
+            sampleCount += pWait->duration();
         }
         else if (auto* pLoop = dynamic_cast<const VgmCommands::LoopPoint*>(pCommand); pLoop != nullptr)
         {
-            loopStartSampleCount = totalSampleCount;
+            loopStartSampleCount = sampleCount;
         }
     }
 
-    const auto loopSampleCount = totalSampleCount - loopStartSampleCount;
+    loopSampleCount = sampleCount - loopStartSampleCount;
+}
+
+void VgmFile::check_header(bool fix)
+{
+    // Check lengths
+    uint32_t totalSampleCount;
+    uint32_t loopSampleCount;
+    count_samples(totalSampleCount, loopSampleCount);
 
-    if (_header.loop_sample_count() != loopSampleCount || _header.sample_count() != totalSampleCount)
+    if (_header->loop_sample_count() != loopSampleCount || _header->sample_count() != totalSampleCount)
     {
         if (fix)
         {
-            _header.set_sample_count(totalSampleCount);
-            _header.set_loop_sample_count(loopSampleCount);
+            header().set_sample_count(totalSampleCount);
+            header().set_loop_sample_count(loopSampleCount);
         }
         else
         {
@@ -125,8 +337,8 @@ void VgmFile::check_header(bool fix)
                 "In header:\n"
                 "Total: {} samples = {:.2} seconds\n"
                 "Loop: {} samples = {:.2} seconds",
-                _header.sample_count(), _header.sample_count() / 44100.0,
-                _header.loop_sample_count(), _header.loop_sample_count() / 44100.0,
+                _header->sample_count(), _header->sample_count() / 44100.0,
+                _header->loop_sample_count(), _header->loop_sample_count() / 44100.0,
                 totalSampleCount, totalSampleCount / 44100.0,
                 loopSampleCount, loopSampleCount / 44100.0));
         }
@@ -143,16 +355,16 @@ void VgmFile::write_to_text(std::ostream& s, const IVGMToolCallback& callback) c
 
     // First the header...
     s << "VGM Header:\n"
-        << _header.write_to_text()
+        << _header->write_to_text()
         << "\nVGM data:\n";
 
-    size_t offset = _header.data_offset();
+    size_t offset = _header->data_offset();
     int time = 0;
-    SN76489State psgState(_header);
-    YM2413State ym2413State(_header);
+    SN76489State psgState(*_header);
+    YM2413State ym2413State(*_header);
     BinaryData scratch;
 
-    for (const auto* pCommand : _data.commands())
+    for (const auto* pCommand : commands())
     {
         // File offset
         s << std::format("{:#010x} ", offset);
@@ -248,10 +460,10 @@ void VgmFile::write_to_text(std::ostream& s, const IVGMToolCallback& callback) c
         s << "\n";
     }
 
-    if (!_gd3Tag.empty())
+    if (!_gd3Tag->empty())
     {
         s << "\nGD3 tag:\n"
-            << _gd3Tag.write_to_text();
+            << _gd3Tag->write_to_text();
     }
 
     callback.show_status("Write to text complete");
@@ -1,35 +1,149 @@
 #pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 
+#include "BinaryData.h"
+#include "CommandSequence.h"
 #include "CommandStream.h"
 #include "Gd3Tag.h"
 #include "VgmHeader.h"
 
 class IVGMToolCallback;
 
+// The header and GD3 tag are parsed when the file is loaded, but the commands are only parsed when they are first
+// needed. Errors in the data are therefore thrown from the first call to commands() (or anything using it).
+//
+// A snapshot() shares the header, commands and GD3 tag with the file it came from until either of them changes one,
+// so it is a cheap way to keep an undo state or try out an edit. Getting a non-const reference to a part counts as
+// changing it, so read through a const VgmFile where you can. Snapshots can be used on different threads as long as
+// none of them is changed. A moved-from file can only be assigned to or destroyed.
 class VgmFile
 {
-    VgmHeader _header;
-    CommandStream _data;
-    Gd3Tag _gd3Tag;
+    // The commands, and what we need to parse them when they are first used
+    struct Commands
+    {
+        CommandStream stream;
+
+        // The file contents, kept until the commands are parsed from them
+        BinaryData unparsedData;
+        uint32_t unparsedDataOffset{};
+        uint32_t unparsedLoopOffset{};
+        uint32_t unparsedEndOffset{};
+        // If set, unparsedData has to be loaded from this file first
+        std::string unparsedFilename;
+        // Parsing may be triggered from several threads sharing a const file
+        std::atomic<bool> parsed{true};
+        std::mutex parseMutex;
+
+        void set_unparsed_data(BinaryData&& data, const VgmHeader& header);
+        void parse();
+    };
+
+    std::shared_ptr<VgmHeader> _header;
+    std::shared_ptr<Commands> _commands;
+    std::shared_ptr<Gd3Tag> _gd3Tag;
+
+    VgmFile(std::shared_ptr<VgmHeader> header, std::shared_ptr<Commands> commands, std::shared_ptr<Gd3Tag> gd3Tag);
+
+    void load_data(BinaryData&& data);
+
+    // Makes our own copy of a part if a snapshot shares it, so we can change it
+    template <typename T>
+    static T& unshare(std::shared_ptr<T>& part)
+    {
+        if (part.use_count() > 1)
+        {
+            part = std::make_shared<T>(*part);
+        }
+        return *part;
+    }
+
+    void unshare_commands();
 
 public:
-    VgmFile() = default;
+    VgmFile();
     explicit VgmFile(const std::string& filename);
 
+    // Use snapshot() to copy
+    VgmFile(const VgmFile& other) = delete;
+    VgmFile(VgmFile&& other) noexcept = default;
+    VgmFile& operator=(const VgmFile& other) = delete;
+    VgmFile& operator=(VgmFile&& other) noexcept = default;
+    ~VgmFile() = default;
+
+    // Returns a copy of the file which shares everything with this one until either of them is changed
+    [[nodiscard]] VgmFile snapshot() const;
+
     void load_file(const std::string& filename);
+    // Loads from uncompressed file data in memory
+    void load_data(std::vector<uint8_t>&& data);
+    // Reads only the header and GD3 tag from the file, which is much faster for compressed files with a saved
+    // GzipIndex. The rest of the file is read if the commands are used.
+    void load_header_and_gd3(const std::string& filename);
     void save_file(const std::string& filename);
+    // Saves over filename, via a temp file so it is never left half written. It stays compressed if it was.
+    void save_over(const std::string& filename);
+    // Saves a file with this file's GD3 tag, but a different header and commands. The header's offsets are updated.
+    void save_file(const std::string& filename, VgmHeader& header, const std::vector<const VgmCommands::ICommand*>& commands) const;
+    // Writes the file contents to data, which should be empty, as save_file() would
+    void to_binary(BinaryData& data);
 
     VgmHeader& header()
     {
-        return _header;
+        return unshare(_header);
+    }
+
+    [[nodiscard]] const VgmHeader& header() const
+    {
+        return *_header;
     }
 
     Gd3Tag& gd3()
     {
-        return _gd3Tag;
+        return unshare(_gd3Tag);
+    }
+
+    [[nodiscard]] const Gd3Tag& gd3() const
+    {
+        return *_gd3Tag;
+    }
+
+    std::vector<VgmCommands::ICommand*>& commands()
+    {
+        if (_commands.use_count() > 1)
+        {
+            unshare_commands();
+        }
+        if (!_commands->parsed)
+        {
+            _commands->parse();
+        }
+        return _commands->stream.commands();
     }
 
+    [[nodiscard]] const std::vector<VgmCommands::ICommand*>& commands() const
+    {
+        if (!_commands->parsed)
+        {
+            _commands->parse();
+        }
+        return _commands->stream.commands();
+    }
+
+    // Replaces the commands with these, taking ownership of them. Unlike going through commands(), the old commands
+    // aren't parsed first if they haven't been yet. commands is left empty.
+    void set_commands(std::vector<VgmCommands::ICommand*>&& commands);
+
+    // Moves the commands into a CommandSequence for edit() to change, which is much faster than using commands() for
+    // many insertions and deletions, then moves them back. The header's sample counts are updated.
+    void edit_commands(const std::function<void(CommandSequence&)>& edit);
+
+    // Counts the samples in the commands, in total and after the loop point
+    void count_samples(uint32_t& sampleCount, uint32_t& loopSampleCount) const;
+
     // Checks the header. Throws on any errors found if fix=false, else tries to fix them.
     void check_header(bool fix);
 
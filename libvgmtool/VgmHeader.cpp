@@ -7,6 +7,7 @@
 
 #include "BinaryData.h"
 #include "KeyValuePrinter.h"
+#include "Profile.h"
 #include "utils.h"
 
 namespace
@@ -17,10 +18,35 @@ namespace
     constexpr auto LOOP_DELTA = 0x1cu;
     constexpr auto DATA_DELTA = 0x34u;
     constexpr auto DATA_DEFAULT = 0x40u;
+
+    const std::unordered_map<VgmHeader::Chip, std::string> CHIP_NAMES
+    {
+        {VgmHeader::Chip::SN76489, "SN76489"},
+        {VgmHeader::Chip::YM2413, "YM2413"},
+        {VgmHeader::Chip::YM2612, "YM2612"},
+        {VgmHeader::Chip::YM2151, "YM2151"},
+        {VgmHeader::Chip::SegaPCM, "SegaPCM"},
+        {VgmHeader::Chip::RF5C68, "RF5C68"},
+        {VgmHeader::Chip::YM2203, "YM2203"},
+        {VgmHeader::Chip::YM2608, "YM2608"},
+        {VgmHeader::Chip::YM2610, "YM2610"},
+        {VgmHeader::Chip::YM3812, "YM3812"},
+        {VgmHeader::Chip::YM3526, "YM3526"},
+        {VgmHeader::Chip::Y8950, "Y8950"},
+        {VgmHeader::Chip::YMF262, "YMF262"},
+        {VgmHeader::Chip::YMF278B, "YMF278B"},
+        {VgmHeader::Chip::YMF271, "YMF271"},
+        {VgmHeader::Chip::YMZ280B, "YMZ280B"},
+        {VgmHeader::Chip::RF5C164, "RF5C164"},
+        {VgmHeader::Chip::PWM, "PWM"},
+        {VgmHeader::Chip::AY8910, "AY8910"},
+        {VgmHeader::Chip::GenericDAC, "DAC"}
+    };
 }
 
 void VgmHeader::from_binary(BinaryData& data)
 {
+    Profile::Scope scope("header");
     // https://www.smspower.org/uploads/Music/vgmspec160.txt
 
     // Check ident
@@ -213,7 +239,7 @@ void VgmHeader::to_binary(BinaryData& data) const
     data.write_uint32(clock(Chip::YM2413));
     data.write_uint32(_gd3Offset == 0u ? 0u : _gd3Offset - GD3_DELTA);
     data.write_uint32(_sampleCount);
-    data.write_uint32(_loopOffset - LOOP_DELTA);
+    data.write_uint32(_loopOffset == 0u ? 0u : _loopOffset - LOOP_DELTA);
     data.write_uint32(_loopSampleCount);
     if (_version.at_least(1, 1))
     {
@@ -280,8 +306,6 @@ void VgmHeader::to_binary(BinaryData& data) const
         }
 
         data.write_uint8(_loopModifier);
-        // Reserved byte
-        data.write_uint8(0);
     }
 
     // Pad as needed
@@ -307,6 +331,29 @@ void VgmHeader::set_clock(const Chip chip, const uint32_t value)
     _clocks[chip] = value;
 }
 
+std::string VgmHeader::chip_name(const Chip chip)
+{
+    const auto it = CHIP_NAMES.find(chip);
+    if (it == CHIP_NAMES.end())
+    {
+        return "Nothing";
+    }
+    return it->second;
+}
+
+VgmHeader::Chip VgmHeader::chip_from_name(const std::string& name)
+{
+    const auto& lowerName = Utils::to_lower(name);
+    for (const auto& [chip, chipName] : CHIP_NAMES)
+    {
+        if (Utils::to_lower(chipName) == lowerName)
+        {
+            return chip;
+        }
+    }
+    throw std::runtime_error(std::format("Unknown chip \"{}\"", name));
+}
+
 bool VgmHeader::flag(const Flag flag) const
 {
     const auto it = _flags.find(flag);
@@ -2,6 +2,7 @@
 #include "BcdVersion.h"
 #include <unordered_map>
 #include <cstdint>
+#include <string>
 class BinaryData;
 
 class VgmHeader
@@ -10,9 +11,10 @@ public:
     VgmHeader() = default;
     ~VgmHeader() = default;
 
-    VgmHeader(const VgmHeader& other) = delete;
+    // Copyable so derived files can start from the same header
+    VgmHeader(const VgmHeader& other) = default;
     VgmHeader(VgmHeader&& other) noexcept = delete;
-    VgmHeader& operator=(const VgmHeader& other) = delete;
+    VgmHeader& operator=(const VgmHeader& other) = default;
     VgmHeader& operator=(VgmHeader&& other) noexcept = delete;
 
     void from_binary(BinaryData& data);
@@ -257,6 +259,11 @@ public:
     [[nodiscard]] uint32_t clock(Chip chip) const;
     void set_clock(Chip chip, uint32_t value);
 
+    // Name of the chip, e.g. "YM2612"
+    [[nodiscard]] static std::string chip_name(Chip chip);
+    // Finds the chip for a name, ignoring case. Throws if there is no match.
+    [[nodiscard]] static Chip chip_from_name(const std::string& name);
+
     [[nodiscard]] bool flag(Flag flag) const;
 
 private:
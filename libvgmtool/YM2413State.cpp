@@ -2,7 +2,6 @@
 
 #include <format>
 #include <sstream>
-#include <unordered_set>
 
 #include "utils.h"
 #include "VgmHeader.h"
@@ -10,15 +9,6 @@
 
 namespace
 {
-    const std::unordered_set<int> validRegisters
-    {
-        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, // Custom instrument
-        0x0e, // Rhythm control
-        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, // F-number low 8 bits
-        0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, // F-number high bit, block, key, sustain
-        0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, // Instrument, volume
-    };
-
     const std::vector<double> customInstrumentMultiplyingFactors
     {
         0.5, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 10, 12, 12, 15, 15
@@ -43,16 +33,31 @@ namespace
 }
 
 YM2413State::YM2413State(const VgmHeader& header)
-    : _clockRate(header.clock(VgmHeader::Chip::YM2413)),
-      _registers(0x39) { }
+    : _clockRate(header.clock(VgmHeader::Chip::YM2413)) { }
 
 void YM2413State::add(const VgmCommands::YM2413* pCommand)
 {
     // We just stuff it in the registers (for now)
-    if (validRegisters.contains(pCommand->registerIndex()))
+    _registers.write(pCommand->registerIndex(), pCommand->value());
+}
+
+bool YM2413State::is_audible() const
+{
+    const bool isRhythmMode = Utils::bit_set(_registers[0x0e], 5);
+    if (isRhythmMode && (_registers[0x0e] & RegisterFile<YM2413Layout>::key_bits(0x0e)) != 0)
+    {
+        return true;
+    }
+    // Channels 6-8 are used for the rhythm instruments in rhythm mode
+    const auto melodyChannelCount = isRhythmMode ? 6 : 9;
+    for (auto channel = 0; channel < melodyChannelCount; ++channel)
     {
-        _registers[pCommand->registerIndex()] = pCommand->value();
+        if ((_registers[0x20 + channel] & RegisterFile<YM2413Layout>::key_bits(0x20 + channel)) != 0)
+        {
+            return true;
+        }
     }
+    return false;
 }
 
 std::string YM2413State::percussion_instruments(const uint8_t value)
@@ -145,7 +150,7 @@ void YM2413State::add_with_text(const VgmCommands::ICommand* pCommand, std::ostr
     const auto value = p->value();
 
     // Check if valid
-    if (!validRegisters.contains(p->registerIndex()))
+    if (!RegisterFile<YM2413Layout>::is_valid(p->registerIndex()))
     {
         s << "Invalid register index " << std::format("{:03x}", p->registerIndex());
         return;
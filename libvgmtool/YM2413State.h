@@ -2,6 +2,8 @@
 #include <string>
 #include <unordered_map>
 
+#include "RegisterFile.h"
+#include "RegisterLayouts.h"
 #include "VgmCommands.h"
 
 namespace VgmCommands
@@ -20,6 +22,9 @@ public:
 
     void add(const VgmCommands::YM2413* pCommand);
 
+    // True if any channel or rhythm instrument is keyed on. Release after key off is not included.
+    [[nodiscard]] bool is_audible() const;
+
 private:
     static std::string percussion_instruments(uint8_t value);
     static std::string percussion_volumes(const VgmCommands::YM2413* pCommand);
@@ -28,5 +33,5 @@ private:
     [[nodiscard]] double frequency(int channel) const;
 
     uint32_t _clockRate;
-    std::vector<uint8_t> _registers;
+    RegisterFile<YM2413Layout> _registers;
 };
@@ -0,0 +1,324 @@
+#include "assemble.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BinaryData.h"
+#include "CommandStream.h"
+#include "IVGMToolCallback.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    // totext prints this many bytes of each command
+    constexpr size_t LISTED_BYTE_COUNT = 5;
+    // More than the longest fixed size command, so one cut short at the end of the listing reads into this rather than off the
+    // end of the data
+    constexpr size_t PADDING_SIZE = 16;
+
+    // Value of each hex digit, or -1 for other characters
+    constexpr auto HEX_VALUES = []
+    {
+        std::array<int8_t, 256> result{};
+        result.fill(-1);
+        for (int i = 0; i < 10; ++i)
+        {
+            result['0' + i] = static_cast<int8_t>(i);
+        }
+        for (int i = 0; i < 6; ++i)
+        {
+            result['a' + i] = static_cast<int8_t>(10 + i);
+            result['A' + i] = static_cast<int8_t>(10 + i);
+        }
+        return result;
+    }();
+
+    int hex_value(const char c)
+    {
+        return HEX_VALUES[static_cast<uint8_t>(c)];
+    }
+
+    bool is_space(const char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    struct Line
+    {
+        // Where its bytes start in the data; they end where the next line's start
+        uint32_t dataOffset;
+        // From the listing, if it has one
+        std::optional<uint32_t> fileOffset;
+        uint32_t lineNumber;
+        bool isLoopPoint;
+    };
+
+    // Returns the offset of the line starting with text, or npos
+    size_t find_line(const std::string_view listing, const std::string_view text, const size_t start = 0)
+    {
+        for (auto offset = listing.find(text, start); offset != std::string_view::npos; offset = listing.find(text, offset + 1))
+        {
+            if (offset == 0 || listing[offset - 1] == '\n')
+            {
+                return offset;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+    // Splits the listing into lines and their bytes. We work directly on the text and only add to data and lines, so
+    // nothing is allocated per line.
+    void tokenise(const std::string_view listing, uint32_t lineNumber, std::vector<uint8_t>& data, std::vector<Line>& lines)
+    {
+        const char* p = listing.data();
+        const char* const end = p + listing.size();
+        for (; p < end; ++lineNumber)
+        {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (lineEnd == nullptr)
+            {
+                lineEnd = end;
+            }
+            Line line{static_cast<uint32_t>(data.size()), std::nullopt, lineNumber, false};
+
+            while (p < lineEnd && is_space(*p))
+            {
+                ++p;
+            }
+            if (p == lineEnd || *p == ';' || *p == '#')
+            {
+                p = lineEnd + 1;
+                continue;
+            }
+
+            // Offset
+            if (lineEnd - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            {
+                p += 2;
+                uint64_t offset = 0;
+                int digitCount = 0;
+                for (; p < lineEnd && hex_value(*p) >= 0; ++p, ++digitCount)
+                {
+                    offset = offset << 4 | hex_value(*p);
+                }
+                if (digitCount == 0 || digitCount > 8 || (p < lineEnd && !is_space(*p)))
+                {
+                    throw std::runtime_error(std::format("Line {}: invalid offset", lineNumber));
+                }
+                line.fileOffset = static_cast<uint32_t>(offset);
+            }
+
+            // Bytes, up to the first word which isn't one
+            for (;;)
+            {
+                while (p < lineEnd && is_space(*p))
+                {
+                    ++p;
+                }
+                if (lineEnd - p < 2)
+                {
+                    break;
+                }
+                const auto high = hex_value(p[0]);
+                const auto low = hex_value(p[1]);
+                if (high < 0 || low < 0 || (lineEnd - p > 2 && !is_space(p[2])))
+                {
+                    break;
+                }
+                data.push_back(static_cast<uint8_t>(high << 4 | low));
+                p += 2;
+            }
+
+            if (data.size() == line.dataOffset)
+            {
+                if (std::string_view(p, lineEnd - p).find("LOOP POINT") == std::string_view::npos)
+                {
+                    throw std::runtime_error(std::format("Line {}: expected hex bytes", lineNumber));
+                }
+                line.isLoopPoint = true;
+            }
+            lines.push_back(line);
+            p = lineEnd + 1;
+        }
+    }
+
+    // The commands in the template which totext cuts short, by file offset. We only look for them if we need to.
+    class TemplateCommands
+    {
+    public:
+        TemplateCommands(const VgmFile& file, const CommandStream& stream)
+            : _file(file),
+              _stream(stream)
+        {
+        }
+
+        // Returns a copy of the command at offset if it starts with bytes, or nullptr
+        VgmCommands::ICommand* find(const uint32_t offset, const std::span<const uint8_t> bytes)
+        {
+            if (!_indexed)
+            {
+                index();
+            }
+            const auto it = _commands.find(offset);
+            if (it == _commands.end())
+            {
+                return nullptr;
+            }
+            _scratch.reset();
+            it->second->to_data(_scratch);
+            const auto& buffer = _scratch.buffer();
+            if (buffer.size() < bytes.size() || !std::equal(bytes.begin(), bytes.end(), buffer.begin()))
+            {
+                return nullptr;
+            }
+            _scratch.seek(0);
+            return _stream.read_command(_scratch);
+        }
+
+    private:
+        void index()
+        {
+            auto offset = _file.header().data_offset();
+            for (const auto* pCommand : _file.commands())
+            {
+                _scratch.reset();
+                pCommand->to_data(_scratch);
+                const auto size = static_cast<uint32_t>(_scratch.buffer().size());
+                if (size > LISTED_BYTE_COUNT)
+                {
+                    _commands.emplace(offset, pCommand);
+                }
+                offset += size;
+            }
+            _indexed = true;
+        }
+
+        const VgmFile& _file;
+        const CommandStream& _stream;
+        std::unordered_map<uint32_t, const VgmCommands::ICommand*> _commands;
+        bool _indexed = false;
+        BinaryData _scratch;
+    };
+}
+
+void assemble(const std::string_view listing, VgmFile& file, const IVGMToolCallback& callback)
+{
+    StageTimer timer(callback, "assemble");
+
+    // If it's a whole totext listing, we only want the commands
+    auto start = find_line(listing, "VGM data:");
+    auto end = std::string_view::npos;
+    uint32_t firstLineNumber = 1;
+    if (start != std::string_view::npos)
+    {
+        firstLineNumber += static_cast<uint32_t>(std::count(listing.begin(), listing.begin() + start, '\n')) + 1;
+        start = listing.find('\n', start);
+        start = start == std::string_view::npos ? listing.size() : start + 1;
+        end = find_line(listing, "GD3 tag:", start);
+    }
+    else
+    {
+        start = 0;
+    }
+    const auto commandsText = listing.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start);
+
+    // Most lines are a few bytes of data and some text
+    std::vector<uint8_t> bytes;
+    bytes.reserve(commandsText.size() / 8);
+    std::vector<Line> lines;
+    lines.reserve(commandsText.size() / 32);
+    tokenise(commandsText, firstLineNumber, bytes, lines);
+
+    const auto byteCount = static_cast<uint32_t>(bytes.size());
+    bytes.resize(byteCount + PADDING_SIZE);
+    BinaryData data(std::move(bytes));
+
+    // The stream owns the commands until we're done, so they're deleted if we fail
+    CommandStream stream;
+    auto& commands = stream.commands();
+    commands.reserve(lines.size() + 1);
+    TemplateCommands templateCommands(std::as_const(file), stream);
+    bool ended = false;
+
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        const auto& line = lines[i];
+        if (ended)
+        {
+            throw std::runtime_error(std::format("Line {}: commands after the end of music data", line.lineNumber));
+        }
+        if (line.isLoopPoint)
+        {
+            commands.push_back(new VgmCommands::LoopPoint());
+            continue;
+        }
+
+        const auto lineEnd = i + 1 < lines.size() ? lines[i + 1].dataOffset : byteCount;
+        data.seek(line.dataOffset);
+        while (data.offset() < lineEnd)
+        {
+            if (ended)
+            {
+                throw std::runtime_error(std::format("Line {}: commands after the end of music data", line.lineNumber));
+            }
+            const auto commandOffset = data.offset();
+            VgmCommands::ICommand* pCommand = nullptr;
+            std::string problem = "command is cut short";
+            try
+            {
+                pCommand = stream.read_command(data);
+            }
+            catch (const std::exception& e)
+            {
+                problem = e.what();
+            }
+            if (pCommand != nullptr && data.offset() > lineEnd)
+            {
+                delete pCommand;
+                pCommand = nullptr;
+            }
+
+            if (pCommand == nullptr)
+            {
+                // Maybe it was cut short by totext
+                if (line.fileOffset.has_value())
+                {
+                    pCommand = templateCommands.find(
+                        *line.fileOffset + commandOffset - line.dataOffset,
+                        std::span(data.buffer()).subspan(commandOffset, lineEnd - commandOffset));
+                }
+                if (pCommand == nullptr)
+                {
+                    throw std::runtime_error(std::format("Line {}: {}", line.lineNumber, problem));
+                }
+                data.seek(lineEnd);
+            }
+
+            commands.push_back(pCommand);
+            ended = dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr;
+        }
+    }
+
+    // Hand-written listings may not bother with this
+    if (!ended)
+    {
+        commands.push_back(new VgmCommands::End());
+    }
+
+    // The template's commands are dropped without being parsed, if we didn't need them
+    file.set_commands(std::move(commands));
+    file.check_header(true);
+
+    callback.show_status(std::format("Assembled {} commands from {} lines", file.commands().size(), lines.size()));
+    timer.finish(listing.size(), byteCount, file.commands().size());
+}
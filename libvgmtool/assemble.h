@@ -0,0 +1,23 @@
+#pragma once
+#include <string_view>
+
+// Turns a listing of commands, as written by totext, back into VGM data.
+//
+// If the listing has a "VGM data:" line, only the lines after it are read, up to any "GD3 tag:" line; otherwise all
+// of it is. Each line is one of:
+// - blank, or a comment starting with ; or #
+// - an optional file offset like 0x00000080, then the command's bytes as pairs of hex digits separated by spaces.
+//   Anything after the first word which isn't a pair of hex digits is ignored, so the decoded text totext adds is
+//   fine. A line may hold several commands.
+// - an optional file offset, then some text containing "LOOP POINT"
+//
+// totext only prints the first 5 bytes of longer commands such as data blocks. If a command is cut short like that,
+// we take it from the template file at the offset at the start of the line, as long as it starts with the same
+// bytes. This is the offset from the listing, so it still works after lines are added or removed before it.
+
+class IVGMToolCallback;
+class VgmFile;
+
+// Replaces the commands in file, which supplies the header, GD3 tag and any long commands, with those in listing.
+// The lengths in the header are updated to match. Errors are thrown with the line number they are on.
+void assemble(std::string_view listing, VgmFile& file, const IVGMToolCallback& callback);
@@ -0,0 +1,253 @@
+#include "catalog.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "BinaryData.h"
+#include "fingerprint.h"
+#include "IVGMToolCallback.h"
+#include "utils.h"
+#include "VgmFile.h"
+
+namespace
+{
+    constexpr auto CATALOG_IDENT = "VGMC";
+    // Increase this when the format changes, so old catalogs are rebuilt rather than misread
+    constexpr uint32_t CATALOG_VERSION = 1;
+
+    void write_string(BinaryData& data, const std::string& s)
+    {
+        data.write_uint32(static_cast<uint32_t>(s.size()));
+        data.write_unterminated_ascii_string(s);
+    }
+
+    std::string read_string(BinaryData& data)
+    {
+        return data.read_ascii_string(data.read_uint32());
+    }
+
+    std::string normalise_path(const std::string& path)
+    {
+        return std::filesystem::absolute(path).lexically_normal().string();
+    }
+
+    // Returns true if filename is path, or is in the folder path. Both must be normalised.
+    bool is_in(const std::string& filename, const std::string& path)
+    {
+        const auto& relative = std::filesystem::path(filename).lexically_relative(path);
+        return !relative.empty() && *relative.begin() != "..";
+    }
+
+    bool is_in_any(const std::string& filename, const std::vector<std::string>& paths)
+    {
+        return std::ranges::any_of(paths, [&](const auto& path) { return is_in(filename, path); });
+    }
+
+    void read_entry(CatalogEntry& entry)
+    {
+        const VgmFile file(entry.filename);
+        const auto& header = file.header();
+
+        auto version = header.version();
+        entry.version = version.string();
+        entry.sampleCount = header.sample_count();
+        entry.loopSampleCount = header.loop_sample_count();
+        entry.frameRate = header.frame_rate();
+        entry.clocks.clear();
+        for (auto i = static_cast<int>(VgmHeader::Chip::SN76489); i <= static_cast<int>(VgmHeader::Chip::GenericDAC); ++i)
+        {
+            const auto chip = static_cast<VgmHeader::Chip>(i);
+            if (const auto clock = header.clock(chip); clock != 0)
+            {
+                entry.clocks.emplace_back(chip, clock);
+            }
+        }
+
+        entry.gd3 = file.gd3();
+
+        file.count_samples(entry.dataSampleCount, entry.dataLoopSampleCount);
+
+        entry.fingerprint = fingerprint(file);
+    }
+}
+
+Catalog::Catalog(std::string filename)
+    : _filename(std::move(filename))
+{
+    if (!Utils::file_exists(_filename))
+    {
+        return;
+    }
+
+    BinaryData data(_filename);
+    if (const auto& ident = data.read_ascii_string(4); ident != CATALOG_IDENT)
+    {
+        throw std::runtime_error(std::format("{} is not a catalog file", _filename));
+    }
+    if (data.read_uint32() != CATALOG_VERSION)
+    {
+        // Start again
+        return;
+    }
+
+    _entries.resize(data.read_uint32());
+    for (auto& entry : _entries)
+    {
+        entry.filename = read_string(data);
+        entry.size = data.read_uint64();
+        entry.modified = static_cast<int64_t>(data.read_uint64());
+        entry.version = read_string(data);
+        entry.sampleCount = data.read_uint32();
+        entry.loopSampleCount = data.read_uint32();
+        entry.frameRate = data.read_uint32();
+        entry.clocks.resize(data.read_uint8());
+        for (auto& [chip, clock] : entry.clocks)
+        {
+            chip = static_cast<VgmHeader::Chip>(data.read_uint8());
+            clock = data.read_uint32();
+        }
+        if (data.read_uint8() != 0)
+        {
+            entry.gd3.from_binary(data);
+        }
+        entry.dataSampleCount = data.read_uint32();
+        entry.dataLoopSampleCount = data.read_uint32();
+        entry.fingerprint = data.read_uint64();
+    }
+}
+
+void Catalog::save() const
+{
+    BinaryData data;
+    data.write_unterminated_ascii_string(CATALOG_IDENT);
+    data.write_uint32(CATALOG_VERSION);
+    data.write_uint32(static_cast<uint32_t>(_entries.size()));
+    for (const auto& entry : _entries)
+    {
+        write_string(data, entry.filename);
+        data.write_uint64(entry.size);
+        data.write_uint64(static_cast<uint64_t>(entry.modified));
+        write_string(data, entry.version);
+        data.write_uint32(entry.sampleCount);
+        data.write_uint32(entry.loopSampleCount);
+        data.write_uint32(entry.frameRate);
+        data.write_uint8(static_cast<uint8_t>(entry.clocks.size()));
+        for (const auto& [chip, clock] : entry.clocks)
+        {
+            data.write_uint8(static_cast<uint8_t>(chip));
+            data.write_uint32(clock);
+        }
+        data.write_uint8(entry.gd3.empty() ? 0 : 1);
+        if (!entry.gd3.empty())
+        {
+            entry.gd3.to_binary(data);
+        }
+        data.write_uint32(entry.dataSampleCount);
+        data.write_uint32(entry.dataLoopSampleCount);
+        data.write_uint64(entry.fingerprint);
+    }
+    data.save(_filename);
+}
+
+void Catalog::refresh(const std::vector<std::string>& paths, const IVGMToolCallback& callback)
+{
+    std::vector<std::string> normalisedPaths;
+    std::ranges::transform(paths, std::back_inserter(normalisedPaths), normalise_path);
+
+    std::unordered_map<std::string, CatalogEntry> oldEntries;
+    for (auto& entry : _entries)
+    {
+        auto filename = entry.filename;
+        oldEntries.emplace(std::move(filename), std::move(entry));
+    }
+    _entries.clear();
+
+    // We keep what we already know about unchanged files, and anything outside paths
+    std::vector<CatalogEntry> changedEntries;
+    for (const auto& filename : Utils::find_vgm_files(normalisedPaths))
+    {
+        CatalogEntry entry;
+        entry.filename = normalise_path(filename);
+        entry.size = std::filesystem::file_size(entry.filename);
+        entry.modified = std::filesystem::last_write_time(entry.filename).time_since_epoch().count();
+        const auto it = oldEntries.find(entry.filename);
+        if (it != oldEntries.end() && it->second.size == entry.size && it->second.modified == entry.modified)
+        {
+            _entries.push_back(std::move(it->second));
+        }
+        else
+        {
+            changedEntries.push_back(std::move(entry));
+        }
+        if (it != oldEntries.end())
+        {
+            oldEntries.erase(it);
+        }
+    }
+    auto removedCount = 0;
+    for (auto& [filename, entry] : oldEntries)
+    {
+        if (is_in_any(filename, normalisedPaths))
+        {
+            ++removedCount;
+        }
+        else
+        {
+            _entries.push_back(std::move(entry));
+        }
+    }
+
+    std::vector<std::string> errors(changedEntries.size());
+    Utils::parallel_for(changedEntries.size(), [&](const size_t index)
+    {
+        try
+        {
+            read_entry(changedEntries[index]);
+        }
+        catch (const std::exception& e)
+        {
+            errors[index] = e.what();
+        }
+    });
+
+    // Files which fail to load are left out, so they are tried again next time
+    auto readCount = 0;
+    for (auto i = 0u; i < changedEntries.size(); ++i)
+    {
+        if (!errors[i].empty())
+        {
+            callback.show_error(std::format("{}: {}", changedEntries[i].filename, errors[i]));
+            continue;
+        }
+        _entries.push_back(std::move(changedEntries[i]));
+        ++readCount;
+    }
+
+    std::ranges::sort(_entries, {}, &CatalogEntry::filename);
+
+    callback.show_status(std::format(
+        "Refreshed catalog: {} files, {} read, {} removed",
+        _entries.size(),
+        readCount,
+        removedCount));
+}
+
+std::vector<const CatalogEntry*> Catalog::find(const std::vector<std::string>& paths) const
+{
+    std::vector<std::string> normalisedPaths;
+    std::ranges::transform(paths, std::back_inserter(normalisedPaths), normalise_path);
+
+    std::vector<const CatalogEntry*> result;
+    for (const auto& entry : _entries)
+    {
+        if (is_in_any(entry.filename, normalisedPaths))
+        {
+            result.push_back(&entry);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Gd3Tag.h"
+#include "VgmHeader.h"
+
+// A cache of the details of many VGM files, so they can be listed without reading them all
+
+class IVGMToolCallback;
+
+struct CatalogEntry
+{
+    // Absolute path
+    std::string filename;
+
+    // For spotting changes to the file
+    uint64_t size{};
+    int64_t modified{};
+
+    // From the header
+    std::string version;
+    uint32_t sampleCount{};
+    uint32_t loopSampleCount{};
+    uint32_t frameRate{};
+    // Only the chips which are used
+    std::vector<std::pair<VgmHeader::Chip, uint32_t>> clocks;
+
+    Gd3Tag gd3;
+
+    // Computed from the data, which may not agree with the header
+    uint32_t dataSampleCount{};
+    uint32_t dataLoopSampleCount{};
+    // See fingerprint()
+    uint64_t fingerprint{};
+};
+
+class Catalog
+{
+public:
+    // Loads the catalog from filename, or starts an empty one if it doesn't exist
+    explicit Catalog(std::string filename);
+
+    void save() const;
+
+    // Finds the VGM files in paths (see Utils::find_vgm_files) and reads the ones which are new or have changed size or
+    // modification time since the last refresh, in parallel. Entries for files in paths which are gone are removed.
+    void refresh(const std::vector<std::string>& paths, const IVGMToolCallback& callback);
+
+    // Sorted by filename
+    [[nodiscard]] const std::vector<CatalogEntry>& entries() const
+    {
+        return _entries;
+    }
+
+    // The entries for the files in paths, which may be files or folders. No files are read.
+    [[nodiscard]] std::vector<const CatalogEntry*> find(const std::vector<std::string>& paths) const;
+
+private:
+    std::string _filename;
+    std::vector<CatalogEntry> _entries;
+};
@@ -1,8 +1,14 @@
 #include "convert.h"
 #include <zlib.h>
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
+#include <format>
+#include <stdexcept>
+#include <vector>
 
+#include "BinaryData.h"
 #include "IVGMToolCallback.h"
 #include "vgm.h"
 #include "utils.h"
@@ -20,120 +26,235 @@ struct TGYMXHeader
     uint32_t compressed;
 };
 
-void spread_dac(gzFile in, gzFile out)
+namespace
 {
-    // Spread remaining DAC data up until next pause evenly throughout frame
+    // Size of the GYMX header, if present
+    constexpr auto GYMX_HEADER_SIZE = static_cast<int>(sizeof(TGYMXHeader));
+    // How much we inflate at a time
+    constexpr auto READ_CHUNK_SIZE = 64 * 1024;
 
-    // When this function is called, in and out are open and the last byte read was
-    // the first 0x2a DAC data address byte.
+    // Reads GYM data in a single forward pass, inflating it if it is compressed
+    class GymReader
+    {
+    public:
+        GymReader(const std::span<const uint8_t> data, const bool isCompressed)
+            : _isCompressed(isCompressed)
+        {
+            if (_isCompressed)
+            {
+                if (inflateInit(&_stream) != Z_OK)
+                {
+                    throw std::runtime_error("Failed to initialise decompression");
+                }
+                _isStreamInitialised = true;
+                _stream.next_in = const_cast<Bytef*>(data.data());
+                _stream.avail_in = static_cast<uInt>(data.size());
+            }
+            else
+            {
+                // We can read it directly
+                _data = data;
+            }
+        }
 
-    int numDacValues = 1;
-    const int inFileDataStart = gztell(in);
+        ~GymReader()
+        {
+            if (_isStreamInitialised)
+            {
+                inflateEnd(&_stream);
+            }
+        }
 
-    // 1. Count how many DAC values there are
-    do
-    {
-        gzgetc(in); // Skip DAC data
-        const auto data = gzgetc(in); // Read next byte (00 for wait or 01 for port 0 for DAC/timer)
-        if ((data == 0) || (data == EOF))
+        GymReader(const GymReader&) = delete;
+        GymReader& operator=(const GymReader&) = delete;
+
+        // Returns the next byte, or EOF
+        int get()
         {
-            break; // Exit when I find a pause or EOF
+            if (_offset == _data.size() && !fill())
+            {
+                return EOF;
+            }
+            return _data[_offset++];
         }
-        switch (data)
+
+    private:
+        // Refills the buffer. Returns false at the end of the data.
+        bool fill()
         {
-        case 0x01:
+            if (!_isCompressed)
             {
-                const auto address = gzgetc(in); // Read next byte if not a wait (2a for DAC, 27 for timer)
-                if (address == 0x2a)
+                return false;
+            }
+
+            _buffer.resize(READ_CHUNK_SIZE);
+            _offset = 0;
+            _stream.next_out = _buffer.data();
+            _stream.avail_out = READ_CHUNK_SIZE;
+            while (_stream.avail_out == READ_CHUNK_SIZE && !_isStreamEnded)
+            {
+                if (_stream.avail_in == 0)
                 {
-                    numDacValues++; // counter starts at 1 since if I'm here there's at least one
+                    // Truncated, but we keep what we have
+                    break;
+                }
+                switch (inflate(&_stream, Z_NO_FLUSH))
+                {
+                case Z_OK:
+                    break;
+                case Z_STREAM_END:
+                    _isStreamEnded = true;
+                    break;
+                default:
+                    throw std::runtime_error(std::format("Failed to decompress GYM data: {}", _stream.msg == nullptr ? "unknown error" : _stream.msg));
                 }
-                break;
             }
-        case 0x02:
-            gzgetc(in);
-            break;
-        default:
-            break;
+            _buffer.resize(READ_CHUNK_SIZE - _stream.avail_out);
+            _data = _buffer;
+            return !_data.empty();
         }
-    }
-    while (true);
 
-    // 2. Seek back to data start (01 of first 01 2a)
-    gzseek(in, inFileDataStart - 2, SEEK_SET);
+        bool _isCompressed;
+        bool _isStreamInitialised = false;
+        bool _isStreamEnded = false;
+        z_stream _stream{};
+        // Inflated data, if compressed
+        std::vector<uint8_t> _buffer;
+        // What we are reading from
+        std::span<const uint8_t> _data;
+        size_t _offset = 0;
+    };
+
+    struct GymWrite
+    {
+        int type;
+        int address;
+        int data;
 
-    // 3. Read data again, this time outputting it with wait commands between
-    int i = 0;
-    do
+        [[nodiscard]] bool is_dac() const
+        {
+            return type == 0x01 && address == 0x2a;
+        }
+    };
+
+    // Reads the writes up to the next wait. Returns false if the data ended without a wait.
+    bool read_frame(GymReader& reader, std::vector<GymWrite>& frame)
     {
-        const auto data = gzgetc(in); // GYM data type byte
-        if (data == 0 || data == EOF)
+        frame.clear();
+        while (true)
         {
-            break;
+            const auto type = reader.get();
+            switch (type)
+            {
+            case EOF:
+                return false;
+            case 0x00:
+                return true;
+            case 0x01:
+            case 0x02:
+                {
+                    const auto address = reader.get();
+                    const auto data = reader.get();
+                    if (data == EOF)
+                    {
+                        return false;
+                    }
+                    frame.push_back({type, address, data});
+                    break;
+                }
+            case 0x03:
+                {
+                    const auto data = reader.get();
+                    if (data == EOF)
+                    {
+                        return false;
+                    }
+                    frame.push_back({type, 0, data});
+                    break;
+                }
+            default: // Ignore unwanted bytes
+                break;
+            }
         }
+    }
 
-        switch (data)
+    // Writes a frame's data to the VGM. DAC writes are spread evenly through the frame, otherwise the wait is written
+    // if there was one. Returns true if the frame took up time.
+    bool write_frame(BinaryData& out, const std::vector<GymWrite>& frame, const bool hasWait, OldVGMHeader& vgmHeader)
+    {
+        const auto numDacValues = std::ranges::count_if(frame, [](const GymWrite& write) { return write.is_dac(); });
+        int i = 0;
+        for (const auto& write : frame)
         {
-        case 0x01:
+            switch (write.type)
             {
-                gzputc(out, VGM_YM2612_0);
-                const auto address = gzgetc(in); // 2a for DAC, etc
-                gzputc(out, address);
-                gzputc(out, gzgetc(in));
-                if (address == 0x2a)
+            case 0x01:
+                out.write_uint8(VGM_YM2612_0);
+                out.write_uint8(static_cast<uint8_t>(write.address));
+                out.write_uint8(static_cast<uint8_t>(write.data));
+                vgmHeader.YM2612Clock = 7670454; // 3579545*15/7
+                if (write.is_dac())
                 {
                     // Got to DAC data so let's pause
-                    // Calculate pause length
                     const long waitLength = (LEN60TH * (i + 1) / numDacValues) - (LEN60TH * i / numDacValues);
-                    // Write pause
                     write_pause(out, waitLength);
-                    // Increment counter
                     ++i;
                 }
                 break;
+            case 0x02:
+                out.write_uint8(VGM_YM2612_1);
+                out.write_uint8(static_cast<uint8_t>(write.address));
+                out.write_uint8(static_cast<uint8_t>(write.data));
+                vgmHeader.YM2612Clock = 7670454;
+                break;
+            case 0x03:
+                out.write_uint8(VGM_PSG);
+                out.write_uint8(static_cast<uint8_t>(write.data));
+                vgmHeader.PSGClock = 3579545;
+                vgmHeader.PSGShiftRegisterWidth = 16;
+                vgmHeader.PSGWhiteNoiseFeedback = 0x0009;
+                break;
+            default:
+                break;
             }
-        case 0x02:
-            gzputc(out, VGM_YM2612_1);
-            gzputc(out, gzgetc(in));
-            gzputc(out, gzgetc(in));
-            break;
-        case 0x03:
-            gzputc(out, VGM_PSG);
-            gzputc(out, gzgetc(in));
-            break;
-        default:
-            break;
         }
+        if (numDacValues > 0)
+        {
+            // The DAC pauses absorb the wait
+            return true;
+        }
+        if (hasWait)
+        {
+            out.write_uint8(VGM_PAUSE_60TH);
+            return true;
+        }
+        return false;
     }
-    while (true);
-
-    // 4. Finished!
 }
 
-void Convert::gymToVgm(const std::string& filename, gzFile in, gzFile out, OldVGMHeader& vgmHeader)
+void Convert::gymToVgm(const std::span<const uint8_t> in, BinaryData& out, OldVGMHeader& vgmHeader)
 {
     // GYM format:
     // 00    wait
     // 01 aa dd  YM2612 port 0 address aa data dd
     // 02 aa dd  YM2612 port 1 address aa data dd
     // 03 dd  PSG data dd
+    // We convert it a frame at a time, so we never need to seek in the input.
 
     // Check for GYMX header
     TGYMXHeader header{};
-    gzread(in, &header, sizeof(header));
-
-    if (strncmp(header.gym_id, "GYMX", 4) == 0)
+    auto isCompressed = false;
+    auto data = in;
+    if (data.size() >= GYMX_HEADER_SIZE && strncmp(reinterpret_cast<const char*>(data.data()), "GYMX", 4) == 0)
     {
         // File has a GYM header
+        std::memcpy(&header, data.data(), sizeof(header));
+        data = data.subspan(GYMX_HEADER_SIZE);
 
-        // Is the file compressed?
-        if (header.compressed)
-        {
-            // Can't handle that
-            throw std::runtime_error(std::format("Cannot convert compressed GYM \"{}\" - see vgmtool.txt", filename));
-        }
+        // If the file is compressed, the rest is a zlib stream and this is the uncompressed size
+        isCompressed = header.compressed != 0;
 
-        // To do: put the tag information in a GD3, handle looping
+        // To do: put the tag information in a GD3
 
         if (header.looped)
         {
@@ -141,58 +262,22 @@ void Convert::gymToVgm(const std::string& filename, gzFile in, gzFile out, OldVG
             // Store it temporarily in LoopLength
             vgmHeader.LoopLength = (header.looped - 1) * LEN60TH;
         }
-
-        // Seek to the GYM data
-        gzseek(in, 428, SEEK_SET);
     }
+    // Else it's all GYM data
 
-    // To do:
-    // GYMX handling
-    // - GD3 from header
-    // - looping (check it works)
-    while (!gzeof(in))
+    GymReader reader(data, isCompressed);
+    std::vector<GymWrite> frame;
+    auto hasWait = true;
+    while (hasWait)
     {
-        if (header.looped && (vgmHeader.TotalLength == vgmHeader.LoopLength))
+        if (header.looped && vgmHeader.TotalLength == vgmHeader.LoopLength && vgmHeader.LoopOffset == 0)
         {
-            vgmHeader.LoopOffset = gztell(out) - LOOPDELTA;
+            vgmHeader.LoopOffset = out.offset() - LOOPDELTA;
         }
-        switch (gzgetc(in))
+        hasWait = read_frame(reader, frame);
+        if (write_frame(out, frame, hasWait, vgmHeader))
         {
-        case 0: // Wait 1/60s
-            gzputc(out, VGM_PAUSE_60TH);
             vgmHeader.TotalLength += LEN60TH;
-            break;
-        case 1: // YM2612 port 0
-            if (const auto registerNumber = gzgetc(in); registerNumber == 0x2a)
-            {
-                // DAC...
-                spread_dac(in, out);
-                vgmHeader.TotalLength += LEN60TH;
-                // SpreadDAC absorbs the next wait command
-            }
-            else
-            {
-                gzputc(out, VGM_YM2612_0);
-                gzputc(out, registerNumber);
-                gzputc(out, gzgetc(in));
-            }
-            vgmHeader.YM2612Clock = 7670454; // 3579545*15/7
-            break;
-        case 2: // YM2612 port 1
-            gzputc(out, VGM_YM2612_1);
-            gzputc(out, gzgetc(in));
-            gzputc(out, gzgetc(in));
-            vgmHeader.YM2612Clock = 7670454;
-            break;
-        case 3: // PSG
-            gzputc(out, VGM_PSG);
-            gzputc(out, gzgetc(in));
-            vgmHeader.PSGClock = 3579545;
-            vgmHeader.PSGShiftRegisterWidth = 16;
-            vgmHeader.PSGWhiteNoiseFeedback = 0x0009;
-            break;
-        default: // Ignore unwanted bytes & EOF
-            break;
         }
     }
 
@@ -205,6 +290,27 @@ void Convert::gymToVgm(const std::string& filename, gzFile in, gzFile out, OldVG
     }
 }
 
+Convert::FileType Convert::file_type(const std::string& filename)
+{
+    const auto& extension = Utils::to_lower(std::filesystem::path(filename).extension().string());
+    if (extension == ".gym")
+    {
+        return FileType::Gym;
+    }
+    if (extension == ".cym")
+    {
+        return FileType::Cym;
+    }
+    if (extension == ".ssl")
+    {
+        return FileType::Ssl;
+    }
+    throw std::runtime_error(std::format(
+        R"(Unable to convert "{}" to VGM: unknown extension "{}")",
+        filename, 
+        extension));
+}
+
 bool Convert::to_vgm(const std::string& filename, const IVGMToolCallback& callback)
 {
     // Make output filename filename.ext.vgm
@@ -212,149 +318,129 @@ bool Convert::to_vgm(const std::string& filename, const IVGMToolCallback& callba
 
     callback.show_status(std::format("Converting \"{}\" to VGM format...", filename));
 
-    enum class file_type
-    {
-        gym,
-        cym,
-        ssl
-    } fileType;
+    const auto fileType = file_type(filename);
 
-    const auto& extension = Utils::to_lower(std::filesystem::path(filename).extension().string());
-    if (extension == ".gym")
-    {
-        fileType = file_type::gym;
-    }
-    else if (extension == ".cym")
+    try
     {
-        fileType = file_type::cym;
+        std::vector<uint8_t> data;
+        Utils::load_file(data, filename);
+        BinaryData out;
+        to_vgm(data, fileType, out);
+        out.save(outFilename);
+
+        // Do a final compression round
+        Utils::compress(outFilename, callback);
+
+        // Report
+        callback.show_conversion_progress(std::format(R"(Converted "{}" to "{}")", filename, outFilename));
     }
-    else if (extension == ".ssl")
+    catch (const OperationCancelled&)
     {
-        fileType = file_type::ssl;
+        std::filesystem::remove(outFilename.c_str());
+        throw;
     }
-    else
+    catch (const std::exception& e)
     {
-        throw std::runtime_error(std::format(
-            R"(Unable to convert "{}" to VGM: unknown extension "{}")",
-            filename, 
-            extension));
+        std::filesystem::remove(outFilename.c_str());
+        callback.show_error(std::format("Error converting \"{}\" to VGM: {}", filename, e.what()));
+        return false;
     }
 
-    // Open files
-    gzFile in = gzopen(filename.c_str(), "rb");
-    gzFile out = gzopen(outFilename.c_str(), "wb0");
+    return true;
+}
 
-    gzseek(out, VGM_DATA_OFFSET, SEEK_SET);
+void Convert::to_vgm(const std::span<const uint8_t> data, const FileType type, BinaryData& out)
+{
+    // The header is filled in at the end
+    out.write_range(std::vector<uint8_t>(VGM_DATA_OFFSET));
 
     // Fill in VGM header
     OldVGMHeader vgmHeader;
     vgmHeader.RecordingRate = 60;
     vgmHeader.Version = 0x110;
 
-    try
+    // Like gzgetc()
+    size_t offset = 0;
+    auto get = [&]
+    {
+        return offset < data.size() ? data[offset++] : EOF;
+    };
+
+    switch (type)
     {
-        switch (fileType)
+    case FileType::Gym:
+        gymToVgm(data, out, vgmHeader);
+        break;
+    case FileType::Ssl:
         {
-        case file_type::gym:
-            gymToVgm(filename, in, out, vgmHeader);
-            break;
-        case file_type::ssl:
-            {
-                // SSL format:
-                // 00    wait
-                // 03 dd  PSG data dd
-                // 04 dd  GG stereo dd
-                // 05 aa  YM2413 address aa
-                // 06 dd  YM2413 data dd
-                int ym2413Address = 0;
-                while (!gzeof(in))
-                {
-                    switch (gzgetc(in))
-                    {
-                    case 0: // Wait 1/60s
-                        gzputc(out, VGM_PAUSE_60TH);
-                        vgmHeader.TotalLength += LEN60TH;
-                        break;
-                    case 3: // PSG
-                        gzputc(out, VGM_PSG);
-                        gzputc(out, gzgetc(in));
-                        vgmHeader.PSGClock = 3579545;
-                        vgmHeader.PSGShiftRegisterWidth = 16;
-                        vgmHeader.PSGWhiteNoiseFeedback = 0x0009;
-                        break;
-                    case 4: // GG stereo
-                        gzputc(out, VGM_GGST);
-                        gzputc(out, gzgetc(in));
-                        break;
-                    case 5: // YM2413 address
-                        ym2413Address = gzgetc(in);
-                        break;
-                    case 6: // YM2413 data
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, ym2413Address);
-                        gzputc(out, gzgetc(in));
-                        vgmHeader.YM2413Clock = 3579545;
-                        break;
-                    default: // Ignore unwanted bytes & EOF
-                        break;
-                    }
-                }
-                break;
-            }
-        case file_type::cym:
-            // CYM format
+            // SSL format:
             // 00    wait
-            // aa dd  YM2151 address aa data dd
-            do
+            // 03 dd  PSG data dd
+            // 04 dd  GG stereo dd
+            // 05 aa  YM2413 address aa
+            // 06 dd  YM2413 data dd
+            uint8_t ym2413Address = 0;
+            while (offset < data.size())
             {
-                auto b1 = gzgetc(in);
-                switch (b1)
+                switch (get())
                 {
                 case 0: // Wait 1/60s
-                    gzputc(out, VGM_PAUSE_60TH);
+                    out.write_uint8(VGM_PAUSE_60TH);
                     vgmHeader.TotalLength += LEN60TH;
                     break;
-                case EOF: // Needs specific handling this time
+                case 3: // PSG
+                    out.write_uint8(VGM_PSG);
+                    out.write_uint8(static_cast<uint8_t>(get()));
+                    vgmHeader.PSGClock = 3579545;
+                    vgmHeader.PSGShiftRegisterWidth = 16;
+                    vgmHeader.PSGWhiteNoiseFeedback = 0x0009;
+                    break;
+                case 4: // GG stereo
+                    out.write_uint8(VGM_GGST);
+                    out.write_uint8(static_cast<uint8_t>(get()));
                     break;
-                default: // Other data
-                    gzputc(out, VGM_YM2151);
-                    gzputc(out, b1);
-                    b1 = gzgetc(in);
-                    gzputc(out, b1);
-                    vgmHeader.YM2151Clock = 7670454;
+                case 5: // YM2413 address
+                    ym2413Address = static_cast<uint8_t>(get());
+                    break;
+                case 6: // YM2413 data
+                    out.write_uint8(VGM_YM2413);
+                    out.write_uint8(ym2413Address);
+                    out.write_uint8(static_cast<uint8_t>(get()));
+                    vgmHeader.YM2413Clock = 3579545;
+                    break;
+                default: // Ignore unwanted bytes & EOF
                     break;
                 }
             }
-            while (!gzeof(in));
             break;
         }
-
-        gzputc(out, VGM_END);
-
-        // Fill in more of the VGM header
-        vgmHeader.EoFOffset = gztell(out) - EOFDELTA;
-
-        // Close files
-        gzclose(out);
-        gzclose(in);
-
-        // Update header
-        write_vgm_header(outFilename, vgmHeader, callback);
-
-        // Do a final compression round
-        Utils::compress(outFilename, callback);
-
-        // Report
-        callback.show_conversion_progress(std::format(R"(Converted "{}" to "{}")", filename, outFilename));
-    }
-    catch (const std::exception& e)
-    {
-        gzclose(out);
-        gzclose(in);
-        std::filesystem::remove(outFilename.c_str());
-        callback.show_error(std::format("Error converting \"{}\" to VGM: {}", filename, e.what()));
-        return false;
+    case FileType::Cym:
+        // CYM format
+        // 00    wait
+        // aa dd  YM2151 address aa data dd
+        while (offset < data.size())
+        {
+            switch (const auto b1 = get())
+            {
+            case 0: // Wait 1/60s
+                out.write_uint8(VGM_PAUSE_60TH);
+                vgmHeader.TotalLength += LEN60TH;
+                break;
+            default: // Other data
+                out.write_uint8(VGM_YM2151);
+                out.write_uint8(static_cast<uint8_t>(b1));
+                out.write_uint8(static_cast<uint8_t>(get()));
+                vgmHeader.YM2151Clock = 7670454;
+                break;
+            }
+        }
+        break;
     }
 
-    return true;
+    out.write_uint8(VGM_END);
+
+    // Fill in more of the VGM header
+    vgmHeader.EoFOffset = out.offset() - EOFDELTA;
+    out.seek(0);
+    out.write_range({reinterpret_cast<const uint8_t*>(&vgmHeader), sizeof(vgmHeader)});
 }
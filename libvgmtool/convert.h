@@ -1,17 +1,29 @@
 #pragma once
+#include <span>
 #include <string>
 
 #include "vgm.h"
 
 // Conversion routines
 
+class BinaryData;
 class IVGMToolCallback;
 
 class Convert
 {
 public:
+    enum class FileType
+    {
+        Gym,
+        Cym,
+        Ssl
+    };
+
+    // Gets the file type from its extension. Throws if it's not one we can convert.
+    static FileType file_type(const std::string& filename);
     static bool to_vgm(const std::string& filename, const IVGMToolCallback& callback);
+    // Converts file data in memory to uncompressed VGM data, written to out
+    static void to_vgm(std::span<const uint8_t> data, FileType type, BinaryData& out);
 private:
-    static void gymToVgm(const std::string& filename, gzFile in,
-                         gzFile out, OldVGMHeader& vgmHeader);
+    static void gymToVgm(std::span<const uint8_t> in, BinaryData& out, OldVGMHeader& vgmHeader);
 };
@@ -0,0 +1,335 @@
+#include "dacstream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+
+#include "IVGMToolCallback.h"
+#include "PcmCompression.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    // Runs shorter than this are left as individual writes, as the stream commands would be bigger
+    constexpr auto MIN_RUN_LENGTH = 32;
+    // How far (in samples) a write in a run can be from where the stream will play it
+    constexpr auto TIMING_TOLERANCE = 1.0;
+    constexpr auto SAMPLE_RATE = 44100.0;
+    // Data block type and stream chip type for the YM2612
+    constexpr uint8_t YM2612_DATA_TYPE = 0x00;
+    constexpr uint8_t YM2612_COMPRESSED_DATA_TYPE = YM2612_DATA_TYPE + VgmCommands::DataBlock::COMPRESSED_TYPE_OFFSET;
+    constexpr uint8_t YM2612_CHIP_TYPE = 0x02;
+    constexpr uint8_t YM2612_DAC_REGISTER = 0x2a;
+    constexpr uint8_t STREAM_ID = 0;
+
+    struct DacWrite
+    {
+        size_t commandIndex;
+        uint32_t time;
+        uint8_t value;
+        // Runs can't cross the loop point, so we number the parts of the file either side of it
+        int part;
+    };
+
+    struct Run
+    {
+        size_t firstWrite;
+        size_t count;
+        uint32_t frequency;
+        uint32_t dataOffset;
+    };
+
+    // Picks a stream frequency which plays a write every [minPeriod, maxPeriod] samples, or 0 if there isn't one
+    uint32_t pick_frequency(const double minPeriod, const double maxPeriod)
+    {
+        const auto minFrequency = static_cast<uint32_t>(std::ceil(SAMPLE_RATE / maxPeriod));
+        const auto maxFrequency = static_cast<uint32_t>(std::floor(SAMPLE_RATE / minPeriod));
+        if (minFrequency > maxFrequency)
+        {
+            return 0;
+        }
+        const auto ideal = static_cast<uint32_t>(std::lround(SAMPLE_RATE * 2 / (minPeriod + maxPeriod)));
+        return std::clamp(ideal, std::max(minFrequency, 1u), maxFrequency);
+    }
+
+    // Finds the DAC writes, or returns false if the file can't be converted
+    bool find_writes(const std::vector<VgmCommands::ICommand*>& commands, std::vector<DacWrite>& writes, const IVGMToolCallback& callback)
+    {
+        std::vector<uint8_t> bank;
+        std::optional<PcmCompression::Table> table;
+        uint32_t bankOffset = 0;
+        uint32_t time = 0;
+        int part = 0;
+        for (auto i = 0u; i < commands.size(); ++i)
+        {
+            const auto* pCommand = commands[i];
+            if (const auto* pWrite = dynamic_cast<const VgmCommands::YM2612Port0*>(pCommand);
+                pWrite != nullptr && pWrite->registerIndex() == YM2612_DAC_REGISTER)
+            {
+                writes.push_back({i, time, pWrite->value(), part});
+            }
+            else if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+            {
+                if (bankOffset >= bank.size())
+                {
+                    throw std::runtime_error(std::format("YM2612 sample read from offset {} past end of data bank", bankOffset));
+                }
+                writes.push_back({i, time, bank[bankOffset++], part});
+                time += pSample->duration();
+            }
+            else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
+            {
+                time += pWait->duration();
+            }
+            else if (const auto* pSeek = dynamic_cast<const VgmCommands::PCMSeek*>(pCommand); pSeek != nullptr)
+            {
+                bankOffset = pSeek->address();
+            }
+            else if (const auto* pDataBlock = dynamic_cast<const VgmCommands::DataBlock*>(pCommand); pDataBlock != nullptr)
+            {
+                if (pDataBlock->type() == YM2612_DATA_TYPE)
+                {
+                    bank.insert(bank.end(), pDataBlock->data().begin(), pDataBlock->data().end());
+                }
+                else if (pDataBlock->type() == YM2612_COMPRESSED_DATA_TYPE)
+                {
+                    const auto& data = PcmCompression::decompress(pDataBlock->data(), table ? &*table : nullptr);
+                    bank.insert(bank.end(), data.begin(), data.end());
+                }
+                else if (pDataBlock->type() == VgmCommands::DataBlock::DECOMPRESSION_TABLE_TYPE)
+                {
+                    table = PcmCompression::Table::from_payload(pDataBlock->data());
+                }
+            }
+            else if (pCommand->chip() == VgmHeader::Chip::GenericDAC)
+            {
+                callback.show_error("File already uses DAC streams");
+                return false;
+            }
+            else if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                ++part;
+            }
+        }
+        return true;
+    }
+
+    // Finds runs of writes at a steady rate. A run is extended for as long as there is a stream frequency that
+    // would play every write in it within TIMING_TOLERANCE of its original time.
+    std::vector<Run> find_runs(const std::vector<DacWrite>& writes)
+    {
+        std::vector<Run> runs;
+        for (size_t start = 0; start < writes.size();)
+        {
+            // The range of periods (in samples) which fit so far
+            auto minPeriod = 1.0;
+            auto maxPeriod = std::numeric_limits<double>::infinity();
+            auto frequency = 0u;
+            auto end = start + 1;
+            for (; end < writes.size() && writes[end].part == writes[start].part; ++end)
+            {
+                const auto count = static_cast<double>(end - start);
+                const auto elapsed = static_cast<double>(writes[end].time - writes[start].time);
+                const auto newMinPeriod = std::max(minPeriod, (elapsed - TIMING_TOLERANCE) / count);
+                const auto newMaxPeriod = std::min(maxPeriod, (elapsed + TIMING_TOLERANCE) / count);
+                const auto newFrequency = newMinPeriod <= newMaxPeriod ? pick_frequency(newMinPeriod, newMaxPeriod) : 0;
+                if (newFrequency == 0)
+                {
+                    break;
+                }
+                minPeriod = newMinPeriod;
+                maxPeriod = newMaxPeriod;
+                frequency = newFrequency;
+            }
+            if (end - start >= MIN_RUN_LENGTH)
+            {
+                runs.push_back({start, end - start, frequency, 0});
+                start = end;
+            }
+            else
+            {
+                // The last write that fitted may be the start of a run
+                start = std::max(start + 1, end - 1);
+            }
+        }
+        return runs;
+    }
+
+    // Puts the run data into the bank, reusing any existing data which starts with the same bytes
+    void add_to_bank(const std::vector<DacWrite>& writes, std::vector<Run>& runs, std::vector<uint8_t>& bank)
+    {
+        // Offsets of the start of each sample in the bank, by the hash of its first MIN_RUN_LENGTH bytes
+        std::unordered_map<uint64_t, std::vector<uint32_t>> samplesByPrefix;
+        std::vector<uint8_t> sample;
+        for (auto& run : runs)
+        {
+            sample.clear();
+            for (auto i = 0u; i < run.count; ++i)
+            {
+                sample.push_back(writes[run.firstWrite + i].value);
+            }
+            auto& candidates = samplesByPrefix[Utils::hash(sample.data(), MIN_RUN_LENGTH)];
+            const auto it = std::ranges::find_if(candidates, [&](const uint32_t offset)
+            {
+                return offset + sample.size() <= bank.size() &&
+                    std::equal(sample.begin(), sample.end(), bank.begin() + offset);
+            });
+            if (it != candidates.end())
+            {
+                run.dataOffset = *it;
+                continue;
+            }
+            run.dataOffset = static_cast<uint32_t>(bank.size());
+            candidates.push_back(run.dataOffset);
+            bank.insert(bank.end(), sample.begin(), sample.end());
+        }
+    }
+}
+
+void convert_dac_to_streams(VgmFile& file, const IVGMToolCallback& callback)
+{
+    if (file.header().clock(VgmHeader::Chip::YM2612) == 0)
+    {
+        callback.show_status("No YM2612, nothing to do");
+        return;
+    }
+
+    auto& commands = file.commands();
+    std::vector<DacWrite> writes;
+    if (!find_writes(commands, writes, callback))
+    {
+        return;
+    }
+    auto runs = find_runs(writes);
+    if (runs.empty())
+    {
+        callback.show_status("No DAC runs found");
+        return;
+    }
+    std::vector<uint8_t> bank;
+    add_to_bank(writes, runs, bank);
+
+    // Index of the run starting at each write, or -1
+    std::vector<int> runStartingAt(writes.size(), -1);
+    // Whether each write is played by a stream
+    std::vector<bool> isStreamed(writes.size(), false);
+    for (auto i = 0u; i < runs.size(); ++i)
+    {
+        runStartingAt[runs[i].firstWrite] = static_cast<int>(i);
+        std::fill_n(isStreamed.begin() + static_cast<std::ptrdiff_t>(runs[i].firstWrite), runs[i].count, true);
+    }
+
+    std::vector<VgmCommands::ICommand*> result;
+    result.reserve(commands.size());
+
+    // The data and stream setup go at the start
+    auto* pBank = new VgmCommands::DataBlock();
+    const auto bankSize = bank.size();
+    pBank->set_data(YM2612_DATA_TYPE, std::move(bank));
+    result.push_back(pBank);
+    auto* pSetup = new VgmCommands::DacStreamControlSetup();
+    pSetup->set(STREAM_ID, YM2612_CHIP_TYPE, 0, YM2612_DAC_REGISTER);
+    result.push_back(pSetup);
+    auto* pSetData = new VgmCommands::DacStreamSetData();
+    pSetData->set(STREAM_ID, YM2612_DATA_TYPE, 1, 0);
+    result.push_back(pSetData);
+
+    uint32_t pendingWait = 0;
+    auto flushWait = [&]
+    {
+        CommandStream::add_wait(result, pendingWait);
+        pendingWait = 0;
+    };
+
+    auto writeIndex = 0u;
+    uint32_t streamFrequency = 0;
+    for (auto i = 0u; i < commands.size(); ++i)
+    {
+        auto* pCommand = commands[i];
+        if (writeIndex < writes.size() && writes[writeIndex].commandIndex == i)
+        {
+            const auto& write = writes[writeIndex];
+            if (const auto runIndex = runStartingAt[writeIndex]; runIndex >= 0)
+            {
+                const auto& run = runs[runIndex];
+                flushWait();
+                if (run.frequency != streamFrequency)
+                {
+                    auto* pFrequency = new VgmCommands::DacStreamSetFrequency();
+                    pFrequency->set(STREAM_ID, run.frequency);
+                    result.push_back(pFrequency);
+                    streamFrequency = run.frequency;
+                }
+                auto* pStart = new VgmCommands::DacStreamStart();
+                pStart->set(STREAM_ID, run.dataOffset, VgmCommands::DacStreamStart::LENGTH_COMMANDS, static_cast<uint32_t>(run.count));
+                result.push_back(pStart);
+            }
+            else if (!isStreamed[writeIndex])
+            {
+                flushWait();
+                auto* pWrite = new VgmCommands::YM2612Port0();
+                pWrite->set_register(YM2612_DAC_REGISTER);
+                pWrite->set_value(write.value);
+                result.push_back(pWrite);
+            }
+            if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+            {
+                pendingWait += pSample->duration();
+            }
+            ++writeIndex;
+            delete pCommand;
+        }
+        else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
+        {
+            pendingWait += pWait->duration();
+            delete pCommand;
+        }
+        else if (dynamic_cast<const VgmCommands::PCMSeek*>(pCommand) != nullptr)
+        {
+            // Only needed for the samples we replaced
+            delete pCommand;
+        }
+        else if (const auto* pDataBlock = dynamic_cast<const VgmCommands::DataBlock*>(pCommand);
+            pDataBlock != nullptr && (pDataBlock->type() == YM2612_DATA_TYPE || pDataBlock->type() == YM2612_COMPRESSED_DATA_TYPE))
+        {
+            // Replaced by our data
+            delete pCommand;
+        }
+        else
+        {
+            if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                // We can arrive here from the end of the file, so we can't assume the frequency
+                streamFrequency = 0;
+            }
+            flushWait();
+            result.push_back(pCommand);
+        }
+    }
+    flushWait();
+
+    // The commands are now owned by result
+    const auto commandCountBefore = commands.size();
+    commands.swap(result);
+
+    if (auto version = file.header().version(); !version.at_least(1, 60))
+    {
+        version.set_major(1);
+        version.set_minor(60);
+        file.header().set_version(version);
+    }
+
+    callback.show_status(std::format(
+        "Converted {} of {} DAC writes to {} streams using {} bytes of data; {} commands -> {} commands",
+        std::count(isStreamed.begin(), isStreamed.end(), true),
+        writes.size(),
+        runs.size(),
+        bankSize,
+        commandCountBefore,
+        commands.size()));
+}
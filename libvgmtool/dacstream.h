@@ -0,0 +1,11 @@
+#pragma once
+
+// Conversion of YM2612 DAC writes to DAC stream commands
+
+class IVGMToolCallback;
+class VgmFile;
+
+// Finds runs of YM2612 DAC writes at a steady rate (either 0x52 0x2a dd writes, or 0x8n data bank samples) and
+// replaces them with a data block holding the (deduplicated) sample data, plus DAC stream commands to play it.
+// Writes not in a run become plain 0x52 0x2a dd writes. This needs VGM 1.60, so the version is updated if needed.
+void convert_dac_to_streams(VgmFile& file, const IVGMToolCallback& callback);
@@ -0,0 +1,108 @@
+#include "datablocks.h"
+
+#include <format>
+#include <optional>
+
+#include "IVGMToolCallback.h"
+#include "PcmCompression.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+void decompress_data_blocks(VgmFile& file, const IVGMToolCallback& callback)
+{
+    auto& commands = file.commands();
+    std::vector<VgmCommands::ICommand*> result;
+    result.reserve(commands.size());
+    std::optional<PcmCompression::Table> table;
+    size_t sizeBefore = 0;
+    size_t sizeAfter = 0;
+    for (auto* pCommand : commands)
+    {
+        auto* pDataBlock = dynamic_cast<VgmCommands::DataBlock*>(pCommand);
+        if (pDataBlock == nullptr)
+        {
+            result.push_back(pCommand);
+            continue;
+        }
+        if (pDataBlock->type() == VgmCommands::DataBlock::DECOMPRESSION_TABLE_TYPE)
+        {
+            table = PcmCompression::Table::from_payload(pDataBlock->data());
+            sizeBefore += pDataBlock->length();
+            delete pCommand;
+            continue;
+        }
+        if (pDataBlock->is_compressed())
+        {
+            sizeBefore += pDataBlock->length();
+            pDataBlock->set_data(
+                pDataBlock->type() - VgmCommands::DataBlock::COMPRESSED_TYPE_OFFSET,
+                PcmCompression::decompress(pDataBlock->data(), table ? &*table : nullptr));
+            sizeAfter += pDataBlock->length();
+        }
+        result.push_back(pCommand);
+    }
+    commands.swap(result);
+
+    callback.show_status(std::format("Decompressed data blocks: {} bytes -> {} bytes", sizeBefore, sizeAfter));
+}
+
+void compress_data_blocks(VgmFile& file, const IVGMToolCallback& callback)
+{
+    // We start from uncompressed data
+    decompress_data_blocks(file, callback);
+
+    auto& commands = file.commands();
+    std::vector<VgmCommands::ICommand*> result;
+    result.reserve(commands.size());
+    std::optional<PcmCompression::Table> table;
+    size_t sizeBefore = 0;
+    size_t sizeAfter = 0;
+    auto compressedCount = 0;
+    for (auto* pCommand : commands)
+    {
+        auto* pDataBlock = dynamic_cast<VgmCommands::DataBlock*>(pCommand);
+        if (pDataBlock == nullptr || !PcmCompression::is_compressible_type(pDataBlock->type()))
+        {
+            result.push_back(pCommand);
+            continue;
+        }
+        sizeBefore += pDataBlock->length();
+        auto compressed = PcmCompression::compress(pDataBlock->data());
+        if (compressed.payload.empty())
+        {
+            // No gain
+            sizeAfter += pDataBlock->length();
+            result.push_back(pCommand);
+            continue;
+        }
+        if (compressed.needsTable && table != compressed.table)
+        {
+            auto* pTable = new VgmCommands::DataBlock();
+            pTable->set_data(VgmCommands::DataBlock::DECOMPRESSION_TABLE_TYPE, compressed.table.to_payload());
+            sizeAfter += pTable->length();
+            result.push_back(pTable);
+            table = compressed.table;
+        }
+        pDataBlock->set_data(pDataBlock->type() + VgmCommands::DataBlock::COMPRESSED_TYPE_OFFSET, std::move(compressed.payload));
+        sizeAfter += pDataBlock->length();
+        result.push_back(pCommand);
+        ++compressedCount;
+    }
+    commands.swap(result);
+
+    if (compressedCount > 0)
+    {
+        if (auto version = file.header().version(); !version.at_least(1, 60))
+        {
+            version.set_major(1);
+            version.set_minor(60);
+            file.header().set_version(version);
+        }
+    }
+
+    callback.show_status(std::format(
+        "Compressed {} data blocks: {} bytes -> {} bytes",
+        compressedCount,
+        sizeBefore,
+        sizeAfter));
+}
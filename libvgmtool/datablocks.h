@@ -0,0 +1,13 @@
+#pragma once
+
+// Data block compression
+
+class IVGMToolCallback;
+class VgmFile;
+
+// Compresses every PCM data block that can be made smaller, adding decompression tables where needed.
+// Any existing compression is redone. This needs VGM 1.60, so the version is updated if needed.
+void compress_data_blocks(VgmFile& file, const IVGMToolCallback& callback);
+
+// Decompresses all compressed data blocks, and removes the decompression tables
+void decompress_data_blocks(VgmFile& file, const IVGMToolCallback& callback);
@@ -0,0 +1,661 @@
+#include "diff.h"
+
+#include <algorithm>
+#include <format>
+#include <limits>
+#include <map>
+#include <ranges>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include "BinaryData.h"
+#include "Profile.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    // Chunks end after a command whose hash has these bits clear, so they end in the same places in both files
+    constexpr uint64_t CHUNK_BOUNDARY_MASK = 0x3f;
+    constexpr size_t MIN_CHUNK_SIZE = 16;
+    constexpr size_t MAX_CHUNK_SIZE = 1024;
+    // Ranges we match up one by one with Myers' algorithm, which is slow for big ranges with many differences
+    constexpr size_t MAX_MYERS_SIZE = 20000;
+    constexpr int64_t MAX_EDIT_DISTANCE = 1000;
+    // Bigger ranges are lined up on the values which occur once in each, then the ranges between those. Each level
+    // usually finds more such values, but we give up eventually.
+    constexpr int MAX_ALIGN_DEPTH = 32;
+    // We only print this much of each command
+    constexpr size_t MAX_PRINTED_BYTES = 8;
+
+    struct Event
+    {
+        uint32_t time;
+        // In the file's commands
+        uint32_t index;
+    };
+
+    // The commands for one chip in one file
+    struct Stream
+    {
+        std::vector<Event> events;
+        std::vector<uint64_t> hashes;
+        // Where each chunk starts in events, followed by the end
+        std::vector<size_t> chunkStarts{0};
+        std::vector<uint64_t> chunkHashes;
+    };
+
+    struct DriftChange
+    {
+        VgmHeader::Chip chip;
+        uint32_t timeA;
+        uint32_t timeB;
+        int64_t drift;
+    };
+
+    using Matches = std::vector<std::pair<size_t, size_t>>;
+
+    void make_chunks(Stream& stream)
+    {
+        const auto& hashes = stream.hashes;
+        auto start = 0u;
+        auto hash = Utils::hash(nullptr, 0);
+        for (auto i = 0u; i < hashes.size(); ++i)
+        {
+            hash = Utils::hash(&hashes[i], sizeof(uint64_t), hash);
+            const size_t size = i + 1 - start;
+            if (size >= MAX_CHUNK_SIZE
+                || (size >= MIN_CHUNK_SIZE && ((hashes[i] >> 40) & CHUNK_BOUNDARY_MASK) == 0)
+                || i + 1 == hashes.size())
+            {
+                // The size is part of the hash, so matching chunks have the same number of commands
+                stream.chunkHashes.push_back(Utils::hash(&size, sizeof(size), hash));
+                stream.chunkStarts.push_back(i + 1);
+                start = i + 1;
+                hash = Utils::hash(nullptr, 0);
+            }
+        }
+    }
+
+    // Splits the file's commands by chip, with the time of each. Waits only count towards the time.
+    std::map<VgmHeader::Chip, Stream> read_streams(const VgmFile& file, uint32_t& length)
+    {
+        std::map<VgmHeader::Chip, Stream> streams;
+        const auto& commands = file.commands();
+        BinaryData scratch;
+        uint32_t time = 0;
+        Stream* pStream = nullptr;
+        auto streamChip = VgmHeader::Chip::Nothing;
+        for (auto i = 0u; i < commands.size(); ++i)
+        {
+            const auto* pCommand = commands[i];
+            const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+            const auto isSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) != nullptr;
+            if (pWait != nullptr && !isSample)
+            {
+                time += pWait->duration();
+                continue;
+            }
+
+            if (const auto chip = pCommand->chip(); pStream == nullptr || chip != streamChip)
+            {
+                pStream = &streams[chip];
+                streamChip = chip;
+            }
+            if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                // It has no data, so we give it a hash of its own
+                pStream->hashes.push_back(Utils::hash("loop", 4));
+            }
+            else
+            {
+                scratch.reset();
+                pCommand->to_data(scratch);
+                pStream->hashes.push_back(Utils::hash(scratch.buffer().data(), scratch.buffer().size()));
+            }
+            pStream->events.push_back({time, i});
+
+            if (isSample)
+            {
+                // A DAC write, then a wait
+                time += pWait->duration();
+            }
+        }
+        length = time;
+
+        for (auto& stream : streams | std::views::values)
+        {
+            make_chunks(stream);
+        }
+        return streams;
+    }
+
+    // Finds a longest common subsequence of a[aStart, aEnd) and b[bStart, bEnd) with Myers' algorithm, and appends the
+    // index pairs of it to matches in order. Returns false, having appended nothing, if there are more than
+    // MAX_EDIT_DISTANCE differences.
+    bool match_myers(
+        const std::vector<uint64_t>& a,
+        const size_t aStart,
+        const size_t aEnd,
+        const std::vector<uint64_t>& b,
+        const size_t bStart,
+        const size_t bEnd,
+        Matches& matches)
+    {
+        const auto n = static_cast<int64_t>(aEnd - aStart);
+        const auto m = static_cast<int64_t>(bEnd - bStart);
+        const auto equal = [&](const int64_t x, const int64_t y)
+        {
+            return a[aStart + static_cast<size_t>(x)] == b[bStart + static_cast<size_t>(y)];
+        };
+        const auto maxDistance = std::min(n + m, MAX_EDIT_DISTANCE);
+        // v[offset + k] is the furthest x reached on diagonal k = x - y
+        const auto offset = maxDistance + 1;
+        std::vector<int64_t> v(static_cast<size_t>(2 * offset + 1));
+        // v for diagonals -d to d at the start of each round d, to find our way back
+        std::vector<std::vector<int64_t>> trace;
+        auto found = false;
+        for (int64_t d = 0; d <= maxDistance && !found; ++d)
+        {
+            trace.emplace_back(v.begin() + (offset - d), v.begin() + (offset + d + 1));
+            for (auto k = -d; k <= d; k += 2)
+            {
+                auto x = k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1])
+                    ? v[offset + k + 1]
+                    : v[offset + k - 1] + 1;
+                auto y = x - k;
+                while (x < n && y < m && equal(x, y))
+                {
+                    ++x;
+                    ++y;
+                }
+                v[offset + k] = x;
+                if (x >= n && y >= m)
+                {
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+
+        Matches result;
+        auto x = n;
+        auto y = m;
+        for (auto d = static_cast<int64_t>(trace.size()) - 1; d >= 0; --d)
+        {
+            int64_t previousX = 0;
+            int64_t previousY = 0;
+            if (d > 0)
+            {
+                const auto& previousV = trace[static_cast<size_t>(d)];
+                const auto at = [&](const int64_t k)
+                {
+                    return previousV[static_cast<size_t>(k + d)];
+                };
+                const auto k = x - y;
+                const auto previousK = k == -d || (k != d && at(k - 1) < at(k + 1)) ? k + 1 : k - 1;
+                previousX = at(previousK);
+                previousY = previousX - previousK;
+            }
+            while (x > previousX && y > previousY)
+            {
+                --x;
+                --y;
+                result.emplace_back(aStart + static_cast<size_t>(x), bStart + static_cast<size_t>(y));
+            }
+            x = previousX;
+            y = previousY;
+        }
+        matches.insert(matches.end(), result.rbegin(), result.rend());
+        return true;
+    }
+
+    // Finds the values which occur exactly once in each of a[aStart, aEnd) and b[bStart, bEnd), and returns the longest
+    // run of their index pairs which is in order in both
+    Matches match_unique(
+        const std::vector<uint64_t>& a,
+        const size_t aStart,
+        const size_t aEnd,
+        const std::vector<uint64_t>& b,
+        const size_t bStart,
+        const size_t bEnd)
+    {
+        // Where each value is in a and b. NOT_SEEN and MORE_THAN_ONCE are never valid indices.
+        constexpr auto NOT_SEEN = std::numeric_limits<size_t>::max();
+        constexpr auto MORE_THAN_ONCE = NOT_SEEN - 1;
+        std::unordered_map<uint64_t, std::pair<size_t, size_t>> positions;
+        for (auto i = aStart; i < aEnd; ++i)
+        {
+            if (auto [it, isNew] = positions.try_emplace(a[i], i, NOT_SEEN); !isNew)
+            {
+                it->second.first = MORE_THAN_ONCE;
+            }
+        }
+        for (auto j = bStart; j < bEnd; ++j)
+        {
+            if (const auto it = positions.find(b[j]); it != positions.end())
+            {
+                it->second.second = it->second.second == NOT_SEEN ? j : MORE_THAN_ONCE;
+            }
+        }
+        Matches candidates;
+        for (const auto& [i, j] : positions | std::views::values)
+        {
+            if (i < MORE_THAN_ONCE && j < MORE_THAN_ONCE)
+            {
+                candidates.emplace_back(i, j);
+            }
+        }
+        std::ranges::sort(candidates);
+
+        // Longest increasing subsequence of the b indices. tails[n] is the candidate ending the best run of length n + 1.
+        std::vector<size_t> tails;
+        std::vector<size_t> previous(candidates.size());
+        for (auto i = 0u; i < candidates.size(); ++i)
+        {
+            const auto it = std::ranges::lower_bound(tails, candidates[i].second, {}, [&](const size_t index)
+            {
+                return candidates[index].second;
+            });
+            previous[i] = it == tails.begin() ? candidates.size() : *(it - 1);
+            if (it == tails.end())
+            {
+                tails.push_back(i);
+            }
+            else
+            {
+                *it = i;
+            }
+        }
+        Matches result;
+        for (auto i = tails.empty() ? candidates.size() : tails.back(); i < candidates.size(); i = previous[i])
+        {
+            result.push_back(candidates[i]);
+        }
+        std::ranges::reverse(result);
+        return result;
+    }
+
+    // Matches up as much of a[aStart, aEnd) and b[bStart, bEnd) as we can, appending the index pairs in order
+    void align(
+        const std::vector<uint64_t>& a,
+        size_t aStart,
+        size_t aEnd,
+        const std::vector<uint64_t>& b,
+        size_t bStart,
+        size_t bEnd,
+        Matches& matches,
+        const int depth = 0)
+    {
+        // Matching ends need no searching
+        for (; aStart < aEnd && bStart < bEnd && a[aStart] == b[bStart]; ++aStart, ++bStart)
+        {
+            matches.emplace_back(aStart, bStart);
+        }
+        size_t suffix = 0;
+        for (; aStart < aEnd && bStart < bEnd && a[aEnd - 1] == b[bEnd - 1]; --aEnd, --bEnd)
+        {
+            ++suffix;
+        }
+
+        if (aStart < aEnd && bStart < bEnd
+            && (aEnd - aStart + bEnd - bStart > MAX_MYERS_SIZE || !match_myers(a, aStart, aEnd, b, bStart, bEnd, matches))
+            && depth < MAX_ALIGN_DEPTH)
+        {
+            for (const auto& [i, j] : match_unique(a, aStart, aEnd, b, bStart, bEnd))
+            {
+                align(a, aStart, i, b, bStart, j, matches, depth + 1);
+                matches.emplace_back(i, j);
+                aStart = i + 1;
+                bStart = j + 1;
+            }
+            if (aStart != aEnd || bStart != bEnd)
+            {
+                align(a, aStart, aEnd, b, bStart, bEnd, matches, depth + 1);
+            }
+        }
+
+        for (auto i = 0u; i < suffix; ++i)
+        {
+            matches.emplace_back(aEnd + i, bEnd + i);
+        }
+    }
+
+    // Works through the differences for one chip
+    class ChipDiff
+    {
+    public:
+        ChipDiff(
+            const VgmHeader::Chip chip,
+            const Stream& a,
+            const Stream& b,
+            const VgmFile& fileA,
+            const VgmFile& fileB,
+            const size_t maxEntries,
+            DiffResult& result,
+            std::vector<DriftChange>& driftChanges)
+            : _chip(chip),
+              _a(a),
+              _b(b),
+              _fileA(fileA),
+              _fileB(fileB),
+              _maxEntries(maxEntries),
+              _result(result),
+              _driftChanges(driftChanges)
+        {
+        }
+
+        void run()
+        {
+            // First we match up whole chunks, which skips over everything that's the same quickly
+            Matches chunkMatches;
+            align(_a.chunkHashes, 0, _a.chunkHashes.size(), _b.chunkHashes, 0, _b.chunkHashes.size(), chunkMatches);
+
+            // Then we look at the commands between them one by one
+            size_t aNext = 0;
+            size_t bNext = 0;
+            for (const auto& [aChunk, bChunk] : chunkMatches)
+            {
+                const auto aStart = _a.chunkStarts[aChunk];
+                const auto bStart = _b.chunkStarts[bChunk];
+                compare_range(aNext, aStart, bNext, bStart, static_cast<int64_t>(_b.events[bStart].time) - _a.events[aStart].time);
+                aNext = _a.chunkStarts[aChunk + 1];
+                bNext = _b.chunkStarts[bChunk + 1];
+                add_matches(aStart, bStart, aNext - aStart);
+            }
+            compare_range(aNext, _a.events.size(), bNext, _b.events.size(), _drift);
+        }
+
+    private:
+        // Matches up commands which are the same at the same time, allowing for the timing before and after the range
+        void compare_range(const size_t aStart, const size_t aEnd, const size_t bStart, const size_t bEnd, const int64_t endDrift)
+        {
+            if (aStart == aEnd && bStart == bEnd)
+            {
+                return;
+            }
+            const auto key = [](const Stream& stream, const size_t index, const int64_t drift)
+            {
+                const int64_t time = stream.events[index].time + drift;
+                return Utils::hash(&time, sizeof(time), stream.hashes[index]);
+            };
+            std::vector<uint64_t> bKeys;
+            bKeys.reserve(bEnd - bStart);
+            for (auto j = bStart; j < bEnd; ++j)
+            {
+                bKeys.push_back(key(_b, j, 0));
+            }
+            std::vector<uint64_t> aKeys;
+            aKeys.reserve(aEnd - aStart);
+            for (auto i = aStart; i < aEnd; ++i)
+            {
+                aKeys.push_back(key(_a, i, _drift));
+            }
+            Matches matches;
+            align(aKeys, 0, aKeys.size(), bKeys, 0, bKeys.size(), matches);
+
+            if (endDrift != _drift)
+            {
+                // The timing changed somewhere in the range, so we try the new timing for the rest
+                for (auto i = 0u; i < aKeys.size(); ++i)
+                {
+                    aKeys[i] = key(_a, aStart + i, endDrift);
+                }
+                Matches allMatches;
+                size_t aNext = 0;
+                size_t bNext = 0;
+                for (const auto& [i, j] : matches)
+                {
+                    align(aKeys, aNext, i, bKeys, bNext, j, allMatches);
+                    allMatches.emplace_back(i, j);
+                    aNext = i + 1;
+                    bNext = j + 1;
+                }
+                align(aKeys, aNext, aKeys.size(), bKeys, bNext, bKeys.size(), allMatches);
+                matches.swap(allMatches);
+            }
+
+            auto aNext = aStart;
+            auto bNext = bStart;
+            for (const auto& [i, j] : matches)
+            {
+                const auto nextDrift = static_cast<int64_t>(_b.events[bStart + j].time) - _a.events[aStart + i].time;
+                add_differences(aNext, aStart + i, bNext, bStart + j, nextDrift);
+                add_matches(aStart + i, bStart + j, 1);
+                aNext = aStart + i + 1;
+                bNext = bStart + j + 1;
+            }
+            add_differences(aNext, aEnd, bNext, bEnd, endDrift);
+        }
+
+        void add_matches(const size_t aStart, const size_t bStart, const size_t count)
+        {
+            _result.matchedCount += count;
+            for (size_t i = 0; i < count; ++i)
+            {
+                const auto& a = _a.events[aStart + i];
+                const auto& b = _b.events[bStart + i];
+                if (const auto drift = static_cast<int64_t>(b.time) - a.time; drift != _drift)
+                {
+                    _driftChanges.push_back({_chip, a.time, b.time, drift});
+                    _drift = drift;
+                }
+            }
+        }
+
+        // Reports the commands which didn't match, in time order. Writes to the same register at the same time are
+        // reported as changes. nextDrift is the timing after them; it may have changed anywhere since the last match, so
+        // we line them up using it unless they line up with the timing before.
+        void add_differences(size_t aStart, const size_t aEnd, size_t bStart, const size_t bEnd, const int64_t nextDrift)
+        {
+            while (aStart < aEnd || bStart < bEnd)
+            {
+                const auto drift = aStart < aEnd && bStart < bEnd && _a.events[aStart].time + _drift == _b.events[bStart].time
+                    ? _drift
+                    : nextDrift;
+                const auto isAFirst = bStart == bEnd
+                    || (aStart < aEnd && _a.events[aStart].time + drift <= _b.events[bStart].time);
+                if (aStart < aEnd && bStart < bEnd && _a.events[aStart].time + drift == _b.events[bStart].time)
+                {
+                    const auto& aBytes = bytes(_fileA, _a.events[aStart]);
+                    const auto& bBytes = bytes(_fileB, _b.events[bStart]);
+                    if (aBytes.size() == bBytes.size() && aBytes.size() >= 3
+                        && std::equal(aBytes.begin(), aBytes.end() - 1, bBytes.begin()))
+                    {
+                        ++_result.changedCount;
+                        add_entry(DiffEntry::Kind::Changed, _a.events[aStart].time, _b.events[bStart].time, aBytes, bBytes);
+                        ++aStart;
+                        ++bStart;
+                        continue;
+                    }
+                }
+                if (isAFirst)
+                {
+                    const auto& event = _a.events[aStart++];
+                    ++_result.removedCount;
+                    add_entry(DiffEntry::Kind::Removed, event.time, to_time(event.time + drift), bytes(_fileA, event), {});
+                }
+                else
+                {
+                    const auto& event = _b.events[bStart++];
+                    ++_result.insertedCount;
+                    add_entry(DiffEntry::Kind::Inserted, to_time(event.time - drift), event.time, {}, bytes(_fileB, event));
+                }
+            }
+        }
+
+        void add_entry(
+            const DiffEntry::Kind kind,
+            const uint32_t timeA,
+            const uint32_t timeB,
+            const std::vector<uint8_t>& commandA,
+            const std::vector<uint8_t>& commandB)
+        {
+            // We only need the first few from each chip, as they're sorted by time later
+            if (++_entryCount > _maxEntries)
+            {
+                return;
+            }
+            _result.entries.push_back({kind, _chip, timeA, timeB, to_hex(commandA), to_hex(commandB), 0});
+        }
+
+        std::vector<uint8_t> bytes(const VgmFile& file, const Event& event)
+        {
+            _buffer.reset();
+            file.commands()[event.index]->to_data(_buffer);
+            return _buffer.buffer();
+        }
+
+        static uint32_t to_time(const int64_t time)
+        {
+            return static_cast<uint32_t>(std::max(time, int64_t{0}));
+        }
+
+        static std::string to_hex(const std::vector<uint8_t>& bytes)
+        {
+            std::string result;
+            for (auto i = 0u; i < bytes.size() && i < MAX_PRINTED_BYTES; ++i)
+            {
+                result += std::format("{}{:02x}", i == 0 ? "" : " ", bytes[i]);
+            }
+            if (bytes.size() > MAX_PRINTED_BYTES)
+            {
+                result += std::format(" ... ({} bytes)", bytes.size());
+            }
+            return result;
+        }
+
+        VgmHeader::Chip _chip;
+        const Stream& _a;
+        const Stream& _b;
+        const VgmFile& _fileA;
+        const VgmFile& _fileB;
+        size_t _maxEntries;
+        size_t _entryCount = 0;
+        DiffResult& _result;
+        std::vector<DriftChange>& _driftChanges;
+        // How much later the second file is, as of the last matching commands
+        int64_t _drift = 0;
+        BinaryData _buffer;
+    };
+}
+
+DiffResult diff_files(const VgmFile& a, const VgmFile& b, const size_t maxEntries)
+{
+    Profile::Scope scope("diff");
+    DiffResult result{};
+    // The files are independent until we compare them
+    std::map<VgmHeader::Chip, Stream> streamsA;
+    std::map<VgmHeader::Chip, Stream> streamsB;
+    Utils::parallel_for(2, [&](const size_t index)
+    {
+        if (index == 0)
+        {
+            streamsA = read_streams(a, result.lengthA);
+        }
+        else
+        {
+            streamsB = read_streams(b, result.lengthB);
+        }
+    });
+
+    std::map<VgmHeader::Chip, std::pair<const Stream*, const Stream*>> chips;
+    for (const auto& [chip, stream] : streamsA)
+    {
+        chips[chip].first = &stream;
+    }
+    for (const auto& [chip, stream] : streamsB)
+    {
+        chips[chip].second = &stream;
+    }
+    const Stream empty;
+    std::vector<DriftChange> driftChanges;
+    for (const auto& [chip, streams] : chips)
+    {
+        const auto& [pA, pB] = streams;
+        ChipDiff(chip, pA == nullptr ? empty : *pA, pB == nullptr ? empty : *pB, a, b, maxEntries, result, driftChanges).run();
+    }
+
+    // Timing changes usually affect all chips, so we only report them when they first show up
+    std::ranges::stable_sort(driftChanges, {}, &DriftChange::timeA);
+    int64_t drift = 0;
+    for (const auto& change : driftChanges)
+    {
+        if (change.drift == drift)
+        {
+            continue;
+        }
+        drift = change.drift;
+        ++result.driftCount;
+        if (result.driftCount <= maxEntries)
+        {
+            result.entries.push_back({DiffEntry::Kind::Drift, change.chip, change.timeA, change.timeB, {}, {}, drift});
+        }
+    }
+
+    std::ranges::stable_sort(result.entries, [](const DiffEntry& x, const DiffEntry& y)
+    {
+        return std::tie(x.timeA, x.timeB) < std::tie(y.timeA, y.timeB);
+    });
+    if (result.entries.size() > maxEntries)
+    {
+        result.entries.resize(maxEntries);
+    }
+    return result;
+}
+
+void write_diff(std::ostream& s, const DiffResult& result)
+{
+    s << std::format(
+        "Lengths: {} samples ({}) and {} samples ({})\n",
+        result.lengthA,
+        Utils::samples_to_display_text(result.lengthA, true),
+        result.lengthB,
+        Utils::samples_to_display_text(result.lengthB, true));
+    if (!result.entries.empty())
+    {
+        s << std::format("{:>10} {:>10}  {:<10} Difference\n", "Sample A", "Sample B", "Chip");
+    }
+    for (const auto& entry : result.entries)
+    {
+        s << std::format(
+            "{:>10} {:>10}  {:<10} ",
+            entry.timeA,
+            entry.timeB,
+            entry.chip == VgmHeader::Chip::Nothing ? "Other" : VgmHeader::chip_name(entry.chip));
+        switch (entry.kind)
+        {
+        case DiffEntry::Kind::Removed:
+            s << "- " << entry.commandA;
+            break;
+        case DiffEntry::Kind::Inserted:
+            s << "+ " << entry.commandB;
+            break;
+        case DiffEntry::Kind::Changed:
+            s << "~ " << entry.commandA << " -> " << entry.commandB;
+            break;
+        case DiffEntry::Kind::Drift:
+            s << std::format("Timing now {:+} samples", entry.drift);
+            break;
+        }
+        s << "\n";
+    }
+    const auto total = result.removedCount + result.insertedCount + result.changedCount + result.driftCount;
+    if (total > result.entries.size())
+    {
+        s << std::format("... and {} more\n", total - result.entries.size());
+    }
+    s << std::format(
+        "{} removed, {} inserted, {} changed, {} timing changes, {} commands the same\n",
+        result.removedCount,
+        result.insertedCount,
+        result.changedCount,
+        result.driftCount,
+        result.matchedCount);
+}
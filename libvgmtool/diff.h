@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "VgmHeader.h"
+
+// Compares the commands in two files, lined up by time and chip rather than by where they are in the file
+
+class VgmFile;
+
+struct DiffEntry
+{
+    enum class Kind
+    {
+        Removed,
+        Inserted,
+        Changed,
+        // Everything from here on happens at a different time
+        Drift,
+    };
+
+    Kind kind;
+    VgmHeader::Chip chip;
+    // When it happens in each file, in samples. For removed commands, timeB is where it would have been in the second
+    // file, and vice versa for inserted ones.
+    uint32_t timeA;
+    uint32_t timeB;
+    // The command in each file, as hex bytes
+    std::string commandA;
+    std::string commandB;
+    // For Drift, how much later things happen in the second file, in samples
+    int64_t drift;
+};
+
+struct DiffResult
+{
+    // In time order, up to the maximum asked for
+    std::vector<DiffEntry> entries;
+    // Of all the differences, including any not in entries
+    uint64_t removedCount;
+    uint64_t insertedCount;
+    uint64_t changedCount;
+    uint64_t driftCount;
+    // Commands found in both files
+    uint64_t matchedCount;
+    // In samples
+    uint32_t lengthA;
+    uint32_t lengthB;
+
+    [[nodiscard]] bool is_same() const
+    {
+        return removedCount == 0 && insertedCount == 0 && changedCount == 0 && driftCount == 0;
+    }
+};
+
+// Matches up the commands for each chip in the two files, ignoring waits, and reports the ones that don't match and
+// any changes in timing between the ones that do. Runs of commands which are the same in both files are found by
+// hashing, so files which are mostly the same are compared in linear time.
+DiffResult diff_files(const VgmFile& a, const VgmFile& b, size_t maxEntries);
+
+void write_diff(std::ostream& s, const DiffResult& result);
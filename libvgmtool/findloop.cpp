@@ -0,0 +1,226 @@
+#include "findloop.h"
+
+#include <algorithm>
+#include <ranges>
+#include <unordered_map>
+
+#include "RegisterModel.h"
+#include "SN76489State.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    // How many segments of upcoming commands are included in the hash at each point
+    constexpr auto WINDOW_SIZE = 16;
+    // Multiplier for the rolling hash of segments
+    constexpr uint64_t ROLLING_HASH_BASE = 0x100000001b3;
+    // We only keep the first few points for each hash, as the earliest loop start is the one we want
+    constexpr size_t MAX_MATCHES_PER_HASH = 4;
+
+    // The commands between two waits, plus the waits after them
+    struct Segment
+    {
+        // When it starts, in samples
+        uint32_t time;
+        // Hash of the chip state at the start
+        uint64_t stateHash;
+        // Hash of the commands, and the total wait time after them
+        uint64_t commandsHash;
+    };
+
+    class SegmentBuilder
+    {
+    public:
+        explicit SegmentBuilder(const VgmHeader& header)
+            : _psgState(header),
+              _registerModels(IRegisterModel::create_all(header))
+        {
+            start_segment();
+        }
+
+        void add(const VgmCommands::ICommand* pCommand)
+        {
+            if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+                pWait != nullptr && dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) == nullptr)
+            {
+                _waitTotal += pWait->duration();
+                _time += pWait->duration();
+                return;
+            }
+            if (_waitTotal > 0)
+            {
+                end_segment();
+                start_segment();
+            }
+
+            _buffer.reset();
+            pCommand->to_data(_buffer);
+            _current.commandsHash = Utils::hash(_buffer.buffer().data(), _buffer.buffer().size(), _current.commandsHash);
+
+            if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+            {
+                _psgState.add(pPsg);
+            }
+            else if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+            {
+                _psgState.add(pStereo);
+            }
+            else if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+            {
+                // This is a wait too, but not a segment boundary
+                _time += pSample->duration();
+            }
+            else
+            {
+                for (const auto& model : _registerModels)
+                {
+                    if (model->add(pCommand) != IRegisterModel::AddResult::NotHandled)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<Segment> finish()
+        {
+            end_segment();
+            return std::move(_segments);
+        }
+
+    private:
+        void start_segment()
+        {
+            auto stateHash = _psgState.state_hash();
+            for (const auto& model : _registerModels)
+            {
+                const auto modelHash = model->state_hash();
+                stateHash = Utils::hash(&modelHash, sizeof(modelHash), stateHash);
+            }
+            _current = {_time, stateHash, Utils::hash(nullptr, 0)};
+        }
+
+        void end_segment()
+        {
+            _current.commandsHash = Utils::hash(&_waitTotal, sizeof(_waitTotal), _current.commandsHash);
+            _segments.push_back(_current);
+            _waitTotal = 0;
+        }
+
+        SN76489State _psgState;
+        std::vector<std::unique_ptr<IRegisterModel>> _registerModels;
+        BinaryData _buffer;
+        std::vector<Segment> _segments;
+        Segment _current{};
+        uint32_t _time = 0;
+        uint32_t _waitTotal = 0;
+    };
+
+    // Checks that the segments from a and b match for at least verifySamples
+    bool verify(const std::vector<Segment>& segments, const size_t a, const size_t b, const uint32_t verifySamples)
+    {
+        for (size_t i = 0; b + i < segments.size(); ++i)
+        {
+            if (segments[a + i].commandsHash != segments[b + i].commandsHash ||
+                segments[a + i].stateHash != segments[b + i].stateHash)
+            {
+                return false;
+            }
+            if (segments[a + i].time - segments[a].time >= verifySamples)
+            {
+                return true;
+            }
+        }
+        // We ran out of data before we verified enough
+        return false;
+    }
+}
+
+std::vector<LoopCandidate> find_loops(const VgmFile& file, const uint32_t verifySamples, const uint32_t minimumLength)
+{
+    // First we reduce the file to a list of segments
+    SegmentBuilder builder(file.header());
+    for (const auto* pCommand : file.commands())
+    {
+        if (dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr)
+        {
+            break;
+        }
+        if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) == nullptr)
+        {
+            builder.add(pCommand);
+        }
+    }
+    const auto segments = builder.finish();
+    if (segments.size() < WINDOW_SIZE)
+    {
+        return {};
+    }
+
+    // Then we compute a rolling hash of WINDOW_SIZE segments at each point, combined with the state there,
+    // and look for earlier points with the same hash
+    uint64_t highestPower = 1;
+    uint64_t windowHash = 0;
+    for (size_t i = 0; i < WINDOW_SIZE; ++i)
+    {
+        if (i > 0)
+        {
+            highestPower *= ROLLING_HASH_BASE;
+        }
+        windowHash = windowHash * ROLLING_HASH_BASE + segments[i].commandsHash;
+    }
+
+    std::unordered_map<uint64_t, std::vector<size_t>> pointsByHash;
+    pointsByHash.reserve(segments.size());
+    // Candidates by loop length
+    std::unordered_map<uint32_t, LoopCandidate> candidates;
+    for (size_t i = 0; i + WINDOW_SIZE <= segments.size(); ++i)
+    {
+        if (i > 0)
+        {
+            windowHash = (windowHash - segments[i - 1].commandsHash * highestPower) * ROLLING_HASH_BASE
+                + segments[i + WINDOW_SIZE - 1].commandsHash;
+        }
+        const auto hash = Utils::hash(&segments[i].stateHash, sizeof(uint64_t), windowHash);
+        auto& points = pointsByHash[hash];
+        for (const auto earlierPoint : points)
+        {
+            const auto start = segments[earlierPoint].time;
+            const auto end = segments[i].time;
+            if (end - start < minimumLength)
+            {
+                continue;
+            }
+            if (const auto it = candidates.find(end - start); it != candidates.end())
+            {
+                // We already verified this length from an earlier start
+                ++it->second.support;
+                break;
+            }
+            if (verify(segments, earlierPoint, i, verifySamples))
+            {
+                candidates[end - start] = {start, end, 1};
+                break;
+            }
+        }
+        if (points.size() < MAX_MATCHES_PER_HASH)
+        {
+            points.push_back(i);
+        }
+    }
+
+    // The best loop starts earliest, and then is shortest
+    std::vector<LoopCandidate> result;
+    result.reserve(candidates.size());
+    for (const auto& candidate : candidates | std::views::values)
+    {
+        result.push_back(candidate);
+    }
+    std::ranges::sort(result, [](const LoopCandidate& a, const LoopCandidate& b)
+    {
+        return a.start != b.start ? a.start < b.start : a.end < b.end;
+    });
+    return result;
+}
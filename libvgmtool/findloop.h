@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Automatic loop detection
+
+class VgmFile;
+
+struct LoopCandidate
+{
+    // Loop start and end, in samples from the start of the file
+    uint32_t start;
+    uint32_t end;
+    // How many points in the file agree with this loop length
+    int support;
+};
+
+// Finds loops by matching the chip state plus the upcoming commands at every wait.
+// Candidates are only returned if the data after the start and end is the same for at least verifySamples,
+// and the loop is at least minimumLength samples long. The best candidate is first.
+std::vector<LoopCandidate> find_loops(const VgmFile& file, uint32_t verifySamples, uint32_t minimumLength);
@@ -0,0 +1,194 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <ranges>
+#include <unordered_map>
+
+#include "BinaryData.h"
+#include "IVGMToolCallback.h"
+#include "RegisterModel.h"
+#include "SN76489State.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    // Hashes the commands the data optimiser would write, without making the new command list
+    class CanonicalHasher
+    {
+    public:
+        explicit CanonicalHasher(const VgmHeader& header)
+            : _psgState(header),
+              _registerModels(IRegisterModel::create_all(header))
+        {
+            // The clocks affect the sound, so they are part of it
+            for (auto i = static_cast<int>(VgmHeader::Chip::SN76489); i <= static_cast<int>(VgmHeader::Chip::GenericDAC); ++i)
+            {
+                const auto clock = header.clock(static_cast<VgmHeader::Chip>(i));
+                _hash = Utils::hash(&clock, sizeof(clock), _hash);
+            }
+        }
+
+        void add(const VgmCommands::ICommand* pCommand)
+        {
+            if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+            {
+                _psgState.add(pPsg);
+            }
+            else if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+            {
+                _psgState.add(pStereo);
+            }
+            else if (const auto addResult = add_to_register_models(pCommand);
+                addResult == IRegisterModel::AddResult::Deferred)
+            {
+                // Nothing to do until time passes
+            }
+            else if (addResult == IRegisterModel::AddResult::KeepInPlace)
+            {
+                flush_state();
+                hash_command(pCommand);
+            }
+            else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+                pWait != nullptr && dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) == nullptr)
+            {
+                flush_state();
+                _pendingWait += pWait->duration();
+            }
+            else if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                flush_state();
+                hash_command(pCommand);
+                _psgState.forget_written_state();
+                for (const auto& model : _registerModels)
+                {
+                    model->forget_written_state();
+                }
+            }
+            else
+            {
+                flush_state();
+                hash_command(pCommand);
+            }
+        }
+
+        uint64_t finish()
+        {
+            flush_state();
+            flush_wait();
+            return _hash;
+        }
+
+    private:
+        IRegisterModel::AddResult add_to_register_models(const VgmCommands::ICommand* pCommand) const
+        {
+            for (const auto& model : _registerModels)
+            {
+                if (const auto result = model->add(pCommand); result != IRegisterModel::AddResult::NotHandled)
+                {
+                    return result;
+                }
+            }
+            return IRegisterModel::AddResult::NotHandled;
+        }
+
+        void flush_state()
+        {
+            _psgState.write_changes(_changes);
+            for (const auto& model : _registerModels)
+            {
+                model->write_changes(_changes);
+            }
+            for (const auto* pCommand : _changes)
+            {
+                hash_command(pCommand);
+                delete pCommand;
+            }
+            _changes.clear();
+        }
+
+        void flush_wait()
+        {
+            // The total is hashed rather than the commands, so any way of encoding it is the same
+            if (_pendingWait > 0)
+            {
+                _hash = Utils::hash(&_pendingWait, sizeof(_pendingWait), _hash);
+                _pendingWait = 0;
+            }
+        }
+
+        void hash_command(const VgmCommands::ICommand* pCommand)
+        {
+            flush_wait();
+            _buffer.reset();
+            pCommand->to_data(_buffer);
+            _hash = Utils::hash(_buffer.buffer().data(), _buffer.buffer().size(), _hash);
+        }
+
+        SN76489State _psgState;
+        std::vector<std::unique_ptr<IRegisterModel>> _registerModels;
+        std::vector<VgmCommands::ICommand*> _changes;
+        BinaryData _buffer;
+        uint32_t _pendingWait = 0;
+        uint64_t _hash = Utils::hash(nullptr, 0);
+    };
+}
+
+uint64_t fingerprint(const VgmFile& file)
+{
+    CanonicalHasher hasher(file.header());
+    for (const auto* pCommand : file.commands())
+    {
+        hasher.add(pCommand);
+    }
+    return hasher.finish();
+}
+
+std::vector<std::vector<std::string>> find_duplicates(const std::vector<std::string>& paths, const IVGMToolCallback& callback)
+{
+    const auto& filenames = Utils::find_vgm_files(paths);
+
+    std::vector<uint64_t> fingerprints(filenames.size());
+    std::vector<std::string> errors(filenames.size());
+    Utils::parallel_for(filenames.size(), [&](const size_t index)
+    {
+        try
+        {
+            fingerprints[index] = fingerprint(VgmFile(filenames[index]));
+        }
+        catch (const std::exception& e)
+        {
+            errors[index] = e.what();
+        }
+    });
+
+    std::unordered_map<uint64_t, std::vector<std::string>> filesByFingerprint;
+    for (auto i = 0u; i < filenames.size(); ++i)
+    {
+        if (!errors[i].empty())
+        {
+            callback.show_error(std::format("{}: {}", filenames[i], errors[i]));
+            continue;
+        }
+        filesByFingerprint[fingerprints[i]].push_back(filenames[i]);
+    }
+
+    std::vector<std::vector<std::string>> result;
+    for (auto& files : filesByFingerprint | std::views::values)
+    {
+        if (files.size() > 1)
+        {
+            result.push_back(std::move(files));
+        }
+    }
+    std::ranges::sort(result);
+
+    callback.show_status(std::format(
+        "Fingerprinted {} files, found {} groups of duplicates",
+        filenames.size(),
+        result.size()));
+    return result;
+}
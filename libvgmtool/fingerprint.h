@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Duplicate detection
+
+class IVGMToolCallback;
+class VgmFile;
+
+// Hash of the music in the file: the chip clocks, plus the commands as the data optimiser would write them (so waits
+// are merged and redundant writes are dropped). The GD3 tag and the rest of the header are not included, so files
+// which only differ in tagging, wait encoding or redundant data have the same fingerprint.
+uint64_t fingerprint(const VgmFile& file);
+
+// Fingerprints all the VGM and VGZ files in the given files and folders (recursively), in parallel, and returns the
+// groups of files with matching fingerprints. Files which fail to load are reported and skipped.
+std::vector<std::vector<std::string>> find_duplicates(const std::vector<std::string>& paths, const IVGMToolCallback& callback);
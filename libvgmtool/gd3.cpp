@@ -1,9 +1,116 @@
 #include "gd3.h"
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <utility>
 #include <zlib.h>
 
+#include "BinaryData.h"
+#include "Gd3Tag.h"
 #include "IVGMToolCallback.h"
+#include "libpu8.h"
 #include "vgm.h"
 #include "utils.h"
+#include "VgmFile.h"
+
+namespace
+{
+    uint32_t read_uint32(std::istream& f)
+    {
+        uint8_t bytes[4]{};
+        f.read(reinterpret_cast<char*>(bytes), 4);
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+
+    void write_uint32(std::ostream& f, const uint32_t value)
+    {
+        const uint8_t bytes[4]{
+            static_cast<uint8_t>(value),
+            static_cast<uint8_t>(value >> 8),
+            static_cast<uint8_t>(value >> 16),
+            static_cast<uint8_t>(value >> 24)
+        };
+        f.write(reinterpret_cast<const char*>(bytes), 4);
+    }
+
+    // Returns the offset of the GD3 tag if it is at the end of the (uncompressed) file, or the end of the file if it
+    // has no tag. We check the header offsets agree with the file size, so we know nothing comes after the tag.
+    std::optional<uint32_t> find_gd3_at_end(std::istream& f, const uint64_t fileSize)
+    {
+        f.seekg(0);
+        if (read_uint32(f) != 0x206d6756) // "Vgm "
+        {
+            return std::nullopt;
+        }
+        f.seekg(EOFDELTA);
+        const auto eofOffset = read_uint32(f) + EOFDELTA;
+        f.seekg(GD3DELTA);
+        const auto gd3Offset = read_uint32(f);
+        if (gd3Offset == 0)
+        {
+            return eofOffset == fileSize ? std::optional(eofOffset) : std::nullopt;
+        }
+
+        f.seekg(gd3Offset + GD3DELTA);
+        if (read_uint32(f) != 0x20336447) // "Gd3 "
+        {
+            return std::nullopt;
+        }
+        read_uint32(f); // Version
+        const auto textLength = read_uint32(f);
+        if (!f || gd3Offset + GD3DELTA + sizeof(TGD3Header) + textLength != fileSize)
+        {
+            return std::nullopt;
+        }
+        return gd3Offset + GD3DELTA;
+    }
+
+    struct TagEdit
+    {
+        std::string filename;
+        std::vector<std::pair<Gd3Tag::Key, std::wstring>> changes;
+    };
+
+    std::vector<TagEdit> read_tag_manifest(const std::string& manifestFilename)
+    {
+        std::ifstream f(manifestFilename);
+        if (!f)
+        {
+            throw std::runtime_error(std::format("Failed to open \"{}\"", manifestFilename));
+        }
+        const auto& folder = std::filesystem::path(manifestFilename).parent_path();
+
+        std::vector<TagEdit> edits;
+        std::string line;
+        for (auto lineNumber = 1; std::getline(f, line); ++lineNumber)
+        {
+            std::erase(line, '\r');
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            if (line.front() == '[' && line.back() == ']')
+            {
+                edits.emplace_back((folder / line.substr(1, line.size() - 2)).string());
+                continue;
+            }
+            const auto equalsPosition = line.find('=');
+            if (equalsPosition == std::string::npos || edits.empty())
+            {
+                throw std::runtime_error(std::format("{}({}): expected [filename] or field=value", manifestFilename, lineNumber));
+            }
+            // Notes can have line breaks
+            auto value = line.substr(equalsPosition + 1);
+            for (auto position = value.find("\\n"); position != std::string::npos; position = value.find("\\n", position + 1))
+            {
+                value.replace(position, 2, "\n");
+            }
+            edits.back().changes.emplace_back(Gd3Tag::key_from_name(line.substr(0, equalsPosition)), u8widen(value));
+        }
+        return edits;
+    }
+}
 
 //----------------------------------------------------------------------------------------------
 // Remove GD3 from file
@@ -25,29 +132,117 @@ void remove_gd3(const std::string& filename, const IVGMToolCallback& callback)
         return;
     }
 
-    // ShowStatus("Removing GD3 tag...");
-
-    gzrewind(in);
+    gzclose(in);
 
-    const std::string outFilename = Utils::make_temp_filename(filename);
+    write_gd3(filename, Gd3Tag());
 
-    gzFile out = gzopen(outFilename.c_str(), "wb0");
+    callback.show_status("GD3 tag removed");
+}
 
-    // Copy everything up to the GD3 tag
-    for (auto i = 0; i < static_cast<int>(VGMHeader.GD3Offset + GD3DELTA); ++i)
+void write_gd3(const std::string& filename, const Gd3Tag& tag)
+{
+    BinaryData tagData;
+    if (!tag.empty())
     {
-        gzputc(out, gzgetc(in));
+        tag.to_binary(tagData);
     }
 
-    VGMHeader.GD3Offset = 0;
-    VGMHeader.EoFOffset = gztell(out) - EOFDELTA; // Update EoF offset in header
+    const auto isCompressed = Utils::is_compressed(filename);
+    std::optional<uint32_t> tagOffset;
+    uint64_t fileSize = 0;
+    {
+        std::ifstream f(filename, std::ios::binary);
+        if (!isCompressed)
+        {
+            fileSize = std::filesystem::file_size(filename);
+            tagOffset = find_gd3_at_end(f, fileSize);
+        }
+    }
 
-    gzclose(in);
-    gzclose(out);
+    // We write to a temp file and then replace the original, so it is never left half written
+    const auto tempFilename = Utils::make_temp_filename(filename);
+    try
+    {
+        if (tagOffset.has_value())
+        {
+            // We can just replace the tail of the file
+            std::filesystem::copy_file(filename, tempFilename, std::filesystem::copy_options::overwrite_existing);
+            const auto newSize = *tagOffset + tagData.size();
+            std::fstream f(tempFilename, std::ios::binary | std::ios::in | std::ios::out);
+            f.seekp(*tagOffset);
+            f.write(reinterpret_cast<const char*>(tagData.buffer().data()), static_cast<std::streamsize>(tagData.size()));
+            f.seekp(GD3DELTA);
+            write_uint32(f, tag.empty() ? 0 : *tagOffset - GD3DELTA);
+            f.seekp(EOFDELTA);
+            write_uint32(f, static_cast<uint32_t>(newSize) - EOFDELTA);
+            if (!f)
+            {
+                throw std::runtime_error(std::format("Failed to write to \"{}\"", tempFilename));
+            }
+            f.close();
+            if (newSize < fileSize)
+            {
+                std::filesystem::resize_file(tempFilename, newSize);
+            }
+        }
+        else
+        {
+            // Otherwise we have to rewrite the whole file, keeping it compressed if it was
+            VgmFile file(filename);
+            file.gd3() = tag;
+            BinaryData data;
+            file.to_binary(data);
+            if (isCompressed)
+            {
+                Utils::save_gzip(tempFilename, data.buffer());
+            }
+            else
+            {
+                data.save(tempFilename);
+            }
+        }
+    }
+    catch (...)
+    {
+        std::filesystem::remove(tempFilename);
+        throw;
+    }
+    Utils::replace_file(filename, tempFilename);
+}
 
-    write_vgm_header(outFilename, VGMHeader, callback); // Write changed header
+void apply_tag_manifest(const std::string& manifestFilename, const IVGMToolCallback& callback)
+{
+    const auto& edits = read_tag_manifest(manifestFilename);
 
-    Utils::replace_file(filename, outFilename);
+    std::vector<std::string> errors(edits.size());
+    Utils::parallel_for(edits.size(), [&](const size_t index)
+    {
+        try
+        {
+            const auto& edit = edits[index];
+            VgmFile file;
+            file.load_header_and_gd3(edit.filename);
+            auto tag = file.gd3();
+            for (const auto& [key, value] : edit.changes)
+            {
+                tag.set_text(key, value);
+            }
+            write_gd3(edit.filename, tag);
+        }
+        catch (const std::exception& e)
+        {
+            errors[index] = e.what();
+        }
+    });
 
-    callback.show_status("GD3 tag removed");
+    auto errorCount = 0;
+    for (auto i = 0u; i < edits.size(); ++i)
+    {
+        if (!errors[i].empty())
+        {
+            callback.show_error(std::format("{}: {}", edits[i].filename, errors[i]));
+            ++errorCount;
+        }
+    }
+    callback.show_status(std::format("Tagged {} files", edits.size() - errorCount));
 }
@@ -5,6 +5,7 @@
 // GD3 tag format definitions
 // and functionality
 
+class Gd3Tag;
 class IVGMToolCallback;
 
 // GD3 file header
@@ -32,3 +33,16 @@ enum Gd3Indices
 };
 
 void remove_gd3(const std::string& filename, const IVGMToolCallback& callback);
+
+// Replaces the GD3 tag of the file, or removes it if tag is empty. If the file is uncompressed and the tag (if any) is
+// at the end, only the tag and the header offsets are written. Otherwise, the whole file is rewritten uncompressed.
+void write_gd3(const std::string& filename, const Gd3Tag& tag);
+
+// Applies a manifest of tag edits to many files, in parallel. The manifest is UTF-8 text like this:
+//   # Comment
+//   [folder/file.vgz]
+//   title=Title Screen
+//   notes=First line\nSecond line
+// Filenames are relative to the manifest's folder. The field names are as for Gd3Tag::key_from_name(); fields which
+// are not mentioned are left as they were.
+void apply_tag_manifest(const std::string& manifestFilename, const IVGMToolCallback& callback);
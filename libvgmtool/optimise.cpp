@@ -6,7 +6,11 @@
 #include "trim.h"
 #include "gd3.h"
 #include "IVGMToolCallback.h"
+#include "RegisterModel.h"
+#include "SN76489State.h"
 #include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
 
 //----------------------------------------------------------------------------------------------
 // Pause optimiser
@@ -39,6 +43,9 @@ bool optimise_vgm_pauses(const std::string& filename, const IVGMToolCallback& ca
     // ...open it...
     gzFile out = gzopen(outFilename.c_str(), "wb0");
 
+    // ...copy the header, to be updated later (zlib fills a seek before any writes from an uninitialised buffer)...
+    gzwrite(out, &VGMHeader, sizeof(VGMHeader));
+
     // ...skip to the data section...
     gzseek(in, VGM_DATA_OFFSET, SEEK_SET);
     gzseek(out, VGM_DATA_OFFSET, SEEK_SET);
@@ -298,7 +305,7 @@ int remove_offset(const std::string& filename, const IVGMToolCallback& callback)
                     // Write the frequency bytes
                     gzputc(out, VGM_PSG);
                     gzputc(out, 
-                        static_cast<char>(0x80 | (PSGLatchedRegister << 4) | PSGRegisters[PSGLatchedRegister] & 0xf));
+                        static_cast<char>(0x80 | (PSGLatchedRegister << 4) | (PSGRegisters[PSGLatchedRegister] & 0xf)));
                     gzputc(out, VGM_PSG);
                     gzputc(out, static_cast<char>(PSGRegisters[PSGLatchedRegister] >> 4));
                 }
@@ -447,6 +454,138 @@ int remove_offset(const std::string& filename, const IVGMToolCallback& callback)
   The start of the file needs full initialisation, though. Let *last==NULL signal that.
 */
 
+//----------------------------------------------------------------------------------------------
+// Data optimiser
+//----------------------------------------------------------------------------------------------
+namespace
+{
+    IRegisterModel::AddResult add_to_register_models(
+        const std::vector<std::unique_ptr<IRegisterModel>>& models,
+        const VgmCommands::ICommand* pCommand)
+    {
+        for (const auto& model : models)
+        {
+            if (const auto result = model->add(pCommand); result != IRegisterModel::AddResult::NotHandled)
+            {
+                return result;
+            }
+        }
+        return IRegisterModel::AddResult::NotHandled;
+    }
+}
+
+// Runs all chip writes through the state models, so only the changes visible at each wait are written.
+// Chips without a state model are passed through unchanged.
+void optimise_vgm_data(VgmFile& file, const IVGMToolCallback& callback)
+{
+    SN76489State psgState(file.header());
+    const auto registerModels = IRegisterModel::create_all(file.header());
+
+    auto& commands = file.commands();
+    StageTimer timer(callback, "optimise");
+    const auto commandCountBefore = commands.size();
+    std::vector<VgmCommands::ICommand*> result;
+    result.reserve(commands.size());
+    uint32_t pendingWait = 0;
+
+    auto flushWait = [&]
+    {
+        CommandStream::add_wait(result, pendingWait);
+        pendingWait = 0;
+    };
+    // Chip writes are applied to the state models, and we write out the changes when time passes.
+    // Redundant writes therefore disappear, and the waits around them can be merged.
+    std::vector<VgmCommands::ICommand*> changes;
+    auto flushState = [&]
+    {
+        psgState.write_changes(changes);
+        for (const auto& model : registerModels)
+        {
+            model->write_changes(changes);
+        }
+        if (!changes.empty())
+        {
+            flushWait();
+            result.insert(result.end(), changes.begin(), changes.end());
+            changes.clear();
+        }
+    };
+
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+        // Every so often, so it costs nothing
+        if ((i & 0xffff) == 0)
+        {
+            if (callback.is_cancelled())
+            {
+                // We own some of the commands now, so we give them back. The result is garbage, but safe to destroy.
+                result.insert(result.end(), commands.begin() + static_cast<std::ptrdiff_t>(i), commands.end());
+                commands.swap(result);
+                throw OperationCancelled();
+            }
+            callback.show_progress("optimise", i, commands.size());
+        }
+
+        auto* pCommand = commands[i];
+        if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+        {
+            psgState.add(pPsg);
+            delete pCommand;
+        }
+        else if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+        {
+            psgState.add(pStereo);
+            delete pCommand;
+        }
+        else if (const auto addResult = add_to_register_models(registerModels, pCommand);
+            addResult == IRegisterModel::AddResult::Deferred)
+        {
+            delete pCommand;
+        }
+        else if (addResult == IRegisterModel::AddResult::KeepInPlace)
+        {
+            // Anything before it has to be written first
+            flushState();
+            flushWait();
+            result.push_back(pCommand);
+        }
+        else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+            pWait != nullptr && dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) == nullptr)
+        {
+            flushState();
+            pendingWait += pWait->duration();
+            delete pCommand;
+        }
+        else if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+        {
+            flushState();
+            flushWait();
+            result.push_back(pCommand);
+            // We can arrive here from the end of the file, so we can't assume anything about the state
+            psgState.forget_written_state();
+            for (const auto& model : registerModels)
+            {
+                model->forget_written_state();
+            }
+        }
+        else
+        {
+            // Anything else passes through, keeping its timing relative to the chip writes
+            flushState();
+            flushWait();
+            result.push_back(pCommand);
+        }
+    }
+    flushState();
+    flushWait();
+
+    // The commands are now owned by result
+    commands.swap(result);
+    timer.finish(0, 0, commandCountBefore);
+
+    callback.show_status(std::format("Optimised data: {} commands -> {} commands", commandCountBefore, commands.size()));
+}
+
 
 /*
 //----------------------------------------------------------------------------------------------
@@ -4,9 +4,12 @@
 // VGM optimisation
 
 class IVGMToolCallback;
+class VgmFile;
 
 bool optimise_vgm_pauses(const std::string& filename, const IVGMToolCallback& callback);
 
+void optimise_vgm_data(VgmFile& file, const IVGMToolCallback& callback);
+
 int remove_offset(const std::string& filename, const IVGMToolCallback& callback);
 
 bool round_to_frame_accurate(const std::string& filename, const IVGMToolCallback& callback);
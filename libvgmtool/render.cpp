@@ -0,0 +1,82 @@
+#include "render.h"
+
+#include <cmath>
+
+#include "BinaryData.h"
+#include "SN76489Renderer.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+std::vector<int16_t> render_sn76489(const VgmFile& file)
+{
+    SN76489Renderer renderer(file.header());
+    std::vector<int16_t> result;
+    result.reserve(static_cast<size_t>(file.header().sample_count()) * 2);
+    for (const auto* pCommand : file.commands())
+    {
+        if (dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr)
+        {
+            break;
+        }
+        if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+        {
+            renderer.add(pPsg);
+        }
+        else if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+        {
+            renderer.add(pStereo);
+        }
+        else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
+        {
+            // We render everything between register changes in one go
+            renderer.render(pWait->duration(), result);
+        }
+    }
+    return result;
+}
+
+void save_wav(const std::string& filename, const std::vector<int16_t>& samples, const uint32_t sampleRate)
+{
+    constexpr auto channelCount = 2;
+    constexpr auto bytesPerSample = 2;
+    const auto dataSize = static_cast<uint32_t>(samples.size() * bytesPerSample);
+
+    BinaryData data;
+    data.write_unterminated_ascii_string("RIFF");
+    data.write_uint32(36 + dataSize);
+    data.write_unterminated_ascii_string("WAVE");
+    data.write_unterminated_ascii_string("fmt ");
+    data.write_uint32(16);
+    data.write_uint16(1); // PCM
+    data.write_uint16(channelCount);
+    data.write_uint32(sampleRate);
+    data.write_uint32(sampleRate * channelCount * bytesPerSample);
+    data.write_uint16(channelCount * bytesPerSample);
+    data.write_uint16(bytesPerSample * 8);
+    data.write_unterminated_ascii_string("data");
+    data.write_uint32(dataSize);
+    for (const auto sample : samples)
+    {
+        data.write_uint16(static_cast<uint16_t>(sample));
+    }
+    data.save(filename);
+}
+
+Loudness measure_loudness(const std::vector<int16_t>& samples)
+{
+    int peak = 0;
+    double sumOfSquares = 0;
+    for (const auto sample : samples)
+    {
+        peak = std::max(peak, std::abs(static_cast<int>(sample)));
+        sumOfSquares += static_cast<double>(sample) * sample;
+    }
+    const auto toDb = [](const double value)
+    {
+        return value > 0 ? 20 * std::log10(value / 32768) : -INFINITY;
+    };
+    return {
+        toDb(peak),
+        toDb(samples.empty() ? 0 : std::sqrt(sumOfSquares / static_cast<double>(samples.size())))
+    };
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Audio rendering
+
+class VgmFile;
+
+// Renders the SN76489 part of the file to 44.1kHz stereo PCM, as interleaved left, right pairs.
+// The loop is not followed.
+std::vector<int16_t> render_sn76489(const VgmFile& file);
+
+// Saves interleaved stereo PCM as a WAV file
+void save_wav(const std::string& filename, const std::vector<int16_t>& samples, uint32_t sampleRate);
+
+// Level measurements, in dB relative to full scale
+struct Loudness
+{
+    double peak;
+    double rms;
+};
+
+Loudness measure_loudness(const std::vector<int16_t>& samples);
@@ -0,0 +1,142 @@
+#include "silence.h"
+
+#include <algorithm>
+
+#include "SN76489State.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+#include "YM2413State.h"
+
+namespace
+{
+    // We don't model FM release after key off, so we allow this long for it to fade out
+    constexpr uint32_t FM_RELEASE_SAMPLES = 44100 / 2;
+
+    // Tracks when one source of sound starts and stops being audible
+    class AudibleSpan
+    {
+    public:
+        explicit AudibleSpan(const uint32_t releaseSamples)
+            : _releaseSamples(releaseSamples) { }
+
+        void update(const bool isAudible, const uint32_t time)
+        {
+            if (isAudible && !_isAudible && !_hasSound)
+            {
+                _hasSound = true;
+                _start = time;
+            }
+            else if (!isAudible && _isAudible)
+            {
+                _end = time + _releaseSamples;
+            }
+            _isAudible = isAudible;
+        }
+
+        void finish(const uint32_t time)
+        {
+            if (_isAudible)
+            {
+                _end = time;
+            }
+        }
+
+        [[nodiscard]] bool has_sound() const
+        {
+            return _hasSound;
+        }
+
+        [[nodiscard]] uint32_t start() const
+        {
+            return _start;
+        }
+
+        [[nodiscard]] uint32_t end() const
+        {
+            return _end;
+        }
+
+    private:
+        uint32_t _releaseSamples;
+        bool _isAudible = false;
+        bool _hasSound = false;
+        uint32_t _start = 0;
+        uint32_t _end = 0;
+    };
+}
+
+TrimSuggestion suggest_trim(const VgmFile& file)
+{
+    const auto& header = file.header();
+    SN76489State psgState(header);
+    YM2413State ym2413State(header);
+    AudibleSpan psg(0);
+    AudibleSpan ym2413(FM_RELEASE_SAMPLES);
+    AudibleSpan otherChips(0);
+
+    uint32_t time = 0;
+    for (const auto* pCommand : file.commands())
+    {
+        if (dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr)
+        {
+            break;
+        }
+        if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+        {
+            psgState.add(pPsg);
+            psg.update(psgState.is_audible(), time);
+        }
+        else if (const auto* pYM2413 = dynamic_cast<const VgmCommands::YM2413*>(pCommand); pYM2413 != nullptr)
+        {
+            ym2413State.add(pYM2413);
+            ym2413.update(ym2413State.is_audible(), time);
+        }
+        else if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+        {
+            // A DAC write, then a wait
+            otherChips.update(true, time);
+            time += pSample->duration();
+        }
+        else if (const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand); pWait != nullptr)
+        {
+            time += pWait->duration();
+        }
+        else if (dynamic_cast<const VgmCommands::GGStereo*>(pCommand) == nullptr &&
+            dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) == nullptr &&
+            dynamic_cast<const VgmCommands::DataBlock*>(pCommand) == nullptr)
+        {
+            // Something we don't model
+            otherChips.update(true, time);
+        }
+    }
+
+    TrimSuggestion result{0, -1, static_cast<int>(time), false};
+    uint32_t start = time;
+    uint32_t end = 0;
+    for (auto* pSpan : {&psg, &ym2413, &otherChips})
+    {
+        pSpan->finish(time);
+        if (pSpan->has_sound())
+        {
+            result.hasSound = true;
+            start = std::min(start, pSpan->start());
+            end = std::max(end, pSpan->end());
+        }
+    }
+    if (!result.hasSound)
+    {
+        return result;
+    }
+    end = std::min(end, time);
+    result.start = static_cast<int>(start);
+    result.end = static_cast<int>(end);
+
+    if (header.loop_offset() != 0 && header.loop_sample_count() > 0 && header.loop_sample_count() <= time)
+    {
+        // Any silence at the end is part of the loop, so we keep it. If the loop starts in the leading silence, we loop
+        // to the start of the sound instead.
+        result.loop = static_cast<int>(std::max(time - header.loop_sample_count(), start));
+        result.end = static_cast<int>(time);
+    }
+    return result;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Silence detection, for suggesting trim points
+
+class VgmFile;
+
+struct TrimSuggestion
+{
+    // Trim points in samples, as used by trim(). loop is -1 for no loop.
+    int start;
+    int loop;
+    int end;
+    // False if nothing is ever audible, in which case the trim points are meaningless
+    bool hasSound;
+};
+
+// Finds the leading and trailing silence in a single pass over the file's commands, and suggests trim points to
+// remove it. Chips we don't model are assumed to be audible from their first write to the end of the file. Looped
+// files keep their end, as any silence there is part of the loop.
+TrimSuggestion suggest_trim(const VgmFile& file);
@@ -0,0 +1,527 @@
+#include "strip.h"
+
+#include <algorithm>
+#include <format>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "CommandStream.h"
+#include "IVGMToolCallback.h"
+#include "Profile.h"
+#include "RegisterLayouts.h"
+#include "utils.h"
+#include "vgm.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    constexpr auto CHIP_COUNT = static_cast<size_t>(VgmHeader::Chip::GenericDAC) + 1;
+    // YM2413 percussion channels, which are also bits 0..4 of register 0x0e
+    constexpr uint32_t YM2413_PERCUSSION_MASK = 0x1f << YM2413PercHH;
+
+    class PsgFilter
+    {
+    public:
+        explicit PsgFilter(const uint32_t mask)
+            : _mask(mask) { }
+
+        bool keep(const VgmCommands::ICommand* pCommand)
+        {
+            if (dynamic_cast<const VgmCommands::GGStereo*>(pCommand) != nullptr)
+            {
+                return (_mask & (1 << PSGGGst)) != 0;
+            }
+            if (const auto* pWrite = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pWrite != nullptr)
+            {
+                // Data bytes go to the last latched channel
+                if ((pWrite->value() & 0x80) != 0)
+                {
+                    _latchedChannel = (pWrite->value() >> 5) & 0x03;
+                }
+                return (_mask & (1 << _latchedChannel)) != 0;
+            }
+            return true;
+        }
+
+    private:
+        uint32_t _mask;
+        int _latchedChannel = 0;
+    };
+
+    class Ym2413Filter
+    {
+    public:
+        enum class Decision
+        {
+            Keep,
+            Remove,
+            // Keep it, but with a different value
+            ChangeValue
+        };
+
+        explicit Ym2413Filter(const uint32_t mask)
+            : _mask(mask) { }
+
+        Decision decide(const VgmCommands::ICommand* pCommand, uint8_t& newValue) const
+        {
+            const auto* pWrite = dynamic_cast<const VgmCommands::RegisterDataCommand*>(pCommand);
+            if (pWrite == nullptr)
+            {
+                return Decision::Keep;
+            }
+            const auto isOtherKept = (_mask & (1 << YM2413Invalid)) != 0;
+            const auto registerIndex = pWrite->registerIndex();
+            switch (registerIndex >> 4)
+            {
+            case 0x0:
+                if (registerIndex <= 0x07)
+                {
+                    // User instrument
+                    return keep_if((_mask & (1 << YM2413UserInst)) != 0);
+                }
+                if (registerIndex == 0x0e)
+                {
+                    // Rhythm mode and percussion keys: we always keep it, but only with the keys we want
+                    using Registers = RegisterFile<YM2413Layout>;
+                    const auto keptBits = (Registers::valid_bits(0x0e) & ~Registers::key_bits(0x0e))
+                        | (_mask & YM2413_PERCUSSION_MASK) >> YM2413PercHH;
+                    newValue = static_cast<uint8_t>(pWrite->value() & keptBits);
+                    return newValue == pWrite->value() ? Decision::Keep : Decision::ChangeValue;
+                }
+                return keep_if(isOtherKept);
+            case 0x1: // F-number low bits
+            case 0x2: // F-number high bits, block, key
+            case 0x3: // Instrument and volume
+                {
+                    const auto channel = registerIndex & 0xf;
+                    if (channel > YM2413Tone9)
+                    {
+                        return keep_if(isOtherKept);
+                    }
+                    // The last 3 channels are also used for percussion
+                    return keep_if((_mask & (1 << channel)) != 0 ||
+                        (channel >= YM2413Tone7 && (_mask & YM2413_PERCUSSION_MASK) != 0));
+                }
+            default:
+                return keep_if(isOtherKept);
+            }
+        }
+
+    private:
+        static Decision keep_if(const bool keep)
+        {
+            return keep ? Decision::Keep : Decision::Remove;
+        }
+
+        uint32_t _mask;
+    };
+
+    // Output for stripping a file in place. The commands are moved to the output, or deleted.
+    class InPlaceOutput
+    {
+    public:
+        explicit InPlaceOutput(const size_t capacity)
+        {
+            _commands.reserve(capacity);
+        }
+
+        void keep(VgmCommands::ICommand* pCommand)
+        {
+            _commands.push_back(pCommand);
+        }
+
+        static void remove(const VgmCommands::ICommand* pCommand)
+        {
+            delete pCommand;
+        }
+
+        void replace_with_wait(const VgmCommands::ICommand* pCommand, const uint32_t duration)
+        {
+            CommandStream::add_wait(_commands, duration);
+            delete pCommand;
+        }
+
+        void keep_with_value(VgmCommands::RegisterDataCommand* pCommand, const uint8_t value)
+        {
+            pCommand->set_value(value);
+            _commands.push_back(pCommand);
+        }
+
+        std::vector<VgmCommands::ICommand*>& commands()
+        {
+            return _commands;
+        }
+
+    private:
+        std::vector<VgmCommands::ICommand*> _commands;
+    };
+
+    // Output for making a stripped copy of a file. The source commands are shared, and any new ones are owned here.
+    class SharedOutput
+    {
+    public:
+        explicit SharedOutput(const size_t capacity)
+        {
+            _commands.reserve(capacity);
+        }
+
+        SharedOutput(const SharedOutput&) = delete;
+        SharedOutput(SharedOutput&&) = default;
+        SharedOutput& operator=(const SharedOutput&) = delete;
+        SharedOutput& operator=(SharedOutput&&) = default;
+
+        ~SharedOutput()
+        {
+            for (const auto* pCommand : _ownedCommands)
+            {
+                delete pCommand;
+            }
+        }
+
+        void keep(const VgmCommands::ICommand* pCommand)
+        {
+            _commands.push_back(pCommand);
+        }
+
+        static void remove(const VgmCommands::ICommand*)
+        {
+            // Nothing to do
+        }
+
+        void replace_with_wait(const VgmCommands::ICommand*, const uint32_t duration)
+        {
+            const auto start = _ownedCommands.size();
+            CommandStream::add_wait(_ownedCommands, duration);
+            _commands.insert(_commands.end(), _ownedCommands.begin() + static_cast<ptrdiff_t>(start), _ownedCommands.end());
+        }
+
+        void keep_with_value(const VgmCommands::RegisterDataCommand* pCommand, const uint8_t value)
+        {
+            VgmCommands::RegisterDataCommand* pCopy;
+            if (dynamic_cast<const VgmCommands::YM2413_Second*>(pCommand) != nullptr)
+            {
+                pCopy = new VgmCommands::YM2413_Second();
+            }
+            else
+            {
+                pCopy = new VgmCommands::YM2413();
+            }
+            pCopy->set_register(pCommand->registerIndex());
+            pCopy->set_value(value);
+            _ownedCommands.push_back(pCopy);
+            _commands.push_back(pCopy);
+        }
+
+        [[nodiscard]] const std::vector<const VgmCommands::ICommand*>& commands() const
+        {
+            return _commands;
+        }
+
+    private:
+        std::vector<const VgmCommands::ICommand*> _commands;
+        std::vector<VgmCommands::ICommand*> _ownedCommands;
+    };
+
+    // The filters are chosen at compile time, so chips without channel filtering just get a table lookup
+    template <typename Output, bool FilterPsg, bool FilterYm2413, bool RemoveYm2612>
+    void strip_commands(const std::vector<VgmCommands::ICommand*>& commands, const StripMask& mask, Output& output)
+    {
+        std::array<bool, CHIP_COUNT> isKept{};
+        for (auto i = 0u; i < CHIP_COUNT; ++i)
+        {
+            isKept[i] = !mask.removes_all(static_cast<VgmHeader::Chip>(i));
+        }
+        // Waits, data blocks, etc
+        isKept[static_cast<size_t>(VgmHeader::Chip::Nothing)] = true;
+        [[maybe_unused]] PsgFilter psgFilter(mask.channels(VgmHeader::Chip::SN76489));
+        [[maybe_unused]] const Ym2413Filter ym2413Filter(mask.channels(VgmHeader::Chip::YM2413));
+
+        for (auto* pCommand : commands)
+        {
+            const auto chip = pCommand->chip();
+            if constexpr (RemoveYm2612)
+            {
+                if (chip == VgmHeader::Chip::Nothing)
+                {
+                    if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+                    {
+                        // We keep the wait part
+                        output.replace_with_wait(pCommand, pSample->duration());
+                        continue;
+                    }
+                }
+            }
+            auto keep = isKept[static_cast<size_t>(chip)];
+            if constexpr (FilterPsg)
+            {
+                if (chip == VgmHeader::Chip::SN76489)
+                {
+                    keep = psgFilter.keep(pCommand);
+                }
+            }
+            if constexpr (FilterYm2413)
+            {
+                if (chip == VgmHeader::Chip::YM2413)
+                {
+                    uint8_t newValue;
+                    switch (ym2413Filter.decide(pCommand, newValue))
+                    {
+                    case Ym2413Filter::Decision::Keep:
+                        keep = true;
+                        break;
+                    case Ym2413Filter::Decision::Remove:
+                        keep = false;
+                        break;
+                    case Ym2413Filter::Decision::ChangeValue:
+                        output.keep_with_value(static_cast<VgmCommands::RegisterDataCommand*>(pCommand), newValue);
+                        continue;
+                    }
+                }
+            }
+
+            if (keep)
+            {
+                output.keep(pCommand);
+            }
+            else
+            {
+                output.remove(pCommand);
+            }
+        }
+    }
+
+    template <typename Output>
+    using StripFunction = void (*)(const std::vector<VgmCommands::ICommand*>&, const StripMask&, Output&);
+
+    template <typename Output, size_t... Indexes>
+    constexpr auto make_strip_functions(std::index_sequence<Indexes...>)
+    {
+        return std::array<StripFunction<Output>, sizeof...(Indexes)>
+        {
+            &strip_commands<Output, (Indexes & 1) != 0, (Indexes & 2) != 0, (Indexes & 4) != 0>...
+        };
+    }
+
+    template <typename Output>
+    constexpr auto STRIP_FUNCTIONS = make_strip_functions<Output>(std::make_index_sequence<8>());
+
+    // Chips with only some channels kept need a filter
+    bool needs_filter(const StripMask& mask, const VgmHeader::Chip chip)
+    {
+        return !mask.keeps_all(chip) && !mask.removes_all(chip);
+    }
+
+    // Picks the specialisation for the mask
+    template <typename Output>
+    void strip_commands(const std::vector<VgmCommands::ICommand*>& commands, const StripMask& mask, Output& output)
+    {
+        const auto index = (needs_filter(mask, VgmHeader::Chip::SN76489) ? 1 : 0) |
+            (needs_filter(mask, VgmHeader::Chip::YM2413) ? 2 : 0) |
+            (mask.removes_all(VgmHeader::Chip::YM2612) ? 4 : 0);
+        STRIP_FUNCTIONS<Output>[index](commands, mask, output);
+    }
+
+    // Keeps only the given chip, plus the DAC streams in case they are for it
+    StripMask only(const VgmHeader::Chip chip)
+    {
+        StripMask mask;
+        for (auto i = 0u; i < CHIP_COUNT; ++i)
+        {
+            if (const auto other = static_cast<VgmHeader::Chip>(i);
+                other != chip && other != VgmHeader::Chip::Nothing && other != VgmHeader::Chip::GenericDAC)
+            {
+                mask.remove_chip(other);
+            }
+        }
+        return mask;
+    }
+
+    // Keeps only the given channels of a chip
+    SplitOutput only(const VgmHeader::Chip chip, const std::string& name, const std::initializer_list<int> channels)
+    {
+        SplitOutput output{std::format("{} {}", VgmHeader::chip_name(chip), name), only(chip)};
+        for (auto channel = 0; channel < StripMask::channel_count(chip); ++channel)
+        {
+            if (std::ranges::find(channels, channel) == channels.end())
+            {
+                output.mask.remove_channel(chip, channel);
+            }
+        }
+        return output;
+    }
+
+    // Clears the clocks for anything removed entirely
+    void clear_removed_clocks(VgmHeader& header, const StripMask& mask)
+    {
+        for (auto i = 0u; i < CHIP_COUNT; ++i)
+        {
+            if (const auto chip = static_cast<VgmHeader::Chip>(i);
+                chip != VgmHeader::Chip::Nothing && mask.removes_all(chip) && header.clock(chip) != 0)
+            {
+                header.set_clock(chip, 0);
+            }
+        }
+    }
+}
+
+StripMask::StripMask()
+{
+    for (auto i = 0u; i < _channels.size(); ++i)
+    {
+        _channels[i] = all_channels(static_cast<VgmHeader::Chip>(i));
+    }
+}
+
+void StripMask::remove_chip(const VgmHeader::Chip chip)
+{
+    if (chip == VgmHeader::Chip::Nothing)
+    {
+        throw std::runtime_error("Cannot remove non-chip commands");
+    }
+    _channels[static_cast<size_t>(chip)] = 0;
+}
+
+void StripMask::remove_channel(const VgmHeader::Chip chip, const int channel)
+{
+    if (chip == VgmHeader::Chip::Nothing)
+    {
+        throw std::runtime_error("Cannot remove non-chip commands");
+    }
+    if (channel < 0 || channel >= channel_count(chip))
+    {
+        throw std::runtime_error(std::format(
+            "Channel {} is out of range for {}, which has {} channel(s)",
+            channel,
+            VgmHeader::chip_name(chip),
+            channel_count(chip)));
+    }
+    _channels[static_cast<size_t>(chip)] &= ~(1u << channel);
+}
+
+void StripMask::remove(const std::string& spec)
+{
+    const auto colonPosition = spec.find(':');
+    const auto chip = VgmHeader::chip_from_name(spec.substr(0, colonPosition));
+    if (colonPosition == std::string::npos)
+    {
+        remove_chip(chip);
+        return;
+    }
+    std::istringstream channels(spec.substr(colonPosition + 1));
+    std::string channel;
+    while (std::getline(channels, channel, ','))
+    {
+        try
+        {
+            remove_channel(chip, std::stoi(channel));
+        }
+        catch (const std::logic_error&)
+        {
+            // std::stoi failures
+            throw std::runtime_error(std::format("Invalid channel \"{}\" in \"{}\"", channel, spec));
+        }
+    }
+}
+
+int StripMask::channel_count(const VgmHeader::Chip chip)
+{
+    switch (chip)
+    {
+    case VgmHeader::Chip::Nothing:
+        return 0;
+    case VgmHeader::Chip::SN76489:
+        return NumPSGTypes;
+    case VgmHeader::Chip::YM2413:
+        return NumYM2413Types;
+    default:
+        return 1;
+    }
+}
+
+void strip(VgmFile& file, const StripMask& mask, const IVGMToolCallback& callback)
+{
+    auto& commands = file.commands();
+    const auto commandCountBefore = commands.size();
+
+    InPlaceOutput output(commands.size());
+    strip_commands(commands, mask, output);
+    commands.swap(output.commands());
+
+    clear_removed_clocks(file.header(), mask);
+
+    callback.show_status(std::format(
+        "Stripped {} of {} commands",
+        commandCountBefore - commands.size(),
+        commandCountBefore));
+}
+
+std::vector<SplitOutput> split_outputs(const VgmHeader& header, const bool byChannel)
+{
+    std::vector<SplitOutput> result;
+    for (auto i = 0u; i < CHIP_COUNT; ++i)
+    {
+        const auto chip = static_cast<VgmHeader::Chip>(i);
+        if (chip == VgmHeader::Chip::Nothing || chip == VgmHeader::Chip::GenericDAC || header.clock(chip) == 0)
+        {
+            continue;
+        }
+        if (byChannel && chip == VgmHeader::Chip::SN76489)
+        {
+            // GG stereo goes with each channel
+            result.push_back(only(chip, "tone 0", {PSGTone0, PSGGGst}));
+            result.push_back(only(chip, "tone 1", {PSGTone1, PSGGGst}));
+            result.push_back(only(chip, "tone 2", {PSGTone2, PSGGGst}));
+            result.push_back(only(chip, "noise", {PSGNoise, PSGGGst}));
+        }
+        else if (byChannel && chip == VgmHeader::Chip::YM2413)
+        {
+            // The user instrument is shared by the tone channels
+            for (int channel = YM2413Tone1; channel <= YM2413Tone9; ++channel)
+            {
+                result.push_back(only(chip, std::format("tone {}", channel - YM2413Tone1 + 1), {channel, YM2413UserInst, YM2413Invalid}));
+            }
+            result.push_back(only(chip, "percussion", {YM2413PercHH, YM2413PercCym, YM2413PercTT, YM2413PercSD, YM2413PercBD, YM2413Invalid}));
+        }
+        else
+        {
+            result.push_back({VgmHeader::chip_name(chip), only(chip)});
+        }
+    }
+    return result;
+}
+
+void split(const VgmFile& file, const std::string& filename, const std::vector<SplitOutput>& outputs, const IVGMToolCallback& callback)
+{
+    // Each output is independent, so we can make them in parallel
+    std::vector<std::future<size_t>> tasks;
+    tasks.reserve(outputs.size());
+    auto* profiler = Profile::profiler();
+    for (const auto& output : outputs)
+    {
+        tasks.push_back(std::async(std::launch::async, [&file, &filename, &output, profiler]
+        {
+            Profile::UseProfiler useProfiler(profiler);
+            SharedOutput stripped(file.commands().size());
+            strip_commands(file.commands(), output.mask, stripped);
+            VgmHeader header(file.header());
+            clear_removed_clocks(header, output.mask);
+            file.save_file(Utils::make_suffixed_filename(filename, output.suffix), header, stripped.commands());
+            return stripped.commands().size();
+        }));
+    }
+
+    // We wait for them all before reporting, and get() throws any exceptions from them
+    for (auto i = 0u; i < outputs.size(); ++i)
+    {
+        const auto commandCount = tasks[i].get();
+        callback.show_status(std::format(
+            "Split {} from {}: {} of {} commands",
+            outputs[i].suffix,
+            filename,
+            commandCount,
+            file.commands().size()));
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "VgmHeader.h"
+
+// Chip and channel stripping
+
+class IVGMToolCallback;
+class VgmFile;
+
+// Which chips and channels to keep. The SN76489 channels are PSGTypes and the YM2413 channels are YM2413Types
+// (see vgm.h); all other chips have a single channel 0 for the whole chip.
+class StripMask
+{
+public:
+    // Keeps everything
+    StripMask();
+
+    void remove_chip(VgmHeader::Chip chip);
+    void remove_channel(VgmHeader::Chip chip, int channel);
+    // Removes what is described by "chip" or "chip:channel,channel,...", e.g. "SN76489:3" for the noise channel
+    void remove(const std::string& spec);
+
+    // Bits are set for the channels which are kept
+    [[nodiscard]] uint32_t channels(VgmHeader::Chip chip) const
+    {
+        return _channels[static_cast<size_t>(chip)];
+    }
+
+    [[nodiscard]] bool keeps_all(const VgmHeader::Chip chip) const
+    {
+        return channels(chip) == all_channels(chip);
+    }
+
+    [[nodiscard]] bool removes_all(const VgmHeader::Chip chip) const
+    {
+        return channels(chip) == 0;
+    }
+
+    [[nodiscard]] static int channel_count(VgmHeader::Chip chip);
+
+private:
+    [[nodiscard]] static uint32_t all_channels(const VgmHeader::Chip chip)
+    {
+        return (1u << channel_count(chip)) - 1;
+    }
+
+    std::array<uint32_t, static_cast<size_t>(VgmHeader::Chip::GenericDAC) + 1> _channels{};
+};
+
+// Removes the commands for the chips and channels not in the mask. Chips which are removed entirely get their clocks
+// set to zero in the header.
+void strip(VgmFile& file, const StripMask& mask, const IVGMToolCallback& callback);
+
+// One of the files made by split()
+struct SplitOutput
+{
+    // Added to the filename, e.g. "YM2612"
+    std::string suffix;
+    StripMask mask;
+};
+
+// Makes an output for each chip in the header, or with byChannel, for each SN76489 and YM2413 channel (or channel
+// group) and each other chip. DAC stream commands and data blocks go to all of them.
+std::vector<SplitOutput> split_outputs(const VgmHeader& header, bool byChannel);
+
+// Writes a stripped copy of the file for each output, named from filename with the output's suffix. The copies are
+// all made from the one set of parsed commands, in parallel.
+void split(const VgmFile& file, const std::string& filename, const std::vector<SplitOutput>& outputs, const IVGMToolCallback& callback);
@@ -2,13 +2,22 @@
 #include <cstdio>
 #include "trim.h"
 
-#include <filesystem>
+#include <algorithm>
+#include <format>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include <zlib.h>
 #include "vgm.h"
 #include "gd3.h"
 #include "IVGMToolCallback.h"
 #include "optimise.h"
+#include "RegisterLayouts.h"
+#include "RegisterModel.h"
+#include "SN76489State.h"
 #include "utils.h"
+#include "VgmFile.h"
 
 //----------------------------------------------------------------------------------------------
 // Creates a log of the trim for future reference
@@ -46,375 +55,243 @@ void log_trim(const std::string& VGMFile, int start, int loop, int end, const IV
     fclose(f);
 }
 
-//----------------------------------------------------------------------------------------------
-// Rewritten Trim with:
-// - Loop point initialisation at end of file
-// - No optimisation
-// - Hopefully some clarity
-//----------------------------------------------------------------------------------------------
-bool new_trim(const std::string& filename, const int start, const int loop, const int end, const IVGMToolCallback& callback)
+namespace
 {
-    gzFile in, out;
-    int b0 = 0, b1 = 0, b2 = 0;
-    TSystemState CurrentState{}, LoopPointState{};
-
-    bool PastStart = false, PastLoop = (loop < 0);
-    // If loop<0 then PastLoop=TRUE so it won't bother to record a loop state ever
-    // Thus loop=-1 means no loop
-
-    if (!Utils::file_exists(filename))
+    // Splits any wait spanning sampleOffset in two, and returns the index of the first command at or after it
+    size_t split_at(CommandSequence& sequence, const uint32_t sampleOffset)
     {
-        return false;
+        const auto index = sequence.find_sample(sampleOffset);
+        const auto commandEnd = sequence.sample_offset(index);
+        if (commandEnd <= sampleOffset)
+        {
+            return index;
+        }
+        // The wait before index spans it
+        auto commands = sequence.extract(index - 1, index).release();
+        auto* pCommand = commands.front();
+        const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+        const auto before = pWait->duration() - (commandEnd - sampleOffset);
+        const auto after = commandEnd - sampleOffset;
+        commands.clear();
+        if (auto* pSample = dynamic_cast<VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+        {
+            // The DAC write stays before the split
+            pSample->set_duration(static_cast<uint8_t>(before));
+            commands.push_back(pSample);
+        }
+        else
+        {
+            delete pCommand;
+            CommandStream::add_wait(commands, before);
+        }
+        const auto splitIndex = index - 1 + commands.size();
+        CommandStream::add_wait(commands, after);
+        sequence.insert(index - 1, std::move(commands));
+        return splitIndex;
     }
+}
 
-    // Check edit points are sensible
-    if ((start < 0) ||
-        ((loop != -1) && (loop < start)) ||
-        (end <= loop))
+void trim(VgmFile& file, const int start, const int loop, const int end, const IVGMToolCallback& callback)
+{
+    if (start < 0 || (loop != -1 && loop < start) || end <= loop || end <= start)
     {
-        // Invalid edit points
-        callback.show_error("Invalid edit points!\nFailed the condition start <= loop < end");
-        return false;
+        throw std::runtime_error("Invalid edit points: failed the condition start <= loop < end");
     }
 
-    // Open input file
-    in = gzopen(filename.c_str(), "rb");
-
-    // Read its VGM header
-    OldVGMHeader VGMHeader;
-    gzread(in, &VGMHeader, sizeof(VGMHeader));
+    // The state models let us write the chip state at any point
+    const auto hasPsg = file.header().clock(VgmHeader::Chip::SN76489) != 0;
+    SN76489State psgState(file.header());
+    const auto registerModels = IRegisterModel::create_all(file.header());
+    // The YM2612 PCM data bank position, which YM2612Sample moves on
+    uint32_t pcmAddress = 0;
+    auto isPcmUsed = false;
 
-    // See if the edit points are within the file
-    if (end > static_cast<int>(VGMHeader.TotalLength))
+    auto writeState = [&](std::vector<VgmCommands::ICommand*>& commands, const bool isLoopPoint)
     {
-        gzclose(in);
-        callback.show_error("End point beyond end of file");
-        return false;
-    }
-
-    // Parse input file to see what chips are used
-    get_used_chips(in, &CurrentState.UsesPSG, &CurrentState.UsesYM2413, &CurrentState.UsesYM2612,
-        &CurrentState.UsesYM2151, &CurrentState.UsesReserved);
-
-    // Let's make the output filename...
-    auto outfilename = Utils::make_suffixed_filename(filename, "trimmed");
-
-    // ...open it...
-    out = gzopen(outfilename.c_str(), "wb0");
-
-    // ...skip to the data section...
-    gzseek(in, VGM_DATA_OFFSET, SEEK_SET);
-    gzseek(out, VGM_DATA_OFFSET, SEEK_SET);
-
-    // ...initialise state to default values...
-    ResetState(&CurrentState);
+        if (hasPsg)
+        {
+            psgState.write_state(commands);
+        }
+        for (const auto& model : registerModels)
+        {
+            model->write_state(commands, isLoopPoint);
+        }
+        if (isPcmUsed)
+        {
+            auto* pSeek = new VgmCommands::PCMSeek();
+            pSeek->set_address(pcmAddress);
+            commands.push_back(pSeek);
+        }
+    };
 
-    // ...and parse/copy the input file
-    // Record the current state at all times, and if PastStart, pass data through
-    do
+    // Applies a command to the state, and returns true if that is all it does before the start, so it can be dropped
+    auto applyToState = [&](const VgmCommands::ICommand* pCommand)
     {
-        b0 = gzgetc(in);
-        switch (b0)
+        if (dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) != nullptr)
         {
-        case VGM_GGST: // GG stereo
-        case VGM_PSG: // PSG write
-            // both have 1 byte data
-            b1 = gzgetc(in);
-            WriteToState(&CurrentState, b0, b1, 0);
-            if (PastStart)
-            {
-                gzputc(out, b0);
-                gzputc(out, b1);
-            }
-            break;
-        case VGM_YM2413: // YM2413
-        case VGM_YM2612_0: // YM2612 port 0
-        case VGM_YM2612_1: // YM2612 port 1
-        case VGM_YM2151: // YM2151
-        case 0x55:
-        case 0x56:
-        case 0x57:
-        case 0x58:
-        case 0x59:
-        case 0x5a:
-        case 0x5b:
-        case 0x5c:
-        case 0x5d:
-        case 0x5e:
-        case 0x5f: // reserved types
-            // All have 2 bytes of data
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            WriteToState(&CurrentState, b0, b1, b2);
-            if (PastStart)
-            {
-                gzputc(out, b0);
-                gzputc(out, b1);
-                gzputc(out, b2);
-            }
-            break;
-        case VGM_PAUSE_WORD: // Wait n samples
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            WriteToState(&CurrentState, b0, b1, b2);
-            if ( // Write waits if:
-                PastStart && // Past start (so in data-writing mode) AND
-                (
-                    PastLoop || // past loop point
-                    (CurrentState.samplecount < loop) // OR before it
-                ) // (so it won't be written as I go past it, since I need to divide that wait into two)
-                && // AND
-                (CurrentState.samplecount < end) // before the end (final pause not written either)
-            )
-            {
-                gzputc(out, b0);
-                gzputc(out, b1);
-                gzputc(out, b2);
-            }
-            break;
-        //    case VGM_PAUSE_BYTE:  // Wait n samples
-        //      b1=gzgetc(in);
-        //      WriteToState(&CurrentState, b0, b1, 0);
-        // Same conditions for writing all pauses
-        //      if (PastStart && (PastLoop || (CurrentState.samplecount<loop)) && (CurrentState.samplecount<end) ) {
-        //        gzputc(out, b0);
-        //        gzputc(out, b1);
-        //      }
-        //      break;
-        case 0x70:
-        case 0x71:
-        case 0x72:
-        case 0x73:
-        case 0x74:
-        case 0x75:
-        case 0x76:
-        case 0x77:
-        case 0x78:
-        case 0x79:
-        case 0x7a:
-        case 0x7b:
-        case 0x7c:
-        case 0x7d:
-        case 0x7e:
-        case 0x7f: // Wait 1-16 samples
-        case VGM_PAUSE_60TH: // Wait 1/60 s
-        case VGM_PAUSE_50TH: // Wait 1/50 s
-            // All are 1-byte pause commands
-            WriteToState(&CurrentState, b0, 0, 0);
-            if (PastStart && (PastLoop || (CurrentState.samplecount < loop)) && (CurrentState.samplecount < end))
+            // This also writes to the DAC and moves on in the data bank
+            ++pcmAddress;
+            isPcmUsed = true;
+            return true;
+        }
+        if (dynamic_cast<const VgmCommands::Wait*>(pCommand) != nullptr
+            || dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr)
+        {
+            return true;
+        }
+        if (const auto* pSeek = dynamic_cast<const VgmCommands::PCMSeek*>(pCommand); pSeek != nullptr)
+        {
+            pcmAddress = pSeek->address();
+            isPcmUsed = true;
+            return true;
+        }
+        if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+        {
+            psgState.add(pPsg);
+            return true;
+        }
+        if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+        {
+            psgState.add(pStereo);
+            return true;
+        }
+        // Writes with side effects, e.g. key on, are restored by write_state() too
+        for (const auto& model : registerModels)
+        {
+            if (model->add(pCommand) != IRegisterModel::AddResult::NotHandled)
             {
-                gzputc(out, b0);
+                return true;
             }
-            break;
-        case VGM_END: // End of sound data
-            b0 = EOF; // break out of loop
-            break;
-        default:
-            break;
-        } // end switch
-
+        }
+        // Stream starts and stops are over by the start. Data blocks, stream setup and writes to chips without a state
+        // model are kept, as later commands may depend on them.
+        return dynamic_cast<const VgmCommands::DacStreamStart*>(pCommand) != nullptr
+            || dynamic_cast<const VgmCommands::DacStreamStartFast*>(pCommand) != nullptr
+            || dynamic_cast<const VgmCommands::DacStreamStop*>(pCommand) != nullptr;
+    };
 
-        // Start point state write
+    StageTimer timer(callback, "trim");
+    const auto commandCountBefore = file.commands().size();
 
-        if ((!PastStart) && (CurrentState.samplecount >= start))
+    // We only need to look at the commands up to the loop point; the rest are cut or kept as they are
+    file.edit_commands([&](CommandSequence& sequence)
+    {
+        if (std::cmp_greater(end, sequence.sample_count()))
         {
-            // We've gone past (or equalled) the start point, so:
-            // 1. Write state
-            WriteStateToFile(out, &CurrentState, true);
-            // 2. Write any remaining pause left
-            write_pause(out, CurrentState.samplecount - start);
-            // 3. Record that it's time to start copying data
-            PastStart = true;
+            throw std::runtime_error(std::format("End point {} is beyond the end of the data ({} samples)", end, sequence.sample_count()));
         }
 
-        // Loop point state saving and pause splitting (if needed)
+        // Everything from the end on goes, and we make our own loop point
+        const auto endIndex = split_at(sequence, end);
+        sequence.erase(endIndex, sequence.size());
+        sequence.insert(sequence.size(), {new VgmCommands::End()});
+        for (auto loopIndex = sequence.loop_index(); loopIndex.has_value(); loopIndex = sequence.loop_index())
+        {
+            sequence.erase(*loopIndex, *loopIndex + 1);
+        }
 
-        if ((!PastLoop) && (CurrentState.samplecount >= loop))
+        // Splitting at the loop can't move the start, as it is after it
+        const auto startIndex = split_at(sequence, start);
+        const auto loopIndex = loop < 0 ? std::optional<size_t>() : split_at(sequence, loop);
+
+        // Run the state up to the start and loop points, noting what we can drop before the start
+        std::vector<VgmCommands::ICommand*> startCommands;
+        std::vector<VgmCommands::ICommand*> loopCommands;
+        std::vector<bool> isDropped;
+        isDropped.reserve(startIndex);
+        const auto stateEnd = loopIndex.value_or(startIndex);
+        auto it = sequence.begin();
+        for (size_t i = 0; ; ++i, ++it)
         {
-            // We've gone past (or equalled) the loop point so:
-            int LastPauseLength = 0;
-            // 1. Record current state
-            LoopPointState = CurrentState;
-            // 2. Write any remaining pause up to the loop point
-            // 2.1 Find how long the last pause was
-            switch (b0)
+            if (i == startIndex && loop != start)
+            {
+                // Else the loop point does it
+                writeState(startCommands, false);
+            }
+            if (i == loopIndex)
+            {
+                loopCommands.push_back(new VgmCommands::LoopPoint());
+                // We can arrive here from the end, so we write the whole state again. If it is also the start, we need
+                // everything, even what restarts.
+                writeState(loopCommands, loop != start);
+            }
+            if (i == stateEnd)
             {
-            case VGM_PAUSE_WORD: LastPauseLength = b1 | (b2 << 8);
-                break;
-            //      case VGM_PAUSE_BYTE: LastPauseLength=b1;          break;
-            case VGM_PAUSE_60TH: LastPauseLength = LEN60TH;
-                break;
-            case VGM_PAUSE_50TH: LastPauseLength = LEN50TH;
-                break;
-            case 0x70:
-            case 0x71:
-            case 0x72:
-            case 0x73:
-            case 0x74:
-            case 0x75:
-            case 0x76:
-            case 0x77:
-            case 0x78:
-            case 0x79:
-            case 0x7a:
-            case 0x7b:
-            case 0x7c:
-            case 0x7d:
-            case 0x7e:
-            case 0x7f: // Wait 1-16 samples
-                LastPauseLength = (b0 & 0xf) + 1;
                 break;
             }
-            // 2.2 Handle cases where the loop and start points are close together
-            // This is complicated, so it's super-comment time...
-            /*
-               Case 1: start was ages ago, loop has been passed
-               Start of data      Last data             Next data
-                                      X                           last pause starts here
-                                      <--------------------->     LastPauseLength
-                 <------------------------------------------>     CurrentState.samplecount
-                 <------------------------------->                loop
-                                      <---------->                Write this pause    = LastPauseLength - (CurrentState.samplecount - loop)
-                                                  <--------->     Then this pause     = CurrentState.samplecount - loop
-               Looping will point to here --------^
-               Loop state will be written before EOF
-               TODO: make sure pause optimiser doesn't merge these two consecutive pauses!
-      
-               Case 2: start was ages ago, loop has just been reached
-               Start of data      Last data             Next data
-                                      X                           last pause starts here
-                                      <--------------------->     LastPauseLength
-                 <------------------------------------------>     CurrentState.samplecount
-                 <------------------------------------------>     loop
-                                      <--------------------->     Write this pause    = LastPauseLength
-                                                                  Then NO pause
-               Looping will point to here --------------------^
-               Loop state will be written before EOF
-               This is OK, because (CurrentState.samplecount - loop) = 0 so the above expressions are OK
-      
-               Case 3: start and loop both happened since the last data
-               Start of data      Last data             Next data
-                                      X                           last pause starts here
-                                      <--------------------->     LastPauseLength
-                 <------------------------------------------>     CurrentState.samplecount
-                 <------------------------>                       start
-                 <------------------------------->                loop
-                                           <---------------->     CurrentState.samplecount - start
-                                           <----->                Write this pause    = (CurrentState.samplecount - start) - (CurrentState.samplecount - loop)
-                                                  <--------->     Then this pause     = CurrentState.samplecount - loop
-               Looping will point to here --------^
-               Loop state will be written before EOF
-               This can be achieved using the same expressions by setting LastPauseLength to (CurrentState.samplecount - start)
-               when LastPauseLength > CurrentState.samplecount-start
-      
-               I am not handling the case where loop is very close to end, or all three are within one pause command.
-               No real music has that and it'd be a lot more work to get right.
-      
-            */
-            if (LastPauseLength > (CurrentState.samplecount - start))
+            if ((i & 0xffff) == 0)
             {
-                LastPauseLength = loop - start;
+                if (callback.is_cancelled())
+                {
+                    // The sequence gives back what it owns, but these aren't in it yet
+                    for (const auto* pCommand : startCommands)
+                    {
+                        delete pCommand;
+                    }
+                    for (const auto* pCommand : loopCommands)
+                    {
+                        delete pCommand;
+                    }
+                    throw OperationCancelled();
+                }
+                callback.show_progress("trim", i, stateEnd);
+            }
+            const auto isStateOnly = applyToState(*it);
+            if (i < startIndex)
+            {
+                isDropped.push_back(isStateOnly);
             }
-
-            write_pause(out, LastPauseLength - (CurrentState.samplecount - loop));
-            // 3. Record loop offset
-            VGMHeader.LoopOffset = gztell(out) - LOOPDELTA;
-            // 4. Write any remaining pause left
-            write_pause(out, CurrentState.samplecount - loop);
-            // 5. Record that I've done it
-            PastLoop = true;
         }
 
-        if (CurrentState.samplecount >= end)
+        if (loopIndex.has_value())
+        {
+            sequence.insert(*loopIndex, std::move(loopCommands));
+        }
+        auto commands = sequence.extract(0, startIndex).release();
+        std::erase_if(commands, [&, i = size_t{0}](VgmCommands::ICommand* pCommand) mutable
         {
-            // We've got to the end
-            // 1. Write any remaining pause
-            int LastPauseLength = 0;
-            switch (b0)
+            if (!isDropped[i++])
             {
-            case VGM_PAUSE_WORD: LastPauseLength = b1 | (b2 << 8);
-                break;
-            //      case VGM_PAUSE_BYTE: LastPauseLength=b1;          break;
-            case VGM_PAUSE_60TH: LastPauseLength = LEN60TH;
-                break;
-            case VGM_PAUSE_50TH: LastPauseLength = LEN50TH;
-                break;
-            case 0x70:
-            case 0x71:
-            case 0x72:
-            case 0x73:
-            case 0x74:
-            case 0x75:
-            case 0x76:
-            case 0x77:
-            case 0x78:
-            case 0x79:
-            case 0x7a:
-            case 0x7b:
-            case 0x7c:
-            case 0x7d:
-            case 0x7e:
-            case 0x7f: // Wait 1-16 samples
-                LastPauseLength = (b0 & 0xf) + 1;
-                break;
+                return false;
             }
-            // Start   Last data   end   Next data
-            //             X                      Last pause starts here
-            //             <----------------->    LastPauseLength
-            //   <--------------------------->    SampleCount
-            //   <------------------>             end
-            //             <-------->             end-(SampleCount-LastPauseLength)
-            write_pause(out, end - (CurrentState.samplecount - LastPauseLength));
-            // 2. Quit (do rest outside loop)
-            b0 = EOF;
-        }
-    }
-    while (b0 != EOF);
+            delete pCommand;
+            return true;
+        });
+        commands.insert(commands.end(), startCommands.begin(), startCommands.end());
+        sequence.insert(0, std::move(commands));
+    });
+    file.check_header(true);
+    timer.finish(0, 0, commandCountBefore);
+
+    callback.show_status(std::format("Trimmed to {} samples", end - start));
+}
 
-    // At end:
-    // 1. If we're doing looping, write the loop state
-    if (loop != -1)
-    {
-        WriteStateToFile(out, &CurrentState, false);
-    }
-    // 2. Write EOF mrker
-    gzputc(out, VGM_END);
-    // 3. Copy GD3 tag
-    if (VGMHeader.GD3Offset)
+//----------------------------------------------------------------------------------------------
+// Trims the file to "<name> (trimmed).<ext>", without optimising it
+//----------------------------------------------------------------------------------------------
+bool new_trim(const std::string& filename, const int start, const int loop, const int end, const IVGMToolCallback& callback)
+{
+    if (!Utils::file_exists(filename))
     {
-        TGD3Header GD3Header;
-        int NewGD3Offset = gztell(out) - GD3DELTA;
-        callback.show_status("Copying GD3 tag...");
-        gzseek(in, VGMHeader.GD3Offset + GD3DELTA, SEEK_SET);
-        gzread(in, &GD3Header, sizeof(GD3Header));
-        gzwrite(out, &GD3Header, sizeof(GD3Header));
-        for (auto i = 0u; i < GD3Header.length; ++i)
-        {
-            gzputc(out, gzgetc(in));
-        }
-        VGMHeader.GD3Offset = NewGD3Offset;
+        return false;
     }
-    gzclose(in);
-    // 4. Fill in VGM header
-    VGMHeader.EoFOffset = gztell(out) - EOFDELTA;
-    VGMHeader.TotalLength = end - start;
-    if (loop > -1)
+
+    try
     {
-        VGMHeader.LoopLength = end - loop;
+        VgmFile file(filename);
+        trim(file, start, loop, end, callback);
+        file.save_file(Utils::make_suffixed_filename(filename, "trimmed"));
     }
-    else
+    catch (const std::exception& e)
     {
-        VGMHeader.LoopLength = 0;
-        VGMHeader.LoopOffset = 0;
+        callback.show_error(e.what());
+        return false;
     }
-
-    gzclose(out);
-    write_vgm_header(outfilename, VGMHeader, callback);
-
     return true;
 }
 
 
+
 struct TPSGState
 {
     uint8_t GGStereo; // GG stereo byte
@@ -425,24 +302,28 @@ struct TPSGState
     bool NoiseUpdated;
 };
 
-TPSGState LastWrittenPSGState = {
-    0xff, // GG stereo - all on
-    {0, 0, 0}, // Tone channels - off
-    0xe5, // Noise byte - white, medium
-    {15, 15, 15, 15}, // Volumes - all off
-    0, 4 // PSG low bits, channel - 4 so no values needed
-};
+// What a trim has written so far. Each trim has its own, so several can run at once.
+struct TrimWriteState
+{
+    TPSGState LastWrittenPSGState = {
+        0xff, // GG stereo - all on
+        {0, 0, 0}, // Tone channels - off
+        0xe5, // Noise byte - white, medium
+        {15, 15, 15, 15}, // Volumes - all off
+        0, 4 // PSG low bits, channel - 4 so no values needed
+    };
 
-unsigned char LastWrittenYM2413Regs[YM2413NumRegs] = ""; // zeroes it
+    unsigned char LastWrittenYM2413Regs[YM2413NumRegs] = ""; // zeroes it
 
-// The game could have moved a key from on to off to on within 1
-// frame/pause... so I need to keep a check on that >:(
-// Bits
-// 0-4 = percussion bits
-// 5-13 = tone channels
-int KeysLifted = 0,
-    KeysPressed = 0;
-int NoiseChanged = 0;
+    // The game could have moved a key from on to off to on within 1
+    // frame/pause... so I need to keep a check on that >:(
+    // Bits
+    // 0-4 = percussion bits
+    // 5-13 = tone channels
+    int KeysLifted = 0,
+        KeysPressed = 0;
+    int NoiseChanged = 0;
+};
 
 const int YM2413StateRegWriteFlags[YM2413NumRegs] = {
     //  Chooses bits when writing states (start/loop)
@@ -464,23 +345,11 @@ const int YM2413StateRegWriteFlags[YM2413NumRegs] = {
     0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 };
 
-const int YM2413RegWriteFlags[YM2413NumRegs] = {
-    //  Chooses bits when copying data -> want everything
-    //  Regs:
-    //  0    1    2    3    4    5    6    7    8    9    a    b    c    d    e    f
-    //  00-07: user-definable tone channel - left at 0xff for now
-    //  0E:    rhythm mode control - all (bits 0-5)
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x00,
-    //  10-18: tone F-number low bits - want all bits
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //  20-28: tone F-number high bit, octave set, "key" & sustain
-    //  0x3f = all (bits 0-5)
-    0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //  30-38: instrument number/volume - want all bits
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
-};
+// Chooses bits when copying data -> want everything that's valid
+using YM2413Registers = RegisterFile<YM2413Layout>;
 
-void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned char YM2413Regs[YM2413NumRegs])
+void WriteVGMInfo(TrimWriteState& state, gzFile out, long* pauselength, TPSGState* PSGState,
+                  unsigned char YM2413Regs[YM2413NumRegs])
 {
     int i;
     if (!*pauselength)
@@ -489,7 +358,7 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
     }
     // If pause=zero do nothing so only the last write to each register before a pause is written
     // Write PSG stuff
-    if (PSGState->GGStereo != LastWrittenPSGState.GGStereo)
+    if (PSGState->GGStereo != state.LastWrittenPSGState.GGStereo)
     {
         // GG stereo
         gzputc(out, VGM_GGST);
@@ -498,7 +367,7 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
     for (i = 0; i < 3; ++i)
     {
         // Tone channel frequencies
-        if (PSGState->ToneFreqs[i] != LastWrittenPSGState.ToneFreqs[i])
+        if (PSGState->ToneFreqs[i] != state.LastWrittenPSGState.ToneFreqs[i])
         {
             gzputc(out, VGM_PSG);
             gzputc(out,
@@ -513,17 +382,17 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
             );
         }
     }
-    if (NoiseChanged)
+    if (state.NoiseChanged)
     {
         // Writing to the noise register resets the LFSR so I have to always repeat writes
         gzputc(out, VGM_PSG); // 1-stage write
         gzputc(out, PSGState->NoiseByte);
-        NoiseChanged = 0;
+        state.NoiseChanged = 0;
     }
     for (i = 0; i < 4; ++i)
     {
         // All 4 channels volumes
-        if (PSGState->Volumes[i] != LastWrittenPSGState.Volumes[i])
+        if (PSGState->Volumes[i] != state.LastWrittenPSGState.Volumes[i])
         {
             gzputc(out, VGM_PSG);
             gzputc(out,
@@ -536,40 +405,40 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
     // Write YM2413 stuff
     for (i = 0; i < YM2413NumRegs; ++i)
     {
-        if (YM2413RegWriteFlags[i])
+        if (YM2413Registers::valid_bits(i))
         {
             if (
-                ((YM2413Regs[i] & YM2413RegWriteFlags[i]) != LastWrittenYM2413Regs[i]) &&
+                ((YM2413Regs[i] & YM2413Registers::valid_bits(i)) != state.LastWrittenYM2413Regs[i]) &&
                 (i != 0x0e) // not percussion
             )
             {
                 gzputc(out, VGM_YM2413); // YM2413
                 gzputc(out, i); // Register
-                gzputc(out, (YM2413Regs[i] & YM2413RegWriteFlags[i])); // Value
-                LastWrittenYM2413Regs[i] = YM2413Regs[i] & YM2413RegWriteFlags[i];
+                gzputc(out, (YM2413Regs[i] & YM2413Registers::valid_bits(i))); // Value
+                state.LastWrittenYM2413Regs[i] = YM2413Regs[i] & YM2413Registers::valid_bits(i);
             }
         }
     }
     // Percussion after tone
-    if (LastWrittenYM2413Regs[0x0e] != (YM2413Regs[0x0e] & YM2413RegWriteFlags[0x0e]))
+    if (state.LastWrittenYM2413Regs[0x0e] != (YM2413Regs[0x0e] & YM2413Registers::valid_bits(0x0e)))
     {
         gzputc(out, VGM_YM2413); // YM2413
         gzputc(out, 0x0e); // Register
-        gzputc(out, (YM2413Regs[0x0e] & YM2413RegWriteFlags[0x0e])); // Value
-        LastWrittenYM2413Regs[0x0e] = YM2413Regs[0x0e] & YM2413RegWriteFlags[0x0e];
+        gzputc(out, (YM2413Regs[0x0e] & YM2413Registers::valid_bits(0x0e))); // Value
+        state.LastWrittenYM2413Regs[0x0e] = YM2413Regs[0x0e] & YM2413Registers::valid_bits(0x0e);
     }
     // Now we have to handle keys which have gone from lifted to
     // pressed since the last write - if they were pressed at the last
     // write, that means they've gone Down-Up-Down, and we need to tell
     // the YM2413 this since it would otherwise be missed by the
     // optimiser
-    if (KeysLifted & KeysPressed)
+    if (state.KeysLifted & state.KeysPressed)
     {
         // At least one key was lifted and pressed
         // First the percussion - find which keys have done DUD
-        char PercussionKeysDUD = LastWrittenYM2413Regs[0x0e] & 0x1f // 1 for each inst currently set to on
-            & KeysLifted & KeysPressed; // 1 for each inst on-off-on
-        int ToneKeysUD = KeysLifted & KeysPressed & 0x1fe0;
+        char PercussionKeysDUD = state.LastWrittenYM2413Regs[0x0e] & 0x1f // 1 for each inst currently set to on
+            & state.KeysLifted & state.KeysPressed; // 1 for each inst on-off-on
+        int ToneKeysUD = state.KeysLifted & state.KeysPressed & 0x1fe0;
         if (ToneKeysUD)
         {
             // At least one tone key went from up to down. So look to
@@ -580,7 +449,7 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
                 // for each tone channel
                 if (
                     (ToneKeysUD & (1 << (5 + i))) && // if it's gone UD
-                    (LastWrittenYM2413Regs[0x20 + i] & 0x10) // and was D before
+                    (state.LastWrittenYM2413Regs[0x20 + i] & 0x10) // and was D before
                 )
                 {
                     // debug marker
@@ -588,41 +457,41 @@ void WriteVGMInfo(gzFile out, long* pauselength, TPSGState* PSGState, unsigned c
                     gzputc(out, VGM_YM2413); // YM2413
                     gzputc(out, 0x20 + i); // Register
                     gzputc(out,
-                        (LastWrittenYM2413Regs[0x20 + i] & 0x2f) // Turn off the key
+                        (state.LastWrittenYM2413Regs[0x20 + i] & 0x2f) // Turn off the key
                     ); // Value
                     gzputc(out, VGM_YM2413); // YM2413
                     gzputc(out, 0x20 + i); // Register
-                    gzputc(out, LastWrittenYM2413Regs[0x20 + i]);
+                    gzputc(out, state.LastWrittenYM2413Regs[0x20 + i]);
                 }
             }
         }
         // Do percussion last in case any ch6-8 writes changed it
         if (
             (PercussionKeysDUD) && // At least one key has gone UDU
-            (LastWrittenYM2413Regs[0x0e] & 0x20) // Percussion is on
+            (state.LastWrittenYM2413Regs[0x0e] & 0x20) // Percussion is on
         )
         {
             gzputc(out, VGM_YM2413); // YM2413
             gzputc(out, 0x0e); // Register
             gzputc(out,
-                (LastWrittenYM2413Regs[0x0e] ^ PercussionKeysDUD) // Turn off the ones I want
+                (state.LastWrittenYM2413Regs[0x0e] ^ PercussionKeysDUD) // Turn off the ones I want
                 | 0x20
             ); // Value
             gzputc(out, VGM_YM2413); // YM2413
             gzputc(out, 0x0e); // Register
-            gzputc(out, LastWrittenYM2413Regs[0x0e]);
+            gzputc(out, state.LastWrittenYM2413Regs[0x0e]);
         }
     }
-    KeysLifted = 0;
-    KeysPressed = 0;
+    state.KeysLifted = 0;
+    state.KeysPressed = 0;
     // then pause
     write_pause(out, *pauselength);
     *pauselength = 0; // maybe not needed
     // and record what we've done
-    LastWrittenPSGState = *PSGState;
+    state.LastWrittenPSGState = *PSGState;
 }
 
-void WritePSGState(gzFile out, TPSGState PSGState)
+void WritePSGState(TrimWriteState& state, gzFile out, TPSGState PSGState)
 {
     int i;
     // GG stereo
@@ -646,7 +515,7 @@ void WritePSGState(gzFile out, TPSGState PSGState)
     // Noise
     gzputc(out, VGM_PSG); // 1-stage write
     gzputc(out, PSGState.NoiseByte);
-    NoiseChanged = 0;
+    state.NoiseChanged = 0;
 
     // All 4 channels volumes
     for (i = 0; i < 4; ++i)
@@ -658,10 +527,10 @@ void WritePSGState(gzFile out, TPSGState PSGState)
             PSGState.Volumes[i] // bits 0 to 4 -> volume
         );
     }
-    LastWrittenPSGState = PSGState;
+    state.LastWrittenPSGState = PSGState;
 }
 
-void WriteYM2413State(gzFile out, unsigned char YM2413Regs[YM2413NumRegs], int IsStart)
+void WriteYM2413State(TrimWriteState& state, gzFile out, unsigned char YM2413Regs[YM2413NumRegs], int IsStart)
 {
     for (int i = 0; i < YM2413NumRegs; ++i)
     {
@@ -670,7 +539,7 @@ void WriteYM2413State(gzFile out, unsigned char YM2413Regs[YM2413NumRegs], int I
             gzputc(out, VGM_YM2413); // YM2413
             gzputc(out, i); // Register
             gzputc(out, (YM2413Regs[i] & YM2413StateRegWriteFlags[i])); // Value
-            LastWrittenYM2413Regs[i] = YM2413Regs[i] & YM2413StateRegWriteFlags[i];
+            state.LastWrittenYM2413Regs[i] = YM2413Regs[i] & YM2413StateRegWriteFlags[i];
         }
     }
 
@@ -679,8 +548,8 @@ void WriteYM2413State(gzFile out, unsigned char YM2413Regs[YM2413NumRegs], int I
         // Write percussion
         gzputc(out, VGM_YM2413);
         gzputc(out, 0x0e);
-        gzputc(out, YM2413Regs[0x0e] & YM2413RegWriteFlags[0x0e]);
-        LastWrittenYM2413Regs[0x0e] = YM2413Regs[0x0e] & YM2413RegWriteFlags[0x0e];
+        gzputc(out, YM2413Regs[0x0e] & YM2413Registers::valid_bits(0x0e));
+        state.LastWrittenYM2413Regs[0x0e] = YM2413Regs[0x0e] & YM2413Registers::valid_bits(0x0e);
     }
 }
 
@@ -702,6 +571,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
     }
 
     uint8_t YM2413Regs[YM2413NumRegs]{};
+    TrimWriteState state;
 
     if ((start > end) || (loop > end) || ((loop > -1) && (loop < start)))
     {
@@ -833,7 +703,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                     currentPsgState.GGStereo = static_cast<uint8_t>(b1);
                     if ((writtenStart) && (vgmHeader.PSGClock))
                     {
-                        WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                        WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                     }
                 }
                 break;
@@ -853,11 +723,11 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                     {
                         // 2nd noise byte (Micro Machines title screen)
                         // Always write
-                        NoiseChanged = 1;
+                        state.NoiseChanged = 1;
                         currentPsgState.NoiseByte = (b1 & 0xf) | 0xe0;
                         if ((writtenStart) && (vgmHeader.PSGClock))
                         {
-                            WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                            WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                         }
                     }
                     else
@@ -878,7 +748,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                                 // If necessary, write 1st byte
                                 if ((writtenStart) && (vgmHeader.PSGClock))
                                 {
-                                    WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                                    WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                                 }
                                 lastFirstByteWritten = firstByte;
                             }
@@ -886,7 +756,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                             if ((writtenStart) && (vgmHeader.PSGClock)
                                 /*&& (CurrentPSGState.Volumes[CurrentPSGState.Channel])*/)
                             {
-                                WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                                WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                             }
                             currentPsgState.ToneFreqs[currentPsgState.Channel] = static_cast<uint16_t>(freq);
                             // Write 2nd byte
@@ -898,12 +768,12 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                     {
                         // noise
                         // No "does it change" because writing resets the LFSR (ie. has an effect)
-                        NoiseChanged = 1;
+                        state.NoiseChanged = 1;
                         currentPsgState.NoiseByte = static_cast<uint8_t>(b1);
                         currentPsgState.Channel = 3;
                         if ((writtenStart) && (vgmHeader.PSGClock))
                         {
-                            WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                            WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                         }
                     }
                     else
@@ -924,7 +794,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                             // Only write volume change if we've got to the start and PSG is turned on
                             if ((writtenStart) && (vgmHeader.PSGClock))
                             {
-                                WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                                WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                             }
                         }
                     }
@@ -936,7 +806,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
             {
                 const auto b1 = gzgetc(in);
                 const auto b2 = gzgetc(in);
-                if ((b1 >= YM2413NumRegs) || !(YM2413RegWriteFlags[b1]))
+                if (!YM2413Registers::is_valid(b1))
                 {
                     break; // Discard invalid register numbers
                 }
@@ -945,10 +815,10 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                 // Check for percussion keys lifted or pressed
                 if (b1 == 0x0e)
                 {
-                    KeysLifted |= (b2 ^ 0x1f) & 0x1f;
+                    state.KeysLifted |= (b2 ^ 0x1f) & 0x1f;
                     // OR the percussion keys with the inverse of the perc.
                     // keys to get a 1 stored there if the key has been lifted
-                    KeysPressed |= (b2 & 0x1f);
+                    state.KeysPressed |= (b2 & 0x1f);
                     // Do similar with the non-inverse to get the keys pressed
                 }
                 // Check for tone keys lifted or pressed
@@ -957,26 +827,26 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                     if (b2 & 0x10)
                     {
                         // Key was pressed
-                        KeysPressed |= 1 << (b1 - 0x20 + 5);
+                        state.KeysPressed |= 1 << (b1 - 0x20 + 5);
                     }
                     else
                     {
-                        KeysLifted |= 1 << (b1 - 0x20 + 5);
+                        state.KeysLifted |= 1 << (b1 - 0x20 + 5);
                     }
                     if (
-                        (KeysLifted & KeysPressed & (1 << (b1 - 0x20 + 5))) // the key has gone UD
+                        (state.KeysLifted & state.KeysPressed & (1 << (b1 - 0x20 + 5))) // the key has gone UD
                         &&
-                        (LastWrittenYM2413Regs[b1] & 0x10) // 0x10 == 00010000 == YM2413 tone key bit
+                        (state.LastWrittenYM2413Regs[b1] & 0x10) // 0x10 == 00010000 == YM2413 tone key bit
                         // ie. the key was D before UD
                     )
                     {
-                        KeysLifted = KeysLifted;
+                        state.KeysLifted = state.KeysLifted;
                     }
                 }
 
                 if ((writtenStart) && (vgmHeader.YM2413Clock))
                 {
-                    WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                    WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                 }
                 break;
             }
@@ -1014,7 +884,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                 if ((writtenStart) && ((sampleCount <= loop) || (loop == -1) || (writtenLoop)) && (sampleCount <=
                     end))
                 {
-                    WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                    WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                 }
                 break;
             }
@@ -1023,7 +893,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
             pauseLength += LEN60TH;
             if ((writtenStart) && ((sampleCount <= loop) || (loop == -1) || (writtenLoop)) && (sampleCount <= end))
             {
-                WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
             }
             break;
         case VGM_PAUSE_50TH: // Wait 1/50 s
@@ -1031,7 +901,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
             pauseLength += LEN50TH;
             if ((writtenStart) && ((sampleCount <= loop) || (loop == -1) || (writtenLoop)) && (sampleCount <= end))
             {
-                WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
             }
             break;
         case 0x70:
@@ -1057,7 +927,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                 if ((writtenStart) && ((sampleCount <= loop) || (loop == -1) || (writtenLoop)) && (sampleCount <=
                     end))
                 {
-                    WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                    WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
                 }
             }
             break;
@@ -1077,7 +947,7 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
             if (writtenStart)
             {
                 pauseLength = loop - (sampleCount - pauseLength); // Write any remaining pause up to the edit point
-                WriteVGMInfo(out, &pauseLength, &currentPsgState, YM2413Regs);
+                WriteVGMInfo(state, out, &pauseLength, &currentPsgState, YM2413Regs);
             }
             pauseLength = sampleCount - loop; // and remember any left over
             // Remember offset
@@ -1089,11 +959,11 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
                 if (havePSG)
                 {
                     currentPsgState.NoiseByte &= 0xf7;
-                    WritePSGState(out, currentPsgState);
+                    WritePSGState(state, out, currentPsgState);
                 }
                 if (haveYM2413)
                 {
-                    WriteYM2413State(out, YM2413Regs, true);
+                    WriteYM2413State(state, out, YM2413Regs, true);
                 }
             }
             writtenLoop = 1;
@@ -1104,11 +974,11 @@ void trim(const std::string& filename, int start, int loop, int end, bool overWr
             if (havePSG)
             {
                 currentPsgState.NoiseByte &= 0xf7;
-                WritePSGState(out, currentPsgState);
+                WritePSGState(state, out, currentPsgState);
             }
             if (haveYM2413)
             {
-                WriteYM2413State(out, YM2413Regs, true);
+                WriteYM2413State(state, out, YM2413Regs, true);
             }
             // Remember any needed delay
             pauseLength = sampleCount - start;
@@ -2,9 +2,14 @@
 #include <xstring>
 
 class IVGMToolCallback;
+class VgmFile;
 
 void log_trim(const std::string& VGMFile, int start, int loop, int end, const IVGMToolCallback& callback);
 
 bool new_trim(const std::string& filename, int start, int loop, int end, const IVGMToolCallback& callback);
 
 void trim(const std::string& filename, int start, int loop, int end, bool overWrite, bool logTrims, const IVGMToolCallback& callback);
+
+// Trims the file in memory to the samples from start to end, with the loop point at loop (or -1 for no loop). The chip
+// state at the start and loop points is written out in full, so they sound the same as they did in the original.
+void trim(VgmFile& file, int start, int loop, int end, const IVGMToolCallback& callback);
@@ -3,13 +3,21 @@
 #include <filesystem>
 #include "utils.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <future>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 #include <vector>
 #include <zopfli.h>
+#include <deflate.h>
 
 #include "IVGMToolCallback.h"
+#include "Profile.h"
 
 bool Utils::file_exists(const std::string& filename)
 {
@@ -38,35 +46,23 @@ void Utils::compress(const std::string& filename, const IVGMToolCallback& callba
         percentReduction(static_cast<int>(data.size()), sizeBefore)));
 
     // Now compress
-    ZopfliOptions options{};
-    ZopfliInitOptions(&options);
-    if (iterations > 0)
-    {
-        // We let the library pick the default (15) if not set
-        options.numiterations = iterations;
-    }
-    unsigned char* out;
-    size_t outSize = 0;
-    ZopfliCompress(&options, ZOPFLI_FORMAT_GZIP, data.data(), data.size(), &out, &outSize);
+    const auto& compressed = compress_data(data, callback, iterations);
 
     // If it is not smaller, do not save
-    if (std::cmp_greater_equal(outSize, sizeBefore))
+    if (std::cmp_greater_equal(compressed.size(), sizeBefore))
     {
         callback.show_status(std::format(
             "Compressed to {} bytes, not overwriting...",
-            outSize));
+            compressed.size()));
         return;
     }
 
     // Write to disk, over the original file
     std::ofstream of;
     of.open(filename, std::ios::binary | std::ios::trunc | std::ios::out);
-    of.write(reinterpret_cast<const char*>(out), static_cast<std::streamsize>(outSize));
+    of.write(reinterpret_cast<const char*>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
     of.close();
 
-    // And free
-    free(out);
-
     const auto sizeAfter = file_size(filename);
     callback.show_status(std::format(
         "{} after: {} bytes ({:.2}% smaller, {:.4}% compression)", 
@@ -76,6 +72,63 @@ void Utils::compress(const std::string& filename, const IVGMToolCallback& callba
         percentReduction(static_cast<int>(data.size()), sizeAfter)));
 }
 
+std::vector<uint8_t> Utils::compress_data(const std::span<const uint8_t> data, const IVGMToolCallback& callback, const int iterations)
+{
+    StageTimer timer(callback, "compress");
+    ZopfliOptions options{};
+    ZopfliInitOptions(&options);
+    if (iterations > 0)
+    {
+        // We let the library pick the default (15) if not set
+        options.numiterations = iterations;
+    }
+
+    // This does the same as ZopfliCompress(), but we do the blocks ourselves so we can report progress and be cancelled
+    // between them. The header is as ZopfliCompress() writes it.
+    std::vector<uint8_t> result{0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 2, 3};
+    // Zopfli splits the data into blocks of this size anyway
+    constexpr size_t blockSize = 1000000;
+    unsigned char bitPointer = 0;
+    unsigned char* out = nullptr;
+    size_t outSize = 0;
+    try
+    {
+        for (size_t offset = 0;;)
+        {
+            callback.check_progress("compress", offset, data.size());
+            const auto size = std::min(blockSize, data.size() - offset);
+            const auto isFinal = offset + size == data.size();
+            ZopfliDeflatePart(&options, 2, isFinal ? 1 : 0, data.data(), offset, offset + size, &bitPointer, &out, &outSize);
+            offset += size;
+            if (isFinal)
+            {
+                break;
+            }
+        }
+    }
+    catch (...)
+    {
+        free(out);
+        throw;
+    }
+    result.insert(result.end(), out, out + outSize);
+    free(out);
+
+    // Then the CRC and size, little-endian
+    const auto crc = crc32_z(0, data.data(), data.size());
+    const auto size = static_cast<uint32_t>(data.size());
+    for (const auto value : {static_cast<uint32_t>(crc), size})
+    {
+        for (auto shift = 0; shift < 32; shift += 8)
+        {
+            result.push_back(static_cast<uint8_t>(value >> shift));
+        }
+    }
+
+    timer.finish(data.size(), result.size());
+    return result;
+}
+
 void Utils::decompress(const std::string& filename)
 {
     // Read file into memory
@@ -89,8 +142,31 @@ void Utils::decompress(const std::string& filename)
     of.close();
 }
 
+bool Utils::is_compressed(const std::string& filename)
+{
+    std::ifstream f(filename, std::ios::binary);
+    const auto b0 = f.get();
+    const auto b1 = f.get();
+    return b0 == 0x1f && b1 == 0x8b;
+}
+
+void Utils::save_gzip(const std::string& filename, const std::span<const uint8_t> data)
+{
+    gzFile out = gzopen(filename.c_str(), "wb9");
+    if (out == nullptr)
+    {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", filename));
+    }
+    const auto written = gzwrite(out, data.data(), static_cast<unsigned>(data.size()));
+    if (gzclose(out) != Z_OK || std::cmp_not_equal(written, data.size()))
+    {
+        throw std::runtime_error(std::format("Failed to write to \"{}\"", filename));
+    }
+}
+
 void Utils::load_file(std::vector<uint8_t>& buffer, const std::string& filename)
 {
+    Profile::Scope scope("load", filename);
     const auto f = gzopen(filename.c_str(), "rb");
     if (f == nullptr)
     {
@@ -117,17 +193,66 @@ void Utils::load_file(std::vector<uint8_t>& buffer, const std::string& filename)
     gzclose(f);
 }
 
+void Utils::load_data(std::vector<uint8_t>& buffer, const std::span<const uint8_t> data)
+{
+    // Same as gzread, we pass through anything without the GZip signature
+    if (data.size() < 2 || data[0] != 0x1f || data[1] != 0x8b)
+    {
+        buffer.assign(data.begin(), data.end());
+        return;
+    }
+
+    z_stream stream{};
+    // 16 selects the GZip format
+    if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+    {
+        throw std::runtime_error("Failed to initialise decompression");
+    }
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = static_cast<uInt>(data.size());
+    constexpr size_t chunkSize = 256 * 1024;
+    for (;;)
+    {
+        const auto sizeBefore = buffer.size();
+        buffer.resize(sizeBefore + chunkSize);
+        stream.next_out = buffer.data() + sizeBefore;
+        stream.avail_out = chunkSize;
+        const auto result = inflate(&stream, Z_NO_FLUSH);
+        buffer.resize(buffer.size() - stream.avail_out);
+        if (result == Z_STREAM_END)
+        {
+            // There may be more GZip members after this one
+            if (stream.avail_in == 0)
+            {
+                break;
+            }
+            inflateReset(&stream);
+        }
+        else if (result != Z_OK)
+        {
+            const std::string message = stream.msg == nullptr ? "unknown error" : stream.msg;
+            inflateEnd(&stream);
+            throw std::runtime_error(std::format("Error decompressing data: {}: {}", result, message));
+        }
+    }
+    inflateEnd(&stream);
+}
+
 // makes a unique temp filename out of src
 // it will probably choke with weird parameters, real writable filenames should be OK
 std::string Utils::make_temp_filename(const std::string& src)
 {
     const auto directory = std::filesystem::canonical(src).parent_path();
 
+    // Several jobs may want a temp file at once, so we reserve the name by creating the file
+    static std::mutex mutex;
+    std::lock_guard lock(mutex);
     for (int i = 0; ; ++i)
     {
         auto testPath = directory / std::format("{}.tmp", i);
         if (!file_exists(testPath.string()))
         {
+            std::ofstream(testPath, std::ios::binary);
             return testPath.string();
         }
     }
@@ -154,12 +279,64 @@ void Utils::replace_file(const std::string& destination, const std::string& sour
     std::filesystem::rename(source, destination);
 }
 
+std::vector<std::string> Utils::find_vgm_files(const std::vector<std::string>& paths)
+{
+    std::vector<std::string> filenames;
+    for (const auto& path : paths)
+    {
+        if (!std::filesystem::is_directory(path))
+        {
+            filenames.push_back(path);
+            continue;
+        }
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+        {
+            if (const auto& extension = to_lower(entry.path().extension().string());
+                entry.is_regular_file() && (extension == ".vgm" || extension == ".vgz"))
+            {
+                filenames.push_back(entry.path().string());
+            }
+        }
+    }
+    std::ranges::sort(filenames);
+    return filenames;
+}
+
+void Utils::parallel_for(const size_t count, const std::function<void(size_t)>& f)
+{
+    // Each thread takes the next index until there are none left, so slow items don't hold up the others
+    std::atomic<size_t> nextIndex = 0;
+    const auto threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto* profiler = Profile::profiler();
+    std::vector<std::future<void>> threads;
+    for (auto i = 0u; i < threadCount; ++i)
+    {
+        threads.push_back(std::async(std::launch::async, [&]
+        {
+            Profile::UseProfiler useProfiler(profiler);
+            for (auto index = nextIndex++; index < count; index = nextIndex++)
+            {
+                f(index);
+            }
+        }));
+    }
+    // We have to wait for all of them before get() can throw
+    for (auto& thread : threads)
+    {
+        thread.wait();
+    }
+    for (auto& thread : threads)
+    {
+        thread.get();
+    }
+}
+
 std::string Utils::to_lower(const std::string& s)
 {
     std::string result;
     std::ranges::transform(
         s,
-        result.begin(),
+        std::back_inserter(result),
         [](const std::string::value_type c)
         {
             return static_cast<std::string::value_type>(std::tolower(c));
@@ -237,3 +414,14 @@ double Utils::percentReduction(int before, int after)
 {
     return static_cast<double>(before - after) / static_cast<double>(before) * 100;
 }
+
+uint64_t Utils::hash(const void* data, const size_t size, uint64_t seed)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        seed ^= p[i];
+        seed *= 0x100000001b3;
+    }
+    return seed;
+}
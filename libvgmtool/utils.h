@@ -3,6 +3,8 @@
 // General purpose functions, not specific to anything much
 // except most are VGM-centric
 
+#include <functional>
+#include <span>
 #include <string>
 #include <vector>
 
@@ -22,16 +24,32 @@ public:
     static int file_size(const std::string& filename);
     // Compresses filename in place with zopfli
     static void compress(const std::string& filename, const IVGMToolCallback& callback, int iterations = -1);
+    // Compresses data with zopfli to GZip format. Progress is reported for each megabyte, which is also how often it can
+    // be cancelled.
+    static std::vector<uint8_t> compress_data(std::span<const uint8_t> data, const IVGMToolCallback& callback, int iterations = -1);
     // Decompresses filename in place
     static void decompress(const std::string& filename);
+    // Returns true if filename starts with the GZip signature
+    static bool is_compressed(const std::string& filename);
+    // Writes data to filename with gzip compression. This is much quicker than zopfli, which the compress verb can
+    // still be used for.
+    static void save_gzip(const std::string& filename, std::span<const uint8_t> data);
     // Reads a file into RAM, possibly decompressing it at the same time
     static void load_file(std::vector<uint8_t>& buffer, const std::string& filename);
+    // Copies data into buffer, decompressing it if it is GZip compressed
+    static void load_data(std::vector<uint8_t>& buffer, std::span<const uint8_t> data);
     // Makes a temp filename (that is not in use) in the same directory as src and returns it. This is subject to a race but probably fine.
     static std::string make_temp_filename(const std::string& src);
     // Makes a filename by adding " (<suffix>)" to src before the extension
     static std::string make_suffixed_filename(const std::string& src, const std::string& suffix);
     // Deletes destination if it exists, and moves source to its place
     static void replace_file(const std::string& destination, const std::string& source);
+    // Returns the files in paths, plus all the .vgm and .vgz files in the folders in paths (recursively), sorted
+    static std::vector<std::string> find_vgm_files(const std::vector<std::string>& paths);
+
+    // Calls f for each index from 0 to count - 1, on one thread per CPU core. Any exception is rethrown once all the
+    // threads have finished.
+    static void parallel_for(size_t count, const std::function<void(size_t)>& f);
 
     // Converts LSB b1, MSB b2 into an integer
     static int make_word(int b1, int b2);
@@ -56,4 +74,7 @@ public:
 
     // Given two numbers, express the second as a percentage reduction compared to the first
     static double percentReduction(int before, int after);
+
+    // 64-bit FNV-1a hash of some bytes. Pass a previous result as the seed to hash several things together.
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325);
 };
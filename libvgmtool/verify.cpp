@@ -0,0 +1,238 @@
+#include "verify.h"
+
+#include <algorithm>
+#include <format>
+#include <limits>
+
+#include "BinaryData.h"
+#include "RegisterModel.h"
+#include "SN76489State.h"
+#include "utils.h"
+#include "VgmCommands.h"
+#include "VgmFile.h"
+
+namespace
+{
+    constexpr auto NO_MORE_COMMANDS = std::numeric_limits<uint32_t>::max();
+
+    // Walks through a file's commands, one point in time at a time
+    class StateTimeline
+    {
+    public:
+        explicit StateTimeline(const VgmFile& file)
+            : _commands(file.commands()),
+              _psgState(file.header()),
+              _registerModels(IRegisterModel::create_all(file.header()))
+        {
+            skip_waits();
+        }
+
+        // The time of the next commands, or NO_MORE_COMMANDS
+        [[nodiscard]] uint32_t next_time() const
+        {
+            return _index < _commands.size() ? _time : NO_MORE_COMMANDS;
+        }
+
+        // Applies all the commands up to the next wait
+        void apply_next()
+        {
+            for (; _index < _commands.size(); ++_index)
+            {
+                const auto* pCommand = _commands[_index];
+                if (dynamic_cast<const VgmCommands::End*>(pCommand) != nullptr)
+                {
+                    _index = _commands.size();
+                    return;
+                }
+                if (const auto* pSample = dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand); pSample != nullptr)
+                {
+                    // A DAC write, then a wait
+                    add_other(pCommand);
+                    ++_pcmAddress;
+                    _time += pSample->duration();
+                    ++_index;
+                    break;
+                }
+                if (dynamic_cast<const VgmCommands::Wait*>(pCommand) != nullptr)
+                {
+                    break;
+                }
+                add(pCommand);
+            }
+            skip_waits();
+        }
+
+        [[nodiscard]] uint64_t psg_hash() const
+        {
+            return _psgState.audible_state_hash();
+        }
+
+        // Hash of the register models' states, and any key presses since the last call they don't show
+        uint64_t take_register_models_hash()
+        {
+            auto hash = Utils::hash(nullptr, 0);
+            for (const auto& model : _registerModels)
+            {
+                const uint64_t modelHashes[] = {model->state_hash(), model->take_key_presses_hash()};
+                hash = Utils::hash(modelHashes, sizeof(modelHashes), hash);
+            }
+            return hash;
+        }
+
+        // Hash of the register models' writes with side effects since the last call, in order
+        uint64_t take_side_effect_writes_hash()
+        {
+            auto hash = Utils::hash(nullptr, 0);
+            for (const auto& model : _registerModels)
+            {
+                const auto modelHash = model->take_side_effect_writes_hash();
+                hash = Utils::hash(&modelHash, sizeof(modelHash), hash);
+            }
+            return hash;
+        }
+
+        // Hash of the commands for chips we don't model since the last call
+        uint64_t take_other_commands_hash()
+        {
+            const auto hash = _otherCommandsHash;
+            _otherCommandsHash = Utils::hash(nullptr, 0);
+            return hash;
+        }
+
+    private:
+        void add(const VgmCommands::ICommand* pCommand)
+        {
+            if (const auto* pPsg = dynamic_cast<const VgmCommands::SN76489*>(pCommand); pPsg != nullptr)
+            {
+                _psgState.add(pPsg);
+                return;
+            }
+            if (const auto* pStereo = dynamic_cast<const VgmCommands::GGStereo*>(pCommand); pStereo != nullptr)
+            {
+                _psgState.add(pStereo);
+                return;
+            }
+            if (dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr)
+            {
+                return;
+            }
+            if (const auto* pSeek = dynamic_cast<const VgmCommands::PCMSeek*>(pCommand); pSeek != nullptr)
+            {
+                // Seeking to where we already are does nothing, e.g. at a trim's loop point
+                if (pSeek->address() != _pcmAddress)
+                {
+                    _pcmAddress = pSeek->address();
+                    add_other(pCommand);
+                }
+                return;
+            }
+            for (const auto& model : _registerModels)
+            {
+                if (model->add(pCommand) != IRegisterModel::AddResult::NotHandled)
+                {
+                    return;
+                }
+            }
+            add_other(pCommand);
+        }
+
+        void add_other(const VgmCommands::ICommand* pCommand)
+        {
+            _buffer.reset();
+            pCommand->to_data(_buffer);
+            _otherCommandsHash = Utils::hash(_buffer.buffer().data(), _buffer.buffer().size(), _otherCommandsHash);
+        }
+
+        // Moves past any waits to the next command
+        void skip_waits()
+        {
+            for (; _index < _commands.size(); ++_index)
+            {
+                const auto* pCommand = _commands[_index];
+                const auto* pWait = dynamic_cast<const VgmCommands::Wait*>(pCommand);
+                if (pWait == nullptr || dynamic_cast<const VgmCommands::YM2612Sample*>(pCommand) != nullptr)
+                {
+                    return;
+                }
+                _time += pWait->duration();
+            }
+        }
+
+        const std::vector<VgmCommands::ICommand*>& _commands;
+        size_t _index = 0;
+        uint32_t _time = 0;
+        SN76489State _psgState;
+        std::vector<std::unique_ptr<IRegisterModel>> _registerModels;
+        // The YM2612 PCM data bank position
+        uint32_t _pcmAddress = 0;
+        BinaryData _buffer;
+        uint64_t _otherCommandsHash = Utils::hash(nullptr, 0);
+    };
+}
+
+VerifyResult verify_equivalent(const VgmFile& original, const VgmFile& modified, const uint32_t startOffset)
+{
+    StateTimeline a(original);
+    StateTimeline b(modified);
+
+    // Catch up the original to the start offset
+    while (a.next_time() < startOffset)
+    {
+        a.apply_next();
+    }
+    a.take_register_models_hash();
+    a.take_side_effect_writes_hash();
+    a.take_other_commands_hash();
+
+    // We stop at the end of the shorter file, as any commands there are allowed to differ
+    const auto endTime = std::min(original.header().sample_count() - std::min(startOffset, original.header().sample_count()),
+        modified.header().sample_count());
+
+    VerifyResult result{true, 0, 0, ""};
+    for (;;)
+    {
+        const auto aTime = a.next_time() == NO_MORE_COMMANDS ? NO_MORE_COMMANDS : a.next_time() - startOffset;
+        const auto time = std::min(aTime, b.next_time());
+        if (time >= endTime)
+        {
+            return result;
+        }
+        if (aTime == time)
+        {
+            a.apply_next();
+        }
+        if (b.next_time() == time)
+        {
+            b.apply_next();
+        }
+
+        // A trim puts the writes which set up the state at the start, along with anything from before it which has to
+        // be kept, like data blocks, so we only compare the state there
+        const auto isTrimStart = startOffset > 0 && result.comparedPoints == 0;
+        ++result.comparedPoints;
+        const char* mismatch = nullptr;
+        if (a.psg_hash() != b.psg_hash())
+        {
+            mismatch = "SN76489 state";
+        }
+        else if (a.take_register_models_hash() != b.take_register_models_hash())
+        {
+            mismatch = "FM/PCM chip state";
+        }
+        else if (a.take_side_effect_writes_hash() != b.take_side_effect_writes_hash() && !isTrimStart)
+        {
+            mismatch = "FM/PCM writes with side effects";
+        }
+        else if (a.take_other_commands_hash() != b.take_other_commands_hash() && !isTrimStart)
+        {
+            mismatch = "commands for other chips";
+        }
+        if (mismatch != nullptr)
+        {
+            result.isEquivalent = false;
+            result.mismatchTime = time;
+            result.mismatch = std::format("{} differs at sample {} (original sample {})", mismatch, time, time + startOffset);
+            return result;
+        }
+    }
+}
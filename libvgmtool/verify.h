@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+// Checks that a rewritten file is equivalent to the original
+
+class VgmFile;
+
+struct VerifyResult
+{
+    bool isEquivalent;
+    // Number of points in time where the state was compared
+    uint32_t comparedPoints;
+    // Where the first difference was, in samples in the modified file
+    uint32_t mismatchTime;
+    // What was different
+    std::string mismatch;
+};
+
+// Replays both files through the chip state models in lockstep, and compares the register state at every point
+// where time passes in either file. Writes with side effects, and commands for chips we don't model, are compared in
+// order between those points, ignoring writes which do nothing. The modified file is expected to start at startOffset
+// samples into the original, as after a trim, where only the state is compared. It is compared until the end of the
+// shorter file. Loops are not followed.
+VerifyResult verify_equivalent(const VgmFile& original, const VgmFile& modified, uint32_t startOffset);
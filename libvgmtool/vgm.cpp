@@ -3,95 +3,13 @@
 
 #include <filesystem>
 
+#include "BinaryData.h"
 #include "IVGMToolCallback.h"
 #include "utils.h"
 #include "VgmFile.h"
 
 #define BUFFER_SIZE 5*1024 // 5KB buffer size for mass copying
 
-//----------------------------------------------------------------------------------------------
-// Arrays defining what YM2413 bits are valid, and which are keys (or act similarly to keys)
-//----------------------------------------------------------------------------------------------
-const int YM2413ValidBits[YM2413NumRegs] = {
-    //0    1    2    3    4    5    6    7    8    9    a    b    c    d    e    f
-    //User inst------------------------------ Unused----------------------- Rhythm Test
-    0xff, 0xff, 0xff, 0xdf, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3f, 0x00,
-    //F-num low 8 bits---------------------------- Unused----------------------------
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //F-num MSB/block/sus/key--------------------- Unused----------------------------
-    0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //Instrument/volume---------------------------
-    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
-};
-const int YM2413KeyBits[YM2413NumRegs] = {
-    //0    1    2    3    4    5    6    7    8    9    a    b    c    d    e    f
-    //User inst------------------------------ Unused----------------------- Rhythm Test
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x00,
-    //F-num low 8 bits---------------------------- Unused----------------------------
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //F-num MSB/block/sus/key--------------------- Unused----------------------------
-    0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    //Instrument/volume---------------------------
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-const int YM2612ValidBits[YM2612NumRegs] = {
-    // Note: I say unnecessary bits are invalid, eg. timers
-    //0    1    2    3    4    5    6    7    8    9    a    b    c    d    e    f
-    //Unused-------------------------------------------------------------------------
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x00x
-    //Unused-------------------------------------------------------------------------
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x01x
-    //Unused--- LFO  Unused         Timer B   Keys      DAC------ Unused-------------
-    //                    Timer A--      Timers, 3/6 mode
-    //                                             Unused
-    0x00, 0x00, 0x0f, 0x00, 0x00, 0x00, 0x00, 0xc0, 0xf7, 0x00, 0xff, 0x80, 0x00, 0x00, 0x00, 0x00, // 0x02x
-    //Detune/mutiple      --------------      --------------      --------------
-    0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x03x
-    //Total level         --------------      --------------      --------------
-    0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x04x
-    // Rate scaling, attack rate--------      --------------      --------------
-    0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, // 0x05x
-    // First decay rate; amplitude modulation --------------      --------------
-    0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, // 0x06x
-    // Secondary decay rate-------------      --------------      --------------
-    0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, // 0x07x
-    // Secondary amplitude; release rate      --------------      --------------
-    0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, // 0x08x
-    // SSG-EG - do not use (?)
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x09x
-    // F-num LSB          Bl, F-num MSB       Ch3 special mode    --------------
-    0xff, 0xff, 0xff, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0xff, 0xff, 0xff, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x0ax
-    // Feedback, algorithm Stereo, LFO          Invalid!
-    0x3f, 0x3f, 0x3f, 0x00, 0xef, 0xef, 0xef, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x0bx
-    // Above 0xb7 is invalid
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x0cx
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x0dx
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x0ex
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x0fx
-    // Part II (port 1): the same again, but only between 0x30 and 0xb7
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x10x
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x11x
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x12x
-    //Detune/mutiple      --------------      --------------      --------------
-    0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x13x
-    //Total level         --------------      --------------      --------------
-    0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x14x
-    // Rate scaling, attack rate--------      --------------      --------------
-    0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, 0xdf, 0xdf, 0xdf, 0x00, // 0x15x
-    // First decay rate; amplitude modulation --------------      --------------
-    0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, 0x9f, 0x9f, 0x9f, 0x00, // 0x16x
-    // Secondary decay rate-------------      --------------      --------------
-    0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, 0x1f, 0x1f, 0x1f, 0x00, // 0x17x
-    // Secondary amplitude; release rate      --------------      --------------
-    0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, // 0x18x
-    // SSG-EG - do not use (?)
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x19x
-    // F-num LSB          Bl, F-num MSB       Ch3 special mode    --------------
-    0xff, 0xff, 0xff, 0x00, 0x7f, 0x7f, 0x7f, 0x00, 0xff, 0xff, 0xff, 0x00, 0x7f, 0x7f, 0x7f, 0x00, // 0x1ax
-    // Feedback, algorithm Stereo, LFO
-    0x3f, 0x3f, 0x3f, 0x00, 0xef, 0xef, 0xef // 0x1bx
-};
-
 bool OldVGMHeader::is_valid() const
 {
     return strncmp(VGMIdent, "Vgm ", 4) == 0;
@@ -101,52 +19,67 @@ bool OldVGMHeader::is_valid() const
 // Writes a pause command to the file
 // Modifies the length parameter to zero when done
 //----------------------------------------------------------------------------------------------
-void write_pause(gzFile out, long int pauselength)
+namespace
 {
-    if (pauselength == 0)
-    {
-        return; // If zero do nothing
-    }
-    while (pauselength > 0xffff)
-    {
-        // If over 0xffff, write 0xffffs
-        gzputc(out, VGM_PAUSE_WORD);
-        gzputc(out, 0xff);
-        gzputc(out, 0xff);
-        pauselength -= 0xffff;
-    }
-    switch (pauselength)
+    // Writes the pause bytes with put(byte)
+    template <typename Put>
+    void write_pause_bytes(Put&& put, long int pauselength)
     {
-    case (LEN60TH * 2):
-        gzputc(out, VGM_PAUSE_60TH);
-    // fall through
-    case LEN60TH:
-        gzputc(out, VGM_PAUSE_60TH);
-        break;
-    case (LEN50TH * 2):
-        gzputc(out, VGM_PAUSE_50TH);
-    // fall through
-    case LEN50TH:
-        gzputc(out, VGM_PAUSE_50TH);
-        break;
-    default:
-        if (pauselength <= 16)
+        if (pauselength == 0)
         {
-            gzputc(out, 0x70 + pauselength - 1); // 1-byte pause 1..16
-            //      } else if(pauselength<256) {
-            //        gzputc(out, VGM_PAUSE_BYTE);         // 2-byte pause 1..255
-            //        gzputc(out, pauselength);
+            return; // If zero do nothing
         }
-        else
+        while (pauselength > 0xffff)
         {
-            gzputc(out, VGM_PAUSE_WORD);
-            gzputc(out, (pauselength & 0xff)); // 3-byte pause 1..65535
-            gzputc(out, (pauselength >> 8));
+            // If over 0xffff, write 0xffffs
+            put(VGM_PAUSE_WORD);
+            put(0xff);
+            put(0xff);
+            pauselength -= 0xffff;
+        }
+        switch (pauselength)
+        {
+        case (LEN60TH * 2):
+            put(VGM_PAUSE_60TH);
+        // fall through
+        case LEN60TH:
+            put(VGM_PAUSE_60TH);
+            break;
+        case (LEN50TH * 2):
+            put(VGM_PAUSE_50TH);
+        // fall through
+        case LEN50TH:
+            put(VGM_PAUSE_50TH);
+            break;
+        default:
+            if (pauselength <= 16)
+            {
+                put(0x70 + pauselength - 1); // 1-byte pause 1..16
+                //      } else if(pauselength<256) {
+                //        put(VGM_PAUSE_BYTE);         // 2-byte pause 1..255
+                //        put(pauselength);
+            }
+            else
+            {
+                put(VGM_PAUSE_WORD);
+                put((pauselength & 0xff)); // 3-byte pause 1..65535
+                put((pauselength >> 8));
+            }
+            break;
         }
-        break;
     }
 }
 
+void write_pause(gzFile out, const long int pauselength)
+{
+    write_pause_bytes([out](const int b) { gzputc(out, b); }, pauselength);
+}
+
+void write_pause(BinaryData& out, const long int pauselength)
+{
+    write_pause_bytes([&out](const int b) { out.write_uint8(static_cast<uint8_t>(b)); }, pauselength);
+}
+
 //----------------------------------------------------------------------------------------------
 // Writes the header to the file
 // Assumes you are writing the original header with minor modifications, so it
@@ -739,229 +672,3 @@ void GetWriteCounts(const std::string& filename, std::vector<int>& PSGwrites, st
 
     callback.show_status("Scan for chip data complete");
 }
-
-
-//----------------------------------------------------------------------------------------------
-// Fills a TSystemState with default values
-//----------------------------------------------------------------------------------------------
-void ResetState(TSystemState* State)
-{
-    State->samplecount = 0;
-
-    State->PSGState.GGStereo = 0xff;
-    for (int i = 0; i < 4; i++)
-    {
-        State->PSGState.Registers[2 * i] = 0;
-        State->PSGState.Registers[2 * i + 1] = 0xf;
-    }
-    State->PSGState.LatchedRegister = 0;
-
-    memset(State->YM2413State.Registers, 0, YM2413NumRegs);
-
-    memset(State->YM2612State.Registers, 0, YM2612NumRegs);
-
-    // TODO: YM2151
-}
-
-// handles a chip write by updating the state in memory
-// also keeps track of time passed
-// unused parameters are zero where necessary
-void WriteToState(TSystemState* state, int b0, int b1, int b2)
-{
-    int i;
-    switch (b0)
-    {
-    case VGM_GGST: // GG stereo
-        state->PSGState.GGStereo = b1;
-        break;
-    case VGM_PSG: // PSG write
-        if (b1 & 0x80)
-        {
-            // latch byte
-            state->PSGState.LatchedRegister = i = ((b1 >> 4) & 0x07); // 1 cc t dddd - get cct as register number
-            state->PSGState.Registers[i] = (state->PSGState.Registers[i] & 0x3f0) | (b1 & 0xf);
-            // update low 4 bits of register
-        }
-        else
-        {
-            // data byte
-            i = state->PSGState.LatchedRegister;
-            if ((i > -1) && (i < 8))
-            {
-                if (!(i % 2) && (i < 5))
-                {
-                    // if latched register is a tone channel
-                    state->PSGState.Registers[i] = (state->PSGState.Registers[i] & 0x00f) | ((b1 & 0x3f) << 4);
-                    // update the high 6 bits
-                }
-                else
-                {
-                    // otherwise it's noise/vol
-                    state->PSGState.Registers[i] = b1 & 0x0f; // so update the low 4 bits
-                }
-            }
-        }
-        break;
-    case VGM_YM2413: // YM2413
-        if (b1 < YM2413NumRegs)
-        {
-            state->YM2413State.Registers[b1] = b2;
-        }
-        break;
-    case VGM_YM2612_0: // YM2612 port 0
-    case VGM_YM2612_1: // YM2612 port 1
-        i = (b0 == VGM_YM2612_0 ? 0 : 0x100) + b1;
-        if (i < YM2612NumRegs)
-        {
-            state->YM2612State.Registers[i] = b2;
-        }
-        break;
-    case VGM_YM2151: // YM2151
-        // TODO: this
-        break;
-
-    // I include these to acknowledge that I am deliberately not handling them here (I don't need to)
-    // all do nothing
-    case 0x55: // Reserved
-    case 0x56:
-    case 0x57:
-    case 0x58:
-    case 0x59:
-    case 0x5a:
-    case 0x5b:
-    case 0x5c:
-    case 0x5d:
-    case 0x5e:
-    case 0x5f:
-        break;
-
-    case VGM_PAUSE_WORD: // Wait n samples
-        state->samplecount += Utils::make_word(b1, b2);
-        break;
-    //  case VGM_PAUSE_BYTE:  // Wait n samples
-    //    state->samplecount+=b1;
-    //    break;
-    case 0x70:
-    case 0x71:
-    case 0x72:
-    case 0x73:
-    case 0x74:
-    case 0x75:
-    case 0x76:
-    case 0x77:
-    case 0x78:
-    case 0x79:
-    case 0x7a:
-    case 0x7b:
-    case 0x7c:
-    case 0x7d:
-    case 0x7e:
-    case 0x7f: // Wait 1-16 samples
-        state->samplecount += (b0 & 0xf) + 1;
-        break;
-    case VGM_PAUSE_60TH: // Wait 1/60 s
-        state->samplecount += LEN60TH;
-        break;
-    case VGM_PAUSE_50TH: // Wait 1/50 s
-        state->samplecount += LEN50TH;
-        break;
-    case VGM_END: // End of sound data
-        break;
-    default:
-        break;
-    } // end switch
-}
-
-//----------------------------------------------------------------------------------------------
-// Writes a TSystemState to *out, with key data if WriteKeys
-//----------------------------------------------------------------------------------------------
-void WriteStateToFile(gzFile out, TSystemState* State, bool WriteKeys)
-{
-    // Write a full system state
-    int i;
-
-    // First PSG
-    if (State->UsesPSG)
-    {
-        // Write in groups, not register order
-        // 1. Tone channel frequencies (regs 0, 2, 4)
-        for (i = 0; i < 5; i += 2)
-        {
-            gzputc(out, VGM_PSG);
-            gzputc(out, // 1st byte
-                0x80 | // Marker  %1-------
-                (i << 4) | // Channel %-cct----
-                State->PSGState.Registers[i] & 0x0f // Data    %----dddd
-            );
-            gzputc(out, VGM_PSG);
-            gzputc(out, // 2nd byte
-                (State->PSGState.Registers[i] >> 4) & 0x3f // Data    %0-dddddd
-            );
-        }
-        // 2. Noise
-        gzputc(out, VGM_PSG);
-        gzputc(out,
-            0xe0 | // %1110----
-            (State->PSGState.Registers[6] & 0x07) // %----dddd
-        );
-        // 3. Volumes (regs 1, 3, 5, 7)
-        for (i = 1; i < 8; i += 2)
-        {
-            gzputc(out, VGM_PSG);
-            gzputc(out,
-                0x80 | // Marker  %1-------
-                (i << 4) | // Channel %-cct----
-                (State->PSGState.Registers[i] & 0x0f) // Data    %----dddd
-            );
-        }
-        // 4. GG stereo
-        gzputc(out, VGM_GGST);
-        gzputc(out, State->PSGState.GGStereo);
-    }
-
-    // Then YM2413
-    if (State->UsesYM2413)
-    {
-        for (i = 0; i < YM2413NumRegs; ++i)
-        {
-            if (YM2413ValidBits[i])
-            {
-                gzputc(out, VGM_YM2413);
-                gzputc(out, i);
-                gzputc(out,
-                    State->YM2413State.Registers[i] & YM2413ValidBits[i] & (WriteKeys ? 0xff : (~YM2413KeyBits[i])));
-                // Output, but zero key bits if it's not the starting point
-            }
-        }
-    }
-
-    // Then YM2612
-    if (State->UsesYM2612)
-    {
-        for (i = 0; i < YM2612NumRegs; ++i)
-        {
-            if (YM2612ValidBits[i])
-            {
-                if (i < 0x100)
-                {
-                    gzputc(out, VGM_YM2612_0);
-                }
-                else
-                {
-                    gzputc(out, VGM_YM2612_1);
-                }
-                gzputc(out, (i & 0xff));
-                // key bit handling
-                if (
-                    ((i & 0xff) != 0x28) // if it's not the keys register
-                    || WriteKeys // OR, we want keys
-                )
-                {
-                    gzputc(out, State->YM2612State.Registers[i] & YM2612ValidBits[i]);
-                }
-            }
-        }
-    }
-
-    // TODO: YM2151 states
-}
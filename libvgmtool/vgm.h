@@ -22,6 +22,7 @@
 
 #define VGMIDENT 0x206d6756 // "Vgm "
 
+class BinaryData;
 class VgmFile;
 class IVGMToolCallback;
 
@@ -121,48 +122,10 @@ enum ReservedTypes
 };
 
 
-//----------------------------------------------------------------------------------------------
-// Structure defining the state of all available chips at any time, plus whether they're used
-// and the currently elapsed time
-//----------------------------------------------------------------------------------------------
-struct TSystemState
-{
-    long int samplecount;
-
-    bool UsesPSG, UsesYM2413, UsesYM2612, UsesYM2151, UsesReserved;
-
-    struct PSGState
-    {
-        int Registers[8];
-        int LatchedRegister;
-        int GGStereo;
-    } PSGState;
-
-    struct YM2413State
-    {
-        int Registers[YM2413NumRegs];
-    } YM2413State;
-
-    struct YM2612State
-    {
-        int Registers[YM2612NumRegs];
-    } YM2612State;
-
-    // TODO: YM2151
-};
-
-// Valid/key bitmask arrays
-
-extern const int YM2413ValidBits[YM2413NumRegs];
-extern const int YM2413KeyBits[YM2413NumRegs];
-extern const int YM2612ValidBits[YM2612NumRegs];
-
-// TODO: YM2151 equivalents
-
-
 // functions
 
 void write_pause(gzFile out, long int pauselength);
+void write_pause(BinaryData& out, long int pauselength);
 
 void write_vgm_header(const std::string& filename, OldVGMHeader VGMHeader, const IVGMToolCallback& callback);
 
@@ -177,10 +140,3 @@ bool ReadVGMHeader(gzFile f, OldVGMHeader* header, const IVGMToolCallback& callb
 void GetWriteCounts(const std::string& filename, std::vector<int>& PSGwrites, std::vector<int>& YM2413writes,
                     std::vector<int>& YM2612writes, std::vector<int>& YM2151writes,
                     std::vector<int>& reservedwrites, const IVGMToolCallback& callback);
-
-
-void ResetState(TSystemState* State);
-
-void WriteToState(TSystemState* state, int b0, int b1, int b2);
-
-void WriteStateToFile(gzFile out, TSystemState* State, bool WriteKeys);
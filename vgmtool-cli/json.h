@@ -0,0 +1,43 @@
+#pragma once
+#include <format>
+#include <string>
+
+// Just enough JSON for our output
+
+// Quotes and escapes s as a JSON string. s is UTF-8, which can pass through unchanged.
+inline std::string json_string(const std::string& s)
+{
+    std::string result = "\"";
+    for (const auto c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            result += "\\\"";
+            break;
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        case '\r':
+            result += "\\r";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                result += std::format("\\u{:04x}", static_cast<int>(c));
+            }
+            else
+            {
+                result += c;
+            }
+            break;
+        }
+    }
+    return result + "\"";
+}
@@ -2,11 +2,33 @@
 #include "libvgmtool/IVGMToolCallback.h"
 #include <libvgmtool/trim.h>
 
+#include "libvgmtool/assemble.h"
+#include "libvgmtool/catalog.h"
 #include "libvgmtool/convert.h"
+#include "libvgmtool/dacstream.h"
+#include "libvgmtool/datablocks.h"
+#include "libvgmtool/diff.h"
+#include "libvgmtool/findloop.h"
+#include "libvgmtool/fingerprint.h"
+#include "libvgmtool/gd3.h"
+#include "libvgmtool/GzipIndex.h"
+#include "libvgmtool/optimise.h"
+#include "libvgmtool/Profile.h"
+#include "libvgmtool/render.h"
+#include "libvgmtool/silence.h"
+#include "libvgmtool/strip.h"
 #include "libvgmtool/utils.h"
+#include "libvgmtool/verify.h"
 #include "libvgmtool/vgm.h"
 #include "libvgmtool/VgmFile.h"
+#include "profiler.h"
+#include "server.h"
+#include "watcher.h"
 
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <libpu8/libpu8/libpu8.h>
 
 namespace
@@ -41,14 +63,52 @@ namespace
                 printf("%s\n", message.c_str());
             }
         }
-    } callback;
+    };
 
-    void write_to_text(const std::string& filename, const std::string& outputFilename, bool gd3Only, bool forTextFile)
+    // The title and times, as used in pack description text files
+    std::string text_file_line(const Gd3Tag& gd3, const uint32_t sampleCount, const uint32_t loopSampleCount)
     {
-        // Read in file
-        VgmFile f(filename);
+        const auto& length = Utils::samples_to_display_text(sampleCount, false);
+        return std::format(
+            "{: <{}} {}   {}",
+            u8narrow(gd3.get_text(Gd3Tag::Key::TitleEn)),
+            39 - length.length(),
+            length,
+            Utils::samples_to_display_text(loopSampleCount, false));
+    }
+
+    // Returns true if text is in the entry's filename or any of its GD3 tag, ignoring case
+    bool catalog_entry_matches(const CatalogEntry& entry, const std::string& text)
+    {
+        auto haystack = entry.filename;
+        for (auto key = static_cast<int>(Gd3Tag::Key::TitleEn); key <= static_cast<int>(Gd3Tag::Key::Notes); ++key)
+        {
+            haystack += '\n';
+            haystack += u8narrow(entry.gd3.get_text(static_cast<Gd3Tag::Key>(key)));
+        }
+        return Utils::to_lower(haystack).find(Utils::to_lower(text)) != std::string::npos;
+    }
+
+    void write_to_text(
+        const std::string& filename,
+        const std::string& outputFilename,
+        bool gd3Only,
+        bool forTextFile,
+        std::ostream& defaultOutput,
+        const IVGMToolCallback& callback)
+    {
+        // Read in file. The GD3 and length modes only need the header and GD3 tag.
+        VgmFile f;
+        if (gd3Only || forTextFile)
+        {
+            f.load_header_and_gd3(filename);
+        }
+        else
+        {
+            f.load_file(filename);
+        }
         // Write to stdout if no filename is given
-        auto* s = outputFilename.empty() ? &std::cout : new std::ofstream(outputFilename);
+        auto* s = outputFilename.empty() ? &defaultOutput : new std::ofstream(outputFilename);
 
         if (gd3Only)
         {
@@ -63,13 +123,7 @@ namespace
         }
         else if (forTextFile)
         {
-            const auto& length = Utils::samples_to_display_text(f.header().sample_count(), false);
-            *s << std::format(
-                "{: <{}} {}   {}",
-                u8narrow(f.gd3().get_text(Gd3Tag::Key::TitleEn)),
-                39 - length.length(),
-                length,
-                Utils::samples_to_display_text(f.header().loop_sample_count(), false));
+            *s << text_file_line(f.gd3(), f.header().sample_count(), f.header().loop_sample_count());
         }
         else
         {
@@ -81,25 +135,32 @@ namespace
             delete s;
         }
     }
-}
 
-int main_utf8(int argc, char** argv)
-{
-    try
+    // Parses and runs a command line, without the program name. Anything which would go to stdout goes to out instead.
+    // verbose is set by --verbose.
+    int run(std::vector<std::string> args, const IVGMToolCallback& callback, bool& verbose, std::ostream& out)
     {
         CLI::App app{"VGMTool CLI: VGM file editing utility"};
         app.require_subcommand()
            ->fallthrough()
            ->allow_windows_style_options()
            ->set_help_all_flag("--help-all", "Show all subcommands help");
-        app.add_flag("-v, --verbose", callback.is_verbose)
+        app.add_flag("-v, --verbose", verbose)
            ->description("Print messages while working");
+        bool isProfiling = false;
+        app.add_flag("--profile", isProfiling)
+           ->description("Print how long each stage of the work took");
+        std::string profileTraceFilename;
+        app.add_option("--profile-trace", profileTraceFilename)
+           ->description("Write how long each stage of the work took to this file, as Chrome trace JSON");
 
         std::vector<std::string> filenames;
         app.add_option("filename", filenames)
-           ->description("The file(s) to process")
-           ->required()
-           ->check(CLI::ExistingFile);
+           ->description("The file(s) to process, or for dupes, catalog and watch, folders to search")
+           ->check(CLI::ExistingPath);
+
+        // Verbs can set this to indicate failure without stopping
+        auto exitCode = EXIT_SUCCESS;
 
         // TODO I'd like to give the vars scoped storage but the lambda also needs to be able to see them
         auto* toTextVerb = app.add_subcommand("totext")
@@ -117,7 +178,7 @@ int main_utf8(int argc, char** argv)
         {
             for (const auto& filename : filenames)
             {
-                write_to_text(filename, outputFilename, gd3Only, forTextFile);
+                write_to_text(filename, outputFilename, gd3Only, forTextFile, out, callback);
             }
         });
 
@@ -147,6 +208,148 @@ int main_utf8(int argc, char** argv)
             }
         });
 
+        auto* silenceVerb = app.add_subcommand("silence", "Find leading and trailing silence and suggest trim points");
+        bool applyTrim;
+        silenceVerb->add_flag("--apply", applyTrim)
+                   ->description("Trim the file(s) at the suggested points");
+        bool logSuggestedTrim;
+        silenceVerb->add_flag("--log", logSuggestedTrim)
+                   ->description("Log suggested trim points to editpoints.txt");
+        silenceVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                TrimSuggestion suggestion{};
+                {
+                    const VgmFile file(filename);
+                    suggestion = suggest_trim(file);
+                }
+                if (!suggestion.hasSound)
+                {
+                    callback.show_message(std::format("{}: silent", filename));
+                    continue;
+                }
+                callback.show_message(std::format(
+                    "{}: start {} ({}), loop {}, end {} ({})",
+                    filename,
+                    suggestion.start,
+                    Utils::samples_to_display_text(suggestion.start, true),
+                    suggestion.loop,
+                    suggestion.end,
+                    Utils::samples_to_display_text(suggestion.end, true)));
+                if (logSuggestedTrim)
+                {
+                    log_trim(filename, suggestion.start, suggestion.loop, suggestion.end, callback);
+                }
+                if (applyTrim)
+                {
+                    trim(filename, suggestion.start, suggestion.loop, suggestion.end, false, false, callback);
+                }
+            }
+        });
+
+        auto* renderVerb = app.add_subcommand("render", "Render the SN76489 part of the file to a WAV file");
+        std::string wavFilename;
+        renderVerb->add_option("--output", wavFilename)
+                  ->description("Output filename, defaults to the input filename with a .wav extension");
+        renderVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                const VgmFile file(filename);
+                const auto& samples = render_sn76489(file);
+                const auto loudness = measure_loudness(samples);
+                callback.show_message(std::format(
+                    "{}: {} samples, peak {:.1f} dB, RMS {:.1f} dB",
+                    filename,
+                    samples.size() / 2,
+                    loudness.peak,
+                    loudness.rms));
+                const auto& outFilename = wavFilename.empty()
+                    ? std::filesystem::path(filename).replace_extension(".wav").string()
+                    : wavFilename;
+                save_wav(outFilename, samples, 44100);
+            }
+        });
+
+        auto* verifyVerb = app.add_subcommand("verify", "Check that modified files are equivalent to their originals");
+        verifyVerb->footer("Files are taken in pairs: original, then modified");
+        int startOffset;
+        verifyVerb->add_option("--offset", startOffset)
+                  ->description("Where the modified file starts in the original, in samples (e.g. the trim start point)")
+                  ->default_val(0)
+                  ->check(CLI::NonNegativeNumber);
+        verifyVerb->callback([&]
+        {
+            if (filenames.size() % 2 != 0)
+            {
+                throw std::runtime_error("verify needs pairs of files");
+            }
+            for (auto i = 0u; i < filenames.size(); i += 2)
+            {
+                const VgmFile original(filenames[i]);
+                const VgmFile modified(filenames[i + 1]);
+                if (const auto& result = verify_equivalent(original, modified, startOffset); result.isEquivalent)
+                {
+                    callback.show_message(std::format(
+                        "{}: equivalent to {} ({} points compared)",
+                        filenames[i + 1],
+                        filenames[i],
+                        result.comparedPoints));
+                }
+                else
+                {
+                    callback.show_error(std::format("{}: {}", filenames[i + 1], result.mismatch));
+                    exitCode = EXIT_FAILURE;
+                }
+            }
+        });
+
+        auto* diffVerb = app.add_subcommand("diff", "Compare the commands in two files, lined up by time");
+        size_t maxDifferences;
+        diffVerb->add_option("--max", maxDifferences)
+                ->description("The most differences to list")
+                ->default_val(1000);
+        diffVerb->callback([&]
+        {
+            if (filenames.size() != 2)
+            {
+                throw std::runtime_error("diff needs two files");
+            }
+            const VgmFile a(filenames[0]);
+            const VgmFile b(filenames[1]);
+            const auto& result = diff_files(a, b, maxDifferences);
+            write_diff(out, result);
+            if (!result.is_same())
+            {
+                exitCode = EXIT_FAILURE;
+            }
+        });
+
+        auto* assembleVerb = app.add_subcommand("assemble", "Make a VGM file from a listing, as written by totext");
+        std::string templateFilename;
+        assembleVerb->add_option("--template", templateFilename)
+                    ->description("VGM file to take the header, GD3 tag and any data blocks from, usually the one the listing came from")
+                    ->required()
+                    ->check(CLI::ExistingFile);
+        std::string assembledFilename;
+        assembleVerb->add_option("--output", assembledFilename)
+                    ->description("Filename to output to. If not specified, the template filename with \" (assembled)\" added.");
+        assembleVerb->callback([&]
+        {
+            if (filenames.size() != 1)
+            {
+                throw std::runtime_error("assemble needs one listing");
+            }
+            std::vector<uint8_t> listing;
+            Utils::load_file(listing, filenames[0]);
+            VgmFile file(templateFilename);
+            assemble(std::string_view(reinterpret_cast<const char*>(listing.data()), listing.size()), file, callback);
+            file.save_file(assembledFilename.empty()
+                               ? Utils::make_suffixed_filename(templateFilename, "assembled")
+                               : assembledFilename);
+        });
+
         app.add_subcommand("check")
            ->description("Check the VGM file(s) for errors")
            ->callback([&]
@@ -190,16 +393,351 @@ int main_utf8(int argc, char** argv)
                }
            });
 
+        app.add_subcommand("optimise")
+           ->description("Remove redundant chip writes from VGM file(s)")
+           ->callback([&]
+           {
+               for (const auto& filename : filenames)
+               {
+                   VgmFile file(filename);
+                   optimise_vgm_data(file, callback);
+                   file.save_over(filename);
+               }
+           });
+
+        app.add_subcommand("dacstreams")
+           ->description("Convert YM2612 DAC writes to DAC stream commands (VGM 1.60)")
+           ->callback([&]
+           {
+               for (const auto& filename : filenames)
+               {
+                   VgmFile file(filename);
+                   convert_dac_to_streams(file, callback);
+                   file.save_over(filename);
+               }
+           });
+
+        auto* stripVerb = app.add_subcommand("strip", "Remove chips or channels from VGM file(s)");
+        std::vector<std::string> stripSpecs;
+        stripVerb->add_option("--remove", stripSpecs)
+                 ->description("Chip to remove, or chip:channel,channel,... for some of its channels. "
+                     "SN76489 channels are 0-2 tone, 3 noise, 4 GG stereo; "
+                     "YM2413 channels are 0-8 tone, 9-13 percussion (HH, Cym, TT, SD, BD), 14 user instrument, 15 other")
+                 ->required();
+        stripVerb->callback([&]
+        {
+            StripMask mask;
+            for (const auto& spec : stripSpecs)
+            {
+                mask.remove(spec);
+            }
+            for (const auto& filename : filenames)
+            {
+                VgmFile file(filename);
+                strip(file, mask, callback);
+                file.save_over(filename);
+            }
+        });
+
+        auto* splitVerb = app.add_subcommand("split", "Split VGM file(s) into one file per chip");
+        bool splitByChannel;
+        splitVerb->add_flag("--channels", splitByChannel)
+                 ->description("Split SN76489 and YM2413 data by channel too");
+        splitVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                const VgmFile file(filename);
+                split(file, filename, split_outputs(file.header(), splitByChannel), callback);
+            }
+        });
+
+        auto* packPcmVerb = app.add_subcommand("packpcm", "Compress PCM data blocks (VGM 1.60)");
+        bool unpackPcm;
+        packPcmVerb->add_flag("--unpack", unpackPcm)
+                   ->description("Decompress them instead");
+        packPcmVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                VgmFile file(filename);
+                if (unpackPcm)
+                {
+                    decompress_data_blocks(file, callback);
+                }
+                else
+                {
+                    compress_data_blocks(file, callback);
+                }
+                file.save_over(filename);
+            }
+        });
+
+        auto* findLoopVerb = app.add_subcommand("findloop", "Find loop points");
+        double verifySeconds;
+        findLoopVerb->add_option("--verify", verifySeconds)
+                    ->description("How many seconds must repeat after the loop end for a loop to be accepted")
+                    ->default_val(10)
+                    ->check(CLI::PositiveNumber);
+        double minimumLoopSeconds;
+        findLoopVerb->add_option("--min-length", minimumLoopSeconds)
+                    ->description("Minimum loop length in seconds")
+                    ->default_val(1)
+                    ->check(CLI::NonNegativeNumber);
+        int candidateCount;
+        findLoopVerb->add_option("--candidates", candidateCount)
+                    ->description("How many loop candidates to show, best first")
+                    ->default_val(1)
+                    ->check(CLI::PositiveNumber);
+        findLoopVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                const VgmFile file(filename);
+                const auto& loops = find_loops(
+                    file,
+                    static_cast<uint32_t>(verifySeconds * 44100),
+                    static_cast<uint32_t>(minimumLoopSeconds * 44100));
+                if (loops.empty())
+                {
+                    callback.show_message(std::format("{}: no loop found", filename));
+                    continue;
+                }
+                for (auto i = 0; i < candidateCount && i < static_cast<int>(loops.size()); ++i)
+                {
+                    const auto& loop = loops[i];
+                    callback.show_message(std::format(
+                        "{}: loop start {} ({}), end {} ({}), length {} ({}), support {}",
+                        filename,
+                        loop.start,
+                        Utils::samples_to_display_text(loop.start, true),
+                        loop.end,
+                        Utils::samples_to_display_text(loop.end, true),
+                        loop.end - loop.start,
+                        Utils::samples_to_display_text(loop.end - loop.start, true),
+                        loop.support));
+                }
+            }
+        });
+
+        app.add_subcommand("dupes", "Find VGM files with the same music, ignoring tags and data encoding")
+           ->callback([&]
+           {
+               const auto& groups = find_duplicates(filenames, callback);
+               for (const auto& group : groups)
+               {
+                   callback.show_message(std::format("{} files match:", group.size()));
+                   for (const auto& filename : group)
+                   {
+                       callback.show_message(std::format("  {}", filename));
+                   }
+               }
+           });
+
+        app.add_subcommand("tag", "Apply GD3 tag manifest file(s): [filename] lines, each followed by field=value lines")
+           ->callback([&]
+           {
+               for (const auto& filename : filenames)
+               {
+                   apply_tag_manifest(filename, callback);
+               }
+           });
+
+        auto* gzIndexVerb = app.add_subcommand("gzindex", "Save index files for fast random access into compressed VGM files");
+        uint32_t gzIndexSpacing;
+        gzIndexVerb->add_option("--spacing", gzIndexSpacing)
+                   ->description("Distance between access points, in uncompressed bytes")
+                   ->default_val(GzipIndex::DEFAULT_SPACING)
+                   ->check(CLI::PositiveNumber);
+        gzIndexVerb->callback([&]
+        {
+            for (const auto& filename : filenames)
+            {
+                const auto& index = GzipIndex::build(filename, gzIndexSpacing);
+                index.save(filename);
+                callback.show_status(std::format("Saved index for {} ({} bytes uncompressed)", filename, index.size()));
+            }
+        });
+
+        auto* catalogVerb = app.add_subcommand("catalog", "List VGM files using a catalog of their details");
+        std::string catalogFilename;
+        catalogVerb->add_option("--index", catalogFilename)
+                   ->description("The catalog file")
+                   ->default_val("vgmtool.catalog");
+        bool refreshCatalog = false;
+        catalogVerb->add_flag("--refresh", refreshCatalog)
+                   ->description("Read new and changed files into the catalog first. This is done anyway if the catalog does not exist.");
+        bool catalogForTextFile = false;
+        catalogVerb->add_flag("--fortxt", catalogForTextFile)
+                   ->description("Emit only the title and times, as for totext --fortxt");
+        bool catalogGd3Only = false;
+        catalogVerb->add_flag("--gd3", catalogGd3Only)
+                   ->description("Emit only the GD3 tags");
+        std::string catalogSearch;
+        catalogVerb->add_option("--search", catalogSearch)
+                   ->description("Only list files with this text in their filename or GD3 tag");
+        std::string catalogChip;
+        catalogVerb->add_option("--chip", catalogChip)
+                   ->description("Only list files using this chip, e.g. YM2612");
+        catalogVerb->callback([&]
+        {
+            Catalog catalog(catalogFilename);
+            if (refreshCatalog || !Utils::file_exists(catalogFilename))
+            {
+                catalog.refresh(filenames, callback);
+                catalog.save();
+            }
+            const auto chip = catalogChip.empty() ? VgmHeader::Chip::Nothing : VgmHeader::chip_from_name(catalogChip);
+            for (const auto* pEntry : catalog.find(filenames))
+            {
+                if (!catalogSearch.empty() && !catalog_entry_matches(*pEntry, catalogSearch))
+                {
+                    continue;
+                }
+                if (chip != VgmHeader::Chip::Nothing &&
+                    std::ranges::find(pEntry->clocks, chip, &std::pair<VgmHeader::Chip, uint32_t>::first) == pEntry->clocks.end())
+                {
+                    continue;
+                }
+                if (catalogForTextFile)
+                {
+                    callback.show_message(text_file_line(pEntry->gd3, pEntry->sampleCount, pEntry->loopSampleCount));
+                }
+                else if (catalogGd3Only)
+                {
+                    callback.show_message(std::format(
+                        "{}:\n{}",
+                        pEntry->filename,
+                        pEntry->gd3.empty() ? "No GD3 tag" : pEntry->gd3.write_to_text()));
+                }
+                else
+                {
+                    std::string chips;
+                    for (const auto& [clockChip, clock] : pEntry->clocks)
+                    {
+                        chips += std::format(" {}", VgmHeader::chip_name(clockChip));
+                    }
+                    callback.show_message(std::format(
+                        "{}: VGM {}, length {}, loop {},{}",
+                        pEntry->filename,
+                        pEntry->version,
+                        Utils::samples_to_display_text(pEntry->dataSampleCount, false),
+                        Utils::samples_to_display_text(pEntry->dataLoopSampleCount, false),
+                        chips));
+                }
+            }
+        });
+
+        auto* serveVerb = app.add_subcommand("serve", "Run commands sent as JSON lines to a local socket (see server.h)");
+        std::string socketPath;
+        serveVerb->add_option("--socket", socketPath)
+                 ->description("The Unix domain socket to listen on")
+                 ->default_val("vgmtool.sock");
+        unsigned int threadCount;
+        serveVerb->add_option("--threads", threadCount)
+                 ->description("How many commands to run at once")
+                 ->default_val(std::max(1u, std::thread::hardware_concurrency()))
+                 ->check(CLI::PositiveNumber);
+        serveVerb->callback([&]
+        {
+            serve(socketPath, threadCount, run, callback);
+        });
+
+        auto* watchVerb = app.add_subcommand("watch", "Process VGM, GYM, CYM and SSL files as they are written to folder(s)");
+        std::vector<std::string> watchSteps;
+        watchVerb->add_option("--steps", watchSteps)
+                 ->description("Verbs to run on each file, with any options")
+                 ->delimiter(',')
+                 ->default_val(std::vector<std::string>{"convert", "check", "optimise", "compress"});
+        int settleMilliseconds;
+        watchVerb->add_option("--settle", settleMilliseconds)
+                 ->description("How long a file must be left alone before it is processed, in milliseconds")
+                 ->default_val(50)
+                 ->check(CLI::NonNegativeNumber);
+        unsigned int watchThreadCount;
+        watchVerb->add_option("--threads", watchThreadCount)
+                 ->description("How many files to process at once")
+                 ->default_val(std::max(1u, std::thread::hardware_concurrency()))
+                 ->check(CLI::PositiveNumber);
+        watchVerb->callback([&]
+        {
+            watch(filenames, watchSteps, std::chrono::milliseconds(settleMilliseconds), watchThreadCount, run, callback);
+        });
+
+        // We start profiling once the options are parsed, before the verb runs
+        std::unique_ptr<Profiler> profiler;
+        std::optional<Profile::Scope> profileScope;
+        auto stopProfiling = [&]
+        {
+            if (profiler != nullptr)
+            {
+                profileScope.reset();
+                Profile::set_profiler(nullptr);
+            }
+        };
+
+        // Every verb except serve works on files
+        app.parse_complete_callback([&]
+        {
+            if (filenames.empty() && !serveVerb->parsed())
+            {
+                throw CLI::RequiredError("filename");
+            }
+            if (isProfiling || !profileTraceFilename.empty())
+            {
+                // The profiler is only seen by this thread and the ones it hands work to, so it wouldn't see the
+                // commands these run
+                if (serveVerb->parsed() || watchVerb->parsed())
+                {
+                    throw std::runtime_error("serve and watch can't be profiled; pass --profile in the commands they run instead");
+                }
+                profiler = std::make_unique<Profiler>();
+                Profile::set_profiler(profiler.get());
+                // Anything outside the library's stages
+                profileScope.emplace("other");
+            }
+        });
+
+        // CLI11 wants the arguments in reverse order
+        std::ranges::reverse(args);
         try
         {
-            app.parse(argc, argv);
+            app.parse(args);
         }
         catch (const CLI::ParseError& e)
         {
-            return app.exit(e);
+            stopProfiling();
+            return app.exit(e, out, out);
+        }
+        catch (...)
+        {
+            stopProfiling();
+            throw;
+        }
+
+        if (profiler != nullptr)
+        {
+            stopProfiling();
+            if (isProfiling)
+            {
+                profiler->write_table(out);
+            }
+            if (!profileTraceFilename.empty())
+            {
+                profiler->write_trace(profileTraceFilename);
+            }
         }
 
-        return EXIT_SUCCESS;
+        return exitCode;
+    }
+}
+
+int main_utf8(int argc, char** argv)
+{
+    try
+    {
+        Callback callback;
+        return run({argv + 1, argv + argc}, callback, callback.is_verbose, std::cout);
     }
     catch (const std::exception& e)
     {
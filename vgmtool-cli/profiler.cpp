@@ -0,0 +1,285 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#else
+#include <ctime>
+#include <sys/resource.h>
+#endif
+
+#include "json.h"
+
+namespace
+{
+    // This is counted whether we are profiling or not, as that is as cheap as checking. It is the only cost of replacing
+    // the allocator when not profiling.
+    thread_local uint64_t allocationCount = 0;
+
+    std::chrono::nanoseconds thread_cpu_time()
+    {
+#ifdef _WIN32
+        FILETIME creationTime;
+        FILETIME exitTime;
+        FILETIME kernelTime;
+        FILETIME userTime;
+        GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime);
+        // In units of 100ns
+        const auto toCount = [](const FILETIME& time)
+        {
+            return static_cast<int64_t>(time.dwHighDateTime) << 32 | time.dwLowDateTime;
+        };
+        return std::chrono::nanoseconds((toCount(kernelTime) + toCount(userTime)) * 100);
+#else
+        timespec time{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+        return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+#endif
+    }
+
+    // Peak resident memory of the whole process so far
+    uint64_t peak_memory_use()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize;
+#else
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        // In KB
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    }
+
+    // Small numbers for the trace, in the order threads are first seen
+    uint32_t thread_id()
+    {
+        static std::atomic<uint32_t> nextId = 1;
+        thread_local const auto id = nextId++;
+        return id;
+    }
+
+    struct OpenStage
+    {
+        std::string_view stage;
+        std::string file;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds cpuStart;
+        uint64_t allocationStart;
+        // Totals for the stages inside this one
+        std::chrono::nanoseconds nestedWallTime{};
+        std::chrono::nanoseconds nestedCpuTime{};
+        uint64_t nestedAllocationCount = 0;
+        // Allocations we made ourselves when starting it
+        uint64_t overheadAllocationCount = 0;
+    };
+
+    thread_local std::vector<OpenStage> openStages;
+    // The file the work on this thread is on
+    thread_local std::string currentFile;
+
+    double to_milliseconds(const std::chrono::nanoseconds time)
+    {
+        return std::chrono::duration<double, std::milli>(time).count();
+    }
+}
+
+// We replace the global allocator so we can count allocations. The other forms of new and delete call these.
+void* operator new(const std::size_t size)
+{
+    ++allocationCount;
+    for (;;)
+    {
+        if (auto* p = std::malloc(size == 0 ? 1 : size); p != nullptr)
+        {
+            return p;
+        }
+        const auto handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+Profiler::Profiler()
+    : _start(std::chrono::steady_clock::now())
+{
+    // serve reuses threads, so this may be left from an earlier command
+    currentFile.clear();
+}
+
+void Profiler::begin(const std::string_view stage, const std::string_view file)
+{
+    const auto allocationsBefore = allocationCount;
+    if (!file.empty())
+    {
+        currentFile = file;
+    }
+    openStages.push_back({stage, currentFile, {}, {}, 0});
+    auto& openStage = openStages.back();
+    openStage.overheadAllocationCount = allocationCount - allocationsBefore;
+    openStage.allocationStart = allocationCount;
+    openStage.cpuStart = thread_cpu_time();
+    openStage.start = std::chrono::steady_clock::now();
+}
+
+void Profiler::end()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto cpuTime = thread_cpu_time();
+    const auto allocationsAtEnd = allocationCount;
+
+    auto stage = std::move(openStages.back());
+    openStages.pop_back();
+    const auto wallTime = now - stage.start;
+    const auto totalCpuTime = cpuTime - stage.cpuStart;
+    const auto allocations = allocationsAtEnd - stage.allocationStart;
+    {
+        std::lock_guard lock(_mutex);
+        _records.push_back({
+            std::string(stage.stage),
+            std::move(stage.file),
+            thread_id(),
+            stage.start - _start,
+            wallTime,
+            wallTime - stage.nestedWallTime,
+            totalCpuTime - stage.nestedCpuTime,
+            allocations - stage.nestedAllocationCount
+        });
+    }
+
+    if (!openStages.empty())
+    {
+        // Our own allocations go with the nested stage, so they don't show up in the one it's inside
+        auto& parent = openStages.back();
+        parent.nestedWallTime += wallTime;
+        parent.nestedCpuTime += totalCpuTime;
+        parent.nestedAllocationCount += stage.overheadAllocationCount + allocations + (allocationCount - allocationsAtEnd);
+    }
+}
+
+void Profiler::write_table(std::ostream& out) const
+{
+    struct Totals
+    {
+        int count = 0;
+        std::chrono::nanoseconds wallTime{};
+        std::chrono::nanoseconds cpuTime{};
+        uint64_t allocationCount = 0;
+
+        void add(const Record& record)
+        {
+            ++count;
+            wallTime += record.wallTime;
+            cpuTime += record.cpuTime;
+            allocationCount += record.allocationCount;
+        }
+    };
+    // Files and stages are in the order we first see them, which is mostly the order the work happens
+    std::vector<std::string> files;
+    std::vector<std::string> stages;
+    std::map<std::pair<std::string, std::string>, Totals> totalsByFile;
+    std::map<std::string, Totals> totalsByStage;
+    Totals total;
+    for (const auto& record : _records)
+    {
+        if (std::ranges::find(files, record.file) == files.end())
+        {
+            files.push_back(record.file);
+        }
+        if (std::ranges::find(stages, record.stage) == stages.end())
+        {
+            stages.push_back(record.stage);
+        }
+        totalsByFile[{record.file, record.stage}].add(record);
+        totalsByStage[record.stage].add(record);
+        total.add(record);
+    }
+
+    const auto writeRow = [&out](const std::string& name, const Totals& totals)
+    {
+        out << std::format(
+            "  {:<18} {:>6} {:>12.3f} {:>12.3f} {:>12}\n",
+            name,
+            totals.count,
+            to_milliseconds(totals.wallTime),
+            to_milliseconds(totals.cpuTime),
+            totals.allocationCount);
+    };
+
+    out << std::format("  {:<18} {:>6} {:>12} {:>12} {:>12}\n", "Stage", "Count", "Wall ms", "CPU ms", "Allocations");
+    if (files.size() > 1 || (files.size() == 1 && !files.front().empty()))
+    {
+        for (const auto& file : files)
+        {
+            out << (file.empty() ? "(No file)" : file) << "\n";
+            for (const auto& stage : stages)
+            {
+                if (const auto it = totalsByFile.find({file, stage}); it != totalsByFile.end())
+                {
+                    writeRow(stage, it->second);
+                }
+            }
+        }
+    }
+    out << "All files\n";
+    for (const auto& stage : stages)
+    {
+        writeRow(stage, totalsByStage[stage]);
+    }
+    writeRow("Total", total);
+    // It's for the whole process, so it includes anything else it did, and can't be split by file or stage
+    out << std::format("Peak memory use (whole process): {:.1f} MB\n",
+        static_cast<double>(peak_memory_use()) / (1024 * 1024));
+}
+
+void Profiler::write_trace(const std::string& filename) const
+{
+    std::ofstream f(filename);
+    if (!f)
+    {
+        throw std::runtime_error(std::format("Failed to open \"{}\"", filename));
+    }
+    f << "{\"traceEvents\":[\n";
+    for (auto i = 0u; i < _records.size(); ++i)
+    {
+        const auto& record = _records[i];
+        // Times are in microseconds
+        f << std::format(
+            R"({{"name":{},"cat":"vgmtool","ph":"X","ts":{:.3f},"dur":{:.3f},"pid":1,"tid":{},"args":{{"file":{},"self_ms":{:.3f},"cpu_ms":{:.3f},"allocations":{}}}}}{})",
+            json_string(record.stage),
+            to_milliseconds(record.start) * 1000,
+            to_milliseconds(record.totalWallTime) * 1000,
+            record.threadId,
+            json_string(record.file),
+            to_milliseconds(record.wallTime),
+            to_milliseconds(record.cpuTime),
+            record.allocationCount,
+            i + 1 < _records.size() ? ",\n" : "\n");
+    }
+    f << std::format("],\"displayTimeUnit\":\"ms\",\"otherData\":{{\"process_peak_memory_bytes\":{}}}}}\n", peak_memory_use());
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "libvgmtool/Profile.h"
+
+// Records the stages of work for --profile, with the wall time, CPU time and heap allocations of each. Times and
+// allocations are exclusive of any stages nested inside, so they add up.
+class Profiler final : public IProfiler
+{
+public:
+    Profiler();
+
+    void begin(std::string_view stage, std::string_view file) override;
+    void end() override;
+
+    // Prints the stages for each file and in total
+    void write_table(std::ostream& out) const;
+    // Writes the stages as Chrome trace JSON, for chrome://tracing or https://ui.perfetto.dev
+    void write_trace(const std::string& filename) const;
+
+private:
+    struct Record
+    {
+        std::string stage;
+        std::string file;
+        uint32_t threadId;
+        // From when we started
+        std::chrono::nanoseconds start;
+        // Including nested stages
+        std::chrono::nanoseconds totalWallTime;
+        // Excluding nested stages
+        std::chrono::nanoseconds wallTime;
+        std::chrono::nanoseconds cpuTime;
+        uint64_t allocationCount;
+    };
+
+    std::chrono::steady_clock::time_point _start;
+    std::vector<Record> _records;
+    std::mutex _mutex;
+};
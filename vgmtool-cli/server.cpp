@@ -0,0 +1,621 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "json.h"
+#include "libvgmtool/IVGMToolCallback.h"
+
+namespace
+{
+#ifdef _WIN32
+    using Socket = SOCKET;
+    constexpr int SEND_FLAGS = 0;
+
+    void close_socket(const Socket s)
+    {
+        closesocket(s);
+    }
+#else
+    using Socket = int;
+    constexpr Socket INVALID_SOCKET = -1;
+    // We don't want a SIGPIPE if the client goes away
+    constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+
+    void close_socket(const Socket s)
+    {
+        close(s);
+    }
+#endif
+
+    struct Request
+    {
+        // As JSON, so we can copy it to the responses without caring what type it is
+        std::string id = "null";
+        std::vector<std::string> args;
+        // If true, this cancels the commands with this id instead
+        bool cancel = false;
+    };
+
+    // Just enough JSON parsing for requests
+    class RequestParser
+    {
+    public:
+        explicit RequestParser(const std::string& text)
+            : _text(text) { }
+
+        Request parse()
+        {
+            Request request;
+            expect('{');
+            if (peek() != '}')
+            {
+                do
+                {
+                    const auto& key = read_string();
+                    expect(':');
+                    if (key == "id")
+                    {
+                        // Skip any whitespace, so it isn't part of the id we echo back
+                        peek();
+                        const auto start = _position;
+                        skip_value();
+                        request.id = _text.substr(start, _position - start);
+                    }
+                    else if (key == "args")
+                    {
+                        expect('[');
+                        if (peek() != ']')
+                        {
+                            do
+                            {
+                                request.args.push_back(read_string());
+                            }
+                            while (accept(','));
+                        }
+                        expect(']');
+                    }
+                    else if (key == "cancel")
+                    {
+                        peek();
+                        const auto start = _position;
+                        skip_value();
+                        request.cancel = _text.compare(start, _position - start, "true") == 0;
+                    }
+                    else
+                    {
+                        skip_value();
+                    }
+                }
+                while (accept(','));
+            }
+            expect('}');
+            return request;
+        }
+
+    private:
+        // Returns the next non-whitespace character, or 0 at the end
+        char peek()
+        {
+            while (_position < _text.size() && std::isspace(static_cast<unsigned char>(_text[_position])))
+            {
+                ++_position;
+            }
+            return _position < _text.size() ? _text[_position] : '\0';
+        }
+
+        bool accept(const char c)
+        {
+            if (peek() != c)
+            {
+                return false;
+            }
+            ++_position;
+            return true;
+        }
+
+        void expect(const char c)
+        {
+            if (!accept(c))
+            {
+                throw std::runtime_error(std::format("Expected '{}' at offset {}", c, _position));
+            }
+        }
+
+        uint32_t read_hex4()
+        {
+            if (_position + 4 > _text.size())
+            {
+                throw std::runtime_error("Incomplete \\u escape");
+            }
+            const auto value = std::stoul(_text.substr(_position, 4), nullptr, 16);
+            _position += 4;
+            return static_cast<uint32_t>(value);
+        }
+
+        std::string read_string()
+        {
+            expect('"');
+            std::string result;
+            while (_position < _text.size())
+            {
+                const auto c = _text[_position++];
+                if (c == '"')
+                {
+                    return result;
+                }
+                if (c != '\\')
+                {
+                    result += c;
+                    continue;
+                }
+                if (_position == _text.size())
+                {
+                    break;
+                }
+                switch (const auto escaped = _text[_position++])
+                {
+                case 'b':
+                    result += '\b';
+                    break;
+                case 'f':
+                    result += '\f';
+                    break;
+                case 'n':
+                    result += '\n';
+                    break;
+                case 'r':
+                    result += '\r';
+                    break;
+                case 't':
+                    result += '\t';
+                    break;
+                case 'u':
+                    {
+                        auto codePoint = read_hex4();
+                        // Surrogate pairs make one code point
+                        if (codePoint >= 0xd800 && codePoint < 0xdc00 && _text.compare(_position, 2, "\\u") == 0)
+                        {
+                            _position += 2;
+                            codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (read_hex4() - 0xdc00);
+                        }
+                        append_utf8(result, codePoint);
+                        break;
+                    }
+                default:
+                    result += escaped;
+                    break;
+                }
+            }
+            throw std::runtime_error("Unterminated string");
+        }
+
+        static void append_utf8(std::string& s, const uint32_t codePoint)
+        {
+            if (codePoint < 0x80)
+            {
+                s += static_cast<char>(codePoint);
+            }
+            else if (codePoint < 0x800)
+            {
+                s += static_cast<char>(0xc0 | codePoint >> 6);
+                s += static_cast<char>(0x80 | (codePoint & 0x3f));
+            }
+            else if (codePoint < 0x10000)
+            {
+                s += static_cast<char>(0xe0 | codePoint >> 12);
+                s += static_cast<char>(0x80 | (codePoint >> 6 & 0x3f));
+                s += static_cast<char>(0x80 | (codePoint & 0x3f));
+            }
+            else
+            {
+                s += static_cast<char>(0xf0 | codePoint >> 18);
+                s += static_cast<char>(0x80 | (codePoint >> 12 & 0x3f));
+                s += static_cast<char>(0x80 | (codePoint >> 6 & 0x3f));
+                s += static_cast<char>(0x80 | (codePoint & 0x3f));
+            }
+        }
+
+        void skip_value()
+        {
+            switch (peek())
+            {
+            case '"':
+                read_string();
+                break;
+            case '{':
+            case '[':
+                {
+                    // We don't care what's inside, only where it ends
+                    auto depth = 0;
+                    do
+                    {
+                        if (peek() == '"')
+                        {
+                            read_string();
+                            continue;
+                        }
+                        const auto c = _text[_position++];
+                        if (c == '{' || c == '[')
+                        {
+                            ++depth;
+                        }
+                        else if (c == '}' || c == ']')
+                        {
+                            --depth;
+                        }
+                    }
+                    while (depth > 0 && _position < _text.size());
+                    break;
+                }
+            default:
+                // Numbers, true, false and null
+                while (_position < _text.size() && std::strchr(",}] \t\r\n", _text[_position]) == nullptr)
+                {
+                    ++_position;
+                }
+                break;
+            }
+        }
+
+        const std::string& _text;
+        size_t _position = 0;
+    };
+
+    // A client connection. Responses are sent from the worker threads, so sending is locked.
+    // We also keep track of its jobs, so they can be cancelled.
+    class Connection
+    {
+    public:
+        explicit Connection(const Socket socket)
+            : _socket(socket) { }
+
+        ~Connection()
+        {
+            close_socket(_socket);
+        }
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        // Returns false when the client has finished sending
+        bool read_line(std::string& line)
+        {
+            for (;;)
+            {
+                if (const auto end = _readBuffer.find('\n'); end != std::string::npos)
+                {
+                    line = _readBuffer.substr(0, end);
+                    _readBuffer.erase(0, end + 1);
+                    return true;
+                }
+                char buffer[4096];
+                const auto count = recv(_socket, buffer, sizeof(buffer), 0);
+                if (count <= 0)
+                {
+                    // Any unterminated last line still counts
+                    line.swap(_readBuffer);
+                    _readBuffer.clear();
+                    return !line.empty();
+                }
+                _readBuffer.append(buffer, count);
+            }
+        }
+
+        void send_line(const std::string& line)
+        {
+            const auto& data = line + "\n";
+            std::lock_guard lock(_sendMutex);
+            for (size_t offset = 0; offset < data.size();)
+            {
+                const auto count = send(_socket, data.data() + offset, static_cast<int>(data.size() - offset), SEND_FLAGS);
+                if (count <= 0)
+                {
+                    // The client has gone, so there is nobody to tell
+                    return;
+                }
+                offset += count;
+            }
+        }
+
+        // Returns the job's cancelled flag
+        std::shared_ptr<std::atomic<bool>> add_job(const std::string& id)
+        {
+            auto cancelled = std::make_shared<std::atomic<bool>>(false);
+            std::lock_guard lock(_jobsMutex);
+            _jobs.emplace(id, cancelled);
+            return cancelled;
+        }
+
+        void remove_job(const std::string& id, const std::shared_ptr<std::atomic<bool>>& cancelled)
+        {
+            std::lock_guard lock(_jobsMutex);
+            const auto [begin, end] = _jobs.equal_range(id);
+            for (auto it = begin; it != end; ++it)
+            {
+                if (it->second == cancelled)
+                {
+                    _jobs.erase(it);
+                    break;
+                }
+            }
+        }
+
+        // Returns how many jobs were cancelled. Ids are not necessarily unique, so this may be more than one.
+        int cancel_jobs(const std::string& id)
+        {
+            std::lock_guard lock(_jobsMutex);
+            auto count = 0;
+            const auto [begin, end] = _jobs.equal_range(id);
+            for (auto it = begin; it != end; ++it)
+            {
+                *it->second = true;
+                ++count;
+            }
+            return count;
+        }
+
+    private:
+        Socket _socket;
+        std::string _readBuffer;
+        std::mutex _sendMutex;
+        // Queued and running jobs, by id
+        std::multimap<std::string, std::shared_ptr<std::atomic<bool>>> _jobs;
+        std::mutex _jobsMutex;
+    };
+
+    // Sends everything to the client, tagged with the request id
+    class JobCallback final : public IVGMToolCallback
+    {
+    public:
+        JobCallback(std::shared_ptr<Connection> connection, std::string id, std::shared_ptr<std::atomic<bool>> cancelled = {})
+            : _connection(std::move(connection)),
+              _id(std::move(id)),
+              _cancelled(std::move(cancelled)) { }
+
+        void show_message(const std::string& message) const override
+        {
+            send("message", message);
+        }
+
+        void show_error(const std::string& message) const override
+        {
+            send("error", message);
+        }
+
+        void show_status(const std::string& message) const override
+        {
+            send("status", message);
+        }
+
+        void show_conversion_progress(const std::string& message) const override
+        {
+            send("progress", message);
+        }
+
+        void show_progress(const std::string_view stage, const uint64_t done, const uint64_t total) const override
+        {
+            _connection->send_line(std::format(
+                R"({{"id":{},"type":"stage_progress","stage":"{}","done":{},"total":{}}})",
+                _id,
+                stage,
+                done,
+                total));
+        }
+
+        void show_metrics(const StageMetrics& metrics) const override
+        {
+            _connection->send_line(std::format(
+                R"({{"id":{},"type":"metrics","stage":"{}","wall_time_ms":{:.3f},"bytes_in":{},"bytes_out":{},"commands":{}}})",
+                _id,
+                metrics.stage,
+                std::chrono::duration<double, std::milli>(metrics.wallTime).count(),
+                metrics.bytesIn,
+                metrics.bytesOut,
+                metrics.commandCount));
+        }
+
+        [[nodiscard]] bool is_cancelled() const override
+        {
+            return _cancelled != nullptr && *_cancelled;
+        }
+
+        void send(const std::string& type, const std::string& text) const
+        {
+            _connection->send_line(std::format(R"({{"id":{},"type":"{}","text":{}}})", _id, type, json_string(text)));
+        }
+
+        void send_done(const int exitCode) const
+        {
+            _connection->send_line(std::format(R"({{"id":{},"type":"done","exit_code":{}}})", _id, exitCode));
+        }
+
+    private:
+        std::shared_ptr<Connection> _connection;
+        std::string _id;
+        std::shared_ptr<std::atomic<bool>> _cancelled;
+    };
+
+    struct Job
+    {
+        std::shared_ptr<Connection> connection;
+        Request request;
+        std::shared_ptr<std::atomic<bool>> cancelled;
+    };
+
+    // Jobs waiting for a worker thread
+    class JobQueue
+    {
+    public:
+        void push(Job&& job)
+        {
+            {
+                std::lock_guard lock(_mutex);
+                _jobs.push(std::move(job));
+            }
+            _condition.notify_one();
+        }
+
+        // Waits for a job
+        Job pop()
+        {
+            std::unique_lock lock(_mutex);
+            _condition.wait(lock, [this] { return !_jobs.empty(); });
+            auto job = std::move(_jobs.front());
+            _jobs.pop();
+            return job;
+        }
+
+    private:
+        std::queue<Job> _jobs;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+    };
+
+    void run_job(const Job& job, const CommandRunner& runCommand)
+    {
+        const JobCallback callback(job.connection, job.request.id, job.cancelled);
+        std::ostringstream out;
+        int exitCode;
+        try
+        {
+            if (std::ranges::find(job.request.args, "serve") != job.request.args.end())
+            {
+                throw std::runtime_error("Commands can't start another server");
+            }
+            if (callback.is_cancelled())
+            {
+                // Before it started
+                throw OperationCancelled();
+            }
+            // Status messages are always sent, the client can ignore them
+            auto verbose = true;
+            exitCode = runCommand(job.request.args, callback, verbose, out);
+        }
+        catch (const std::exception& e)
+        {
+            callback.show_error(e.what());
+            exitCode = EXIT_FAILURE;
+        }
+        if (const auto& output = out.str(); !output.empty())
+        {
+            callback.send("output", output);
+        }
+        job.connection->remove_job(job.request.id, job.cancelled);
+        callback.send_done(exitCode);
+    }
+
+    // Reads requests from the client until it stops sending
+    void read_requests(const std::shared_ptr<Connection>& connection, JobQueue& queue)
+    {
+        std::string line;
+        while (connection->read_line(line))
+        {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
+            try
+            {
+                auto request = RequestParser(line).parse();
+                if (request.cancel)
+                {
+                    // Jobs stop at the next point where they check, and then report an error
+                    if (connection->cancel_jobs(request.id) == 0)
+                    {
+                        JobCallback(connection, request.id).send("error", "No such command to cancel");
+                    }
+                    continue;
+                }
+                auto cancelled = connection->add_job(request.id);
+                queue.push({connection, std::move(request), std::move(cancelled)});
+            }
+            catch (const std::exception& e)
+            {
+                JobCallback(connection, "null").send("error", std::format("Invalid request: {}", e.what()));
+            }
+        }
+    }
+}
+
+void serve(const std::string& socketPath, const unsigned int threadCount, const CommandRunner& runCommand, const IVGMToolCallback& callback)
+{
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+    {
+        throw std::runtime_error("Failed to initialise Winsock");
+    }
+#endif
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error(std::format("Socket path \"{}\" is too long", socketPath));
+    }
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    const auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == INVALID_SOCKET)
+    {
+        throw std::runtime_error("Failed to create socket");
+    }
+    // A previous server may have left it behind
+    std::filesystem::remove(socketPath);
+    if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        close_socket(listener);
+        throw std::runtime_error(std::format("Failed to listen on \"{}\"", socketPath));
+    }
+
+    // The workers live as long as the server, so each command starts with them ready
+    JobQueue queue;
+    for (auto i = 0u; i < threadCount; ++i)
+    {
+        std::thread([&queue, &runCommand]
+        {
+            for (;;)
+            {
+                run_job(queue.pop(), runCommand);
+            }
+        }).detach();
+    }
+
+    callback.show_status(std::format("Listening on {} with {} threads", socketPath, threadCount));
+
+    for (;;)
+    {
+        const auto client = accept(listener, nullptr, nullptr);
+        if (client == INVALID_SOCKET)
+        {
+            continue;
+        }
+        // Each client gets a thread to read its requests, so a slow client can't hold up the others
+        std::thread([connection = std::make_shared<Connection>(client), &queue]
+        {
+            read_requests(connection, queue);
+        }).detach();
+    }
+}
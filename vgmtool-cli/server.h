@@ -0,0 +1,26 @@
+#pragma once
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A local server for running many commands without starting a process for each
+
+class IVGMToolCallback;
+
+// Runs a command line, without the program name. Anything which would go to stdout goes to out instead.
+using CommandRunner = std::function<int(std::vector<std::string> args, const IVGMToolCallback& callback, bool& verbose, std::ostream& out)>;
+
+// Listens on a Unix domain socket for commands, and runs them on threadCount threads until the process is killed.
+// Each line sent to the socket is a JSON object with the command line arguments, for example:
+//   {"id": 1, "args": ["file.vgm", "trim", "--start", "0"]}
+// Each line sent back is a JSON object with the same id, one of:
+//   {"id": 1, "type": "status", "text": "..."} (also "message", "error" and "progress")
+//   {"id": 1, "type": "output", "text": "..."} (what would go to stdout, e.g. from totext)
+//   {"id": 1, "type": "stage_progress", "stage": "compress", "done": 1000000, "total": 5000000}
+//   {"id": 1, "type": "metrics", "stage": "compress", "wall_time_ms": 1234.5, "bytes_in": 5000000, "bytes_out": 500000, "commands": 0}
+//   {"id": 1, "type": "done", "exit_code": 0}
+// Sending {"id": 1, "cancel": true} cancels the command with that id. Long operations check for this now and then.
+// Commands run in parallel, so lines for different ids may be interleaved. To try it:
+//   echo '{"id": 1, "args": ["file.vgm", "check"]}' | socat - UNIX-CONNECT:vgmtool.sock
+void serve(const std::string& socketPath, unsigned int threadCount, const CommandRunner& runCommand, const IVGMToolCallback& callback);
@@ -0,0 +1,443 @@
+#include "watcher.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <libpu8/libpu8/libpu8.h>
+#else
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include "libvgmtool/IVGMToolCallback.h"
+#include "libvgmtool/utils.h"
+
+namespace
+{
+    bool is_vgm_file(const std::filesystem::path& path)
+    {
+        const auto& extension = Utils::to_lower(path.extension().string());
+        return extension == ".vgm" || extension == ".vgz";
+    }
+
+    bool is_watched_file(const std::filesystem::path& path)
+    {
+        const auto& extension = Utils::to_lower(path.extension().string());
+        return is_vgm_file(path) || extension == ".gym" || extension == ".cym" || extension == ".ssl";
+    }
+
+    // Files which have been written, waiting until they stop changing and a worker thread is free
+    class FileQueue
+    {
+    public:
+        explicit FileQueue(const std::chrono::milliseconds settleTime)
+            : _settleTime(settleTime) { }
+
+        // Called when the writer has finished with the file, as far as we can tell
+        void written(const std::string& filename)
+        {
+            {
+                std::lock_guard lock(_mutex);
+                _pending[filename] = Clock::now() + _settleTime;
+            }
+            _condition.notify_all();
+        }
+
+        // Called when the file is still being written. This only delays files we already know about, so we don't
+        // start waiting until the writer is done.
+        void writing(const std::string& filename)
+        {
+            std::lock_guard lock(_mutex);
+            if (const auto it = _pending.find(filename); it != _pending.end())
+            {
+                it->second = Clock::now() + _settleTime;
+            }
+        }
+
+        // Waits for a file which has settled. It is then ours until we call done().
+        std::string pop()
+        {
+            std::unique_lock lock(_mutex);
+            for (;;)
+            {
+                const auto now = Clock::now();
+                auto next = Clock::time_point::max();
+                for (auto it = _pending.begin(); it != _pending.end();)
+                {
+                    if (_busy.contains(it->first))
+                    {
+                        // We'll look again when it's done
+                        ++it;
+                    }
+                    else if (it->second > now)
+                    {
+                        next = std::min(next, it->second);
+                        ++it;
+                    }
+                    else if (!has_changed(it->first))
+                    {
+                        // This is our own write, or the file has gone
+                        it = _pending.erase(it);
+                    }
+                    else
+                    {
+                        auto filename = it->first;
+                        _pending.erase(it);
+                        _busy.insert(filename);
+                        return filename;
+                    }
+                }
+                if (next == Clock::time_point::max())
+                {
+                    _condition.wait(lock);
+                }
+                else
+                {
+                    _condition.wait_until(lock, next);
+                }
+            }
+        }
+
+        // Remembers the state we left the file in, so our own changes to it are ignored
+        void done(const std::string& filename)
+        {
+            {
+                std::lock_guard lock(_mutex);
+                _busy.erase(filename);
+                _processed[filename] = get_state(filename);
+            }
+            _condition.notify_all();
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        using FileState = std::pair<std::filesystem::file_time_type, uintmax_t>;
+
+        static FileState get_state(const std::string& filename)
+        {
+            std::error_code error;
+            const auto& modified = std::filesystem::last_write_time(filename, error);
+            const auto size = std::filesystem::file_size(filename, error);
+            return {modified, error ? 0 : size};
+        }
+
+        bool has_changed(const std::string& filename) const
+        {
+            if (!std::filesystem::is_regular_file(filename))
+            {
+                return false;
+            }
+            const auto it = _processed.find(filename);
+            return it == _processed.end() || it->second != get_state(filename);
+        }
+
+        std::chrono::milliseconds _settleTime;
+        // When each file will have settled
+        std::map<std::string, Clock::time_point> _pending;
+        // Files being processed
+        std::set<std::string> _busy;
+        std::map<std::string, FileState> _processed;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+    };
+
+    void process(
+        const std::string& filename,
+        const std::vector<std::vector<std::string>>& steps,
+        const CommandRunner& runCommand,
+        const IVGMToolCallback& callback)
+    {
+        // Only VGM files get the steps other than convert
+        const auto isVgm = is_vgm_file(filename);
+        if (std::ranges::none_of(steps, [isVgm](const auto& step) { return (step.front() == "convert") != isVgm; }))
+        {
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& step : steps)
+        {
+            if ((step.front() == "convert") == isVgm)
+            {
+                continue;
+            }
+            callback.show_status(std::format("{}: {}", filename, step.front()));
+
+            std::vector<std::string> args{filename};
+            args.insert(args.end(), step.begin(), step.end());
+            std::ostringstream out;
+            auto verbose = false;
+            const auto exitCode = runCommand(args, callback, verbose, out);
+            if (const auto& output = out.str(); !output.empty())
+            {
+                callback.show_message(output);
+            }
+            if (exitCode != EXIT_SUCCESS)
+            {
+                callback.show_error(std::format("{}: {} failed", filename, step.front()));
+                return;
+            }
+        }
+        callback.show_message(std::format(
+            "{}: done in {} ms",
+            filename,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()));
+    }
+
+#ifdef _WIN32
+    // This blocks, so each folder (and its subfolders) gets a thread
+    void watch_folder(const std::filesystem::path& folder, FileQueue& queue, const IVGMToolCallback& callback)
+    {
+        const auto handle = CreateFileW(
+            folder.c_str(),
+            FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr,
+            OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS,
+            nullptr);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error(std::format("Failed to watch \"{}\"", u8narrow(folder.wstring())));
+        }
+
+        alignas(DWORD) uint8_t buffer[64 * 1024];
+        for (;;)
+        {
+            DWORD length;
+            if (!ReadDirectoryChangesW(
+                handle,
+                buffer,
+                sizeof(buffer),
+                TRUE,
+                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE,
+                &length,
+                nullptr,
+                nullptr))
+            {
+                CloseHandle(handle);
+                throw std::runtime_error(std::format("Failed to watch \"{}\"", u8narrow(folder.wstring())));
+            }
+            if (length == 0)
+            {
+                callback.show_error("Too many changes at once, some files may have been missed");
+                continue;
+            }
+            // There is no event for when the writer closes the file, so we rely on the settle time
+            for (DWORD offset = 0;;)
+            {
+                const auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer + offset);
+                if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED || info->Action == FILE_ACTION_RENAMED_NEW_NAME)
+                {
+                    const auto& path = folder / std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR));
+                    if (is_watched_file(path))
+                    {
+                        queue.written(u8narrow(path.wstring()));
+                    }
+                }
+                if (info->NextEntryOffset == 0)
+                {
+                    break;
+                }
+                offset += info->NextEntryOffset;
+            }
+        }
+    }
+
+    void watch_folders(const std::vector<std::string>& folders, FileQueue& queue, const IVGMToolCallback& callback)
+    {
+        std::vector<std::thread> threads;
+        for (const auto& folder : folders)
+        {
+            threads.emplace_back([&folder, &queue, &callback]
+            {
+                try
+                {
+                    watch_folder(u8widen(folder), queue, callback);
+                }
+                catch (const std::exception& e)
+                {
+                    callback.show_error(e.what());
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+#else
+    // inotify doesn't watch subfolders, so we add them as we go
+    void watch_folders(const std::vector<std::string>& folders, FileQueue& queue, const IVGMToolCallback& callback)
+    {
+        const auto fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Failed to initialise inotify");
+        }
+
+        std::map<int, std::filesystem::path> watchedFolders;
+        const auto addWatch = [&](const std::filesystem::path& folder)
+        {
+            const auto wd = inotify_add_watch(fd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE | IN_ONLYDIR);
+            if (wd < 0)
+            {
+                callback.show_error(std::format("Failed to watch \"{}\"", folder.string()));
+                return;
+            }
+            watchedFolders[wd] = folder;
+        };
+        // New folders may already have files in them by the time we see them, so we can queue those
+        const auto addFolder = [&](const std::filesystem::path& folder, const bool queueFiles)
+        {
+            addWatch(folder);
+            std::error_code error;
+            for (std::filesystem::recursive_directory_iterator it(folder, std::filesystem::directory_options::skip_permission_denied, error), end;
+                 it != end;
+                 it.increment(error))
+            {
+                if (it->is_directory(error))
+                {
+                    addWatch(it->path());
+                }
+                else if (queueFiles && is_watched_file(it->path()))
+                {
+                    queue.written(it->path().string());
+                }
+            }
+        };
+
+        for (const auto& folder : folders)
+        {
+            addFolder(folder, false);
+        }
+
+        alignas(inotify_event) char buffer[64 * 1024];
+        for (;;)
+        {
+            const auto length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                close(fd);
+                throw std::runtime_error("Failed to read inotify events");
+            }
+            for (auto offset = 0; offset < length;)
+            {
+                const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += static_cast<int>(sizeof(inotify_event) + event->len);
+
+                if ((event->mask & IN_Q_OVERFLOW) != 0)
+                {
+                    callback.show_error("Too many changes at once, some files may have been missed");
+                    continue;
+                }
+                if ((event->mask & IN_IGNORED) != 0)
+                {
+                    // The folder has gone
+                    watchedFolders.erase(event->wd);
+                    continue;
+                }
+                const auto it = watchedFolders.find(event->wd);
+                if (it == watchedFolders.end() || event->len == 0)
+                {
+                    continue;
+                }
+                const auto& path = it->second / event->name;
+                if ((event->mask & IN_ISDIR) != 0)
+                {
+                    if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0)
+                    {
+                        addFolder(path, true);
+                    }
+                }
+                else if (is_watched_file(path))
+                {
+                    if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0)
+                    {
+                        queue.written(path.string());
+                    }
+                    else if ((event->mask & IN_MODIFY) != 0)
+                    {
+                        queue.writing(path.string());
+                    }
+                }
+            }
+        }
+    }
+#endif
+}
+
+void watch(
+    const std::vector<std::string>& folders,
+    const std::vector<std::string>& steps,
+    const std::chrono::milliseconds settleTime,
+    const unsigned int threadCount,
+    const CommandRunner& runCommand,
+    const IVGMToolCallback& callback)
+{
+    for (const auto& folder : folders)
+    {
+        if (!std::filesystem::is_directory(folder))
+        {
+            throw std::runtime_error(std::format("\"{}\" is not a folder", folder));
+        }
+    }
+
+    // Each step is a verb and its options
+    std::vector<std::vector<std::string>> stepArgs;
+    for (const auto& step : steps)
+    {
+        std::istringstream stream(step);
+        std::vector<std::string> args{std::istream_iterator<std::string>(stream), std::istream_iterator<std::string>()};
+        if (args.empty())
+        {
+            throw std::runtime_error("Empty step");
+        }
+        if (args.front() == "watch" || args.front() == "serve")
+        {
+            throw std::runtime_error(std::format("\"{}\" can't be a step", args.front()));
+        }
+        stepArgs.push_back(std::move(args));
+    }
+
+    // The queue and steps outlive the workers, as we never return
+    FileQueue queue(settleTime);
+    for (auto i = 0u; i < threadCount; ++i)
+    {
+        std::thread([&queue, &stepArgs, &runCommand, &callback]
+        {
+            for (;;)
+            {
+                const auto& filename = queue.pop();
+                try
+                {
+                    process(filename, stepArgs, runCommand, callback);
+                }
+                catch (const std::exception& e)
+                {
+                    callback.show_error(std::format("{}: {}", filename, e.what()));
+                }
+                queue.done(filename);
+            }
+        }).detach();
+    }
+
+    callback.show_status(std::format("Watching for files with {} threads", threadCount));
+    watch_folders(folders, queue, callback);
+}
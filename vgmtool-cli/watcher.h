@@ -0,0 +1,22 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "server.h"
+
+// Processing files as they arrive in a folder
+
+class IVGMToolCallback;
+
+// Watches folders (and their subfolders) for VGM, GYM, CYM and SSL files being written, and runs steps on each one once
+// it has not changed for settleTime, on up to threadCount files at once. Each step is a verb with any options, e.g.
+// "compress --iterations 5". GYM, CYM and SSL files only get the convert step; the VGM file this makes is then picked
+// up like any other. Files which are already there are left alone. Runs until the process is killed.
+void watch(
+    const std::vector<std::string>& folders,
+    const std::vector<std::string>& steps,
+    std::chrono::milliseconds settleTime,
+    unsigned int threadCount,
+    const CommandRunner& runCommand,
+    const IVGMToolCallback& callback);
@@ -0,0 +1,239 @@
+#include "vgmtool_api.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "libvgmtool/BinaryData.h"
+#include "libvgmtool/convert.h"
+#include "libvgmtool/IVGMToolCallback.h"
+#include "libvgmtool/optimise.h"
+#include "libvgmtool/trim.h"
+#include "libvgmtool/utils.h"
+#include "libvgmtool/VgmFile.h"
+
+namespace
+{
+    thread_local std::string lastError;
+
+    // Errors come back as result codes, so there is nothing to show
+    class NullCallback final : public IVGMToolCallback
+    {
+    public:
+        void show_message(const std::string&) const override {}
+        void show_error(const std::string&) const override {}
+        void show_status(const std::string&) const override {}
+        void show_conversion_progress(const std::string&) const override {}
+    };
+
+    const NullCallback callback;
+
+    vgmtool_result fail(const vgmtool_result result, const std::string& message)
+    {
+        lastError = message;
+        return result;
+    }
+
+    // Runs f, which returns a result. Exceptions are assumed to come from invalid data.
+    template <typename F>
+    vgmtool_result run(F&& f) noexcept
+    {
+        try
+        {
+            lastError.clear();
+            return f();
+        }
+        catch (const std::bad_alloc&)
+        {
+            return fail(VGMTOOL_OUT_OF_MEMORY, "Out of memory");
+        }
+        catch (const std::exception& e)
+        {
+            return fail(VGMTOOL_INVALID_DATA, e.what());
+        }
+        catch (...)
+        {
+            return fail(VGMTOOL_ERROR, "Unknown error");
+        }
+    }
+
+    bool is_valid_input(const uint8_t* data, const size_t size)
+    {
+        return data != nullptr || size == 0;
+    }
+
+    vgmtool_result write_output(const std::span<const uint8_t> result, vgmtool_output* output)
+    {
+        output->size = result.size();
+        if (output->data == nullptr)
+        {
+            // malloc(0) may return null
+            output->data = static_cast<uint8_t*>(malloc(std::max<size_t>(result.size(), 1)));
+            if (output->data == nullptr)
+            {
+                return fail(VGMTOOL_OUT_OF_MEMORY, "Out of memory");
+            }
+            output->capacity = result.size();
+        }
+        else if (result.size() > output->capacity)
+        {
+            return fail(VGMTOOL_BUFFER_TOO_SMALL, std::format("The output is {} bytes", result.size()));
+        }
+        std::ranges::copy(result, output->data);
+        return VGMTOOL_OK;
+    }
+
+    void load(VgmFile& file, const uint8_t* data, const size_t size)
+    {
+        std::vector<uint8_t> buffer;
+        Utils::load_data(buffer, {data, size});
+        file.load_data(std::move(buffer));
+    }
+
+    vgmtool_result write_output(VgmFile& file, vgmtool_output* output)
+    {
+        BinaryData data;
+        file.to_binary(data);
+        return write_output(data.buffer(), output);
+    }
+}
+
+int vgmtool_api_version()
+{
+    return VGMTOOL_API_VERSION;
+}
+
+const char* vgmtool_last_error()
+{
+    return lastError.c_str();
+}
+
+void vgmtool_free(uint8_t* data)
+{
+    free(data);
+}
+
+vgmtool_result vgmtool_check(const uint8_t* data, const size_t size, vgmtool_lengths* lengths)
+{
+    if (!is_valid_input(data, size) || lengths == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    return run([&]
+    {
+        VgmFile file;
+        load(file, data, size);
+        file.count_samples(lengths->sample_count, lengths->loop_sample_count);
+        lengths->header_sample_count = file.header().sample_count();
+        lengths->header_loop_sample_count = file.header().loop_sample_count();
+        return VGMTOOL_OK;
+    });
+}
+
+vgmtool_result vgmtool_trim(
+    const uint8_t* data,
+    const size_t size,
+    const int32_t start,
+    const int32_t loop,
+    const int32_t end,
+    vgmtool_output* output)
+{
+    if (!is_valid_input(data, size) || output == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    if (start < 0 || (loop != -1 && loop < start) || end <= loop || end <= start)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Invalid edit points: failed the condition start <= loop < end");
+    }
+    return run([&]
+    {
+        VgmFile file;
+        load(file, data, size);
+        uint32_t sampleCount;
+        uint32_t loopSampleCount;
+        file.count_samples(sampleCount, loopSampleCount);
+        if (static_cast<uint32_t>(end) > sampleCount)
+        {
+            return fail(VGMTOOL_INVALID_ARGUMENT, std::format("End point {} is beyond the end of the data ({} samples)", end, sampleCount));
+        }
+        trim(file, start, loop, end, callback);
+        return write_output(file, output);
+    });
+}
+
+vgmtool_result vgmtool_optimise(const uint8_t* data, const size_t size, vgmtool_output* output)
+{
+    if (!is_valid_input(data, size) || output == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    return run([&]
+    {
+        VgmFile file;
+        load(file, data, size);
+        optimise_vgm_data(file, callback);
+        return write_output(file, output);
+    });
+}
+
+vgmtool_result vgmtool_convert(const uint8_t* data, const size_t size, const vgmtool_format format, vgmtool_output* output)
+{
+    if (!is_valid_input(data, size) || output == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    Convert::FileType type;
+    switch (format)
+    {
+    case VGMTOOL_FORMAT_GYM:
+        type = Convert::FileType::Gym;
+        break;
+    case VGMTOOL_FORMAT_CYM:
+        type = Convert::FileType::Cym;
+        break;
+    case VGMTOOL_FORMAT_SSL:
+        type = Convert::FileType::Ssl;
+        break;
+    default:
+        return fail(VGMTOOL_INVALID_ARGUMENT, std::format("Unknown format {}", static_cast<int>(format)));
+    }
+    return run([&]
+    {
+        // GYM data may itself be compressed, but not as GZip
+        BinaryData out;
+        Convert::to_vgm({data, size}, type, out);
+        return write_output(out.buffer(), output);
+    });
+}
+
+vgmtool_result vgmtool_compress(const uint8_t* data, const size_t size, const int iterations, vgmtool_output* output)
+{
+    if (!is_valid_input(data, size) || output == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    return run([&]
+    {
+        return write_output(Utils::compress_data({data, size}, callback, iterations), output);
+    });
+}
+
+vgmtool_result vgmtool_decompress(const uint8_t* data, const size_t size, vgmtool_output* output)
+{
+    if (!is_valid_input(data, size) || output == nullptr)
+    {
+        return fail(VGMTOOL_INVALID_ARGUMENT, "Null pointer");
+    }
+    return run([&]
+    {
+        std::vector<uint8_t> buffer;
+        Utils::load_data(buffer, {data, size});
+        return write_output(buffer, output);
+    });
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/* A C interface to libvgmtool, working on data in memory rather than files.
+ * Functions return a vgmtool_result; on failure, vgmtool_last_error() describes what went wrong.
+ * Functions may be called from several threads at once. */
+
+#ifdef _WIN32
+#ifdef VGMTOOL_EXPORTS
+#define VGMTOOL_API __declspec(dllexport)
+#else
+#define VGMTOOL_API __declspec(dllimport)
+#endif
+#else
+#define VGMTOOL_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Functions are only ever added, so callers can check for the ones they need */
+#define VGMTOOL_API_VERSION 1
+
+typedef enum vgmtool_result
+{
+    VGMTOOL_OK = 0,
+    /* An argument is invalid, e.g. a null pointer or edit points out of order */
+    VGMTOOL_INVALID_ARGUMENT = 1,
+    /* The input data is not valid */
+    VGMTOOL_INVALID_DATA = 2,
+    /* The output didn't fit in the buffer provided. Its size is in the output's size. */
+    VGMTOOL_BUFFER_TOO_SMALL = 3,
+    VGMTOOL_OUT_OF_MEMORY = 4,
+    VGMTOOL_ERROR = 5
+} vgmtool_result;
+
+/* Where a function puts its output. Either:
+ * - set data to your own buffer and capacity to its size, or
+ * - set data to NULL, and a buffer is allocated for you, which you must free with vgmtool_free().
+ * On success, size is set to the size of the output. */
+typedef struct vgmtool_output
+{
+    uint8_t* data;
+    size_t capacity;
+    size_t size;
+} vgmtool_output;
+
+typedef struct vgmtool_lengths
+{
+    /* Counted from the data, in samples at 44100Hz */
+    uint32_t sample_count;
+    uint32_t loop_sample_count;
+    /* As stored in the header */
+    uint32_t header_sample_count;
+    uint32_t header_loop_sample_count;
+} vgmtool_lengths;
+
+typedef enum vgmtool_format
+{
+    VGMTOOL_FORMAT_GYM = 0,
+    VGMTOOL_FORMAT_CYM = 1,
+    VGMTOOL_FORMAT_SSL = 2
+} vgmtool_format;
+
+/* Returns VGMTOOL_API_VERSION as it was when the library was built */
+VGMTOOL_API int vgmtool_api_version(void);
+
+/* Describes the last failure on the calling thread. Valid until the thread's next call. */
+VGMTOOL_API const char* vgmtool_last_error(void);
+
+/* Frees output data allocated by the library */
+VGMTOOL_API void vgmtool_free(uint8_t* data);
+
+/* In all of these, the input may be VGM or VGZ data, and any VGM output is uncompressed. */
+
+/* Gets the lengths of the file, as counted from the data and as stored in the header. They should be the same. */
+VGMTOOL_API vgmtool_result vgmtool_check(const uint8_t* data, size_t size, vgmtool_lengths* lengths);
+
+/* Trims the file to the samples from start to end, with the loop point at loop (or -1 for no loop) */
+VGMTOOL_API vgmtool_result vgmtool_trim(
+    const uint8_t* data,
+    size_t size,
+    int32_t start,
+    int32_t loop,
+    int32_t end,
+    vgmtool_output* output);
+
+/* Removes redundant chip writes */
+VGMTOOL_API vgmtool_result vgmtool_optimise(const uint8_t* data, size_t size, vgmtool_output* output);
+
+/* Converts GYM, CYM or SSL data to VGM */
+VGMTOOL_API vgmtool_result vgmtool_convert(
+    const uint8_t* data,
+    size_t size,
+    vgmtool_format format,
+    vgmtool_output* output);
+
+/* Compresses data to GZip format with zopfli, for iterations (or the default of 15 if 0) */
+VGMTOOL_API vgmtool_result vgmtool_compress(const uint8_t* data, size_t size, int iterations, vgmtool_output* output);
+
+/* Decompresses GZip data. Anything else is copied unchanged. */
+VGMTOOL_API vgmtool_result vgmtool_decompress(const uint8_t* data, size_t size, vgmtool_output* output);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+#include <format>
+#include <string>
+
+// A minimal test runner. TEST(name) defines a test, which is run by main(). A failed CHECK is reported and the test
+// carries on, so one run shows everything that is wrong. Exceptions fail the test they come from.
+namespace Test
+{
+    // Used by TEST
+    bool add(const char* name, void (*function)());
+    // Used by the CHECK macros
+    void fail(const std::string& message, const char* file, int line);
+    // Runs every test, returning the number that failed
+    int run_all();
+}
+
+#define TEST(name) \
+    static void name(); \
+    static const bool name##_isAdded = Test::add(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            Test::fail(#condition, __FILE__, __LINE__); \
+        } \
+    } while (false)
+
+// Both sides need to be formattable by std::format
+#define CHECK_EQUAL(expected, actual) \
+    do \
+    { \
+        const auto& expectedValue_ = (expected); \
+        const auto& actualValue_ = (actual); \
+        if (!(expectedValue_ == actualValue_)) \
+        { \
+            Test::fail(std::format("{} == {}: expected {}, got {}", #expected, #actual, expectedValue_, actualValue_), \
+                __FILE__, __LINE__); \
+        } \
+    } while (false)
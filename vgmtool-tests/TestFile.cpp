@@ -0,0 +1,142 @@
+#include "TestFile.h"
+
+#include <chrono>
+#include <filesystem>
+#include <format>
+
+#include "libvgmtool/CommandStream.h"
+#include "libvgmtool/VgmCommands.h"
+
+TestFile::TestFile(const std::initializer_list<std::pair<VgmHeader::Chip, uint32_t>> clocks)
+{
+    BcdVersion version;
+    version.set_major(1);
+    version.set_minor(71);
+    _header.set_version(version);
+    for (const auto& [chip, clock] : clocks)
+    {
+        _header.set_clock(chip, clock);
+    }
+}
+
+TestFile::~TestFile()
+{
+    for (const auto* pCommand : _commands)
+    {
+        delete pCommand;
+    }
+}
+
+TestFile& TestFile::add(VgmCommands::ICommand* pCommand)
+{
+    _commands.push_back(pCommand);
+    return *this;
+}
+
+TestFile& TestFile::psg(const uint8_t value)
+{
+    auto* pCommand = new VgmCommands::SN76489();
+    pCommand->set_value(value);
+    return add(pCommand);
+}
+
+TestFile& TestFile::ym2413(const uint8_t registerIndex, const uint8_t value)
+{
+    auto* pCommand = new VgmCommands::YM2413();
+    pCommand->set_register(registerIndex);
+    pCommand->set_value(value);
+    return add(pCommand);
+}
+
+TestFile& TestFile::ym2612(const int port, const uint8_t registerIndex, const uint8_t value)
+{
+    VgmCommands::RegisterDataCommand* pCommand;
+    if (port == 0)
+    {
+        pCommand = new VgmCommands::YM2612Port0();
+    }
+    else
+    {
+        pCommand = new VgmCommands::YM2612Port1();
+    }
+    pCommand->set_register(registerIndex);
+    pCommand->set_value(value);
+    return add(pCommand);
+}
+
+TestFile& TestFile::ym2151(const uint8_t registerIndex, const uint8_t value)
+{
+    auto* pCommand = new VgmCommands::YM2151();
+    pCommand->set_register(registerIndex);
+    pCommand->set_value(value);
+    return add(pCommand);
+}
+
+TestFile& TestFile::ay8910(const uint8_t registerIndex, const uint8_t value)
+{
+    auto* pCommand = new VgmCommands::AY8910();
+    pCommand->set_register(registerIndex);
+    pCommand->set_value(value);
+    return add(pCommand);
+}
+
+TestFile& TestFile::wait(const uint32_t sampleCount)
+{
+    CommandStream::add_wait(_commands, sampleCount);
+    return *this;
+}
+
+TestFile& TestFile::loop()
+{
+    return add(new VgmCommands::LoopPoint());
+}
+
+VgmFile TestFile::build()
+{
+    add(new VgmCommands::End());
+    VgmFile file;
+    file.header() = _header;
+    file.set_commands(std::move(_commands));
+    file.check_header(true);
+    file.load_data(file_data(file));
+    return file;
+}
+
+std::vector<std::pair<int, int>> register_writes(const VgmFile& file, const VgmHeader::Chip chip, const size_t firstIndex)
+{
+    std::vector<std::pair<int, int>> result;
+    const auto& commands = file.commands();
+    for (auto i = firstIndex; i < commands.size(); ++i)
+    {
+        const auto* pCommand = commands[i];
+        if (const auto* pWrite = dynamic_cast<const VgmCommands::RegisterDataCommand*>(pCommand);
+            pWrite != nullptr && pWrite->chip() == chip)
+        {
+            const auto port = dynamic_cast<const VgmCommands::YM2612Port1*>(pCommand) != nullptr ? 0x100 : 0;
+            result.emplace_back(port + pWrite->registerIndex(), pWrite->value());
+        }
+    }
+    return result;
+}
+
+std::vector<uint8_t> file_data(VgmFile& file)
+{
+    BinaryData data;
+    file.to_binary(data);
+    return data.buffer();
+}
+
+TempFile::TempFile(const std::string& extension)
+{
+    // Unique enough for tests run one at a time
+    static auto count = 0;
+    const auto time = std::chrono::steady_clock::now().time_since_epoch().count();
+    _name = (std::filesystem::temp_directory_path() / std::format("vgmtool-tests-{}-{}{}", time, count++, extension))
+        .string();
+}
+
+TempFile::~TempFile()
+{
+    std::error_code error;
+    std::filesystem::remove(_name, error);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libvgmtool/IVGMToolCallback.h"
+#include "libvgmtool/VgmFile.h"
+
+// Builds small VGM files in memory, e.g.
+//   auto file = TestFile({{VgmHeader::Chip::YM2612, 7670453}}).ym2612(0, 0x28, 0xf0).wait(735).build();
+class TestFile
+{
+public:
+    // The chips the file uses, with their clocks
+    explicit TestFile(std::initializer_list<std::pair<VgmHeader::Chip, uint32_t>> clocks);
+    ~TestFile();
+
+    TestFile(const TestFile& other) = delete;
+    TestFile(TestFile&& other) noexcept = delete;
+    TestFile& operator=(const TestFile& other) = delete;
+    TestFile& operator=(TestFile&& other) noexcept = delete;
+
+    // Takes ownership of pCommand
+    TestFile& add(VgmCommands::ICommand* pCommand);
+    TestFile& psg(uint8_t value);
+    TestFile& ym2413(uint8_t registerIndex, uint8_t value);
+    TestFile& ym2612(int port, uint8_t registerIndex, uint8_t value);
+    TestFile& ym2151(uint8_t registerIndex, uint8_t value);
+    TestFile& ay8910(uint8_t registerIndex, uint8_t value);
+    TestFile& wait(uint32_t sampleCount);
+    TestFile& loop();
+
+    // Adds the end, and makes the file. It is saved and loaded again, so it is as if it came from disk.
+    VgmFile build();
+
+private:
+    VgmHeader _header;
+    std::vector<VgmCommands::ICommand*> _commands;
+};
+
+// Ignores everything
+class NullCallback final : public IVGMToolCallback
+{
+public:
+    void show_message(const std::string&) const override {}
+    void show_error(const std::string&) const override {}
+    void show_status(const std::string&) const override {}
+    void show_conversion_progress(const std::string&) const override {}
+};
+
+// The file's writes to one chip, as (register, value) pairs, from the command at index firstIndex on. Port 1 registers
+// are at 0x100 and up.
+std::vector<std::pair<int, int>> register_writes(const VgmFile& file, VgmHeader::Chip chip, size_t firstIndex = 0);
+
+// The file's contents, as save_file() would write them
+std::vector<uint8_t> file_data(VgmFile& file);
+
+// A file name in the system temp folder, which is deleted when this is destroyed
+class TempFile
+{
+public:
+    explicit TempFile(const std::string& extension);
+    ~TempFile();
+
+    TempFile(const TempFile& other) = delete;
+    TempFile(TempFile&& other) noexcept = delete;
+    TempFile& operator=(const TempFile& other) = delete;
+    TempFile& operator=(TempFile&& other) noexcept = delete;
+
+    [[nodiscard]] const std::string& name() const
+    {
+        return _name;
+    }
+
+private:
+    std::string _name;
+};
@@ -0,0 +1,29 @@
+#include <sstream>
+
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/assemble.h"
+#include "libvgmtool/VgmCommands.h"
+
+TEST(totext_then_assemble)
+{
+    // The data block is too long for the listing, so it comes from the template
+    auto* pDataBlock = new VgmCommands::DataBlock();
+    pDataBlock->set_data(0x00, std::vector<uint8_t>(64, 0x80));
+    auto original = TestFile({{VgmHeader::Chip::SN76489, 3579545}, {VgmHeader::Chip::YM2612, 7670453}})
+        .add(pDataBlock)
+        .psg(0x80).psg(0x10).psg(0x90)
+        .ym2612(0, 0x28, 0xf0).ym2612(1, 0xb4, 0xc0)
+        .wait(735)
+        .loop()
+        .psg(0x9f)
+        .wait(100000)
+        .build();
+    std::ostringstream listing;
+    original.write_to_text(listing, NullCallback());
+
+    auto assembled = original.snapshot();
+    assemble(listing.str(), assembled, NullCallback());
+    CHECK(file_data(assembled) == file_data(original));
+}
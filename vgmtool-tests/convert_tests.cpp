@@ -0,0 +1,38 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/BinaryData.h"
+#include "libvgmtool/convert.h"
+#include "libvgmtool/verify.h"
+
+TEST(gym_convert_then_verify)
+{
+    const std::vector<uint8_t> gym
+    {
+        // PSG and YM2612 port 0 writes, then a wait
+        0x03, 0x80, 0x03, 0x10, 0x03, 0x90, 0x01, 0xa4, 0x22, 0x01, 0xa0, 0x69, 0x01, 0x28, 0xf0, 0x00,
+        // Port 1
+        0x02, 0xb4, 0xc0, 0x00,
+        // DAC writes, which are spread through the frame
+        0x01, 0x2a, 0x80, 0x01, 0x2a, 0x90, 0x00,
+        0x00
+    };
+    BinaryData data;
+    Convert::to_vgm(gym, Convert::FileType::Gym, data);
+    VgmFile converted;
+    converted.load_data(std::vector(data.buffer()));
+
+    auto expected = TestFile({{VgmHeader::Chip::SN76489, 3579545}, {VgmHeader::Chip::YM2612, 7670454}})
+        .psg(0x80).psg(0x10).psg(0x90)
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69).ym2612(0, 0x28, 0xf0)
+        .wait(735)
+        .ym2612(1, 0xb4, 0xc0)
+        .wait(735)
+        .ym2612(0, 0x2a, 0x80).wait(367).ym2612(0, 0x2a, 0x90).wait(368)
+        .wait(735)
+        .build();
+    CHECK_EQUAL(expected.header().sample_count(), converted.header().sample_count());
+    CHECK_EQUAL(7670454u, converted.header().clock(VgmHeader::Chip::YM2612));
+    CHECK_EQUAL(3579545u, converted.header().clock(VgmHeader::Chip::SN76489));
+    CHECK(verify_equivalent(expected, converted, 0).isEquivalent);
+}
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <filesystem>
+
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/GzipIndex.h"
+#include "libvgmtool/utils.h"
+
+namespace
+{
+    // Compressible, but not so much that it all fits in one deflate block
+    std::vector<uint8_t> make_data(const size_t size)
+    {
+        std::vector<uint8_t> result(size);
+        uint32_t seed = 1;
+        for (auto& b : result)
+        {
+            seed = seed * 1103515245 + 12345;
+            b = static_cast<uint8_t>((seed >> 16) & 0x0f);
+        }
+        return result;
+    }
+
+    std::vector<uint8_t> range(const std::vector<uint8_t>& data, const uint32_t offset, const uint32_t length)
+    {
+        const auto end = std::min<size_t>(data.size(), offset + length);
+        return {data.begin() + std::min<size_t>(offset, end), data.begin() + end};
+    }
+}
+
+TEST(gzip_index_reads_match_gzread)
+{
+    const TempFile file(".vgz");
+    Utils::save_gzip(file.name(), make_data(300000));
+    // What gzread gives
+    std::vector<uint8_t> data;
+    Utils::load_file(data, file.name());
+
+    const auto index = GzipIndex::build(file.name(), 16 * 1024);
+    CHECK_EQUAL(data.size(), static_cast<size_t>(index.size()));
+    for (const uint32_t offset : {0u, 1u, 16383u, 16384u, 100000u, 299990u, 300000u})
+    {
+        CHECK(index.read(file.name(), offset, 5000) == range(data, offset, 5000));
+    }
+
+    // And again from the saved index
+    index.save(file.name());
+    GzipIndex loaded;
+    CHECK(loaded.load(file.name()));
+    CHECK(loaded.read(file.name(), 123456, 100000) == range(data, 123456, 100000));
+    CHECK(read_file_range(file.name(), 250000, 100) == range(data, 250000, 100));
+    std::filesystem::remove(GzipIndex::sidecar_filename(file.name()));
+}
@@ -0,0 +1,65 @@
+#include <exception>
+#include <iostream>
+#include <vector>
+
+#include "Test.h"
+
+namespace
+{
+    struct TestCase
+    {
+        const char* name;
+        void (*function)();
+    };
+
+    // A function-level static, so it is there for tests added during static initialisation of other files
+    std::vector<TestCase>& tests()
+    {
+        static std::vector<TestCase> tests;
+        return tests;
+    }
+
+    int failureCount = 0;
+}
+
+bool Test::add(const char* name, void (*function)())
+{
+    tests().push_back({name, function});
+    return true;
+}
+
+void Test::fail(const std::string& message, const char* file, const int line)
+{
+    std::cerr << file << "(" << line << "): " << message << "\n";
+    ++failureCount;
+}
+
+int Test::run_all()
+{
+    auto failedTestCount = 0;
+    for (const auto& [name, function] : tests())
+    {
+        const auto failureCountBefore = failureCount;
+        try
+        {
+            function();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Exception: " << e.what() << "\n";
+            ++failureCount;
+        }
+        if (failureCount != failureCountBefore)
+        {
+            std::cerr << "FAILED: " << name << "\n";
+            ++failedTestCount;
+        }
+    }
+    std::cout << tests().size() - failedTestCount << " of " << tests().size() << " tests passed\n";
+    return failedTestCount;
+}
+
+int main()
+{
+    return Test::run_all() == 0 ? 0 : 1;
+}
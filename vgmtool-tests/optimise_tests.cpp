@@ -0,0 +1,71 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/optimise.h"
+#include "libvgmtool/verify.h"
+
+namespace
+{
+    VgmFile make_busy_file()
+    {
+        TestFile file({{VgmHeader::Chip::SN76489, 3579545}, {VgmHeader::Chip::YM2612, 7670453}});
+        for (auto frame = 0; frame < 20; ++frame)
+        {
+            // Tone and volume, written every frame whether they change or not
+            file.psg(0x80 | (frame & 0x0f)).psg(0x01).psg(0x90 | (frame / 4));
+            file.ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, static_cast<uint8_t>(0x69 + frame / 5));
+            file.ym2612(0, 0x40, 0x10);
+            if (frame % 5 == 0)
+            {
+                // Key off and on again in the same frame
+                file.ym2612(0, 0x28, 0x00).ym2612(0, 0x28, 0xf0);
+            }
+            file.wait(735);
+        }
+        return file.build();
+    }
+}
+
+TEST(optimise_then_verify)
+{
+    const auto original = make_busy_file();
+    auto optimised = original.snapshot();
+    optimise_vgm_data(optimised, NullCallback());
+
+    CHECK(optimised.commands().size() < original.commands().size());
+    CHECK_EQUAL(original.header().sample_count(), optimised.header().sample_count());
+    const auto result = verify_equivalent(original, optimised, 0);
+    CHECK(result.isEquivalent);
+    CHECK(result.comparedPoints > 0);
+
+    // It survives saving and loading
+    VgmFile loaded;
+    loaded.load_data(file_data(optimised));
+    CHECK(verify_equivalent(original, loaded, 0).isEquivalent);
+}
+
+TEST(optimise_drops_redundant_writes)
+{
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, 7670453}})
+        .ym2612(0, 0x40, 0x10).wait(100)
+        .ym2612(0, 0x40, 0x10).wait(100)
+        .ym2612(0, 0x40, 0x11).ym2612(0, 0x40, 0x12).wait(100)
+        .build();
+    auto optimised = original.snapshot();
+    optimise_vgm_data(optimised, NullCallback());
+
+    const std::vector<std::pair<int, int>> expected{{0x40, 0x10}, {0x40, 0x12}};
+    CHECK(register_writes(optimised, VgmHeader::Chip::YM2612) == expected);
+}
+
+TEST(verify_finds_a_changed_write)
+{
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, 7670453}})
+        .ym2612(0, 0x40, 0x10).wait(100).ym2612(0, 0x40, 0x20).wait(100).build();
+    const auto modified = TestFile({{VgmHeader::Chip::YM2612, 7670453}})
+        .ym2612(0, 0x40, 0x10).wait(100).ym2612(0, 0x40, 0x21).wait(100).build();
+
+    const auto result = verify_equivalent(original, modified, 0);
+    CHECK(!result.isEquivalent);
+    CHECK_EQUAL(100u, result.mismatchTime);
+}
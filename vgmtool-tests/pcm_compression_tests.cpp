@@ -0,0 +1,66 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/datablocks.h"
+#include "libvgmtool/PcmCompression.h"
+#include "libvgmtool/VgmCommands.h"
+
+namespace
+{
+    VgmCommands::DataBlock* data_block(const uint8_t type, std::vector<uint8_t>&& data)
+    {
+        auto* pDataBlock = new VgmCommands::DataBlock();
+        pDataBlock->set_data(type, std::move(data));
+        return pDataBlock;
+    }
+
+    std::vector<uint8_t> sawtooth(const int step)
+    {
+        std::vector<uint8_t> result;
+        for (auto i = 0; i < 4096; ++i)
+        {
+            result.push_back(static_cast<uint8_t>(0x80 + (i * step) % 32));
+        }
+        return result;
+    }
+}
+
+TEST(pcm_compressible_types)
+{
+    CHECK(PcmCompression::is_compressible_type(0x00));
+    CHECK(PcmCompression::is_compressible_type(0x3e));
+    // PWM is 12-bit
+    CHECK(!PcmCompression::is_compressible_type(0x03));
+    // 0x7f is the decompression table
+    CHECK(!PcmCompression::is_compressible_type(0x3f));
+    // Already compressed
+    CHECK(!PcmCompression::is_compressible_type(0x40));
+}
+
+TEST(pcm_pack_then_unpack)
+{
+    auto original = TestFile({{VgmHeader::Chip::YM2612, 7670453}})
+        .add(data_block(0x00, sawtooth(1)))
+        .add(data_block(0x00, sawtooth(3)))
+        .add(data_block(0x3f, sawtooth(1)))
+        .wait(735)
+        .build();
+
+    auto packed = original.snapshot();
+    compress_data_blocks(packed, NullCallback());
+    CHECK(file_data(packed).size() < file_data(original).size());
+    // Type 0x3f blocks are left alone
+    auto uncompressedCount = 0;
+    for (const auto* pCommand : packed.commands())
+    {
+        if (const auto* pDataBlock = dynamic_cast<const VgmCommands::DataBlock*>(pCommand);
+            pDataBlock != nullptr && pDataBlock->type() == 0x3f)
+        {
+            ++uncompressedCount;
+        }
+    }
+    CHECK_EQUAL(1, uncompressedCount);
+
+    decompress_data_blocks(packed, NullCallback());
+    CHECK(file_data(packed) == file_data(original));
+}
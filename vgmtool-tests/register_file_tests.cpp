@@ -0,0 +1,100 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/optimise.h"
+#include "libvgmtool/verify.h"
+
+namespace
+{
+    constexpr uint32_t YM2612_CLOCK = 7670453;
+
+    std::vector<std::pair<int, int>> optimised_writes(const VgmFile& original)
+    {
+        auto optimised = original.snapshot();
+        optimise_vgm_data(optimised, NullCallback());
+        return register_writes(optimised, VgmHeader::Chip::YM2612);
+    }
+}
+
+TEST(opn_frequency_low_writes_follow_their_high_byte)
+{
+    // The F-number MSB latch is shared by all channels, so channel 0's second LSB write needs its MSB again,
+    // even though it hasn't changed
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69)
+        .ym2612(0, 0xa5, 0x1a).ym2612(0, 0xa1, 0x44)
+        .wait(735)
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x70)
+        .wait(735)
+        .build();
+
+    const std::vector<std::pair<int, int>> expected
+    {
+        {0xa4, 0x22}, {0xa0, 0x69}, {0xa5, 0x1a}, {0xa1, 0x44},
+        {0xa4, 0x22}, {0xa0, 0x70}
+    };
+    CHECK(optimised_writes(original) == expected);
+}
+
+TEST(opn_frequency_latch_is_shared)
+{
+    // Channel 0 gets the last MSB written, whichever channel's register it was written to
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa5, 0x1a).ym2612(0, 0xa0, 0x69)
+        .wait(735)
+        .build();
+
+    const std::vector<std::pair<int, int>> expected{{0xa4, 0x1a}, {0xa0, 0x69}};
+    CHECK(optimised_writes(original) == expected);
+}
+
+TEST(opn_frequency_latch_is_shared_by_both_ports)
+{
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69)
+        .ym2612(1, 0xa4, 0x1a).ym2612(1, 0xa0, 0x44)
+        .wait(735)
+        .ym2612(0, 0xa0, 0x70)
+        .wait(735)
+        .build();
+
+    // The second channel 0 write took port 1's MSB
+    const std::vector<std::pair<int, int>> expected
+    {
+        {0xa4, 0x22}, {0xa0, 0x69}, {0x1a4, 0x1a}, {0x1a0, 0x44},
+        {0xa4, 0x1a}, {0xa0, 0x70}
+    };
+    CHECK(optimised_writes(original) == expected);
+}
+
+TEST(opn_channel_3_frequency_low_writes_follow_their_high_byte)
+{
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xac, 0x22).ym2612(0, 0xa8, 0x69)
+        .ym2612(0, 0xad, 0x1a).ym2612(0, 0xa9, 0x44)
+        .wait(735)
+        .ym2612(0, 0xac, 0x22).ym2612(0, 0xa8, 0x70)
+        .wait(735)
+        .build();
+
+    const std::vector<std::pair<int, int>> expected
+    {
+        {0xac, 0x22}, {0xa8, 0x69}, {0xad, 0x1a}, {0xa9, 0x44},
+        {0xac, 0x22}, {0xa8, 0x70}
+    };
+    CHECK(optimised_writes(original) == expected);
+}
+
+TEST(opn_frequency_high_byte_alone_does_nothing)
+{
+    // Until an LSB is written, an MSB write changes nothing, so it isn't written
+    const auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69)
+        .wait(735)
+        .ym2612(0, 0xa4, 0x23)
+        .wait(735)
+        .build();
+
+    const std::vector<std::pair<int, int>> expected{{0xa4, 0x22}, {0xa0, 0x69}};
+    CHECK(optimised_writes(original) == expected);
+}
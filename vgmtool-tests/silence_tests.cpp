@@ -0,0 +1,47 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/silence.h"
+
+namespace
+{
+    constexpr uint32_t PSG_CLOCK = 3579545;
+}
+
+TEST(suggest_trim_removes_silence)
+{
+    // Channel 0 is only audible from 1000 to 3000
+    const auto file = TestFile({{VgmHeader::Chip::SN76489, PSG_CLOCK}})
+        .psg(0x9f).psg(0xbf).psg(0xdf).psg(0xff)
+        .wait(1000)
+        .psg(0x80).psg(0x10).psg(0x90)
+        .wait(2000)
+        .psg(0x9f)
+        .wait(1000)
+        .build();
+
+    const auto suggestion = suggest_trim(file);
+    CHECK(suggestion.hasSound);
+    CHECK_EQUAL(1000, suggestion.start);
+    CHECK_EQUAL(-1, suggestion.loop);
+    CHECK_EQUAL(3000, suggestion.end);
+}
+
+TEST(suggest_trim_keeps_the_end_of_a_loop)
+{
+    // The silence at the end is a pause in the loop
+    const auto file = TestFile({{VgmHeader::Chip::SN76489, PSG_CLOCK}})
+        .psg(0x9f).psg(0xbf).psg(0xdf).psg(0xff)
+        .wait(1000)
+        .loop()
+        .psg(0x80).psg(0x10).psg(0x90)
+        .wait(2000)
+        .psg(0x9f)
+        .wait(1000)
+        .build();
+
+    const auto suggestion = suggest_trim(file);
+    CHECK_EQUAL(1000, suggestion.start);
+    CHECK_EQUAL(1000, suggestion.loop);
+    CHECK_EQUAL(4000, suggestion.end);
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <filesystem>
+
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/trim.h"
+#include "libvgmtool/utils.h"
+#include "libvgmtool/VgmCommands.h"
+#include "libvgmtool/verify.h"
+
+namespace
+{
+    constexpr uint32_t YM2612_CLOCK = 7670453;
+
+    // The writes to one register
+    std::vector<int> values_written(const std::vector<std::pair<int, int>>& writes, const int index)
+    {
+        std::vector<int> result;
+        for (const auto& [writeIndex, value] : writes)
+        {
+            if (writeIndex == index)
+            {
+                result.push_back(value);
+            }
+        }
+        return result;
+    }
+
+    size_t loop_index(const VgmFile& file)
+    {
+        const auto& commands = file.commands();
+        return std::ranges::find_if(commands, [](const VgmCommands::ICommand* pCommand)
+        {
+            return dynamic_cast<const VgmCommands::LoopPoint*>(pCommand) != nullptr;
+        }) - commands.begin();
+    }
+}
+
+TEST(trim_restores_held_keys)
+{
+    // Channels 1 and 2 are keyed on before the start, and channel 1 is released after it
+    auto file = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69).ym2612(0, 0x28, 0xf0)
+        .ym2612(0, 0xa5, 0x22).ym2612(0, 0xa1, 0x69).ym2612(0, 0x28, 0xf1)
+        .wait(1000)
+        .ym2612(0, 0x28, 0x00)
+        .wait(1000)
+        .build();
+    const auto original = file.snapshot();
+    trim(file, 500, -1, 1500, NullCallback());
+
+    const std::vector<int> expected{0xf0, 0xf1, 0x00};
+    CHECK(values_written(register_writes(file, VgmHeader::Chip::YM2612), 0x28) == expected);
+    CHECK(verify_equivalent(original, file, 500).isEquivalent);
+}
+
+TEST(trim_restores_ym2151_shared_registers)
+{
+    // AM and PM depth are both written to 0x19
+    auto file = TestFile({{VgmHeader::Chip::YM2151, 3579545}})
+        .ym2151(0x19, 0x20).ym2151(0x19, 0x85).ym2151(0x08, 0x78).ym2151(0x08, 0x79).ym2151(0x08, 0x01)
+        .wait(1000)
+        .build();
+    trim(file, 500, -1, 1000, NullCallback());
+
+    const auto writes = register_writes(file, VgmHeader::Chip::YM2151);
+    const std::vector<int> expectedDepths{0x20, 0x85};
+    CHECK(values_written(writes, 0x19) == expectedDepths);
+    const std::vector<int> expectedKeys{0x78, 0x01};
+    CHECK(values_written(writes, 0x08) == expectedKeys);
+}
+
+TEST(trim_restores_held_keys_at_loop)
+{
+    // The key is released before the end, so we have to press it again when we loop
+    auto file = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69).ym2612(0, 0x28, 0xf0)
+        .wait(1000)
+        .ym2612(0, 0x28, 0x00)
+        .wait(1000)
+        .build();
+    const auto original = file.snapshot();
+    trim(file, 0, 500, 2000, NullCallback());
+
+    const auto loopWrites = register_writes(file, VgmHeader::Chip::YM2612, loop_index(file));
+    const std::vector<int> expected{0xf0, 0x00};
+    CHECK(values_written(loopWrites, 0x28) == expected);
+    CHECK(verify_equivalent(original, file, 0).isEquivalent);
+}
+
+TEST(trim_restarts_envelopes_only_at_start)
+{
+    auto file = TestFile({{VgmHeader::Chip::AY8910, 1789772}})
+        .ay8910(0x0b, 0x40).ay8910(0x0d, 0x0e)
+        .wait(1000)
+        .build();
+    trim(file, 200, 300, 1000, NullCallback());
+
+    const std::vector<int> expected{0x0e};
+    CHECK(values_written(register_writes(file, VgmHeader::Chip::AY8910), 0x0d) == expected);
+    CHECK(values_written(register_writes(file, VgmHeader::Chip::AY8910, loop_index(file)), 0x0d).empty());
+}
+
+TEST(trim_then_verify)
+{
+    TestFile builder({{VgmHeader::Chip::SN76489, 3579545}, {VgmHeader::Chip::YM2612, YM2612_CLOCK}});
+    for (auto frame = 0; frame < 30; ++frame)
+    {
+        builder.psg(0x80 | (frame & 0x0f)).psg(0x01).psg(0x90 | (frame / 2));
+        builder.ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, static_cast<uint8_t>(0x69 + frame));
+        builder.ym2612(0, 0x28, frame % 3 == 0 ? 0x00 : 0xf0);
+        builder.wait(735);
+    }
+    const auto original = builder.build();
+
+    auto trimmed = original.snapshot();
+    trim(trimmed, 735 * 10 + 100, 735 * 15, 735 * 25, NullCallback());
+
+    CHECK_EQUAL(735u * 15 - 100, trimmed.header().sample_count());
+    CHECK_EQUAL(735u * 10, trimmed.header().loop_sample_count());
+    const auto result = verify_equivalent(original, trimmed, 735 * 10 + 100);
+    CHECK(result.isEquivalent);
+    CHECK(result.comparedPoints > 0);
+}
+
+TEST(trim_then_verify_with_data_blocks)
+{
+    // Data blocks from before the start are kept, at the start
+    auto* pDataBlock = new VgmCommands::DataBlock();
+    pDataBlock->set_data(0x00, std::vector<uint8_t>(256, 0x80));
+    auto original = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .add(pDataBlock)
+        .ym2612(0, 0xa4, 0x22).ym2612(0, 0xa0, 0x69).ym2612(0, 0x28, 0xf0)
+        .wait(1000)
+        .ym2612(0, 0x28, 0x00)
+        .wait(1000)
+        .build();
+    auto trimmed = original.snapshot();
+    trim(trimmed, 500, -1, 2000, NullCallback());
+
+    const auto result = verify_equivalent(original, trimmed, 500);
+    CHECK(result.isEquivalent);
+    CHECK(result.comparedPoints > 1);
+}
+
+TEST(file_trim_then_verify)
+{
+    // Each file trim has its own state, so trimming again gives the same file
+    TestFile builder({{VgmHeader::Chip::SN76489, 3579545}, {VgmHeader::Chip::YM2413, 3579545}});
+    for (auto frame = 0; frame < 30; ++frame)
+    {
+        builder.psg(0x80 | (frame & 0x0f)).psg(0x01).psg(0x90 | (frame / 2));
+        builder.ym2413(0x10, static_cast<uint8_t>(0x20 + frame)).ym2413(0x30, 0x11);
+        builder.ym2413(0x20, frame % 3 == 0 ? 0x00 : 0x1c);
+        builder.wait(735);
+    }
+    auto original = builder.build();
+    // It writes the data at 0x40, so it needs a version from before the header grew
+    BcdVersion version;
+    version.set_major(1);
+    version.set_minor(10);
+    original.header().set_version(version);
+    const TempFile input(".vgm");
+    original.save_file(input.name());
+    const auto output = Utils::make_suffixed_filename(input.name(), "trimmed");
+
+    std::vector<std::vector<uint8_t>> results;
+    for (auto i = 0; i < 2; ++i)
+    {
+        trim(input.name(), 735 * 10 + 100, 735 * 15, 735 * 25, false, false, NullCallback());
+        VgmFile trimmed(output);
+        CHECK(verify_equivalent(original, trimmed, 735 * 10 + 100).isEquivalent);
+        results.push_back(file_data(trimmed));
+    }
+    std::filesystem::remove(output);
+    CHECK(results[0] == results[1]);
+}
@@ -0,0 +1,91 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/verify.h"
+#include "libvgmtool/VgmCommands.h"
+
+namespace
+{
+    constexpr uint32_t YM2612_CLOCK = 7670453;
+
+    VgmCommands::YM2612Sample* sample(const uint8_t duration)
+    {
+        auto* pSample = new VgmCommands::YM2612Sample();
+        pSample->set_duration(duration);
+        return pSample;
+    }
+
+    VgmCommands::PCMSeek* seek(const uint32_t address)
+    {
+        auto* pSeek = new VgmCommands::PCMSeek();
+        pSeek->set_address(address);
+        return pSeek;
+    }
+}
+
+TEST(verify_compares_key_on_order)
+{
+    // Both end with the same keys on, and the same value in the key on/off register
+    auto first = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0x28, 0xf0).ym2612(0, 0x28, 0xf1).ym2612(0, 0x28, 0xf0)
+        .wait(735)
+        .build();
+    auto second = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0x28, 0xf1).ym2612(0, 0x28, 0xf0)
+        .wait(735)
+        .build();
+
+    const auto result = verify_equivalent(first, second, 0);
+    CHECK(!result.isEquivalent);
+    CHECK_EQUAL(0u, result.mismatchTime);
+}
+
+TEST(verify_ignores_writes_which_do_nothing)
+{
+    // Keying on a channel which is already on does nothing
+    auto first = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0x28, 0xf0)
+        .wait(735)
+        .ym2612(0, 0x28, 0xf1)
+        .wait(735)
+        .build();
+    auto second = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .ym2612(0, 0x28, 0xf0)
+        .wait(735)
+        .ym2612(0, 0x28, 0xf0).ym2612(0, 0x28, 0xf1)
+        .wait(735)
+        .build();
+
+    CHECK(verify_equivalent(first, second, 0).isEquivalent);
+}
+
+TEST(verify_compares_envelope_restarts)
+{
+    // Writing the AY8910 envelope shape again restarts it
+    auto first = TestFile({{VgmHeader::Chip::AY8910, 1789772}})
+        .ay8910(0x0d, 0x0e)
+        .wait(735)
+        .build();
+    auto second = TestFile({{VgmHeader::Chip::AY8910, 1789772}})
+        .ay8910(0x0d, 0x0e).ay8910(0x0d, 0x0e)
+        .wait(735)
+        .build();
+
+    CHECK(!verify_equivalent(first, second, 0).isEquivalent);
+}
+
+TEST(verify_ignores_seeks_to_the_current_position)
+{
+    auto first = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .add(seek(0)).add(sample(10)).add(sample(10))
+        .build();
+    auto second = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .add(sample(10)).add(seek(1)).add(sample(10))
+        .build();
+    auto third = TestFile({{VgmHeader::Chip::YM2612, YM2612_CLOCK}})
+        .add(sample(10)).add(seek(0)).add(sample(10))
+        .build();
+
+    CHECK(verify_equivalent(first, second, 0).isEquivalent);
+    CHECK(!verify_equivalent(first, third, 0).isEquivalent);
+}
@@ -0,0 +1,38 @@
+#include "Test.h"
+#include "TestFile.h"
+
+#include "libvgmtool/utils.h"
+
+namespace
+{
+    VgmFile make_file()
+    {
+        return TestFile({{VgmHeader::Chip::SN76489, 3579545}}).psg(0x9f).wait(735).psg(0x90).wait(735).build();
+    }
+}
+
+TEST(save_over_keeps_compression)
+{
+    auto file = make_file();
+    const TempFile temp(".vgz");
+    Utils::save_gzip(temp.name(), file_data(file));
+
+    VgmFile loaded(temp.name());
+    loaded.save_over(temp.name());
+    CHECK(Utils::is_compressed(temp.name()));
+    VgmFile saved(temp.name());
+    CHECK(file_data(saved) == file_data(file));
+}
+
+TEST(save_over_uncompressed)
+{
+    auto file = make_file();
+    const TempFile temp(".vgm");
+    file.save_file(temp.name());
+
+    VgmFile loaded(temp.name());
+    loaded.save_over(temp.name());
+    CHECK(!Utils::is_compressed(temp.name()));
+    VgmFile saved(temp.name());
+    CHECK(file_data(saved) == file_data(file));
+}
@@ -18,6 +18,7 @@
 #include "libvgmtool/gd3.h"
 #include "libvgmtool/Gd3Tag.h"
 #include "libvgmtool/optimise.h"
+#include "libvgmtool/strip.h"
 #include "libvgmtool/trim.h"
 #include "libvgmtool/utils.h"
 #include "libvgmtool/vgm.h"
@@ -987,32 +988,8 @@ void Gui::update_gd3() const
 
     show_status("Updating GD3 tag...");
 
-    gzFile in = gzopen(_currentFilename.c_str(), "rb");
-    OldVGMHeader VGMHeader;
-    if (!ReadVGMHeader(in, &VGMHeader, *this))
-    {
-        gzclose(in);
-        return;
-    }
-
-    gzrewind(in);
-
-    const auto& outFilename = Utils::make_suffixed_filename(_currentFilename, "tagged");
-    gzFile out = gzopen(outFilename.c_str(), "wb0");
-
-    // Copy everything up to the GD3 tag
-    const auto dataLength = static_cast<int>(VGMHeader.GD3Offset > 0
-                                                 ? VGMHeader.GD3Offset + GD3DELTA
-                                                 : VGMHeader.EoFOffset + EOFDELTA);
-    for (auto i = 0; i < dataLength; ++i)
-    {
-        gzputc(out, gzgetc(in));
-    }
-
-    VGMHeader.GD3Offset = gztell(out) - GD3DELTA; // record GD3 position
-
-    std::wostringstream allGd3Strings;
-
+    // The edit controls are in the same order as the keys
+    Gd3Tag tag;
     for (auto i = 0; i < Gd3Indices::Count; ++i)
     {
         // Get string from widget
@@ -1025,28 +1002,10 @@ void Gui::update_gd3() const
             std::erase(s, L'\r');
         }
 
-        allGd3Strings << s << L'\0';
+        tag.set_text(static_cast<Gd3Tag::Key>(i), s);
     }
 
-    const auto& data = allGd3Strings.str();
-
-    TGD3Header GD3Header{};
-
-    strncpy(GD3Header.id_string, "Gd3 ", 4);
-    GD3Header.version = 0x0100;
-    GD3Header.length = static_cast<uint32_t>(data.length() * 2);
-
-    gzwrite(out, &GD3Header, sizeof(GD3Header)); // write GD3 header
-    gzwrite(out, data.data(), GD3Header.length); // write GD3 strings
-
-    VGMHeader.EoFOffset = gztell(out) - EOFDELTA; // Update EoF offset in header
-
-    gzclose(in);
-    gzclose(out);
-
-    write_vgm_header(outFilename, VGMHeader, *this); // Write changed header
-
-    Utils::replace_file(_currentFilename, outFilename);
+    write_gd3(_currentFilename, tag);
 
     show_status("GD3 tag updated");
 }
@@ -1161,333 +1120,34 @@ void Gui::strip_checked(const std::string& filename) const
 // Remove data for checked boxes
 void Gui::strip(const std::string& filename, const std::string& outfilename) const
 {
-    OldVGMHeader VGMHeader;
-    signed int b0, b1, b2;
-    char LatchedChannel = 0;
-    long int NewLoopOffset = 0;
-
-    // Set up masks
-    unsigned char PSGMask = (1 << NumPSGTypes) - 1;
-    for (auto i = 0; i < NumPSGTypes; i++)
+    // Set up mask. Unused channels' boxes are disabled, and we remove them too.
+    StripMask mask;
+    const auto removeChecked = [&](const VgmHeader::Chip chip, const std::vector<int>& checkBoxes)
     {
-        if ((IsDlgButtonChecked(_stripWnd, _psgCheckBoxes[i])) || (!IsWindowEnabled(
-            GetDlgItem(_stripWnd, _psgCheckBoxes[i]))))
+        for (auto i = 0; i < static_cast<int>(checkBoxes.size()); i++)
         {
-            PSGMask ^= (1 << i);
-        }
-    }
-    unsigned long YM2413Mask = (1 << NumYM2413Types) - 1;
-    for (auto i = 0; i < NumYM2413Types; i++)
-    {
-        if ((IsDlgButtonChecked(_stripWnd, _ym2413CheckBoxes[i])) || (!IsWindowEnabled(
-            GetDlgItem(_stripWnd, _ym2413CheckBoxes[i]))))
-        {
-            YM2413Mask ^= (1 << i);
-        }
-    }
-    unsigned char YM2612Mask = (1 << NumYM2612Types) - 1;
-    for (auto i = 0; i < NumYM2612Types; i++)
-    {
-        if ((IsDlgButtonChecked(_stripWnd, _ym2612CheckBoxes[i])) || (!IsWindowEnabled(
-            GetDlgItem(_stripWnd, _ym2612CheckBoxes[i]))))
-        {
-            YM2612Mask ^= (1 << i);
-        }
-    }
-    unsigned char YM2151Mask = (1 << NumYM2151Types) - 1;
-    for (auto i = 0; i < NumYM2151Types; i++)
-    {
-        if ((IsDlgButtonChecked(_stripWnd, _ym2151CheckBoxes[i])) || (!IsWindowEnabled(
-            GetDlgItem(_stripWnd, _ym2151CheckBoxes[i]))))
-        {
-            YM2151Mask ^= (1 << i);
-        }
-    }
-
-    gzFile in = gzopen(filename.c_str(), "rb");
-
-    // Read header
-    if (!ReadVGMHeader(in, &VGMHeader, *this))
-    {
-        gzclose(in);
-        return;
-    }
-    gzseek(in, VGM_DATA_OFFSET, SEEK_SET);
-
-    gzFile out = gzopen(outfilename.c_str(), "wb0"); // No compression, since I'll recompress it later
-
-    // Write header... update it later
-    gzwrite(out, &VGMHeader, sizeof(VGMHeader));
-    gzseek(out, VGM_DATA_OFFSET, SEEK_SET);
-
-    // process file
-    do
-    {
-        if ((VGMHeader.LoopOffset) && (gztell(in) == static_cast<long>(VGMHeader.LoopOffset) + LOOPDELTA))
-        {
-            NewLoopOffset = gztell(out) -
-                LOOPDELTA;
-        }
-        b0 = gzgetc(in);
-        switch (b0)
-        {
-        case VGM_GGST: // GG stereo
-            b1 = gzgetc(in);
-            if (PSGMask & (1 << 4))
-            {
-                gzputc(out, VGM_GGST);
-                gzputc(out, b1);
-            }
-            break;
-        case VGM_PSG: // PSG write (1 byte data)
-            b1 = gzgetc(in);
-            if (b1 & 0x80)
-            {
-                LatchedChannel = ((b1 >> 5) & 0x03);
-            }
-            if (PSGMask & (1 << LatchedChannel))
-            {
-                gzputc(out, VGM_PSG);
-                gzputc(out, b1);
-            }
-            break;
-        case VGM_YM2413: // YM2413
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            switch (b1 >> 4)
-            {
-            // go by 1st digit first
-            case 0x0: // User tone / percussion
-                switch (b1)
-                {
-                case 0x00:
-                case 0x01:
-                case 0x02:
-                case 0x03:
-                case 0x04:
-                case 0x05:
-                case 0x06:
-                case 0x07:
-                    if (YM2413Mask & (1 << 14))
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                    break;
-                case 0x0E: // Percussion
-                    //if ((b2&0x20) && !(YM2413Mask&0x3e00)) break;  // break if no percussion is wanted and it's rhythm mode
-                    // Original data  --RBSTCH
-                    //          00111100
-                    // Mask        00110101 = (YM2413Mask>>9)&0x1f|0x20
-                    // Result      00110100
-                    b2 &= (YM2413Mask >> 9) & 0x1f | 0x20;
-                    gzputc(out, VGM_YM2413);
-                    gzputc(out, b1);
-                    gzputc(out, b2);
-                    break;
-                default:
-                    if (YM2413Mask & (1 << 15))
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                    break;
-                }
-                break;
-            case 0x1: // Tone F-number low 8 bits
-                if (b1 > 0x18)
-                {
-                    if (YM2413Mask & (1 << 15))
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                else
-                {
-                    if ((YM2413Mask & (1 << (b1 & 0xf))) || // if channel is on
-                        ((b1 >= 0x16) && (YM2413Mask & 0x3e00))) // or last 3 channels AND percussion is wanted
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                break;
-            case 0x2: // Tone more stuff including key
-                if (b1 > 0x28)
-                {
-                    if (YM2413Mask & (1 << 15))
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                else
-                {
-                    if ((YM2413Mask & (1 << (b1 & 0xf))) || // if channel is on
-                        ((b1 >= 0x26) && (YM2413Mask & 0x3e00) /*&& !(b1&0x10)*/))
-                    // or last 3 channels AND percussion is wanted AND key is off
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                break;
-            case 0x3: // Tone instruments and volume
-                if (b1 > YM2413NumRegs)
-                {
-                    if (YM2413Mask & (1 << 15))
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                else
-                {
-                    if ((YM2413Mask & (1 << (b1 & 0xf))) || // if channel is on
-                        ((b1 >= 0x36) && (YM2413Mask & 0x3e00))) // or last 3 channels AND percussion is on
-                    {
-                        gzputc(out, VGM_YM2413);
-                        gzputc(out, b1);
-                        gzputc(out, b2);
-                    }
-                }
-                break;
-            default:
-                if (YM2413Mask & (1 << 15))
-                {
-                    gzputc(out, VGM_YM2413);
-                    gzputc(out, b1);
-                    gzputc(out, b2);
-                }
-                break;
-            }
-            break;
-        case VGM_YM2612_0: // YM2612 port 0
-        case VGM_YM2612_1: // YM2612 port 1
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            if (YM2612Mask & (1 << 0))
-            {
-                gzputc(out, b0);
-                gzputc(out, b1);
-                gzputc(out, b2);
-            }
-            break;
-        case VGM_YM2151: // YM2151
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            if (YM2151Mask & (1 << 0))
+            if ((IsDlgButtonChecked(_stripWnd, checkBoxes[i])) || (!IsWindowEnabled(
+                GetDlgItem(_stripWnd, checkBoxes[i]))))
             {
-                gzputc(out, b0);
-                gzputc(out, b1);
-                gzputc(out, b2);
+                mask.remove_channel(chip, i);
             }
-            break;
-        case 0x55: // Reserved up to 0x5f
-        case 0x56: // All have 2 bytes of data
-        case 0x57: // which I discard :)
-        case 0x58:
-        case 0x59:
-        case 0x5a:
-        case 0x5b:
-        case 0x5c:
-        case 0x5d:
-        case 0x5e:
-        case 0x5f:
-            gzseek(in, 2, SEEK_CUR);
-            break;
-        case VGM_PAUSE_WORD: // Wait n samples
-            b1 = gzgetc(in);
-            b2 = gzgetc(in);
-            gzputc(out, b0);
-            gzputc(out, b1);
-            gzputc(out, b2);
-            break;
-        case VGM_PAUSE_60TH: // Wait 1/60 s
-        case VGM_PAUSE_50TH: // Wait 1/50 s
-            gzputc(out, b0);
-            break;
-        //    case VGM_PAUSE_BYTE:  // Wait n samples
-        //      b1=gzgetc(in);
-        //      gzputc(out, b0);gzputc(out, b1);
-        //      break;
-        case 0x70:
-        case 0x71:
-        case 0x72:
-        case 0x73:
-        case 0x74:
-        case 0x75:
-        case 0x76:
-        case 0x77:
-        case 0x78:
-        case 0x79:
-        case 0x7a:
-        case 0x7b:
-        case 0x7c:
-        case 0x7d:
-        case 0x7e:
-        case 0x7f: // Wait 1-16 samples
-            gzputc(out, b0);
-            break;
-        case VGM_END: // End of sound data
-            gzputc(out, b0);
-            b0 = EOF; // make it break out
-            break;
-        default:
-            break;
         }
-    }
-    while (b0 != EOF);
+    };
+    removeChecked(VgmHeader::Chip::SN76489, _psgCheckBoxes);
+    removeChecked(VgmHeader::Chip::YM2413, _ym2413CheckBoxes);
+    removeChecked(VgmHeader::Chip::YM2612, _ym2612CheckBoxes);
+    removeChecked(VgmHeader::Chip::YM2151, _ym2151CheckBoxes);
 
-    // If removed PSG or FM then set the clock appropriately
-    if (!PSGMask)
-    {
-        VGMHeader.PSGClock = 0;
-    }
-    if (!YM2413Mask)
-    {
-        VGMHeader.YM2413Clock = 0;
-    }
-    if (!YM2612Mask)
-    {
-        VGMHeader.YM2612Clock = 0;
-    }
-    if (!YM2151Mask)
+    try
     {
-        VGMHeader.YM2151Clock = 0;
+        VgmFile file(filename);
+        ::strip(file, mask, *this);
+        file.save_file(outfilename);
     }
-
-    // Then copy the GD3 over
-    if (VGMHeader.GD3Offset)
+    catch (const std::exception& e)
     {
-        TGD3Header GD3Header;
-        int NewGD3Offset = gztell(out) - GD3DELTA;
-        gzseek(in, VGMHeader.GD3Offset + GD3DELTA, SEEK_SET);
-        gzread(in, &GD3Header, sizeof(GD3Header));
-        gzwrite(out, &GD3Header, sizeof(GD3Header));
-        for (auto i = 0u; i < GD3Header.length; ++i)
-        {
-            // Copy strings
-            gzputc(out, gzgetc(in));
-        }
-        VGMHeader.GD3Offset = NewGD3Offset;
+        show_error(std::format("Error stripping \"{}\": {}", filename, e.what()));
     }
-    VGMHeader.LoopOffset = NewLoopOffset;
-    VGMHeader.EoFOffset = gztell(out) - EOFDELTA;
-
-    gzclose(in);
-    gzclose(out);
-
-    // Amend it with the updated header
-    write_vgm_header(outfilename, VGMHeader, *this);
 }
 
 void Gui::copy_lengths_to_clipboard() const